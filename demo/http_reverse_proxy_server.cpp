@@ -0,0 +1,47 @@
+#include "http_server_proxy.hpp"
+#include "load_balancer.hpp"
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+int main() {
+    net::HttpReverseProxyOptions options;
+    options.m_balancer.m_policy = net::LoadBalancePolicy::LEAST_CONNECTIONS;
+    options.m_pool.m_connect_timeout = std::chrono::milliseconds(1000);
+    options.m_pool.m_read_timeout = std::chrono::milliseconds(30000);
+    options.m_health_check_path = "/";
+
+    net::HttpServerProxyReverse::SharedPtr server = std::make_shared<net::HttpServerProxyReverse>(
+        "127.0.0.1",
+        "2197",
+        std::vector<net::Upstream> { { "127.0.0.1", "8080" }, { "127.0.0.1", "8081" } },
+        options
+    );
+
+    server->enable_event_loop();
+    server->enable_thread_pool(96);
+
+    auto err = server->listen();
+    if (err.has_value()) {
+        std::cerr << "Failed to listen: " << err.value().msg << std::endl;
+        return 1;
+    }
+
+    err = server->start();
+    if (err.has_value()) {
+        std::cerr << "Failed to start: " << err.value().msg << std::endl;
+        return 1;
+    }
+
+    while (true) {
+        std::string input;
+        std::cin >> input;
+        if (input == "exit") {
+            server->close();
+            return 0;
+        }
+    }
+    return 0;
+}
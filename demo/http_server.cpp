@@ -42,6 +42,8 @@ int main() {
 
     server.enable_thread_pool(96);
     server.enable_event_loop();
+    // the same page as a cached static file, with ETag, conditional and range requests handled
+    server.serve_static("/static", execDir + "/template/index");
     server.get("/", [&content](const net::HttpRequest& req) {
         // cout req
         std::cout << "Request: " << utils::dump_enum(req.method()) << " " << req.url() << std::endl;
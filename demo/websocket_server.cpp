@@ -3,6 +3,7 @@
 #include "timer.hpp"
 #include "websocket.hpp"
 #include <filesystem>
+#include <fstream>
 #include <memory>
 #include <sys/types.h>
 #include <thread>
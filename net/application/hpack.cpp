@@ -0,0 +1,480 @@
+#include "hpack.hpp"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+namespace net {
+
+namespace {
+
+    constexpr std::pair<std::string_view, std::string_view> STATIC_TABLE[HpackTable::STATIC_SIZE] = {
+        { ":authority", "" },
+        { ":method", "GET" },
+        { ":method", "POST" },
+        { ":path", "/" },
+        { ":path", "/index.html" },
+        { ":scheme", "http" },
+        { ":scheme", "https" },
+        { ":status", "200" },
+        { ":status", "204" },
+        { ":status", "206" },
+        { ":status", "304" },
+        { ":status", "400" },
+        { ":status", "404" },
+        { ":status", "500" },
+        { "accept-charset", "" },
+        { "accept-encoding", "gzip, deflate" },
+        { "accept-language", "" },
+        { "accept-ranges", "" },
+        { "accept", "" },
+        { "access-control-allow-origin", "" },
+        { "age", "" },
+        { "allow", "" },
+        { "authorization", "" },
+        { "cache-control", "" },
+        { "content-disposition", "" },
+        { "content-encoding", "" },
+        { "content-language", "" },
+        { "content-length", "" },
+        { "content-location", "" },
+        { "content-range", "" },
+        { "content-type", "" },
+        { "cookie", "" },
+        { "date", "" },
+        { "etag", "" },
+        { "expect", "" },
+        { "expires", "" },
+        { "from", "" },
+        { "host", "" },
+        { "if-match", "" },
+        { "if-modified-since", "" },
+        { "if-none-match", "" },
+        { "if-range", "" },
+        { "if-unmodified-since", "" },
+        { "last-modified", "" },
+        { "link", "" },
+        { "location", "" },
+        { "max-forwards", "" },
+        { "proxy-authenticate", "" },
+        { "proxy-authorization", "" },
+        { "range", "" },
+        { "referer", "" },
+        { "refresh", "" },
+        { "retry-after", "" },
+        { "server", "" },
+        { "set-cookie", "" },
+        { "strict-transport-security", "" },
+        { "transfer-encoding", "" },
+        { "user-agent", "" },
+        { "vary", "" },
+        { "via", "" },
+        { "www-authenticate", "" },
+    };
+
+    // code lengths of the Huffman code in RFC 7541 appendix B, the last one is EOS
+    // the code is canonical, so the codes follow from the lengths alone
+    constexpr std::size_t HUFFMAN_SYMBOLS = 257;
+    constexpr uint16_t HUFFMAN_EOS = 256;
+    constexpr std::size_t HUFFMAN_MAX_LENGTH = 30;
+    constexpr std::array<uint8_t, HUFFMAN_SYMBOLS> HUFFMAN_LENGTHS = {
+        13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28, //
+        28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28, //
+        6,  10, 10, 12, 13, 6,  8,  11, 10, 10, 8,  11, 8,  6,  6,  6,  //
+        5,  5,  5,  6,  6,  6,  6,  6,  6,  6,  7,  8,  15, 6,  12, 10, //
+        13, 6,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  //
+        7,  7,  7,  7,  7,  7,  7,  7,  8,  7,  8,  13, 19, 13, 14, 6,  //
+        15, 5,  6,  5,  6,  5,  6,  6,  6,  5,  7,  7,  6,  6,  6,  5,  //
+        6,  7,  6,  5,  5,  6,  7,  7,  7,  7,  7,  15, 11, 14, 13, 28, //
+        20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23, //
+        24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24, //
+        22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23, //
+        21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23, //
+        26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25, //
+        19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27, //
+        20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23, //
+        26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26, //
+        30,
+    };
+
+    struct HuffmanCode {
+        std::array<uint32_t, HUFFMAN_SYMBOLS> m_codes {};
+        // per code length the first code, how many codes have it and where their symbols start in m_symbols
+        std::array<uint32_t, HUFFMAN_MAX_LENGTH + 1> m_first {};
+        std::array<uint16_t, HUFFMAN_MAX_LENGTH + 1> m_count {};
+        std::array<uint16_t, HUFFMAN_MAX_LENGTH + 1> m_offset {};
+        // symbols ordered by code
+        std::array<uint16_t, HUFFMAN_SYMBOLS> m_symbols {};
+    };
+
+    constexpr HuffmanCode build_huffman_code() {
+        HuffmanCode code;
+        for (auto length: HUFFMAN_LENGTHS) {
+            code.m_count[length]++;
+        }
+        uint32_t next = 0;
+        uint16_t offset = 0;
+        for (std::size_t length = 1; length <= HUFFMAN_MAX_LENGTH; length++) {
+            next = (next + code.m_count[length - 1]) << 1;
+            code.m_first[length] = next;
+            code.m_offset[length] = offset;
+            offset += code.m_count[length];
+        }
+        auto next_code = code.m_first;
+        auto next_slot = code.m_offset;
+        for (uint16_t symbol = 0; symbol < HUFFMAN_SYMBOLS; symbol++) {
+            auto length = HUFFMAN_LENGTHS[symbol];
+            code.m_codes[symbol] = next_code[length]++;
+            code.m_symbols[next_slot[length]++] = symbol;
+        }
+        return code;
+    }
+
+    constexpr HuffmanCode HUFFMAN = build_huffman_code();
+
+    static_assert(HUFFMAN.m_codes['0'] == 0x0 && HUFFMAN.m_codes['a'] == 0x3, "Huffman code of RFC 7541");
+    static_assert(HUFFMAN.m_codes[0] == 0x1ff8 && HUFFMAN.m_codes[HUFFMAN_EOS] == 0x3fffffff, "Huffman code of RFC 7541");
+
+    /**
+     * @return index of the first static entry named name, 0 if there is none
+     */
+    std::size_t static_name_index(std::string_view name) {
+        static const auto names = []() {
+            std::unordered_map<std::string_view, std::size_t> names;
+            for (std::size_t i = HpackTable::STATIC_SIZE; i > 0; i--) {
+                names[STATIC_TABLE[i - 1].first] = i;
+            }
+            return names;
+        }();
+        auto it = names.find(name);
+        return it == names.end() ? 0 : it->second;
+    }
+
+} // namespace
+
+namespace hpack {
+
+    void encode_integer(uint64_t value, uint8_t prefix_bits, uint8_t first, std::string& out) {
+        uint64_t max = (1u << prefix_bits) - 1;
+        if (value < max) {
+            out.push_back(static_cast<char>(first | value));
+            return;
+        }
+        out.push_back(static_cast<char>(first | max));
+        value -= max;
+        while (value >= 128) {
+            out.push_back(static_cast<char>((value & 127) | 128));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+
+    bool decode_integer(std::string_view input, std::size_t& pos, uint8_t prefix_bits, uint64_t& value) {
+        if (pos >= input.size()) {
+            return false;
+        }
+        uint64_t max = (1u << prefix_bits) - 1;
+        value = static_cast<uint8_t>(input[pos++]) & max;
+        if (value < max) {
+            return true;
+        }
+        for (unsigned shift = 0;; shift += 7) {
+            if (pos >= input.size() || shift > 28) {
+                return false;
+            }
+            auto byte = static_cast<uint8_t>(input[pos++]);
+            value += static_cast<uint64_t>(byte & 127) << shift;
+            if (value > UINT32_MAX) {
+                return false;
+            }
+            if ((byte & 128) == 0) {
+                return true;
+            }
+        }
+    }
+
+    std::size_t huffman_size(std::string_view text) {
+        std::size_t bits = 0;
+        for (auto c: text) {
+            bits += HUFFMAN_LENGTHS[static_cast<uint8_t>(c)];
+        }
+        return (bits + 7) / 8;
+    }
+
+    void huffman_encode(std::string_view text, std::string& out) {
+        // at most 7 pending bits plus a 30 bit code
+        uint64_t bits = 0;
+        unsigned pending = 0;
+        for (auto c: text) {
+            auto symbol = static_cast<uint8_t>(c);
+            bits = (bits << HUFFMAN_LENGTHS[symbol]) | HUFFMAN.m_codes[symbol];
+            pending += HUFFMAN_LENGTHS[symbol];
+            while (pending >= 8) {
+                pending -= 8;
+                out.push_back(static_cast<char>(bits >> pending));
+            }
+        }
+        if (pending > 0) {
+            // padded with the most significant bits of EOS, all ones
+            out.push_back(static_cast<char>((bits << (8 - pending)) | (0xff >> pending)));
+        }
+    }
+
+    bool huffman_decode(std::string_view input, std::string& out) {
+        uint32_t code = 0;
+        std::size_t length = 0;
+        for (auto c: input) {
+            auto byte = static_cast<uint8_t>(c);
+            for (int bit = 7; bit >= 0; bit--) {
+                code = (code << 1) | ((byte >> bit) & 1);
+                if (++length > HUFFMAN_MAX_LENGTH) {
+                    return false;
+                }
+                // in a canonical code the codes of one length are consecutive, shorter ones matched before
+                auto rank = code - HUFFMAN.m_first[length];
+                if (rank < HUFFMAN.m_count[length]) {
+                    auto symbol = HUFFMAN.m_symbols[HUFFMAN.m_offset[length] + rank];
+                    if (symbol == HUFFMAN_EOS) {
+                        return false;
+                    }
+                    out.push_back(static_cast<char>(symbol));
+                    code = 0;
+                    length = 0;
+                }
+            }
+        }
+        // padding is shorter than a byte and a prefix of EOS
+        return length < 8 && code == (1u << length) - 1;
+    }
+
+} // namespace hpack
+
+HpackTable::HpackTable(std::size_t max_size): m_max_size(max_size) {}
+
+std::optional<std::pair<std::string_view, std::string_view>> HpackTable::get(std::size_t index) const {
+    if (index == 0) {
+        return std::nullopt;
+    }
+    if (index <= STATIC_SIZE) {
+        return STATIC_TABLE[index - 1];
+    }
+    index -= STATIC_SIZE + 1;
+    if (index >= m_entries.size()) {
+        return std::nullopt;
+    }
+    return std::pair<std::string_view, std::string_view> { m_entries[index].first, m_entries[index].second };
+}
+
+std::size_t HpackTable::find(std::string_view name, std::string_view value, std::size_t& name_index) const {
+    name_index = static_name_index(name);
+    if (name_index != 0) {
+        for (auto i = name_index; i <= STATIC_SIZE && STATIC_TABLE[i - 1].first == name; i++) {
+            if (STATIC_TABLE[i - 1].second == value) {
+                return i;
+            }
+        }
+    }
+    for (std::size_t i = 0; i < m_entries.size(); i++) {
+        if (m_entries[i].first != name) {
+            continue;
+        }
+        if (m_entries[i].second == value) {
+            return STATIC_SIZE + 1 + i;
+        }
+        if (name_index == 0) {
+            name_index = STATIC_SIZE + 1 + i;
+        }
+    }
+    return 0;
+}
+
+void HpackTable::insert(std::string_view name, std::string_view value) {
+    auto size = name.size() + value.size() + ENTRY_OVERHEAD;
+    if (size > m_max_size) {
+        evict(0);
+        return;
+    }
+    // copied before evicting, name may refer to an entry which is about to go
+    std::pair<std::string, std::string> entry { name, value };
+    evict(m_max_size - size);
+    m_entries.push_front(std::move(entry));
+    m_size += size;
+}
+
+void HpackTable::set_max_size(std::size_t max_size) {
+    m_max_size = max_size;
+    evict(max_size);
+}
+
+std::size_t HpackTable::max_size() const {
+    return m_max_size;
+}
+
+std::size_t HpackTable::size() const {
+    return m_size;
+}
+
+std::size_t HpackTable::entries() const {
+    return m_entries.size();
+}
+
+void HpackTable::evict(std::size_t max_size) {
+    while (m_size > max_size && !m_entries.empty()) {
+        m_size -= m_entries.back().first.size() + m_entries.back().second.size() + ENTRY_OVERHEAD;
+        m_entries.pop_back();
+    }
+}
+
+HpackDecoder::HpackDecoder(std::size_t max_table_size): m_table(max_table_size), m_max_table_size(max_table_size) {}
+
+bool HpackDecoder::decode(
+    std::string_view block,
+    const std::function<void(std::string_view, std::string_view)>& on_field
+) {
+    std::size_t pos = 0;
+    bool field_seen = false;
+    while (pos < block.size()) {
+        auto first = static_cast<uint8_t>(block[pos]);
+        uint64_t index = 0;
+        if (first & 0x80) {
+            // indexed field, RFC 7541 section 6.1
+            if (!hpack::decode_integer(block, pos, 7, index)) {
+                return false;
+            }
+            auto entry = m_table.get(index);
+            if (!entry.has_value()) {
+                return false;
+            }
+            on_field(entry->first, entry->second);
+            field_seen = true;
+            continue;
+        }
+        if ((first & 0xe0) == 0x20) {
+            // dynamic table size update, only allowed ahead of the fields of a block
+            if (field_seen || !hpack::decode_integer(block, pos, 5, index) || index > m_max_table_size) {
+                return false;
+            }
+            m_table.set_max_size(index);
+            continue;
+        }
+        // literal field with incremental indexing, without indexing or never indexed
+        bool indexing = first & 0x40;
+        if (!hpack::decode_integer(block, pos, indexing ? 6 : 4, index)) {
+            return false;
+        }
+        if (index != 0) {
+            auto entry = m_table.get(index);
+            if (!entry.has_value()) {
+                return false;
+            }
+            m_name.assign(entry->first);
+        } else if (!read_string(block, pos, m_name)) {
+            return false;
+        }
+        if (!read_string(block, pos, m_value)) {
+            return false;
+        }
+        on_field(m_name, m_value);
+        field_seen = true;
+        if (indexing) {
+            m_table.insert(m_name, m_value);
+        }
+    }
+    return true;
+}
+
+const HpackTable& HpackDecoder::table() const {
+    return m_table;
+}
+
+bool HpackDecoder::read_string(std::string_view block, std::size_t& pos, std::string& out) {
+    if (pos >= block.size()) {
+        return false;
+    }
+    bool huffman = static_cast<uint8_t>(block[pos]) & 0x80;
+    uint64_t size = 0;
+    if (!hpack::decode_integer(block, pos, 7, size) || size > block.size() - pos) {
+        return false;
+    }
+    auto data = block.substr(pos, size);
+    pos += size;
+    out.clear();
+    if (huffman) {
+        return hpack::huffman_decode(data, out);
+    }
+    out.assign(data);
+    return true;
+}
+
+void HpackEncoder::set_max_table_size(std::size_t max_size) {
+    // the table may stay smaller than the peer allows, larger tables only cost memory here
+    max_size = std::min(max_size, hpack::DEFAULT_TABLE_SIZE);
+    if (max_size == m_table.max_size()) {
+        return;
+    }
+    m_pending_min_size = m_size_update ? std::min(m_pending_min_size, max_size) : max_size;
+    m_size_update = true;
+    m_table.set_max_size(max_size);
+}
+
+void HpackEncoder::begin_block(std::string& out) {
+    if (!m_size_update) {
+        return;
+    }
+    m_size_update = false;
+    // the decoder has to see every eviction, a shrink followed by a growth announces both
+    if (m_pending_min_size < m_table.max_size()) {
+        hpack::encode_integer(m_pending_min_size, 5, 0x20, out);
+    }
+    hpack::encode_integer(m_table.max_size(), 5, 0x20, out);
+}
+
+void HpackEncoder::encode(std::string_view name, std::string_view value, std::string& out, bool sensitive) {
+    std::size_t name_index = 0;
+    auto index = sensitive ? 0 : m_table.find(name, value, name_index);
+    if (index != 0) {
+        hpack::encode_integer(index, 7, 0x80, out);
+        return;
+    }
+    if (sensitive) {
+        m_table.find(name, {}, name_index);
+    }
+    // values which rarely repeat would only push useful entries out
+    bool indexing = !sensitive && name != "set-cookie" && name != "content-range"
+        && name.size() + value.size() + HpackTable::ENTRY_OVERHEAD <= m_table.max_size() / 4;
+    if (indexing) {
+        hpack::encode_integer(name_index, 6, 0x40, out);
+    } else {
+        hpack::encode_integer(name_index, 4, sensitive ? 0x10 : 0x00, out);
+    }
+    if (name_index == 0) {
+        write_string(name, out);
+    }
+    write_string(value, out);
+    if (indexing) {
+        m_table.insert(name, value);
+    }
+}
+
+const HpackTable& HpackEncoder::table() const {
+    return m_table;
+}
+
+void HpackEncoder::write_string(std::string_view text, std::string& out) {
+    auto huffman_size = hpack::huffman_size(text);
+    if (huffman_size < text.size()) {
+        hpack::encode_integer(huffman_size, 7, 0x80, out);
+        hpack::huffman_encode(text, out);
+        return;
+    }
+    hpack::encode_integer(text.size(), 7, 0x00, out);
+    out.append(text);
+}
+
+} // namespace net
@@ -0,0 +1,909 @@
+#include "http2.hpp"
+#include "enum_parser.hpp"
+#include "hpack.hpp"
+#include "http_parser.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <utility>
+
+namespace net {
+
+namespace {
+
+    uint32_t read_u32(const char* data) {
+        auto bytes = reinterpret_cast<const uint8_t*>(data);
+        return (static_cast<uint32_t>(bytes[0]) << 24) | (static_cast<uint32_t>(bytes[1]) << 16)
+            | (static_cast<uint32_t>(bytes[2]) << 8) | bytes[3];
+    }
+
+    void append_u32(std::string& out, uint32_t value) {
+        out.push_back(static_cast<char>(value >> 24));
+        out.push_back(static_cast<char>(value >> 16));
+        out.push_back(static_cast<char>(value >> 8));
+        out.push_back(static_cast<char>(value));
+    }
+
+    void append_setting(std::string& out, Http2Setting id, uint32_t value) {
+        out.push_back(static_cast<char>(static_cast<uint16_t>(id) >> 8));
+        out.push_back(static_cast<char>(static_cast<uint16_t>(id)));
+        append_u32(out, value);
+    }
+
+    /**
+     * @brief decode base64url without padding, the alphabet of the HTTP2-Settings header
+     */
+    bool base64url_decode(std::string_view input, std::string& out) {
+        uint32_t bits = 0;
+        int pending = 0;
+        for (auto c: input) {
+            int value;
+            if (c >= 'A' && c <= 'Z') {
+                value = c - 'A';
+            } else if (c >= 'a' && c <= 'z') {
+                value = c - 'a' + 26;
+            } else if (c >= '0' && c <= '9') {
+                value = c - '0' + 52;
+            } else if (c == '-' || c == '+') {
+                value = 62;
+            } else if (c == '_' || c == '/') {
+                value = 63;
+            } else if (c == '=') {
+                break;
+            } else {
+                return false;
+            }
+            bits = (bits << 6) | static_cast<uint32_t>(value);
+            pending += 6;
+            if (pending >= 8) {
+                pending -= 8;
+                out.push_back(static_cast<char>(bits >> pending));
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @return true for fields which only make sense on a single HTTP/1.1 connection, RFC 9113 section 8.2.2
+     */
+    bool connection_specific(std::string_view name) {
+        return name == "connection" || name == "keep-alive" || name == "proxy-connection"
+            || name == "transfer-encoding" || name == "upgrade";
+    }
+
+} // namespace
+
+Http2FrameHeader Http2FrameHeader::parse(const uint8_t* data) {
+    Http2FrameHeader header;
+    header.m_length = (static_cast<uint32_t>(data[0]) << 16) | (static_cast<uint32_t>(data[1]) << 8) | data[2];
+    header.m_type = static_cast<Http2FrameType>(data[3]);
+    header.m_flags = data[4];
+    header.m_stream_id = read_u32(reinterpret_cast<const char*>(data + 5)) & http2::MAX_WINDOW_SIZE;
+    return header;
+}
+
+void Http2FrameHeader::write(std::string& out) const {
+    out.push_back(static_cast<char>(m_length >> 16));
+    out.push_back(static_cast<char>(m_length >> 8));
+    out.push_back(static_cast<char>(m_length));
+    out.push_back(static_cast<char>(m_type));
+    out.push_back(static_cast<char>(m_flags));
+    append_u32(out, m_stream_id);
+}
+
+Http2Connection::Http2Connection(Http2Options options): m_options(options) {
+    m_options.m_max_frame_size = std::clamp(m_options.m_max_frame_size, http2::DEFAULT_MAX_FRAME_SIZE, http2::MAX_FRAME_SIZE);
+    m_options.m_stream_window_size = std::min(m_options.m_stream_window_size, http2::MAX_WINDOW_SIZE);
+    m_options.m_connection_window_size =
+        std::clamp(m_options.m_connection_window_size, http2::DEFAULT_WINDOW_SIZE, http2::MAX_WINDOW_SIZE);
+    // the server preface, a SETTINGS frame which has to come first
+    std::string settings;
+    append_setting(settings, Http2Setting::MAX_CONCURRENT_STREAMS, m_options.m_max_concurrent_streams);
+    append_setting(settings, Http2Setting::INITIAL_WINDOW_SIZE, m_options.m_stream_window_size);
+    append_setting(settings, Http2Setting::MAX_FRAME_SIZE, m_options.m_max_frame_size);
+    append_setting(settings, Http2Setting::MAX_HEADER_LIST_SIZE, m_options.m_max_header_list_size);
+    write_frame(Http2FrameType::SETTINGS, 0, 0, settings);
+    // the connection window can only be raised by WINDOW_UPDATE
+    if (m_options.m_connection_window_size > http2::DEFAULT_WINDOW_SIZE) {
+        std::string increment;
+        append_u32(increment, m_options.m_connection_window_size - http2::DEFAULT_WINDOW_SIZE);
+        write_frame(Http2FrameType::WINDOW_UPDATE, 0, 0, increment);
+    }
+}
+
+bool Http2Connection::upgrade(std::string_view settings, HttpRequestView request) {
+    std::string payload;
+    if (!base64url_decode(settings, payload) || payload.size() % 6 != 0 || !apply_settings(payload)) {
+        return false;
+    }
+    // the 101 response acknowledges the settings, the client still sends the preface and a SETTINGS frame
+    auto stream = std::make_unique<Stream>();
+    stream->m_id = 1;
+    stream->m_remote_closed = true;
+    stream->m_send_window = m_peer_initial_window;
+    m_streams.emplace(1, std::move(stream));
+    m_last_stream_id = 1;
+    m_requests.push_back({ 1, std::move(request) });
+    return true;
+}
+
+void Http2Connection::feed(std::string_view data) {
+    if (m_failed || data.empty()) {
+        return;
+    }
+    // frames are taken from data in place unless part of one is left over from before
+    std::string_view input = data;
+    if (!m_input.empty()) {
+        m_input.append(data);
+        input = m_input;
+    }
+    std::size_t pos = 0;
+    if (!m_preface_received) {
+        auto size = std::min(input.size(), http2::PREFACE.size());
+        if (input.substr(0, size) != http2::PREFACE.substr(0, size)) {
+            fail(Http2ErrorCode::PROTOCOL_ERROR);
+            return;
+        }
+        if (size < http2::PREFACE.size()) {
+            m_input.assign(input);
+            return;
+        }
+        m_preface_received = true;
+        pos = size;
+    }
+    while (input.size() - pos >= Http2FrameHeader::SIZE) {
+        auto header = Http2FrameHeader::parse(reinterpret_cast<const uint8_t*>(input.data() + pos));
+        if (header.m_length > m_options.m_max_frame_size) {
+            fail(Http2ErrorCode::FRAME_SIZE_ERROR);
+            return;
+        }
+        if (input.size() - pos - Http2FrameHeader::SIZE < header.m_length) {
+            break;
+        }
+        auto payload = input.substr(pos + Http2FrameHeader::SIZE, header.m_length);
+        pos += Http2FrameHeader::SIZE + header.m_length;
+        if (!handle_frame(header, payload)) {
+            m_input.clear();
+            return;
+        }
+    }
+    if (input.data() == m_input.data()) {
+        m_input.erase(0, pos);
+    } else {
+        m_input.assign(input.substr(pos));
+    }
+}
+
+std::optional<Http2Request> Http2Connection::next_request() {
+    if (m_requests.empty()) {
+        return std::nullopt;
+    }
+    auto request = std::move(m_requests.front());
+    m_requests.pop_front();
+    return request;
+}
+
+void Http2Connection::submit_response(uint32_t stream_id, HttpResponse response, bool head_only) {
+    auto it = m_streams.find(stream_id);
+    if (m_failed || it == m_streams.end()) {
+        return;
+    }
+    auto& stream = *it->second;
+    bool streamed = response.body_producer() || response.body_file() != nullptr;
+    bool has_body = !head_only && (streamed || !response.body_view().empty());
+    write_headers(stream, response, !has_body);
+    if (!has_body) {
+        stream.m_local_closed = true;
+        close_stream(stream_id);
+        return;
+    }
+    stream.m_response = std::move(response);
+    if (streamed) {
+        stream.m_producer = stream.m_response.body_producer();
+        stream.m_file = stream.m_response.body_file();
+        stream.m_file_offset = stream.m_response.body_file_offset();
+        stream.m_file_size = stream.m_file != nullptr ? stream.m_response.body_file_size() : 0;
+    } else {
+        stream.m_body_view = stream.m_response.body_view();
+    }
+    stream.m_sending = true;
+    m_sending.push_back(stream_id);
+}
+
+void Http2Connection::produce(std::size_t budget) {
+    std::size_t queued = 0;
+    bool progress = true;
+    while (progress && queued < budget && !m_sending.empty() && !m_failed) {
+        progress = false;
+        // one frame per stream and round, so that a large body doesn't hold up the others
+        for (auto turns = m_sending.size(); turns > 0 && queued < budget; turns--) {
+            auto stream_id = m_sending.front();
+            m_sending.pop_front();
+            auto it = m_streams.find(stream_id);
+            if (it == m_streams.end() || !it->second->m_sending) {
+                continue;
+            }
+            auto& stream = *it->second;
+            auto size = produce_frame(stream, budget - queued);
+            queued += size;
+            progress |= size > 0 || !stream.m_sending;
+            if (stream.m_sending) {
+                m_sending.push_back(stream_id);
+            }
+        }
+    }
+}
+
+void Http2Connection::output(std::vector<struct iovec>& iov) {
+    iov.clear();
+    for (auto& segment: m_segments) {
+        auto data = segment.m_data != nullptr ? segment.m_data : m_frames.data() + segment.m_offset;
+        iov.push_back({ const_cast<char*>(data), segment.m_size });
+    }
+}
+
+void Http2Connection::consume_output() {
+    m_frames.clear();
+    m_segments.clear();
+    m_retired.clear();
+}
+
+bool Http2Connection::has_output() const {
+    return !m_segments.empty();
+}
+
+bool Http2Connection::has_pending_bodies() const {
+    return !m_sending.empty() && !m_failed;
+}
+
+bool Http2Connection::closed() const {
+    return m_failed || (m_goaway_received && m_streams.empty());
+}
+
+std::size_t Http2Connection::open_streams() const {
+    return m_streams.size();
+}
+
+bool Http2Connection::handle_frame(const Http2FrameHeader& header, std::string_view payload) {
+    if (!m_settings_received && header.m_type != Http2FrameType::SETTINGS) {
+        return fail(Http2ErrorCode::PROTOCOL_ERROR);
+    }
+    // a header block is sent in one piece, nothing may come between its frames
+    if (m_header_stream != 0
+        && (header.m_type != Http2FrameType::CONTINUATION || header.m_stream_id != m_header_stream))
+    {
+        return fail(Http2ErrorCode::PROTOCOL_ERROR);
+    }
+    switch (header.m_type) {
+        case Http2FrameType::DATA:
+            return handle_data(header, payload);
+        case Http2FrameType::HEADERS:
+            return handle_headers(header, payload);
+        case Http2FrameType::CONTINUATION:
+            if (m_header_stream == 0) {
+                return fail(Http2ErrorCode::PROTOCOL_ERROR);
+            }
+            m_header_block.append(payload);
+            if (m_header_block.size() > m_options.m_max_header_list_size) {
+                return fail(Http2ErrorCode::ENHANCE_YOUR_CALM);
+            }
+            return (header.m_flags & http2::FLAG_END_HEADERS) == 0 || end_header_block();
+        case Http2FrameType::PRIORITY:
+            // priorities are not followed, every stream takes its turn
+            if (header.m_stream_id == 0) {
+                return fail(Http2ErrorCode::PROTOCOL_ERROR);
+            }
+            if (payload.size() != 5) {
+                reset_stream(header.m_stream_id, Http2ErrorCode::FRAME_SIZE_ERROR);
+            }
+            return true;
+        case Http2FrameType::RST_STREAM:
+            if (header.m_stream_id == 0 || header.m_stream_id > m_last_stream_id) {
+                return fail(Http2ErrorCode::PROTOCOL_ERROR);
+            }
+            if (payload.size() != 4) {
+                return fail(Http2ErrorCode::FRAME_SIZE_ERROR);
+            }
+            close_stream(header.m_stream_id);
+            return true;
+        case Http2FrameType::SETTINGS:
+            return handle_settings(header, payload);
+        case Http2FrameType::PUSH_PROMISE:
+            // only servers push
+            return fail(Http2ErrorCode::PROTOCOL_ERROR);
+        case Http2FrameType::PING:
+            if (header.m_stream_id != 0) {
+                return fail(Http2ErrorCode::PROTOCOL_ERROR);
+            }
+            if (payload.size() != 8) {
+                return fail(Http2ErrorCode::FRAME_SIZE_ERROR);
+            }
+            if ((header.m_flags & http2::FLAG_ACK) == 0) {
+                write_frame(Http2FrameType::PING, http2::FLAG_ACK, 0, payload);
+            }
+            return true;
+        case Http2FrameType::GOAWAY:
+            if (header.m_stream_id != 0) {
+                return fail(Http2ErrorCode::PROTOCOL_ERROR);
+            }
+            if (payload.size() < 8) {
+                return fail(Http2ErrorCode::FRAME_SIZE_ERROR);
+            }
+            // streams already open are still answered
+            m_goaway_received = true;
+            return true;
+        case Http2FrameType::WINDOW_UPDATE:
+            return handle_window_update(header, payload);
+    }
+    // unknown frame types are ignored, RFC 9113 section 5.5
+    return true;
+}
+
+bool Http2Connection::handle_data(const Http2FrameHeader& header, std::string_view payload) {
+    if (header.m_stream_id == 0) {
+        return fail(Http2ErrorCode::PROTOCOL_ERROR);
+    }
+    // the whole payload counts against the windows, padding included
+    if (m_unacked + header.m_length > m_options.m_connection_window_size) {
+        return fail(Http2ErrorCode::FLOW_CONTROL_ERROR);
+    }
+    m_unacked += header.m_length;
+    if (m_unacked >= m_options.m_connection_window_size / 2) {
+        std::string increment;
+        append_u32(increment, m_unacked);
+        write_frame(Http2FrameType::WINDOW_UPDATE, 0, 0, increment);
+        m_unacked = 0;
+    }
+    if (!remove_padding(header, payload)) {
+        return fail(Http2ErrorCode::PROTOCOL_ERROR);
+    }
+    auto it = m_streams.find(header.m_stream_id);
+    if (it == m_streams.end()) {
+        if (header.m_stream_id > m_last_stream_id) {
+            return fail(Http2ErrorCode::PROTOCOL_ERROR);
+        }
+        // a stream reset earlier, frames the client sent before it learned about it are dropped
+        return true;
+    }
+    auto& stream = *it->second;
+    if (stream.m_remote_closed) {
+        reset_stream(header.m_stream_id, Http2ErrorCode::STREAM_CLOSED);
+        return true;
+    }
+    if (stream.m_unacked + header.m_length > m_options.m_stream_window_size) {
+        reset_stream(header.m_stream_id, Http2ErrorCode::FLOW_CONTROL_ERROR);
+        return true;
+    }
+    stream.m_body.append(payload);
+    if (header.m_flags & http2::FLAG_END_STREAM) {
+        stream.m_remote_closed = true;
+        finish_request(stream);
+        return true;
+    }
+    stream.m_unacked += header.m_length;
+    if (stream.m_unacked >= m_options.m_stream_window_size / 2) {
+        std::string increment;
+        append_u32(increment, stream.m_unacked);
+        write_frame(Http2FrameType::WINDOW_UPDATE, 0, header.m_stream_id, increment);
+        stream.m_unacked = 0;
+    }
+    return true;
+}
+
+bool Http2Connection::handle_headers(const Http2FrameHeader& header, std::string_view payload) {
+    if (header.m_stream_id == 0) {
+        return fail(Http2ErrorCode::PROTOCOL_ERROR);
+    }
+    if (!remove_padding(header, payload)) {
+        return fail(Http2ErrorCode::PROTOCOL_ERROR);
+    }
+    if (header.m_flags & http2::FLAG_PRIORITY) {
+        // stream dependency and weight, ignored like PRIORITY frames
+        if (payload.size() < 5) {
+            return fail(Http2ErrorCode::FRAME_SIZE_ERROR);
+        }
+        payload.remove_prefix(5);
+    }
+    m_header_stream = header.m_stream_id;
+    m_header_end_stream = header.m_flags & http2::FLAG_END_STREAM;
+    m_header_block.assign(payload);
+    return (header.m_flags & http2::FLAG_END_HEADERS) == 0 || end_header_block();
+}
+
+bool Http2Connection::end_header_block() {
+    auto stream_id = m_header_stream;
+    m_header_stream = 0;
+    Stream* stream = nullptr;
+    bool trailers = false;
+    bool refused = false;
+    if (auto it = m_streams.find(stream_id); it != m_streams.end()) {
+        // trailer fields after the request body
+        stream = it->second.get();
+        trailers = true;
+    } else if (stream_id % 2 == 0 || stream_id <= m_last_stream_id) {
+        return fail(Http2ErrorCode::PROTOCOL_ERROR);
+    } else {
+        m_last_stream_id = stream_id;
+        if (m_streams.size() >= m_options.m_max_concurrent_streams) {
+            refused = true;
+        } else {
+            auto fresh = std::make_unique<Stream>();
+            fresh->m_id = stream_id;
+            fresh->m_send_window = m_peer_initial_window;
+            stream = fresh.get();
+            m_streams.emplace(stream_id, std::move(fresh));
+        }
+    }
+    // decoded whatever happens to the stream, the block changes the dynamic table either way
+    std::size_t list_size = 0;
+    bool keep = stream != nullptr && !trailers;
+    bool decoded = m_decoder.decode(m_header_block, [&](std::string_view name, std::string_view value) {
+        list_size += name.size() + value.size() + HpackTable::ENTRY_OVERHEAD;
+        if (!keep || list_size > m_options.m_max_header_list_size) {
+            return;
+        }
+        auto offset = static_cast<uint32_t>(stream->m_field_data.size());
+        stream->m_field_data.append(name);
+        stream->m_field_data.append(value);
+        stream->m_fields.push_back({ offset,
+                                     static_cast<uint32_t>(name.size()),
+                                     static_cast<uint32_t>(offset + name.size()),
+                                     static_cast<uint32_t>(value.size()) });
+    });
+    m_header_block.clear();
+    if (!decoded) {
+        return fail(Http2ErrorCode::COMPRESSION_ERROR);
+    }
+    if (refused) {
+        reset_stream(stream_id, Http2ErrorCode::REFUSED_STREAM);
+        return true;
+    }
+    if (trailers) {
+        // trailers end the request, they are dropped like the HTTP/1.1 parser drops them
+        if (stream->m_remote_closed || !m_header_end_stream) {
+            reset_stream(stream_id, stream->m_remote_closed ? Http2ErrorCode::STREAM_CLOSED
+                                                            : Http2ErrorCode::PROTOCOL_ERROR);
+            return true;
+        }
+        stream->m_remote_closed = true;
+        finish_request(*stream);
+        return true;
+    }
+    // a header list above the limit is treated as malformed rather than answered with 431
+    if (list_size > m_options.m_max_header_list_size || !validate_request(*stream)) {
+        reset_stream(stream_id, Http2ErrorCode::PROTOCOL_ERROR);
+        return true;
+    }
+    if (m_header_end_stream) {
+        stream->m_remote_closed = true;
+        finish_request(*stream);
+    }
+    return true;
+}
+
+bool Http2Connection::validate_request(const Stream& stream) const {
+    bool regular_seen = false;
+    std::size_t regular = 0;
+    bool cookie_seen = false;
+    bool host_seen = false;
+    std::string_view method;
+    std::string_view path;
+    std::string_view scheme;
+    std::string_view authority;
+    for (auto& field: stream.m_fields) {
+        auto name = std::string_view(stream.m_field_data).substr(field.m_name_offset, field.m_name_size);
+        auto value = std::string_view(stream.m_field_data).substr(field.m_value_offset, field.m_value_size);
+        if (name.empty()) {
+            return false;
+        }
+        if (name[0] == ':') {
+            // pseudo-header fields come first and only once each
+            std::string_view* slot = name == ":method" ? &method
+                : name == ":path"                      ? &path
+                : name == ":scheme"                    ? &scheme
+                : name == ":authority"                 ? &authority
+                                                       : nullptr;
+            if (regular_seen || slot == nullptr || slot->data() != nullptr) {
+                return false;
+            }
+            *slot = value.data() != nullptr ? value : std::string_view("", 0);
+            continue;
+        }
+        regular_seen = true;
+        if (std::any_of(name.begin(), name.end(), [](char c) { return c >= 'A' && c <= 'Z'; })) {
+            return false;
+        }
+        if (connection_specific(name) || (name == "te" && value != "trailers")) {
+            return false;
+        }
+        if (name == "cookie") {
+            // crumbs are joined into one field
+            regular += cookie_seen ? 0 : 1;
+            cookie_seen = true;
+            continue;
+        }
+        host_seen |= name == "host";
+        regular++;
+    }
+    if (!host_seen && !authority.empty()) {
+        regular++;
+    }
+    if (regular > HttpRequestView::MAX_HEADERS || method.empty()) {
+        return false;
+    }
+    if (method == "CONNECT") {
+        return !authority.empty() && scheme.data() == nullptr && path.data() == nullptr;
+    }
+    return !scheme.empty() && !path.empty();
+}
+
+void Http2Connection::finish_request(Stream& stream) {
+    std::string_view data = stream.m_field_data;
+    std::string_view method;
+    std::string_view path;
+    std::string_view authority;
+    std::size_t size = http2::PREFACE.size() + stream.m_body.size();
+    bool host_seen = false;
+    std::optional<std::size_t> content_length;
+    for (auto& field: stream.m_fields) {
+        auto name = data.substr(field.m_name_offset, field.m_name_size);
+        auto value = data.substr(field.m_value_offset, field.m_value_size);
+        if (name == ":method") {
+            method = value;
+        } else if (name == ":path") {
+            path = value;
+        } else if (name == ":authority") {
+            authority = value;
+        } else if (name == "content-length") {
+            std::size_t length = 0;
+            auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), length);
+            if (ec != std::errc() || ptr != value.data() + value.size()) {
+                reset_stream(stream.m_id, Http2ErrorCode::PROTOCOL_ERROR);
+                return;
+            }
+            content_length = length;
+        }
+        host_seen |= name == "host";
+        // room for the cookie separators as well
+        size += name.size() + value.size() + 2;
+    }
+    // a body which doesn't match its Content-Length makes the request malformed, RFC 9113 section 8.1.1
+    if (content_length.has_value() && content_length.value() != stream.m_body.size()) {
+        reset_stream(stream.m_id, Http2ErrorCode::PROTOCOL_ERROR);
+        return;
+    }
+    size += authority.size() + 4;
+    // everything the view points at is copied into one buffer, like a HTTP/1.1 request arrives in one
+    PooledBuffer buffer(size);
+    auto put = [&buffer](std::string_view text) {
+        auto begin = reinterpret_cast<const char*>(buffer.tail());
+        std::memcpy(buffer.tail(), text.data(), text.size());
+        buffer.commit(text.size());
+        return std::string_view(begin, text.size());
+    };
+    HttpRequestView request;
+    request.m_method = utils::parse_enum<HttpMethod>(method);
+    request.m_url = put(path);
+    request.m_version = put(HTTP_VERSION_2_0);
+    const char* cookie = nullptr;
+    for (auto& field: stream.m_fields) {
+        auto name = data.substr(field.m_name_offset, field.m_name_size);
+        auto value = data.substr(field.m_value_offset, field.m_value_size);
+        if (name[0] == ':' || name == "cookie") {
+            continue;
+        }
+        request.m_headers[request.m_header_num++] = { put(name), put(value) };
+    }
+    for (auto& field: stream.m_fields) {
+        auto name = data.substr(field.m_name_offset, field.m_name_size);
+        if (name != "cookie") {
+            continue;
+        }
+        if (cookie != nullptr) {
+            put("; ");
+        } else {
+            auto key = put(name);
+            request.m_headers[request.m_header_num++].key = key;
+            cookie = reinterpret_cast<const char*>(buffer.tail());
+        }
+        put(data.substr(field.m_value_offset, field.m_value_size));
+        request.m_headers[request.m_header_num - 1].value =
+            std::string_view(cookie, static_cast<std::size_t>(reinterpret_cast<const char*>(buffer.tail()) - cookie));
+    }
+    if (!host_seen && !authority.empty()) {
+        request.m_headers[request.m_header_num++] = { put("host"), put(authority) };
+    }
+    request.m_body = put(stream.m_body);
+    request.m_buffer = std::move(buffer);
+    // the stream keeps nothing but what it needs to answer
+    stream.m_field_data = std::string();
+    stream.m_fields = std::vector<Field>();
+    stream.m_body = std::string();
+    m_requests.push_back({ stream.m_id, std::move(request) });
+}
+
+bool Http2Connection::handle_settings(const Http2FrameHeader& header, std::string_view payload) {
+    if (header.m_stream_id != 0) {
+        return fail(Http2ErrorCode::PROTOCOL_ERROR);
+    }
+    if (header.m_flags & http2::FLAG_ACK) {
+        return payload.empty() || fail(Http2ErrorCode::FRAME_SIZE_ERROR);
+    }
+    if (payload.size() % 6 != 0) {
+        return fail(Http2ErrorCode::FRAME_SIZE_ERROR);
+    }
+    if (!apply_settings(payload)) {
+        return false;
+    }
+    m_settings_received = true;
+    write_frame(Http2FrameType::SETTINGS, http2::FLAG_ACK, 0, {});
+    return true;
+}
+
+bool Http2Connection::apply_settings(std::string_view payload) {
+    for (std::size_t pos = 0; pos + 6 <= payload.size(); pos += 6) {
+        auto id = static_cast<Http2Setting>((static_cast<uint8_t>(payload[pos]) << 8) | static_cast<uint8_t>(payload[pos + 1]));
+        auto value = read_u32(payload.data() + pos + 2);
+        switch (id) {
+            case Http2Setting::HEADER_TABLE_SIZE:
+                m_encoder.set_max_table_size(value);
+                break;
+            case Http2Setting::ENABLE_PUSH:
+                if (value > 1) {
+                    return fail(Http2ErrorCode::PROTOCOL_ERROR);
+                }
+                break;
+            case Http2Setting::INITIAL_WINDOW_SIZE: {
+                if (value > http2::MAX_WINDOW_SIZE) {
+                    return fail(Http2ErrorCode::FLOW_CONTROL_ERROR);
+                }
+                // applies to the windows of open streams as well, which may become negative
+                auto delta = static_cast<int64_t>(value) - m_peer_initial_window;
+                for (auto& [stream_id, stream]: m_streams) {
+                    stream->m_send_window += delta;
+                    if (stream->m_send_window > http2::MAX_WINDOW_SIZE) {
+                        return fail(Http2ErrorCode::FLOW_CONTROL_ERROR);
+                    }
+                }
+                m_peer_initial_window = value;
+                break;
+            }
+            case Http2Setting::MAX_FRAME_SIZE:
+                if (value < http2::DEFAULT_MAX_FRAME_SIZE || value > http2::MAX_FRAME_SIZE) {
+                    return fail(Http2ErrorCode::PROTOCOL_ERROR);
+                }
+                m_peer_max_frame_size = value;
+                break;
+            default:
+                // the rest limits what the server pushes or sends in headers, neither of which gets near them
+                break;
+        }
+    }
+    return true;
+}
+
+bool Http2Connection::handle_window_update(const Http2FrameHeader& header, std::string_view payload) {
+    if (payload.size() != 4) {
+        return fail(Http2ErrorCode::FRAME_SIZE_ERROR);
+    }
+    auto increment = read_u32(payload.data()) & http2::MAX_WINDOW_SIZE;
+    if (header.m_stream_id == 0) {
+        if (increment == 0) {
+            return fail(Http2ErrorCode::PROTOCOL_ERROR);
+        }
+        m_send_window += increment;
+        return m_send_window <= http2::MAX_WINDOW_SIZE || fail(Http2ErrorCode::FLOW_CONTROL_ERROR);
+    }
+    auto it = m_streams.find(header.m_stream_id);
+    if (it == m_streams.end()) {
+        return header.m_stream_id <= m_last_stream_id || fail(Http2ErrorCode::PROTOCOL_ERROR);
+    }
+    it->second->m_send_window += increment;
+    if (increment == 0 || it->second->m_send_window > http2::MAX_WINDOW_SIZE) {
+        reset_stream(header.m_stream_id,
+                     increment == 0 ? Http2ErrorCode::PROTOCOL_ERROR : Http2ErrorCode::FLOW_CONTROL_ERROR);
+    }
+    return true;
+}
+
+bool Http2Connection::remove_padding(const Http2FrameHeader& header, std::string_view& payload) {
+    if ((header.m_flags & http2::FLAG_PADDED) == 0) {
+        return true;
+    }
+    if (payload.empty()) {
+        return false;
+    }
+    auto padding = static_cast<uint8_t>(payload[0]);
+    if (padding >= payload.size()) {
+        return false;
+    }
+    payload = payload.substr(1, payload.size() - 1 - padding);
+    return true;
+}
+
+void Http2Connection::write_frame(Http2FrameType type, uint8_t flags, uint32_t stream_id, std::string_view payload) {
+    auto offset = m_frames.size();
+    Http2FrameHeader { static_cast<uint32_t>(payload.size()), type, flags, stream_id }.write(m_frames);
+    m_frames.append(payload);
+    append_segment(nullptr, offset, m_frames.size() - offset);
+}
+
+void Http2Connection::write_headers(Stream& stream, const HttpResponse& response, bool end_stream) {
+    std::string block;
+    m_encoder.begin_block(block);
+    char status[8];
+    auto [end, ec] = std::to_chars(status, status + sizeof(status), static_cast<int>(response.status_code()));
+    m_encoder.encode(":status", std::string_view(status, static_cast<std::size_t>(end - status)), block);
+    bool length_seen = false;
+    bool date_seen = false;
+    std::string name;
+    for (auto& [key, value]: response.headers()) {
+        name.resize(key.size());
+        std::transform(key.begin(), key.end(), name.begin(), [](char c) {
+            return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+        });
+        if (connection_specific(name)) {
+            continue;
+        }
+        length_seen |= name == "content-length";
+        date_seen |= name == "date";
+        m_encoder.encode(name, value, block);
+    }
+    if (!date_seen) {
+        // "Date: <date>\r\n"
+        auto date = date_header();
+        m_encoder.encode("date", date.substr(6, date.size() - 8), block);
+    }
+    auto file = response.body_file() != nullptr;
+    if (!length_seen && (file || (!response.body_producer() && !response.body_view().empty()))) {
+        char length[24];
+        auto size = file ? response.body_file_size() : response.body_view().size();
+        auto [length_end, length_ec] = std::to_chars(length, length + sizeof(length), size);
+        m_encoder.encode("content-length", std::string_view(length, static_cast<std::size_t>(length_end - length)), block);
+    }
+    // split at the frame size of the peer, CONTINUATION frames carry the rest
+    std::string_view rest = block;
+    auto type = Http2FrameType::HEADERS;
+    do {
+        auto piece = rest.substr(0, m_peer_max_frame_size);
+        rest.remove_prefix(piece.size());
+        uint8_t flags = rest.empty() ? http2::FLAG_END_HEADERS : 0;
+        if (type == Http2FrameType::HEADERS && end_stream) {
+            flags |= http2::FLAG_END_STREAM;
+        }
+        write_frame(type, flags, stream.m_id, piece);
+        type = Http2FrameType::CONTINUATION;
+    } while (!rest.empty());
+}
+
+std::size_t Http2Connection::produce_frame(Stream& stream, std::size_t max_size) {
+    auto window = std::max<int64_t>(std::min(m_send_window, stream.m_send_window), 0);
+    auto limit = std::min<std::size_t>({ max_size, m_peer_max_frame_size, static_cast<std::size_t>(window) });
+    std::size_t size = 0;
+    bool last = false;
+    auto header_offset = m_frames.size();
+    if (stream.m_file != nullptr && stream.m_file_size > 0) {
+        size = std::min(limit, stream.m_file_size);
+        if (size == 0) {
+            return 0;
+        }
+        last = size == stream.m_file_size && !stream.m_producer;
+        Http2FrameHeader { static_cast<uint32_t>(size), Http2FrameType::DATA, last ? http2::FLAG_END_STREAM : uint8_t(0), stream.m_id }
+            .write(m_frames);
+        auto offset = m_frames.size();
+        m_frames.resize(offset + size);
+        std::size_t done = 0;
+        while (done < size) {
+            auto num_bytes = ::pread(*stream.m_file, m_frames.data() + offset + done, size - done, stream.m_file_offset + static_cast<off_t>(done));
+            if (num_bytes == -1 && errno == EINTR) {
+                continue;
+            }
+            if (num_bytes <= 0) {
+                // the length is promised already, the stream can only be cut off
+                m_frames.resize(header_offset);
+                reset_stream(stream.m_id, Http2ErrorCode::INTERNAL_ERROR);
+                return 0;
+            }
+            done += static_cast<std::size_t>(num_bytes);
+        }
+        append_segment(nullptr, header_offset, m_frames.size() - header_offset);
+        stream.m_file_offset += static_cast<off_t>(size);
+        stream.m_file_size -= size;
+    } else if (stream.m_producer) {
+        try {
+            while (stream.m_chunk_offset == stream.m_chunk.size() && !stream.m_producer_done) {
+                stream.m_chunk.clear();
+                stream.m_chunk_offset = 0;
+                stream.m_producer_done = !stream.m_producer(stream.m_chunk);
+            }
+        } catch (const std::exception& e) {
+            reset_stream(stream.m_id, Http2ErrorCode::INTERNAL_ERROR);
+            return 0;
+        }
+        auto left = stream.m_chunk.size() - stream.m_chunk_offset;
+        size = std::min(limit, left);
+        if (size == 0 && left != 0) {
+            return 0;
+        }
+        last = size == left && stream.m_producer_done;
+        write_frame(Http2FrameType::DATA, last ? http2::FLAG_END_STREAM : 0, stream.m_id,
+                    std::string_view(stream.m_chunk).substr(stream.m_chunk_offset, size));
+        stream.m_chunk_offset += size;
+    } else {
+        size = std::min(limit, stream.m_body_view.size());
+        if (size == 0) {
+            return 0;
+        }
+        last = size == stream.m_body_view.size();
+        Http2FrameHeader { static_cast<uint32_t>(size), Http2FrameType::DATA, last ? http2::FLAG_END_STREAM : uint8_t(0), stream.m_id }
+            .write(m_frames);
+        append_segment(nullptr, header_offset, Http2FrameHeader::SIZE);
+        // the body stays where the response keeps it, until the output is consumed
+        append_segment(stream.m_body_view.data(), 0, size);
+        stream.m_body_view.remove_prefix(size);
+    }
+    m_send_window -= static_cast<int64_t>(size);
+    stream.m_send_window -= static_cast<int64_t>(size);
+    if (last) {
+        finish_sending(stream);
+    }
+    return size;
+}
+
+void Http2Connection::finish_sending(Stream& stream) {
+    stream.m_sending = false;
+    stream.m_local_closed = true;
+    close_stream(stream.m_id);
+}
+
+void Http2Connection::reset_stream(uint32_t stream_id, Http2ErrorCode code) {
+    std::string payload;
+    append_u32(payload, static_cast<uint32_t>(code));
+    write_frame(Http2FrameType::RST_STREAM, 0, stream_id, payload);
+    close_stream(stream_id);
+}
+
+bool Http2Connection::fail(Http2ErrorCode code) {
+    if (!m_failed) {
+        std::string payload;
+        append_u32(payload, m_last_stream_id);
+        append_u32(payload, static_cast<uint32_t>(code));
+        write_frame(Http2FrameType::GOAWAY, 0, 0, payload);
+        m_failed = true;
+    }
+    return false;
+}
+
+void Http2Connection::close_stream(uint32_t stream_id) {
+    auto it = m_streams.find(stream_id);
+    if (it == m_streams.end()) {
+        return;
+    }
+    it->second->m_sending = false;
+    m_retired.push_back(std::move(it->second));
+    m_streams.erase(it);
+}
+
+void Http2Connection::append_segment(const char* data, std::size_t offset, std::size_t size) {
+    if (size == 0) {
+        return;
+    }
+    // bytes written to m_frames right behind the last segment extend it
+    if (data == nullptr && !m_segments.empty() && m_segments.back().m_data == nullptr
+        && m_segments.back().m_offset + m_segments.back().m_size == offset)
+    {
+        m_segments.back().m_size += size;
+        return;
+    }
+    m_segments.push_back({ data, offset, size });
+}
+
+} // namespace net
@@ -0,0 +1,484 @@
+#include "http_async_client.hpp"
+#include "buffer_pool.hpp"
+#include "defines.hpp"
+#include "event_loop.hpp"
+#include "http_parser.hpp"
+#include "timing_wheel.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <system_error>
+#include <unistd.h>
+#include <utility>
+
+namespace net {
+
+HttpAsyncClient::HttpAsyncClient(HttpAsyncClientOptions options): m_options(options) {
+    for (std::size_t i = 0; i < std::max<std::size_t>(m_options.m_event_loops, 1); i++) {
+        m_workers.push_back(std::make_unique<Worker>(m_options, m_in_flight));
+    }
+}
+
+HttpAsyncClient::~HttpAsyncClient() {
+    m_workers.clear();
+}
+
+void HttpAsyncClient::request(
+    const std::string& ip,
+    const std::string& service,
+    HttpRequest req,
+    Callback callback,
+    std::chrono::milliseconds timeout
+) {
+    auto pending = std::make_shared<Pending>();
+    pending->m_request = std::move(req);
+    pending->m_callback = std::move(callback);
+    pending->m_timeout = timeout.count() == 0 ? m_options.m_timeout : timeout;
+    m_in_flight.fetch_add(1, std::memory_order_relaxed);
+    auto index = m_next_worker.fetch_add(1, std::memory_order_relaxed) % m_workers.size();
+    m_workers[index]->submit({ ip, service, std::move(pending) });
+}
+
+std::future<HttpResult> HttpAsyncClient::request(
+    const std::string& ip,
+    const std::string& service,
+    HttpRequest req,
+    std::chrono::milliseconds timeout
+) {
+    auto promise = std::make_shared<std::promise<HttpResult>>();
+    auto future = promise->get_future();
+    request(
+        ip,
+        service,
+        std::move(req),
+        [promise](std::optional<NetError> error, HttpResponse response) {
+            promise->set_value({ std::move(error), std::move(response) });
+        },
+        timeout
+    );
+    return future;
+}
+
+std::size_t HttpAsyncClient::in_flight() const {
+    return m_in_flight.load(std::memory_order_relaxed);
+}
+
+HttpAsyncClient::Worker::Worker(const HttpAsyncClientOptions& options, std::atomic<std::size_t>& in_flight):
+    m_options(options),
+    m_in_flight(in_flight),
+    m_event_loop(std::make_shared<EpollEventLoop>()),
+    m_timer_service(m_event_loop->timer_service()),
+    m_resolutions(std::make_shared<Resolutions>()),
+    m_buffer(BufferPool::SIZE_CLASSES.back()) {
+    m_wake_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_wake_fd == -1) {
+        throw std::system_error(errno, std::system_category(), "Failed to create eventfd");
+    }
+    m_resolutions->m_wake_fd = m_wake_fd;
+    auto handler = std::make_shared<EventHandler>();
+    handler->m_on_read = [this](int fd) {
+        uint64_t count;
+        while (::read(fd, &count, sizeof(count)) > 0) {}
+        take_submissions();
+        take_resolutions();
+    };
+    // the loop owns the eventfd from now on and closes it
+    m_event_loop->add_event(std::make_shared<Event>(m_wake_fd, handler));
+    m_thread = std::thread([this]() { run(); });
+}
+
+HttpAsyncClient::Worker::~Worker() {
+    {
+        std::lock_guard<std::mutex> lock(m_resolutions->m_mutex);
+        m_resolutions->m_closed = true;
+    }
+    m_stop = true;
+    uint64_t one = 1;
+    [[maybe_unused]] auto written = ::write(m_wake_fd, &one, sizeof(one));
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    // the loop is gone, whatever is left fails here on the destroying thread
+    NetError error { NET_CONNECTION_RESET_CODE, "Client stopped before the response arrived" };
+    for (auto& submission: m_submissions) {
+        finish(*submission.m_pending, error);
+    }
+    for (auto& [key, host]: m_hosts) {
+        for (auto& pending: host->m_waiting) {
+            finish(*pending, error);
+        }
+        for (auto& [fd, conn]: host->m_connections) {
+            conn->m_closed = true;
+            if (conn->m_pending != nullptr) {
+                finish(*conn->m_pending, error);
+            }
+            m_event_loop->remove_event(fd);
+        }
+    }
+}
+
+void HttpAsyncClient::Worker::submit(Submission submission) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_submissions.push_back(std::move(submission));
+        // the loop is woken up by the first submission only, it takes all of them at once
+        if (m_submissions.size() > 1) {
+            return;
+        }
+    }
+    uint64_t one = 1;
+    [[maybe_unused]] auto written = ::write(m_wake_fd, &one, sizeof(one));
+}
+
+void HttpAsyncClient::Worker::run() {
+    while (!m_stop) {
+        try {
+            m_event_loop->wait_for_events();
+        } catch (std::runtime_error& e) {
+            std::cerr << std::format("Failed to waiting for events: {}\n", e.what()) << std::endl;
+        }
+    }
+}
+
+void HttpAsyncClient::Worker::take_submissions() {
+    std::vector<Submission> submissions;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        submissions.swap(m_submissions);
+    }
+    for (auto& submission: submissions) {
+        start(submission);
+    }
+}
+
+void HttpAsyncClient::Worker::start(Submission& submission) {
+    auto& host = m_hosts[{ submission.m_ip, submission.m_service }];
+    if (host == nullptr) {
+        host = std::make_unique<Host>();
+        host->m_ip = submission.m_ip;
+        host->m_service = submission.m_service;
+    }
+    auto& pending = submission.m_pending;
+    if (pending->m_timeout.count() != 0) {
+        pending->m_timer = m_timer_service->schedule(pending->m_timeout, [this, pending]() { on_timeout(pending); });
+    }
+    host->m_waiting.push_back(std::move(pending));
+    if (!host->m_resolving
+        && (!host->m_address.has_value() || std::chrono::steady_clock::now() >= host->m_expires))
+    {
+        resolve(*host);
+    }
+    if (host->m_address.has_value()) {
+        dispatch(*host);
+    }
+}
+
+void HttpAsyncClient::Worker::resolve(Host& host) {
+    host.m_resolving = true;
+    // the answer may come right away on this thread, it goes through the eventfd all the same
+    DnsResolver::shared()->async_resolve(
+        host.m_ip,
+        host.m_service,
+        [resolutions = m_resolutions, key = std::make_pair(host.m_ip, host.m_service)](
+            std::optional<NetError> error,
+            DnsAnswer answer
+        ) {
+            std::lock_guard<std::mutex> lock(resolutions->m_mutex);
+            if (resolutions->m_closed) {
+                return;
+            }
+            resolutions->m_done.push_back(Resolution { key, std::move(error), std::move(answer) });
+            uint64_t one = 1;
+            [[maybe_unused]] auto written = ::write(resolutions->m_wake_fd, &one, sizeof(one));
+        }
+    );
+}
+
+void HttpAsyncClient::Worker::take_resolutions() {
+    std::vector<Resolution> resolutions;
+    {
+        std::lock_guard<std::mutex> lock(m_resolutions->m_mutex);
+        resolutions.swap(m_resolutions->m_done);
+    }
+    for (auto& resolution: resolutions) {
+        auto it = m_hosts.find(resolution.m_key);
+        if (it == m_hosts.end()) {
+            continue;
+        }
+        auto& host = *it->second;
+        host.m_resolving = false;
+        if (!resolution.m_error.has_value() && !resolution.m_answer.m_addresses.empty()) {
+            const auto& first = resolution.m_answer.m_addresses.front();
+            addressResolver::address address;
+            ::memcpy(&address.m_addr_storage, &first, sizeof(first));
+            address.m_addr_len = DnsResolver::address_length(first);
+            host.m_address = address;
+            host.m_expires = resolution.m_answer.m_expires;
+        } else if (!host.m_address.has_value()) {
+            auto error = resolution.m_error.value_or(NetError { NET_HOST_NOT_FOUND_CODE, "Host has no address" });
+            while (!host.m_waiting.empty()) {
+                auto pending = std::move(host.m_waiting.front());
+                host.m_waiting.pop_front();
+                finish(*pending, error);
+            }
+            continue;
+        }
+        // a failed lookup keeps the old address, the next request asks again
+        dispatch(host);
+    }
+}
+
+void HttpAsyncClient::Worker::dispatch(Host& host) {
+    while (!host.m_waiting.empty()) {
+        if (host.m_waiting.front()->m_done) {
+            // timed out while waiting
+            host.m_waiting.pop_front();
+            continue;
+        }
+        std::shared_ptr<Connection> conn;
+        if (!host.m_idle.empty()) {
+            conn = std::move(host.m_idle.back());
+            host.m_idle.pop_back();
+            conn->m_reused = true;
+        } else if (host.m_connections.size() < m_options.m_max_connections_per_host) {
+            auto err = connect(host, conn);
+            if (err.has_value()) {
+                auto pending = std::move(host.m_waiting.front());
+                host.m_waiting.pop_front();
+                finish(*pending, err.value());
+                continue;
+            }
+        } else {
+            return;
+        }
+        auto pending = std::move(host.m_waiting.front());
+        host.m_waiting.pop_front();
+        assign(conn, std::move(pending));
+    }
+}
+
+std::optional<NetError> HttpAsyncClient::Worker::connect(Host& host, std::shared_ptr<Connection>& conn) {
+    auto& address = host.m_address.value();
+    int fd = ::socket(address.m_addr.sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return GET_ERROR_MSG();
+    }
+    if (::connect(fd, &address.m_addr, address.m_addr_len) == -1 && errno != EINPROGRESS) {
+        auto error = GET_ERROR_MSG();
+        ::close(fd);
+        return error;
+    }
+    conn = std::make_shared<Connection>();
+    conn->m_fd = fd;
+    conn->m_host = &host;
+    // the handler keeps the connection alive as long as the loop knows the fd
+    auto handler = std::make_shared<EventHandler>();
+    handler->m_on_read = [this, conn](int) { on_readable(conn); };
+    handler->m_on_write = [this, conn](int) { on_writable(conn); };
+    handler->m_on_error = [this, conn](int) {
+        if (!conn->m_closed) {
+            fail_connection(conn, NetError { NET_CONNECTION_RESET_CODE, "Connection reset by peer" });
+        }
+    };
+    m_event_loop->add_event(std::make_shared<Event>(fd, handler));
+    // connected once writable
+    m_event_loop->watch_writable(fd, true);
+    host.m_connections[fd] = conn;
+    return std::nullopt;
+}
+
+void HttpAsyncClient::Worker::assign(const std::shared_ptr<Connection>& conn, std::shared_ptr<Pending> pending) {
+    if (conn->m_idle_timer != 0) {
+        m_timer_service->cancel(conn->m_idle_timer);
+        conn->m_idle_timer = 0;
+    }
+    if (pending->m_data.empty()) {
+        pending->m_data = conn->m_parser.write_req(pending->m_request);
+    }
+    pending->m_connection = conn;
+    conn->m_pending = std::move(pending);
+    conn->m_sent = 0;
+    conn->m_received = false;
+    if (!conn->m_connecting) {
+        send(conn);
+    }
+}
+
+void HttpAsyncClient::Worker::send(const std::shared_ptr<Connection>& conn) {
+    auto& data = conn->m_pending->m_data;
+    while (conn->m_sent < data.size()) {
+        auto num_bytes = ::send(conn->m_fd, data.data() + conn->m_sent, data.size() - conn->m_sent, MSG_NOSIGNAL);
+        if (num_bytes == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                watch_writable(*conn, true);
+                return;
+            }
+            fail_connection(conn, GET_ERROR_MSG());
+            return;
+        }
+        conn->m_sent += num_bytes;
+    }
+    watch_writable(*conn, false);
+}
+
+void HttpAsyncClient::Worker::watch_writable(Connection& conn, bool enable) {
+    if (conn.m_watching_writable != enable) {
+        m_event_loop->watch_writable(conn.m_fd, enable);
+        conn.m_watching_writable = enable;
+    }
+}
+
+void HttpAsyncClient::Worker::on_writable(const std::shared_ptr<Connection>& conn) {
+    if (conn->m_closed) {
+        return;
+    }
+    if (conn->m_connecting) {
+        int so_error = 0;
+        socklen_t len = sizeof(so_error);
+        ::getsockopt(conn->m_fd, SOL_SOCKET, SO_ERROR, &so_error, &len);
+        if (so_error != 0) {
+            fail_connection(conn, NetError { so_error, std::system_category().message(so_error) });
+            return;
+        }
+        conn->m_connecting = false;
+    }
+    if (conn->m_pending != nullptr && conn->m_sent < conn->m_pending->m_data.size()) {
+        send(conn);
+    } else {
+        watch_writable(*conn, false);
+    }
+}
+
+void HttpAsyncClient::Worker::on_readable(const std::shared_ptr<Connection>& conn) {
+    // edge triggered, read until the socket is drained
+    while (!conn->m_closed) {
+        m_buffer.resize(m_buffer.capacity());
+        auto num_bytes = ::recv(conn->m_fd, m_buffer.data(), m_buffer.size(), 0);
+        if (num_bytes == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;
+            }
+            fail_connection(conn, GET_ERROR_MSG());
+            return;
+        }
+        if (num_bytes == 0) {
+            fail_connection(conn, NetError { NET_CONNECTION_RESET_CODE, "Connection reset by peer while reading" });
+            return;
+        }
+        if (conn->m_pending == nullptr) {
+            // nothing was asked for, the connection can't be trusted anymore
+            close(conn);
+            return;
+        }
+        conn->m_received = true;
+        m_buffer.resize(num_bytes);
+        conn->m_parser.add_res_read_buffer(m_buffer);
+        if (conn->m_parser.res_failed()) {
+            auto pending = std::move(conn->m_pending);
+            close(conn);
+            finish(*pending, NetError { NET_INVALID_HTTP_MESSAGE, "Malformed response" });
+            return;
+        }
+        auto res = conn->m_parser.read_res();
+        if (res.has_value()) {
+            auto pending = std::move(conn->m_pending);
+            if (res->keep_alive()) {
+                release(conn);
+            } else {
+                close(conn);
+            }
+            finish(*pending, std::nullopt, std::move(res.value()));
+        }
+    }
+}
+
+void HttpAsyncClient::Worker::fail_connection(const std::shared_ptr<Connection>& conn, NetError error) {
+    auto pending = std::move(conn->m_pending);
+    if (pending == nullptr) {
+        close(conn);
+        return;
+    }
+    // a reused connection may have been closed by the server right before the request went out
+    bool stale = conn->m_reused && !conn->m_received && !pending->m_retried;
+    if (stale && (conn->m_sent == 0 || idempotent(pending->m_request.method()))) {
+        pending->m_retried = true;
+        conn->m_host->m_waiting.push_front(std::move(pending));
+        close(conn);
+        return;
+    }
+    close(conn);
+    finish(*pending, std::move(error));
+}
+
+void HttpAsyncClient::Worker::release(const std::shared_ptr<Connection>& conn) {
+    auto& host = *conn->m_host;
+    host.m_idle.push_back(conn);
+    if (m_options.m_idle_timeout.count() != 0) {
+        std::weak_ptr<Connection> weak = conn;
+        conn->m_idle_timer = m_timer_service->schedule(m_options.m_idle_timeout, [this, weak]() {
+            auto conn = weak.lock();
+            if (conn != nullptr && conn->m_pending == nullptr) {
+                conn->m_idle_timer = 0;
+                close(conn);
+            }
+        });
+    }
+    dispatch(host);
+}
+
+void HttpAsyncClient::Worker::close(const std::shared_ptr<Connection>& conn) {
+    if (conn->m_closed) {
+        return;
+    }
+    conn->m_closed = true;
+    if (conn->m_idle_timer != 0) {
+        m_timer_service->cancel(conn->m_idle_timer);
+        conn->m_idle_timer = 0;
+    }
+    auto& host = *conn->m_host;
+    std::erase(host.m_idle, conn);
+    host.m_connections.erase(conn->m_fd);
+    m_event_loop->remove_event(conn->m_fd);
+    // its slot is free for a waiting request
+    dispatch(host);
+}
+
+void HttpAsyncClient::Worker::on_timeout(const std::shared_ptr<Pending>& pending) {
+    if (pending->m_done) {
+        return;
+    }
+    pending->m_timer = 0;
+    auto conn = pending->m_connection.lock();
+    if (conn != nullptr && conn->m_pending == pending) {
+        // the response is cut off halfway, the connection is of no use anymore
+        conn->m_pending.reset();
+        close(conn);
+    }
+    finish(*pending, NetError { NET_TIMEOUT_CODE, "Timeout waiting for the response" });
+}
+
+void HttpAsyncClient::Worker::finish(Pending& pending, std::optional<NetError> error, HttpResponse response) {
+    if (pending.m_done) {
+        return;
+    }
+    pending.m_done = true;
+    if (pending.m_timer != 0) {
+        m_timer_service->cancel(pending.m_timer);
+        pending.m_timer = 0;
+    }
+    m_in_flight.fetch_sub(1, std::memory_order_relaxed);
+    try {
+        pending.m_callback(std::move(error), std::move(response));
+    } catch (const std::exception& e) {
+        std::cerr << std::format("Exception in response callback: {}\n", e.what()) << std::endl;
+    }
+}
+
+} // namespace net
@@ -7,12 +7,16 @@
 #include "websocket_utils.hpp"
 #include <algorithm>
 #include <cassert>
+#include <cerrno>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <shared_mutex>
 #include <string>
+#include <sys/socket.h>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 namespace net {
 
@@ -33,17 +37,55 @@ std::optional<NetError> HttpClient::read_http(HttpResponse& res) {
     std::optional<HttpResponse> res_opt;
     do {
         buffer.resize(1024);
-        auto err = m_client->read(buffer);
+        auto err = m_client->read(buffer, m_read_timeout);
         if (err.has_value()) {
             return err;
         }
         m_parser->add_res_read_buffer(buffer);
         res_opt = m_parser->read_res();
+        if (m_parser->res_failed()) {
+            return NetError { NET_INVALID_HTTP_MESSAGE, "Malformed chunked response body" };
+        }
     } while (!res_opt.has_value());
     res = std::move(res_opt.value());
     return std::nullopt;
 }
 
+std::optional<NetError> HttpClient::read_http_head(HttpResponse& res) {
+    std::vector<uint8_t> buffer;
+    // the head may have come in along with the previous body already
+    auto res_opt = m_parser->read_res_head();
+    while (!res_opt.has_value()) {
+        auto err = m_client->read(buffer, m_read_timeout);
+        if (err.has_value()) {
+            return err;
+        }
+        m_parser->add_res_read_buffer(buffer);
+        res_opt = m_parser->read_res_head();
+    }
+    res = std::move(res_opt.value());
+    return std::nullopt;
+}
+
+std::optional<NetError> HttpClient::read_http_body(std::string& piece, bool& finished) {
+    std::vector<uint8_t> buffer;
+    while (true) {
+        finished = m_parser->read_res_body(piece);
+        if (m_parser->res_failed()) {
+            return NetError { NET_INVALID_HTTP_MESSAGE, "Malformed chunked response body" };
+        }
+        if (finished || !piece.empty()) {
+            return std::nullopt;
+        }
+        // bounded, a fast upstream would otherwise be read into memory faster than the piece is passed on
+        auto err = m_client->read(buffer, m_read_timeout, BufferPool::SIZE_CLASSES.back());
+        if (err.has_value()) {
+            return err;
+        }
+        m_parser->add_res_read_buffer(buffer);
+    }
+}
+
 std::optional<NetError> HttpClient::write_http(const HttpRequest& req) {
     if (m_use_proxy) {
         // Prepare the proxy request (for example, set the proxy URL and headers)
@@ -66,6 +108,36 @@ std::optional<NetError> HttpClient::write_http(const HttpRequest& req) {
     return std::nullopt;
 }
 
+std::optional<NetError> HttpClient::write_http_head(const HttpRequest& req) {
+    assert(req.body().empty() && "The body of a streamed request goes through write_http_body");
+    m_chunked_upload = std::none_of(req.headers().begin(), req.headers().end(), [](const auto& header) {
+        return iequals(header.first, "Content-Length");
+    });
+    if (!m_chunked_upload) {
+        return write_http(req);
+    }
+    auto chunked = req;
+    chunked.set_header("transfer-encoding", "chunked");
+    return write_http(chunked);
+}
+
+std::optional<NetError> HttpClient::write_http_body(std::string_view piece) {
+    if (piece.empty()) {
+        return std::nullopt;
+    }
+    if (!m_chunked_upload) {
+        return m_client->write(std::vector<uint8_t>(piece.begin(), piece.end()));
+    }
+    return m_client->write(m_parser->write_req_chunk(piece));
+}
+
+std::optional<NetError> HttpClient::end_http_body() {
+    if (!std::exchange(m_chunked_upload, false)) {
+        return std::nullopt;
+    }
+    return m_client->write(m_parser->write_req_last_chunk());
+}
+
 std::optional<NetError> HttpClient::get(
     HttpResponse& response,
     const std::string& path,
@@ -91,7 +163,7 @@ std::future<std::optional<NetError>> HttpClient::async_get(
     const std::unordered_map<std::string, std::string>& headers,
     const std::string& version
 ) {
-    return std::async(std::launch::async, [this, path, &headers, &version, &response]() {
+    return std::async(std::launch::async, [this, path, headers, version, &response]() {
         return get(response, path, headers, version);
     });
 }
@@ -123,7 +195,7 @@ std::future<std::optional<NetError>> HttpClient::async_post(
     const std::unordered_map<std::string, std::string>& headers,
     const std::string& version
 ) {
-    return std::async(std::launch::async, [this, path, &body, &headers, &version, &response]() {
+    return std::async(std::launch::async, [this, path, body, headers, version, &response]() {
         return post(response, path, body, headers, version);
     });
 }
@@ -155,7 +227,7 @@ std::future<std::optional<NetError>> HttpClient::async_put(
     const std::unordered_map<std::string, std::string>& headers,
     const std::string& version
 ) {
-    return std::async(std::launch::async, [this, path, &body, &headers, &version, &response]() {
+    return std::async(std::launch::async, [this, path, body, headers, version, &response]() {
         return put(response, path, body, headers, version);
     });
 }
@@ -185,7 +257,7 @@ std::future<std::optional<NetError>> HttpClient::async_del(
     const std::unordered_map<std::string, std::string>& headers,
     const std::string& version
 ) {
-    return std::async(std::launch::async, [this, path, &headers, &version, &response]() {
+    return std::async(std::launch::async, [this, path, headers, version, &response]() {
         return del(response, path, headers, version);
     });
 }
@@ -217,7 +289,7 @@ std::future<std::optional<NetError>> HttpClient::async_patch(
     const std::unordered_map<std::string, std::string>& headers,
     const std::string& version
 ) {
-    return std::async(std::launch::async, [this, path, &body, &headers, &version, &response]() {
+    return std::async(std::launch::async, [this, path, body, headers, version, &response]() {
         return patch(response, path, body, headers, version);
     });
 }
@@ -247,7 +319,7 @@ std::future<std::optional<NetError>> HttpClient::async_head(
     const std::unordered_map<std::string, std::string>& headers,
     const std::string& version
 ) {
-    return std::async(std::launch::async, [this, path, &headers, &version, &response]() {
+    return std::async(std::launch::async, [this, path, headers, version, &response]() {
         return head(response, path, headers, version);
     });
 }
@@ -277,7 +349,7 @@ std::future<std::optional<NetError>> HttpClient::async_options(
     const std::unordered_map<std::string, std::string>& headers,
     const std::string& version
 ) {
-    return std::async(std::launch::async, [this, path, &headers, &version, &response]() {
+    return std::async(std::launch::async, [this, path, headers, version, &response]() {
         return options(response, path, headers, version);
     });
 }
@@ -307,7 +379,7 @@ std::future<std::optional<NetError>> HttpClient::async_connect(
     const std::unordered_map<std::string, std::string>& headers,
     const std::string& version
 ) {
-    return std::async(std::launch::async, [this, path, &headers, &version, &response]() {
+    return std::async(std::launch::async, [this, path, headers, version, &response]() {
         return this->connect(response, path, headers, version);
     });
 }
@@ -337,13 +409,13 @@ std::future<std::optional<NetError>> HttpClient::async_trace(
     const std::unordered_map<std::string, std::string>& headers,
     const std::string& version
 ) {
-    return std::async(std::launch::async, [this, path, &headers, &version, &response]() {
+    return std::async(std::launch::async, [this, path, headers, version, &response]() {
         return trace(response, path, headers, version);
     });
 }
 
-std::optional<NetError> HttpClient::connect_server() {
-    return m_client->connect();
+std::optional<NetError> HttpClient::connect_server(std::size_t time_out) {
+    return m_client->connect(time_out);
 }
 
 std::optional<NetError> HttpClient::close() {
@@ -397,6 +469,7 @@ void HttpClient::set_proxy(
     } else {
         m_client = std::make_shared<TcpClient>(m_proxy_ip, m_proxy_service);
     }
+    m_client->set_parallel_connect(m_parallel_connect);
 }
 
 void HttpClient::unset_proxy() {
@@ -410,6 +483,16 @@ void HttpClient::unset_proxy() {
     } else {
         m_client = std::make_shared<TcpClient>(m_target_ip, m_target_service);
     }
+    m_client->set_parallel_connect(m_parallel_connect);
+}
+
+void HttpClient::set_parallel_connect(bool enable) {
+    m_parallel_connect = enable;
+    m_client->set_parallel_connect(enable);
+}
+
+void HttpClient::set_read_timeout(std::size_t time_out) {
+    m_read_timeout = time_out;
 }
 
 std::optional<NetError> HttpClientGroup::connect(const std::string& ip, const std::string& service) {
@@ -467,4 +550,326 @@ HttpClientGroup::add_client(const std::string& ip, const std::string& service, s
     return std::nullopt;
 }
 
-} // namespace net
\ No newline at end of file
+HttpConnectionPool::Lease::Lease(Lease&& other) noexcept:
+    m_host(std::move(other.m_host)),
+    m_client(std::move(other.m_client)),
+    m_reused(other.m_reused),
+    m_keep_alive(other.m_keep_alive) {}
+
+HttpConnectionPool::Lease& HttpConnectionPool::Lease::operator=(Lease&& other) noexcept {
+    if (this != &other) {
+        discard();
+        m_host = std::move(other.m_host);
+        m_client = std::move(other.m_client);
+        m_reused = other.m_reused;
+        m_keep_alive = other.m_keep_alive;
+    }
+    return *this;
+}
+
+HttpConnectionPool::Lease::~Lease() {
+    discard();
+}
+
+void HttpConnectionPool::Lease::release() {
+    if (m_client == nullptr) {
+        return;
+    }
+    if (!m_keep_alive || m_client->status() != SocketStatus::CONNECTED) {
+        discard();
+        return;
+    }
+    m_host->put_back(std::move(m_client));
+    m_host.reset();
+}
+
+void HttpConnectionPool::Lease::discard() {
+    if (m_client == nullptr) {
+        return;
+    }
+    m_client.reset();
+    m_host->put_back(nullptr);
+    m_host.reset();
+}
+
+void HttpConnectionPool::Host::put_back(HttpClient::SharedPtr client) {
+    std::vector<HttpClient::SharedPtr> expired;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (client != nullptr && m_idle.size() < m_options.m_max_idle_per_host) {
+            m_idle.push_back({ std::move(client), Clock::now() });
+        } else {
+            m_open--;
+        }
+        take_expired(expired);
+    }
+    m_released.notify_one();
+}
+
+void HttpConnectionPool::Host::take_expired(std::vector<HttpClient::SharedPtr>& expired) {
+    if (m_options.m_idle_timeout.count() == 0) {
+        return;
+    }
+    auto limit = Clock::now() - m_options.m_idle_timeout;
+    while (!m_idle.empty() && m_idle.front().m_since < limit) {
+        expired.push_back(std::move(m_idle.front().m_client));
+        m_idle.pop_front();
+        m_open--;
+    }
+}
+
+HttpConnectionPool::HttpConnectionPool(HttpConnectionPoolOptions options): m_options(options) {}
+
+std::shared_ptr<HttpConnectionPool::Host> HttpConnectionPool::find_host(
+    const std::string& ip,
+    const std::string& service,
+    const std::shared_ptr<SSLContext>& ctx,
+    bool create
+) {
+    Key key { ip, service, ctx.get() };
+    {
+        std::shared_lock lock(m_mutex);
+        auto it = m_hosts.find(key);
+        if (it != m_hosts.end() || !create) {
+            return it == m_hosts.end() ? nullptr : it->second;
+        }
+    }
+    std::unique_lock lock(m_mutex);
+    auto& host = m_hosts[key];
+    if (host == nullptr) {
+        host = std::make_shared<Host>();
+        host->m_ip = ip;
+        host->m_service = service;
+        host->m_ssl_ctx = ctx;
+        host->m_options = m_options;
+    }
+    return host;
+}
+
+bool HttpConnectionPool::alive(const HttpClient& client) {
+    if (client.status() != SocketStatus::CONNECTED) {
+        return false;
+    }
+    // an idle connection has nothing to read, unless the server closed it or broke the protocol
+    char byte;
+    auto num_bytes = ::recv(client.get_fd(), &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    return num_bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+std::optional<NetError> HttpConnectionPool::acquire(
+    Lease& lease,
+    const std::string& ip,
+    const std::string& service,
+    std::shared_ptr<SSLContext> ctx
+) {
+    lease.discard();
+    auto host = find_host(ip, service, ctx, true);
+    std::vector<HttpClient::SharedPtr> expired;
+    HttpClient::SharedPtr client;
+    {
+        std::unique_lock<std::mutex> lock(host->m_mutex);
+        auto deadline = Clock::now() + m_options.m_acquire_timeout;
+        while (true) {
+            host->take_expired(expired);
+            if (!host->m_idle.empty()) {
+                client = std::move(host->m_idle.back().m_client);
+                host->m_idle.pop_back();
+                // checked outside the lock, the slot stays taken meanwhile
+                break;
+            }
+            if (host->m_open < m_options.m_max_connections_per_host) {
+                break;
+            }
+            if (m_options.m_acquire_timeout.count() == 0) {
+                host->m_released.wait(lock);
+            } else if (host->m_released.wait_until(lock, deadline) == std::cv_status::timeout
+                       && host->m_idle.empty() && host->m_open >= m_options.m_max_connections_per_host)
+            {
+                return NetError { NET_TIMEOUT_CODE, "Timeout waiting for a pooled connection" };
+            }
+        }
+        if (client == nullptr) {
+            host->m_open++;
+        }
+    }
+    lease.m_host = host;
+    lease.m_keep_alive = true;
+    while (client != nullptr) {
+        if (alive(*client)) {
+            lease.m_client = std::move(client);
+            lease.m_reused = true;
+            return std::nullopt;
+        }
+        // the server closed it while idle, try the next one, the slot carries over
+        client.reset();
+        std::lock_guard<std::mutex> lock(host->m_mutex);
+        if (!host->m_idle.empty()) {
+            client = std::move(host->m_idle.back().m_client);
+            host->m_idle.pop_back();
+            host->m_open--;
+        }
+    }
+    try {
+        client = std::make_shared<HttpClient>(ip, service, ctx);
+    } catch (const std::exception& e) {
+        host->put_back(nullptr);
+        lease.m_host.reset();
+        return NetError { errno, e.what() };
+    }
+    client->set_parallel_connect(m_options.m_parallel_connect);
+    client->set_read_timeout(m_options.m_read_timeout.count());
+    auto err = client->connect_server(m_options.m_connect_timeout.count());
+    if (err.has_value()) {
+        host->put_back(nullptr);
+        lease.m_host.reset();
+        return err;
+    }
+    lease.m_client = std::move(client);
+    lease.m_reused = false;
+    return std::nullopt;
+}
+
+std::optional<NetError> HttpConnectionPool::send(
+    Lease& lease,
+    HttpResponse& res,
+    const std::string& ip,
+    const std::string& service,
+    const HttpRequest& req,
+    std::shared_ptr<SSLContext> ctx
+) {
+    while (true) {
+        if (!lease) {
+            auto err = acquire(lease, ip, service, ctx);
+            if (err.has_value()) {
+                return err;
+            }
+        }
+        auto err = lease->write_http(req);
+        bool written = !err.has_value();
+        if (!err.has_value()) {
+            err = lease->read_http_head(res);
+        }
+        if (!err.has_value()) {
+            lease.m_keep_alive = res.keep_alive();
+            return std::nullopt;
+        }
+        // a fresh connection failing is a real error, a reused one may have been closed by the server just now
+        auto code = err.value().error_code;
+        bool stale = lease.reused() && (code == NET_CONNECTION_RESET_CODE || code == ECONNRESET || code == EPIPE);
+        lease.discard();
+        if (!stale || (written && !idempotent(req.method()))) {
+            return err;
+        }
+    }
+}
+
+std::optional<NetError> HttpConnectionPool::send_head(
+    Lease& lease,
+    const std::string& ip,
+    const std::string& service,
+    const HttpRequest& req,
+    std::shared_ptr<SSLContext> ctx
+) {
+    while (true) {
+        if (!lease) {
+            auto err = acquire(lease, ip, service, ctx);
+            if (err.has_value()) {
+                return err;
+            }
+        }
+        auto err = lease->write_http_head(req);
+        if (!err.has_value()) {
+            return std::nullopt;
+        }
+        // nothing reached the server, a reused connection closed by it just now is replaced whatever the method
+        auto code = err.value().error_code;
+        bool stale = lease.reused() && (code == NET_CONNECTION_RESET_CODE || code == ECONNRESET || code == EPIPE);
+        lease.discard();
+        if (!stale) {
+            return err;
+        }
+    }
+}
+
+std::optional<NetError> HttpConnectionPool::receive(Lease& lease, HttpResponse& res) {
+    auto err = lease->read_http_head(res);
+    if (err.has_value()) {
+        lease.discard();
+        return err;
+    }
+    lease.m_keep_alive = res.keep_alive();
+    return std::nullopt;
+}
+
+std::optional<NetError> HttpConnectionPool::request(
+    HttpResponse& res,
+    const std::string& ip,
+    const std::string& service,
+    const HttpRequest& req,
+    std::shared_ptr<SSLContext> ctx
+) {
+    Lease lease;
+    auto err = send(lease, res, ip, service, req, ctx);
+    if (err.has_value()) {
+        return err;
+    }
+    std::string body;
+    std::string piece;
+    bool finished = false;
+    while (!finished) {
+        err = lease->read_http_body(piece, finished);
+        if (err.has_value()) {
+            return err;
+        }
+        body.append(piece);
+    }
+    res.set_body(body);
+    lease.release();
+    return std::nullopt;
+}
+
+void HttpConnectionPool::evict_idle() {
+    std::vector<std::shared_ptr<Host>> hosts;
+    {
+        std::shared_lock lock(m_mutex);
+        for (auto& [key, host]: m_hosts) {
+            hosts.push_back(host);
+        }
+    }
+    std::vector<HttpClient::SharedPtr> expired;
+    for (auto& host: hosts) {
+        {
+            std::lock_guard<std::mutex> lock(host->m_mutex);
+            host->take_expired(expired);
+        }
+        host->m_released.notify_all();
+    }
+}
+
+std::size_t HttpConnectionPool::open_connections(
+    const std::string& ip,
+    const std::string& service,
+    const std::shared_ptr<SSLContext>& ctx
+) {
+    auto host = find_host(ip, service, ctx, false);
+    if (host == nullptr) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> lock(host->m_mutex);
+    return host->m_open;
+}
+
+std::size_t HttpConnectionPool::idle_connections(
+    const std::string& ip,
+    const std::string& service,
+    const std::shared_ptr<SSLContext>& ctx
+) {
+    auto host = find_host(ip, service, ctx, false);
+    if (host == nullptr) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> lock(host->m_mutex);
+    return host->m_idle.size();
+}
+
+} // namespace net
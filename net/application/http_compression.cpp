@@ -0,0 +1,408 @@
+#include "http_compression.hpp"
+#include "http_parser.hpp"
+#include <algorithm>
+#include <cctype>
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <zlib.h>
+#ifdef NET_HAS_BROTLI
+    #include <brotli/encode.h>
+#endif
+
+namespace net {
+
+namespace {
+
+#ifdef NET_HAS_BROTLI
+constexpr ContentCoding SUPPORTED_CODINGS[] = { ContentCoding::BROTLI, ContentCoding::GZIP, ContentCoding::DEFLATE };
+#else
+constexpr ContentCoding SUPPORTED_CODINGS[] = { ContentCoding::GZIP, ContentCoding::DEFLATE };
+#endif
+
+bool icontains(std::string_view text, std::string_view token) {
+    return std::search(text.begin(), text.end(), token.begin(), token.end(), [](char a, char b) {
+               return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+           })
+        != text.end();
+}
+
+std::string_view trim(std::string_view text) {
+    auto first = text.find_first_not_of(" \t");
+    if (first == std::string_view::npos) {
+        return {};
+    }
+    return text.substr(first, text.find_last_not_of(" \t") - first + 1);
+}
+
+std::string_view find_header(const HttpResponse& response, std::string_view key) {
+    for (auto& [name, value]: response.headers()) {
+        if (iequals(name, key)) {
+            return value;
+        }
+    }
+    return {};
+}
+
+/**
+ * @return q value of an Accept-Encoding element in thousandths, 1000 if it has none, -1 if it is malformed
+ */
+int parse_q(std::string_view params) {
+    int q = 1000;
+    while (!params.empty()) {
+        auto end = std::min(params.find(';'), params.size());
+        auto param = trim(params.substr(0, end));
+        params = end < params.size() ? params.substr(end + 1) : std::string_view {};
+        if (param.size() < 2 || std::tolower(static_cast<unsigned char>(param[0])) != 'q' || param[1] != '=') {
+            continue;
+        }
+        // qvalue = ( "0" [ "." 0*3DIGIT ] ) / ( "1" [ "." 0*3("0") ] )
+        auto value = param.substr(2);
+        if (value.empty() || (value[0] != '0' && value[0] != '1')) {
+            return -1;
+        }
+        q = (value[0] - '0') * 1000;
+        if (value.size() > 1) {
+            if (value[1] != '.' || value.size() > 5) {
+                return -1;
+            }
+            int scale = 100;
+            for (auto c: value.substr(2)) {
+                if (c < '0' || c > '9') {
+                    return -1;
+                }
+                q += (c - '0') * scale;
+                scale /= 10;
+            }
+        }
+        q = std::min(q, 1000);
+    }
+    return q;
+}
+
+class ZlibCompressor: public Compressor {
+public:
+    ZlibCompressor(bool gzip, int level) {
+        // 15 bits of window, plus 16 for the gzip wrapper instead of the zlib one
+        if (deflateInit2(&m_stream, level, Z_DEFLATED, gzip ? 15 + 16 : 15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            throw std::runtime_error("Failed to initialize zlib");
+        }
+    }
+
+    ZlibCompressor(const ZlibCompressor&) = delete;
+
+    ZlibCompressor& operator=(const ZlibCompressor&) = delete;
+
+    ~ZlibCompressor() override {
+        deflateEnd(&m_stream);
+    }
+
+    void compress(std::string_view input, std::string& out, Flush flush) override {
+        auto mode = flush == Flush::FINISH ? Z_FINISH : flush == Flush::SYNC ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+        m_stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+        m_stream.avail_in = static_cast<uInt>(input.size());
+        while (true) {
+            auto size = out.size();
+            auto room = std::max<std::size_t>(deflateBound(&m_stream, m_stream.avail_in), 256);
+            out.resize(size + room);
+            m_stream.next_out = reinterpret_cast<Bytef*>(out.data() + size);
+            m_stream.avail_out = static_cast<uInt>(room);
+            auto ret = deflate(&m_stream, mode);
+            out.resize(size + room - m_stream.avail_out);
+            if (ret == Z_STREAM_ERROR) {
+                throw std::runtime_error("Failed to compress with zlib");
+            }
+            if (mode == Z_FINISH ? ret == Z_STREAM_END : m_stream.avail_out != 0 && m_stream.avail_in == 0) {
+                break;
+            }
+        }
+    }
+
+private:
+    z_stream m_stream {};
+};
+
+#ifdef NET_HAS_BROTLI
+class BrotliCompressor: public Compressor {
+public:
+    explicit BrotliCompressor(int quality) {
+        m_state = BrotliEncoderCreateInstance(nullptr, nullptr, nullptr);
+        if (m_state == nullptr) {
+            throw std::runtime_error("Failed to initialize brotli");
+        }
+        BrotliEncoderSetParameter(m_state, BROTLI_PARAM_QUALITY, static_cast<uint32_t>(quality));
+    }
+
+    BrotliCompressor(const BrotliCompressor&) = delete;
+
+    BrotliCompressor& operator=(const BrotliCompressor&) = delete;
+
+    ~BrotliCompressor() override {
+        BrotliEncoderDestroyInstance(m_state);
+    }
+
+    void compress(std::string_view input, std::string& out, Flush flush) override {
+        auto operation = flush == Flush::FINISH ? BROTLI_OPERATION_FINISH
+            : flush == Flush::SYNC              ? BROTLI_OPERATION_FLUSH
+                                                : BROTLI_OPERATION_PROCESS;
+        auto next_in = reinterpret_cast<const uint8_t*>(input.data());
+        auto avail_in = input.size();
+        while (true) {
+            // no output buffer, the encoder keeps its own and hands it out through BrotliEncoderTakeOutput
+            std::size_t avail_out = 0;
+            if (!BrotliEncoderCompressStream(m_state, operation, &avail_in, &next_in, &avail_out, nullptr, nullptr)) {
+                throw std::runtime_error("Failed to compress with brotli");
+            }
+            std::size_t size = 0;
+            auto data = BrotliEncoderTakeOutput(m_state, &size);
+            out.append(reinterpret_cast<const char*>(data), size);
+            if (avail_in == 0 && !BrotliEncoderHasMoreOutput(m_state)
+                && (operation != BROTLI_OPERATION_FINISH || BrotliEncoderIsFinished(m_state)))
+            {
+                break;
+            }
+        }
+    }
+
+private:
+    BrotliEncoderState* m_state;
+};
+#endif
+
+} // namespace
+
+std::string_view coding_name(ContentCoding coding) {
+    switch (coding) {
+        case ContentCoding::GZIP:
+            return "gzip";
+        case ContentCoding::DEFLATE:
+            return "deflate";
+        case ContentCoding::BROTLI:
+            return "br";
+        case ContentCoding::IDENTITY:
+            break;
+    }
+    return "identity";
+}
+
+std::span<const ContentCoding> supported_codings() {
+    return SUPPORTED_CODINGS;
+}
+
+ContentCoding negotiate_coding(std::string_view accept_encoding, std::span<const ContentCoding> available) {
+    // q values in thousandths, -1 while a coding isn't mentioned
+    std::array<int, 4> q;
+    q.fill(-1);
+    int wildcard = -1;
+    while (!accept_encoding.empty()) {
+        auto end = std::min(accept_encoding.find(','), accept_encoding.size());
+        auto element = accept_encoding.substr(0, end);
+        accept_encoding = end < accept_encoding.size() ? accept_encoding.substr(end + 1) : std::string_view {};
+        auto semicolon = std::min(element.find(';'), element.size());
+        auto name = trim(element.substr(0, semicolon));
+        auto value = parse_q(element.substr(semicolon));
+        if (name.empty() || value < 0) {
+            continue;
+        }
+        if (name == "*") {
+            wildcard = value;
+            continue;
+        }
+        // x-gzip is the old name of gzip, RFC 9110 8.4.1.3
+        if (iequals(name, "x-gzip")) {
+            name = "gzip";
+        }
+        // every known coding counts, available may list ones this build can't produce, like precompressed files
+        for (auto coding: { ContentCoding::GZIP, ContentCoding::DEFLATE, ContentCoding::BROTLI }) {
+            if (iequals(name, coding_name(coding))) {
+                q[static_cast<std::size_t>(coding)] = value;
+            }
+        }
+    }
+    auto best = ContentCoding::IDENTITY;
+    int best_q = 0;
+    for (auto coding: available) {
+        auto value = q[static_cast<std::size_t>(coding)];
+        if (value < 0) {
+            value = std::max(wildcard, 0);
+        }
+        if (value > best_q) {
+            best = coding;
+            best_q = value;
+        }
+    }
+    return best;
+}
+
+Compressor::UniquePtr Compressor::create(ContentCoding coding, int level) {
+    switch (coding) {
+        case ContentCoding::GZIP:
+        case ContentCoding::DEFLATE:
+            return std::make_unique<ZlibCompressor>(coding == ContentCoding::GZIP, level < 0 ? 6 : level);
+#ifdef NET_HAS_BROTLI
+        case ContentCoding::BROTLI:
+            return std::make_unique<BrotliCompressor>(level < 0 ? 5 : level);
+#endif
+        default:
+            return nullptr;
+    }
+}
+
+ResponseCompressor::ResponseCompressor(CompressionOptions options): m_options(std::move(options)) {
+    std::erase_if(m_options.m_codings, [](ContentCoding coding) {
+        return std::find(std::begin(SUPPORTED_CODINGS), std::end(SUPPORTED_CODINGS), coding)
+            == std::end(SUPPORTED_CODINGS);
+    });
+}
+
+void ResponseCompressor::apply(std::string_view accept_encoding, HttpResponse& response) {
+    if (response.status_code() != HttpResponseCode::OK || response.has_header("Content-Encoding")
+        || response.has_header("Content-Range") || response.body_file() != nullptr
+        || icontains(find_header(response, "Cache-Control"), "no-transform")
+        || !compressible_type(find_header(response, "Content-Type")))
+    {
+        return;
+    }
+    // caches have to tell the variants apart, whichever one this response turns out to be
+    auto vary = std::string(find_header(response, "Vary"));
+    if (vary.empty()) {
+        response.set_header("Vary", "Accept-Encoding");
+    } else if (vary != "*" && !icontains(vary, "Accept-Encoding")) {
+        response.remove_header("Vary").set_header("Vary", vary + ", Accept-Encoding");
+    }
+    auto coding = negotiate_coding(accept_encoding, m_options.m_codings);
+    if (coding == ContentCoding::IDENTITY) {
+        return;
+    }
+    auto encode = [&response, coding](std::optional<std::size_t> size) {
+        response.set_header("Content-Encoding", std::string(coding_name(coding)));
+        response.remove_header("Content-Length");
+        if (size.has_value()) {
+            response.set_header("Content-Length", std::to_string(size.value()));
+        }
+        // a strong validator must differ between representations, "x" becomes "x-gzip"
+        auto etag = std::string(find_header(response, "ETag"));
+        if (etag.size() >= 2 && etag.back() == '"') {
+            etag.insert(etag.size() - 1, "-" + std::string(coding_name(coding)));
+            response.remove_header("ETag").set_header("ETag", etag);
+        }
+    };
+    if (response.body_producer()) {
+        std::shared_ptr<Compressor> compressor = Compressor::create(coding, level(coding));
+        auto producer = response.body_producer();
+        response.set_body_producer([producer, compressor, piece = std::string()](std::string& chunk) mutable {
+            piece.clear();
+            bool more = producer(piece);
+            if (more && piece.empty()) {
+                return true;
+            }
+            // flushed piece by piece, a streamed body is often read as it is produced
+            compressor->compress(piece, chunk, more ? Compressor::Flush::SYNC : Compressor::Flush::FINISH);
+            return more;
+        });
+        encode(std::nullopt);
+        return;
+    }
+    auto body = response.body_view();
+    if (body.size() < m_options.m_min_size) {
+        return;
+    }
+    if (m_options.m_cache_capacity > 0 && body.size() <= m_options.m_max_cached_body) {
+        auto key = std::hash<std::string_view> {}(body) ^ (static_cast<uint64_t>(coding) * 0x9e3779b97f4a7c15ULL);
+        bool hot = false;
+        auto entry = cached(coding, key, body, hot);
+        if (entry == nullptr && hot) {
+            auto fresh = std::make_shared<Entry>(Entry { coding, key, std::string(body), compress(coding, body) });
+            if (fresh->m_compressed.size() >= body.size()) {
+                fresh->m_compressed.clear();
+            }
+            insert(fresh);
+            entry = std::move(fresh);
+        }
+        if (entry != nullptr) {
+            if (!entry->m_compressed.empty()) {
+                encode(entry->m_compressed.size());
+                response.set_body_view(entry->m_compressed, entry);
+            }
+            return;
+        }
+    }
+    auto compressed = std::make_shared<const std::string>(compress(coding, body));
+    if (compressed->size() >= body.size()) {
+        return;
+    }
+    encode(compressed->size());
+    response.set_body_view(*compressed, compressed);
+}
+
+std::size_t ResponseCompressor::cached_entries() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_entries.size();
+}
+
+std::size_t ResponseCompressor::cached_size() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_cached_size;
+}
+
+bool ResponseCompressor::compressible_type(std::string_view content_type) const {
+    auto media_type = trim(content_type.substr(0, content_type.find(';')));
+    if (media_type.empty()) {
+        return false;
+    }
+    return std::any_of(m_options.m_mime_types.begin(), m_options.m_mime_types.end(), [media_type](auto& allowed) {
+        std::string_view pattern = allowed;
+        if (pattern.ends_with("/*")) {
+            pattern.remove_suffix(1);
+            return media_type.size() > pattern.size() && iequals(media_type.substr(0, pattern.size()), pattern);
+        }
+        return iequals(media_type, pattern);
+    });
+}
+
+int ResponseCompressor::level(ContentCoding coding) const {
+    return coding == ContentCoding::BROTLI ? m_options.m_brotli_quality : m_options.m_gzip_level;
+}
+
+std::string ResponseCompressor::compress(ContentCoding coding, std::string_view body) const {
+    std::string out;
+    Compressor::create(coding, level(coding))->compress(body, out, Compressor::Flush::FINISH);
+    return out;
+}
+
+std::shared_ptr<const ResponseCompressor::Entry>
+ResponseCompressor::cached(ContentCoding coding, uint64_t key, std::string_view body, bool& hot) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto entry = m_entries.find(key);
+    if (entry != m_entries.end() && (*entry->second)->m_coding == coding && (*entry->second)->m_body == body) {
+        m_lru.splice(m_lru.begin(), m_lru, entry->second);
+        return *entry->second;
+    }
+    auto& seen = m_seen[key % m_seen.size()];
+    hot = seen == key;
+    seen = key;
+    return nullptr;
+}
+
+void ResponseCompressor::insert(std::shared_ptr<const Entry> entry) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto erase = [this](decltype(m_entries)::iterator it) {
+        m_cached_size -= (*it->second)->m_body.size() + (*it->second)->m_compressed.size();
+        m_lru.erase(it->second);
+        m_entries.erase(it);
+    };
+    if (auto existing = m_entries.find(entry->m_key); existing != m_entries.end()) {
+        erase(existing);
+    }
+    m_cached_size += entry->m_body.size() + entry->m_compressed.size();
+    m_lru.push_front(entry);
+    m_entries.emplace(entry->m_key, m_lru.begin());
+    while (m_cached_size > m_options.m_cache_capacity && !m_lru.empty()) {
+        erase(m_entries.find(m_lru.back()->m_key));
+    }
+}
+
+} // namespace net
@@ -1,9 +1,90 @@
 #include "http_parser.hpp"
+#include "defines.hpp"
 #include "enum_parser.hpp"
+#include "simd_scan.hpp"
+#include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <ctime>
+#include <format>
+#include <iterator>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace net {
 
+bool iequals(std::string_view lhs, std::string_view rhs) {
+    if (lhs.size() != rhs.size()) {
+        return false;
+    }
+    for (std::size_t i = 0; i < lhs.size(); i++) {
+        char a = lhs[i], b = rhs[i];
+        if (a != b && ((a | 0x20) != (b | 0x20) || (a | 0x20) < 'a' || (a | 0x20) > 'z')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static std::string_view url_path(std::string_view url) {
+    return url.substr(0, simd::find_char(url, '?'));
+}
+
+static std::string_view url_query(std::string_view url) {
+    auto pos = simd::find_char(url, '?');
+    return pos == std::string_view::npos ? std::string_view {} : url.substr(pos + 1);
+}
+
+bool idempotent(HttpMethod method) {
+    return method != HttpMethod::POST && method != HttpMethod::PATCH && method != HttpMethod::CONNECT;
+}
+
+bool RouteParams::push(std::string_view name, std::size_t offset, std::size_t size) {
+    if (m_size == MAX_PARAMS) {
+        return false;
+    }
+    m_params[m_size++] = Param { name, static_cast<uint32_t>(offset), static_cast<uint32_t>(size) };
+    return true;
+}
+
+void RouteParams::pop() {
+    assert(m_size > 0 && "No parameter to pop");
+    --m_size;
+}
+
+void RouteParams::clear() {
+    m_size = 0;
+}
+
+std::size_t RouteParams::size() const {
+    return m_size;
+}
+
+bool RouteParams::empty() const {
+    return m_size == 0;
+}
+
+std::string_view RouteParams::name(std::size_t index) const {
+    assert(index < m_size && "Parameter index out of range");
+    return m_params[index].name;
+}
+
+std::string_view RouteParams::value(std::string_view path, std::size_t index) const {
+    assert(index < m_size && "Parameter index out of range");
+    return path.substr(m_params[index].offset, m_params[index].size);
+}
+
+std::string_view RouteParams::get(std::string_view path, std::string_view name) const {
+    for (std::size_t i = 0; i < m_size; i++) {
+        if (m_params[i].name == name) {
+            return value(path, i);
+        }
+    }
+    return {};
+}
+
 HttpResponse& HttpResponse::set_version(const std::string& version) {
     m_version = version;
     return *this;
@@ -29,11 +110,73 @@ HttpResponse& HttpResponse::set_headers(const std::unordered_map<std::string, st
     return *this;
 }
 
+HttpResponse& HttpResponse::remove_header(std::string_view key) {
+    std::erase_if(m_headers, [key](const auto& header) { return iequals(header.first, key); });
+    return *this;
+}
+
 HttpResponse& HttpResponse::set_body(const std::string& body) {
     m_body = body;
+    m_body_view = {};
+    m_body_owner.reset();
+    return *this;
+}
+
+HttpResponse& HttpResponse::set_body_view(std::string_view body, std::shared_ptr<const void> owner) {
+    m_body.clear();
+    m_body_view = body;
+    m_body_owner = std::move(owner);
+    return *this;
+}
+
+HttpResponse& HttpResponse::set_body_file(std::shared_ptr<const int> file, off_t offset, std::size_t size) {
+    m_body_file = std::move(file);
+    m_body_file_offset = offset;
+    m_body_file_size = size;
     return *this;
 }
 
+HttpResponse& HttpResponse::set_body_producer(HttpBodyProducer producer) {
+    m_body_producer = std::move(producer);
+    return *this;
+}
+
+HttpResponse& HttpResponse::set_body_fd(int fd) {
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        auto offset = ::lseek(fd, 0, SEEK_CUR);
+        set_header("Content-Length", std::to_string(st.st_size - std::max<off_t>(offset, 0)));
+    }
+    // shared by every copy of the producer, the last one closes the fd
+    std::shared_ptr<int> file(new int(fd), [](int* fd) {
+        ::close(*fd);
+        delete fd;
+    });
+    return set_body_producer([file](std::string& chunk) {
+        chunk.resize(BODY_FD_CHUNK_SIZE);
+        ssize_t num_bytes;
+        do {
+            num_bytes = ::read(*file, chunk.data(), chunk.size());
+        } while (num_bytes == -1 && errno == EINTR);
+        if (num_bytes == -1) {
+            throw std::runtime_error(std::format("Failed to read response body: {}", GET_ERROR_MSG().msg));
+        }
+        chunk.resize(static_cast<std::size_t>(num_bytes));
+        return num_bytes != 0;
+    });
+}
+
+HttpResponse& HttpResponse::set_body_generator(std::function<std::optional<std::string>()> generator) {
+    return set_body_producer([generator = std::move(generator)](std::string& chunk) {
+        auto piece = generator();
+        if (!piece.has_value()) {
+            return false;
+        }
+        chunk = std::move(piece.value());
+        return true;
+    });
+}
+
 [[nodiscard]] const std::string& HttpResponse::version() const {
     return m_version;
 }
@@ -49,7 +192,14 @@ HttpResponse& HttpResponse::set_body(const std::string& body) {
 [[nodiscard]] const std::string& HttpResponse::header(const std::string& key) const {
     auto it = m_headers.find(key);
     if (it == m_headers.end()) {
-        return std::move(std::string());
+        // parsed responses carry lowercased keys, ones built by hand whatever case they were set in
+        it = std::find_if(m_headers.begin(), m_headers.end(), [&key](const auto& header) {
+            return iequals(header.first, key);
+        });
+    }
+    if (it == m_headers.end()) {
+        static const std::string empty;
+        return empty;
     }
     return it->second;
 }
@@ -58,10 +208,49 @@ HttpResponse& HttpResponse::set_body(const std::string& body) {
     return m_headers;
 }
 
+[[nodiscard]] bool HttpResponse::has_header(std::string_view key) const {
+    return std::any_of(m_headers.begin(), m_headers.end(), [key](const auto& header) {
+        return iequals(header.first, key);
+    });
+}
+
+[[nodiscard]] bool HttpResponse::keep_alive() const {
+    std::string_view connection;
+    for (auto& [key, value]: m_headers) {
+        if (iequals(key, "connection")) {
+            connection = value;
+        }
+    }
+    if (m_version == HTTP_VERSION_1_0) {
+        return iequals(connection, "keep-alive");
+    }
+    return !iequals(connection, "close");
+}
+
 [[nodiscard]] const std::string& HttpResponse::body() const {
     return m_body;
 }
 
+[[nodiscard]] std::string_view HttpResponse::body_view() const {
+    return m_body_owner != nullptr ? m_body_view : std::string_view(m_body);
+}
+
+[[nodiscard]] const HttpBodyProducer& HttpResponse::body_producer() const {
+    return m_body_producer;
+}
+
+[[nodiscard]] const std::shared_ptr<const int>& HttpResponse::body_file() const {
+    return m_body_file;
+}
+
+[[nodiscard]] off_t HttpResponse::body_file_offset() const {
+    return m_body_file_offset;
+}
+
+[[nodiscard]] std::size_t HttpResponse::body_file_size() const {
+    return m_body_file_size;
+}
+
 HttpRequest& HttpRequest::set_version(const std::string& version) {
     m_version = version;
     return *this;
@@ -92,6 +281,11 @@ HttpRequest& HttpRequest::set_method(HttpMethod method) {
     return *this;
 }
 
+HttpRequest& HttpRequest::set_params(const RouteParams& params) {
+    m_params = params;
+    return *this;
+}
+
 [[nodiscard]] HttpMethod HttpRequest::method() const {
     return m_method;
 }
@@ -100,6 +294,22 @@ HttpRequest& HttpRequest::set_method(HttpMethod method) {
     return m_url;
 }
 
+[[nodiscard]] std::string_view HttpRequest::path() const {
+    return url_path(m_url);
+}
+
+[[nodiscard]] std::string_view HttpRequest::query() const {
+    return url_query(m_url);
+}
+
+[[nodiscard]] std::string_view HttpRequest::param(std::string_view name) const {
+    return m_params.get(m_url, name);
+}
+
+[[nodiscard]] const RouteParams& HttpRequest::params() const {
+    return m_params;
+}
+
 [[nodiscard]] const std::string& HttpRequest::version() const {
     return m_version;
 }
@@ -107,7 +317,8 @@ HttpRequest& HttpRequest::set_method(HttpMethod method) {
 [[nodiscard]] const std::string& HttpRequest::header(const std::string& key) const {
     auto it = m_headers.find(key);
     if (it == m_headers.end()) {
-        return std::move(std::string());
+        static const std::string empty;
+        return empty;
     }
     return it->second;
 }
@@ -134,13 +345,13 @@ void http11_header_parser::reset_state() {
 
 void http11_header_parser::_extract_headers() {
     std::string_view header = m_header;
-    size_t pos = header.find("\r\n", 0, 2);
+    size_t pos = simd::find_crlf(header);
     m_headline = std::string(header.substr(0, pos));
     while (pos != std::string::npos) {
         // 跳过 "\r\n"
         pos += 2;
         // 从当前位置开始找，先找到下一行位置（可能为 npos）
-        size_t next_pos = header.find("\r\n", pos, 2);
+        size_t next_pos = simd::find_crlf(header, pos);
         size_t line_len = std::string::npos;
         if (next_pos != std::string::npos) {
             // 如果下一行还不是结束，那么 line_len
@@ -149,7 +360,10 @@ void http11_header_parser::_extract_headers() {
         }
         // 就能切下本行
         std::string_view line = header.substr(pos, line_len);
-        size_t colon = line.find(": ", 0, 2);
+        size_t colon = simd::find_char(line, ':');
+        while (colon != std::string::npos && (colon + 1 == line.size() || line[colon + 1] != ' ')) {
+            colon = simd::find_char(line, ':', colon + 1);
+        }
         if (colon != std::string::npos) {
             // 每一行都是 "键: 值"
             std::string key = std::string(line.substr(0, colon));
@@ -168,38 +382,24 @@ void http11_header_parser::_extract_headers() {
     }
 }
 
-void http11_header_parser::push_chunk(std::string& chunk) {
+std::size_t http11_header_parser::push_chunk(std::string_view chunk) {
     assert(!m_header_finished);
     size_t old_size = m_header.size();
+    // 头部的字节归解析器所有，调用者的缓冲区不再保留它们
     m_header.append(chunk);
     std::string_view header = m_header;
     // 如果还在解析头部的话，尝试判断头部是否结束
-    if (old_size < 4) {
-        old_size = 4;
-    }
-    old_size -= 4;
-    size_t header_len = header.find("\r\n\r\n", old_size, 4);
-    if (header_len != std::string::npos) {
-        // 头部已经结束
-        m_header_finished = true;
-        // 把不小心多读取的正文留下
-        m_header.resize(header_len);
-        // 开始分析头部，尝试提取 Content-length 字段
-        _extract_headers();
-        auto content_length = m_header_keys.find("content-length");
-        if (content_length != m_header_keys.end()) {
-            size_t body_len = std::stoul(content_length->second);
-            if (header_len + 4 + body_len <= header.size()) {
-                m_body = header.substr(header_len + 4, body_len);
-                chunk = chunk.substr(header_len + 4 + body_len);
-            } else {
-                m_body = header.substr(header_len + 4, header.size() - header_len - 4);
-                chunk.clear();
-            }
-        } else {
-            chunk = chunk.substr(header_len + 4);
-        }
+    size_t from = old_size < 4 ? 0 : old_size - 4;
+    size_t header_len = simd::find_header_end(header, from);
+    if (header_len == std::string::npos) {
+        return chunk.size();
     }
+    // 头部已经结束
+    m_header_finished = true;
+    // 多读取的正文留在调用者的缓冲区里，由 _http_base_parser 按 content-length 或 chunked 处理
+    m_header.resize(header_len);
+    _extract_headers();
+    return header_len + 4 - old_size;
 }
 
 std::string& http11_header_parser::headline() {
@@ -245,6 +445,247 @@ void http11_header_writer::end_header() {
     m_buffer.append("\r\n\r\n");
 }
 
+namespace {
+
+struct StatusLine {
+    int code;
+    std::string_view line;
+};
+
+constexpr StatusLine STATUS_LINES[] = {
+    { 100, "HTTP/1.1 100 Continue\r\n" },
+    { 101, "HTTP/1.1 101 Switching Protocols\r\n" },
+    { 102, "HTTP/1.1 102 Processing\r\n" },
+    { 103, "HTTP/1.1 103 Early Hints\r\n" },
+    { 200, "HTTP/1.1 200 OK\r\n" },
+    { 201, "HTTP/1.1 201 Created\r\n" },
+    { 202, "HTTP/1.1 202 Accepted\r\n" },
+    { 203, "HTTP/1.1 203 Non-Authoritative Information\r\n" },
+    { 204, "HTTP/1.1 204 No Content\r\n" },
+    { 205, "HTTP/1.1 205 Reset Content\r\n" },
+    { 206, "HTTP/1.1 206 Partial Content\r\n" },
+    { 207, "HTTP/1.1 207 Multi-Status\r\n" },
+    { 208, "HTTP/1.1 208 Already Reported\r\n" },
+    { 226, "HTTP/1.1 226 IM Used\r\n" },
+    { 300, "HTTP/1.1 300 Multiple Choices\r\n" },
+    { 301, "HTTP/1.1 301 Moved Permanently\r\n" },
+    { 302, "HTTP/1.1 302 Found\r\n" },
+    { 303, "HTTP/1.1 303 See Other\r\n" },
+    { 304, "HTTP/1.1 304 Not Modified\r\n" },
+    { 305, "HTTP/1.1 305 Use Proxy\r\n" },
+    { 306, "HTTP/1.1 306 Switch Proxy\r\n" },
+    { 307, "HTTP/1.1 307 Temporary Redirect\r\n" },
+    { 308, "HTTP/1.1 308 Permanent Redirect\r\n" },
+    { 400, "HTTP/1.1 400 Bad Request\r\n" },
+    { 401, "HTTP/1.1 401 Unauthorized\r\n" },
+    { 402, "HTTP/1.1 402 Payment Required\r\n" },
+    { 403, "HTTP/1.1 403 Forbidden\r\n" },
+    { 404, "HTTP/1.1 404 Not Found\r\n" },
+    { 405, "HTTP/1.1 405 Method Not Allowed\r\n" },
+    { 406, "HTTP/1.1 406 Not Acceptable\r\n" },
+    { 407, "HTTP/1.1 407 Proxy Authentication Required\r\n" },
+    { 408, "HTTP/1.1 408 Request Timeout\r\n" },
+    { 409, "HTTP/1.1 409 Conflict\r\n" },
+    { 410, "HTTP/1.1 410 Gone\r\n" },
+    { 411, "HTTP/1.1 411 Length Required\r\n" },
+    { 412, "HTTP/1.1 412 Precondition Failed\r\n" },
+    { 413, "HTTP/1.1 413 Content Too Large\r\n" },
+    { 414, "HTTP/1.1 414 URI Too Long\r\n" },
+    { 415, "HTTP/1.1 415 Unsupported Media Type\r\n" },
+    { 416, "HTTP/1.1 416 Range Not Satisfiable\r\n" },
+    { 417, "HTTP/1.1 417 Expectation Failed\r\n" },
+    { 418, "HTTP/1.1 418 I'm a teapot\r\n" },
+    { 421, "HTTP/1.1 421 Misdirected Request\r\n" },
+    { 422, "HTTP/1.1 422 Unprocessable Content\r\n" },
+    { 423, "HTTP/1.1 423 Locked\r\n" },
+    { 424, "HTTP/1.1 424 Failed Dependency\r\n" },
+    { 425, "HTTP/1.1 425 Too Early\r\n" },
+    { 426, "HTTP/1.1 426 Upgrade Required\r\n" },
+    { 428, "HTTP/1.1 428 Precondition Required\r\n" },
+    { 429, "HTTP/1.1 429 Too Many Requests\r\n" },
+    { 431, "HTTP/1.1 431 Request Header Fields Too Large\r\n" },
+    { 451, "HTTP/1.1 451 Unavailable For Legal Reasons\r\n" },
+    { 500, "HTTP/1.1 500 Internal Server Error\r\n" },
+    { 501, "HTTP/1.1 501 Not Implemented\r\n" },
+    { 502, "HTTP/1.1 502 Bad Gateway\r\n" },
+    { 503, "HTTP/1.1 503 Service Unavailable\r\n" },
+    { 504, "HTTP/1.1 504 Gateway Timeout\r\n" },
+    { 505, "HTTP/1.1 505 HTTP Version Not Supported\r\n" },
+    { 506, "HTTP/1.1 506 Variant Also Negotiates\r\n" },
+    { 507, "HTTP/1.1 507 Insufficient Storage\r\n" },
+    { 508, "HTTP/1.1 508 Loop Detected\r\n" },
+    { 510, "HTTP/1.1 510 Not Extended\r\n" },
+    { 511, "HTTP/1.1 511 Network Authentication Required\r\n" },
+};
+
+// "HTTP/1.1 200 " comes before the reason, "\r\n" after it
+constexpr std::size_t REASON_OFFSET = 13;
+
+constexpr bool status_lines_valid() {
+    for (auto& status: STATUS_LINES) {
+        auto line = status.line;
+        if (!line.starts_with("HTTP/1.1 ") || !line.ends_with("\r\n") || line.size() <= REASON_OFFSET + 2
+            || line[12] != ' ' || (line[9] - '0') * 100 + (line[10] - '0') * 10 + (line[11] - '0') != status.code)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(status_lines_valid(), "Status line does not match its code");
+
+constexpr auto STATUS_LINE_TABLE = []() {
+    std::array<std::string_view, 600> table {};
+    for (auto& status: STATUS_LINES) {
+        table[status.code] = status.line;
+    }
+    return table;
+}();
+
+} // namespace
+
+std::string_view status_line(HttpResponseCode code) {
+    auto index = static_cast<int>(code);
+    if (index < 0 || index >= static_cast<int>(STATUS_LINE_TABLE.size())) {
+        return {};
+    }
+    return STATUS_LINE_TABLE[index];
+}
+
+std::string_view reason_phrase(HttpResponseCode code) {
+    auto line = status_line(code);
+    if (line.empty()) {
+        return {};
+    }
+    return line.substr(REASON_OFFSET, line.size() - REASON_OFFSET - 2);
+}
+
+namespace {
+
+constexpr std::string_view DAYS[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+constexpr std::string_view MONTHS[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                        "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+// length of "Sun, 06 Nov 1994 08:49:37 GMT"
+constexpr std::size_t HTTP_DATE_SIZE = 29;
+
+template<class Out>
+Out format_http_date(Out out, std::size_t size, std::time_t time) {
+    std::tm tm;
+    ::gmtime_r(&time, &tm);
+    return std::format_to_n(
+               out,
+               size,
+               "{}, {:02} {} {} {:02}:{:02}:{:02} GMT",
+               DAYS[tm.tm_wday],
+               tm.tm_mday,
+               MONTHS[tm.tm_mon],
+               tm.tm_year + 1900,
+               tm.tm_hour,
+               tm.tm_min,
+               tm.tm_sec
+    )
+        .out;
+}
+
+} // namespace
+
+std::string_view date_header() {
+    static constexpr std::string_view PREFIX = "Date: ";
+    struct DateCache {
+        std::time_t second = -1;
+        std::array<char, 64> line;
+        std::size_t size = 0;
+    };
+    thread_local DateCache cache;
+    auto now = std::time(nullptr);
+    if (now != cache.second) {
+        auto out = std::copy(PREFIX.begin(), PREFIX.end(), cache.line.data());
+        out = format_http_date(out, cache.line.size() - PREFIX.size() - 2, now);
+        *out++ = '\r';
+        *out++ = '\n';
+        cache.size = static_cast<std::size_t>(out - cache.line.data());
+        cache.second = now;
+    }
+    return { cache.line.data(), cache.size };
+}
+
+std::string http_date(std::time_t time) {
+    std::string date(HTTP_DATE_SIZE, '\0');
+    auto end = format_http_date(date.data(), date.size(), time);
+    date.resize(static_cast<std::size_t>(end - date.data()));
+    return date;
+}
+
+std::optional<std::time_t> parse_http_date(std::string_view date) {
+    // "Sun, 06 Nov 1994 08:49:37 GMT", the weekday is redundant and not checked
+    if (date.size() != HTTP_DATE_SIZE || date.substr(3, 2) != ", " || date[7] != ' ' || date[11] != ' '
+        || date[16] != ' ' || date[19] != ':' || date[22] != ':' || date.substr(25) != " GMT")
+    {
+        return std::nullopt;
+    }
+    auto number = [date](std::size_t pos, std::size_t size, int& value) {
+        auto [ptr, ec] = std::from_chars(date.data() + pos, date.data() + pos + size, value);
+        return ec == std::errc() && ptr == date.data() + pos + size;
+    };
+    std::tm tm {};
+    auto month = std::find(std::begin(MONTHS), std::end(MONTHS), date.substr(8, 3));
+    if (month == std::end(MONTHS) || !number(5, 2, tm.tm_mday) || !number(12, 4, tm.tm_year)
+        || !number(17, 2, tm.tm_hour) || !number(20, 2, tm.tm_min) || !number(23, 2, tm.tm_sec))
+    {
+        return std::nullopt;
+    }
+    tm.tm_mon = static_cast<int>(month - std::begin(MONTHS));
+    tm.tm_year -= 1900;
+    auto time = ::timegm(&tm);
+    if (time == -1) {
+        return std::nullopt;
+    }
+    return time;
+}
+
+std::size_t HttpResponseSerializer::serialize(const HttpResponse& res, struct iovec* iov) {
+    std::size_t count = 0;
+    m_head.clear();
+    auto code = res.status_code();
+    auto line = status_line(code);
+    auto& reason = res.reason();
+    if (line.empty() || (!reason.empty() && reason != reason_phrase(code) && reason != utils::dump_enum(code))) {
+        std::format_to(std::back_inserter(m_head), "HTTP/1.1 {} {}\r\n", static_cast<int>(code), reason);
+    } else {
+        iov[count++] = { const_cast<char*>(line.data()), line.size() };
+    }
+    if (!res.has_header("Date")) {
+        m_head.append(date_header());
+    }
+    for (auto& [key, value]: res.headers()) {
+        m_head.append(key);
+        m_head.append(": ");
+        m_head.append(value);
+        m_head.append("\r\n");
+    }
+    bool streamed = static_cast<bool>(res.body_producer());
+    bool file = res.body_file() != nullptr;
+    auto body = res.body_view();
+    if (!res.has_header("Content-Length")) {
+        if (streamed && !file) {
+            m_head.append("Transfer-Encoding: chunked\r\n");
+        } else if (file || !body.empty()) {
+            char size[24];
+            auto [ptr, ec] = std::to_chars(size, size + sizeof(size), file ? res.body_file_size() : body.size());
+            m_head.append("Content-Length: ");
+            m_head.append(size, ptr);
+            m_head.append("\r\n");
+        }
+    }
+    m_head.append("\r\n");
+    iov[count++] = { m_head.data(), m_head.size() };
+    if (!streamed && !file && !body.empty()) {
+        iov[count++] = { const_cast<char*>(body.data()), body.size() };
+    }
+    return count;
+}
+
 std::vector<uint8_t> HttpParser::write_req(const HttpRequest& req) {
     m_req_writer.reset_state();
     m_req_writer.begin_header(utils::dump_enum(req.method()), req.url());
@@ -256,38 +697,474 @@ std::vector<uint8_t> HttpParser::write_req(const HttpRequest& req) {
     return std::vector<uint8_t>(m_req_writer.buffer().begin(), m_req_writer.buffer().end());
 }
 
+std::vector<uint8_t> HttpParser::write_req_chunk(std::string_view body) {
+    m_req_writer.reset_state();
+    m_req_writer.write_chunk(body);
+    return std::vector<uint8_t>(m_req_writer.buffer().begin(), m_req_writer.buffer().end());
+}
+
+std::vector<uint8_t> HttpParser::write_req_last_chunk() {
+    m_req_writer.reset_state();
+    m_req_writer.write_last_chunk();
+    return std::vector<uint8_t>(m_req_writer.buffer().begin(), m_req_writer.buffer().end());
+}
+
 std::vector<uint8_t> HttpParser::write_res(const HttpResponse& res) {
-    m_res_writer.reset_state();
-    m_res_writer.begin_header(static_cast<int>(res.status_code()));
-    for (auto& [key, value]: res.headers()) {
-        m_res_writer.write_header(key, value);
+    std::array<struct iovec, HttpResponseSerializer::MAX_IOV> iov;
+    auto count = m_res_serializer.serialize(res, iov.data());
+    std::size_t size = 0;
+    for (std::size_t i = 0; i < count; i++) {
+        size += iov[i].iov_len;
     }
-    if (!res.body().empty() && !res.headers().contains("Content-Length")) {
-        m_res_writer.write_header("Content-Length", std::to_string(res.body().size()));
+    std::vector<uint8_t> data;
+    data.reserve(size);
+    for (std::size_t i = 0; i < count; i++) {
+        auto base = static_cast<const uint8_t*>(iov[i].iov_base);
+        data.insert(data.end(), base, base + iov[i].iov_len);
     }
-    m_res_writer.end_header();
-    m_res_writer.write_body(res.body());
+    return data;
+}
+
+std::vector<uint8_t> HttpParser::write_res_chunk(std::string_view body) {
+    m_res_writer.reset_state();
+    m_res_writer.write_chunk(body);
     return std::vector<uint8_t>(m_res_writer.buffer().begin(), m_res_writer.buffer().end());
 }
 
+std::vector<uint8_t> HttpParser::write_res_last_chunk(const std::unordered_map<std::string, std::string>& trailers) {
+    m_res_writer.reset_state();
+    m_res_writer.write_last_chunk(trailers);
+    return std::vector<uint8_t>(m_res_writer.buffer().begin(), m_res_writer.buffer().end());
+}
+
+template<class Parser>
+static std::unordered_map<std::string, std::string> decoded_headers(Parser& parser) {
+    auto headers = parser.headers();
+    if (parser.chunked()) {
+        // the body is handed out decoded, describe it the way it is now
+        headers.erase("transfer-encoding");
+        headers.insert_or_assign("content-length", std::to_string(parser.body().size()));
+        for (auto& [key, value]: parser.trailers()) {
+            headers.emplace(key, value);
+        }
+    }
+    return headers;
+}
+
 std::optional<HttpRequest> HttpParser::read_req() {
     if (m_req_parser.request_finished()) {
         HttpRequest req;
         req.set_method(m_req_parser.method())
             .set_url(m_req_parser.url())
             .set_version(m_req_parser.version())
-            .set_headers(m_req_parser.headers())
+            .set_headers(decoded_headers(m_req_parser))
             .set_body(m_req_parser.body());
         m_req_parser.reset_state();
-        add_req_read_buffer({});
+        add_req_read_buffer(PooledBuffer {});
         return req;
     }
     return std::nullopt;
 }
 
+template<class Parser>
+void HttpParser::feed(Parser& parser, std::string& pending, std::string_view data) {
+    if (parser.request_finished()) {
+        // the message is not taken yet, data belongs to the next one
+        pending.append(data);
+        return;
+    }
+    if (pending.empty()) {
+        pending.assign(data.substr(parser.push_chunk(data)));
+        return;
+    }
+    pending.append(data);
+    pending.erase(0, parser.push_chunk(pending));
+}
+
 void HttpParser::add_req_read_buffer(const std::vector<uint8_t>& buffer) {
-    m_req_read_buffer.insert(m_req_read_buffer.end(), buffer.begin(), buffer.end());
-    m_req_parser.push_chunk(m_req_read_buffer);
+    feed(m_req_parser, m_req_read_buffer, { reinterpret_cast<const char*>(buffer.data()), buffer.size() });
+}
+
+void HttpParser::add_req_read_buffer(const PooledBuffer& buffer) {
+    feed(m_req_parser, m_req_read_buffer, buffer.view());
+}
+
+HttpParser::ReadPhase HttpParser::req_phase() {
+    if (m_view_mode) {
+        return m_req_view_parser.phase();
+    }
+    if (m_req_parser.header_finished()) {
+        return m_req_parser.request_finished() ? ReadPhase::IDLE : ReadPhase::BODY;
+    }
+    return m_req_parser.headers_raw().empty() ? ReadPhase::IDLE : ReadPhase::HEADER;
+}
+
+void HttpParser::add_req_view_buffer(PooledBuffer&& buffer) {
+    m_view_mode = true;
+    m_req_view_parser.feed(std::move(buffer));
+}
+
+std::optional<HttpRequestView> HttpParser::read_req_view() {
+    return m_req_view_parser.next();
+}
+
+std::string_view HttpParser::req_view_pending() const {
+    return m_req_view_parser.pending();
+}
+
+std::optional<HttpRequestView> HttpParser::read_req_view_head() {
+    return m_req_view_parser.next_head();
+}
+
+void HttpParser::stream_req_view_body() {
+    m_req_view_parser.stream_body();
+}
+
+bool HttpParser::read_req_view_body(const std::function<void(std::string_view)>& on_data) {
+    return m_req_view_parser.read_body(on_data);
+}
+
+bool HttpParser::req_view_failed() const {
+    return m_req_view_parser.failed();
+}
+
+static std::string_view trim_whitespace(std::string_view value) {
+    while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) {
+        value.remove_prefix(1);
+    }
+    while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) {
+        value.remove_suffix(1);
+    }
+    return value;
+}
+
+HttpMethod HttpRequestView::method() const {
+    return m_method;
+}
+
+std::string_view HttpRequestView::url() const {
+    return m_url;
+}
+
+std::string_view HttpRequestView::path() const {
+    return url_path(m_url);
+}
+
+std::string_view HttpRequestView::query() const {
+    return url_query(m_url);
+}
+
+std::string_view HttpRequestView::param(std::string_view name) const {
+    return m_params.get(m_url, name);
+}
+
+const RouteParams& HttpRequestView::params() const {
+    return m_params;
+}
+
+void HttpRequestView::set_params(const RouteParams& params) {
+    m_params = params;
+}
+
+int HttpRequestView::remote_fd() const {
+    return m_remote_fd;
+}
+
+void HttpRequestView::set_remote_fd(int fd) {
+    m_remote_fd = fd;
+}
+
+std::string_view HttpRequestView::version() const {
+    return m_version;
+}
+
+std::string_view HttpRequestView::body() const {
+    return m_body;
+}
+
+std::string_view HttpRequestView::header(std::string_view key) const {
+    for (std::size_t i = 0; i < m_header_num; i++) {
+        if (iequals(m_headers[i].key, key)) {
+            return m_headers[i].value;
+        }
+    }
+    return {};
+}
+
+bool HttpRequestView::has_header(std::string_view key) const {
+    return std::any_of(headers_begin(), headers_end(), [key](const HttpHeaderView& header) {
+        return iequals(header.key, key);
+    });
+}
+
+const HttpHeaderView* HttpRequestView::headers_begin() const {
+    return m_headers.data();
+}
+
+const HttpHeaderView* HttpRequestView::headers_end() const {
+    return m_headers.data() + m_header_num;
+}
+
+HttpRequest HttpRequestView::to_request() const {
+    std::unordered_map<std::string, std::string> headers;
+    for (auto it = headers_begin(); it != headers_end(); ++it) {
+        std::string key(it->key);
+        std::transform(key.begin(), key.end(), key.begin(), [](char c) {
+            return 'A' <= c && c <= 'Z' ? static_cast<char>(c + 'a' - 'A') : c;
+        });
+        headers.emplace(std::move(key), std::string(it->value));
+    }
+    HttpRequest req;
+    req.set_method(m_method)
+        .set_url(std::string(m_url))
+        .set_version(std::string(m_version))
+        .set_headers(headers)
+        .set_body(std::string(m_body))
+        .set_params(m_params);
+    return req;
+}
+
+void HttpRequestViewParser::feed(PooledBuffer&& buffer) {
+    if (buffer.empty()) {
+        return;
+    }
+    if (m_begin == m_buffer.size()) {
+        // nothing pending, take the buffer as it is
+        m_buffer = std::move(buffer);
+        m_begin = 0;
+        return;
+    }
+    feed(buffer.view());
+}
+
+void HttpRequestViewParser::feed(std::string_view data) {
+    if (data.empty()) {
+        return;
+    }
+    auto pending = m_buffer.size() - m_begin;
+    if (m_begin != 0) {
+        // earlier requests may still look at the front of the block, the pending tail moves to a fresh one
+        PooledBuffer buffer(pending + data.size());
+        std::memcpy(buffer.tail(), m_buffer.data() + m_begin, pending);
+        buffer.commit(pending);
+        m_buffer = std::move(buffer);
+        m_begin = 0;
+    }
+    m_buffer.reserve(pending + data.size());
+    std::memcpy(m_buffer.tail(), data.data(), data.size());
+    m_buffer.commit(data.size());
+}
+
+bool HttpRequestViewParser::parse_head(std::string_view head) {
+    m_pending.m_header_num = 0;
+    auto line_end = simd::find_crlf(head);
+    auto request_line = head.substr(0, line_end);
+    auto first_space = request_line.find(' ');
+    auto second_space = request_line.find(' ', first_space + 1);
+    if (first_space == std::string_view::npos || second_space == std::string_view::npos) {
+        return false;
+    }
+    auto method = request_line.substr(0, first_space);
+    if (method.empty() || simd::find_invalid_token_char(method) != std::string_view::npos) {
+        return false;
+    }
+    m_pending.m_method = utils::parse_enum<HttpMethod>(method);
+    m_pending.m_url = request_line.substr(first_space + 1, second_space - first_space - 1);
+    m_pending.m_version = request_line.substr(second_space + 1);
+    while (line_end != std::string_view::npos) {
+        auto line_begin = line_end + 2;
+        line_end = simd::find_crlf(head, line_begin);
+        auto line = head.substr(line_begin, line_end == std::string_view::npos ? line_end : line_end - line_begin);
+        if (line.empty()) {
+            continue;
+        }
+        auto colon = simd::find_char(line, ':');
+        if (colon == std::string_view::npos || colon == 0 || m_pending.m_header_num == HttpRequestView::MAX_HEADERS) {
+            return false;
+        }
+        if (simd::find_invalid_token_char(line.substr(0, colon)) != std::string_view::npos) {
+            return false;
+        }
+        m_pending.m_headers[m_pending.m_header_num++] = { line.substr(0, colon),
+                                                          trim_whitespace(line.substr(colon + 1)) };
+    }
+    return true;
+}
+
+bool HttpRequestViewParser::locate_head() {
+    if (m_head_size != 0) {
+        return true;
+    }
+    std::string_view data = m_buffer.view().substr(m_begin);
+    // only the last 3 bytes already searched can be part of the blank line
+    auto from = m_scanned > 3 ? m_scanned - 3 : 0;
+    auto end = simd::find_header_end(data, from);
+    if (end == std::string_view::npos) {
+        m_scanned = data.size();
+        if (data.size() > MAX_HEADER_SIZE) {
+            m_failed = true;
+        }
+        return false;
+    }
+    m_head_size = end + 4;
+    if (!parse_head(data.substr(0, end))) {
+        m_failed = true;
+        return false;
+    }
+    m_pending_base = m_buffer.data();
+    m_content_length = 0;
+    auto content_length = m_pending.header("Content-Length");
+    auto transfer_encoding = m_pending.header("Transfer-Encoding");
+    if (!transfer_encoding.empty()) {
+        // without chunked as the final coding the end of the body can't be told
+        auto last = transfer_encoding.substr(transfer_encoding.find_last_of(',') + 1);
+        if (!iequals(trim_whitespace(last), "chunked")) {
+            m_failed = true;
+            return false;
+        }
+        m_chunked = true;
+        m_chunked_decoder.reset();
+        m_chunked_raw = 0;
+        m_chunked_body = 0;
+    } else if (!content_length.empty()) {
+        auto [ptr, ec] =
+            std::from_chars(content_length.data(), content_length.data() + content_length.size(), m_content_length);
+        if (ec != std::errc() || ptr != content_length.data() + content_length.size()) {
+            m_failed = true;
+            return false;
+        }
+    }
+    return true;
+}
+
+void HttpRequestViewParser::finish_request() {
+    m_scanned = 0;
+    m_head_size = 0;
+    m_content_length = 0;
+    m_chunked = false;
+    m_pending_base = nullptr;
+    m_head_reported = false;
+    m_streaming = false;
+    if (m_begin == m_buffer.size()) {
+        // all consumed, the block now belongs to the requests handed out alone
+        m_buffer = PooledBuffer {};
+        m_begin = 0;
+    }
+}
+
+std::optional<HttpRequestView> HttpRequestViewParser::next() {
+    if (m_failed || m_streaming || !locate_head()) {
+        return std::nullopt;
+    }
+    std::string_view data = m_buffer.view().substr(m_begin);
+    std::size_t body_size = m_content_length;
+    std::size_t raw_size = m_content_length;
+    if (m_chunked) {
+        // nothing behind m_begin is shared yet, so the chunk data can be moved down over the framing
+        auto* body = m_buffer.data() + m_begin + m_head_size;
+        auto consumed = m_chunked_decoder.decode(
+            data.substr(m_head_size + m_chunked_raw),
+            [this, body](std::string_view chunk) {
+                std::memmove(body + m_chunked_body, chunk.data(), chunk.size());
+                m_chunked_body += chunk.size();
+            },
+            [](std::string_view, std::string_view) {}
+        );
+        m_chunked_raw += consumed;
+        if (m_chunked_decoder.failed()) {
+            m_failed = true;
+            return std::nullopt;
+        }
+        if (!m_chunked_decoder.finished()) {
+            return std::nullopt;
+        }
+        body_size = m_chunked_body;
+        raw_size = m_chunked_raw;
+    } else if (data.size() - m_head_size < m_content_length) {
+        return std::nullopt;
+    }
+    if (m_pending_base != m_buffer.data()) {
+        // the buffer grew while the body came in
+        parse_head(data.substr(0, m_head_size - 4));
+    }
+    m_pending.m_body = data.substr(m_head_size, body_size);
+    m_pending.m_buffer = m_buffer;
+    HttpRequestView req = std::move(m_pending);
+    m_pending = HttpRequestView {};
+
+    m_begin += m_head_size + raw_size;
+    finish_request();
+    return req;
+}
+
+std::optional<HttpRequestView> HttpRequestViewParser::next_head() {
+    if (m_failed || m_streaming || m_head_reported || !locate_head()) {
+        return std::nullopt;
+    }
+    m_head_reported = true;
+    if (m_pending_base != m_buffer.data()) {
+        parse_head(m_buffer.view().substr(m_begin, m_head_size - 4));
+        m_pending_base = m_buffer.data();
+    }
+    HttpRequestView head = m_pending;
+    head.m_buffer = m_buffer;
+    return head;
+}
+
+void HttpRequestViewParser::stream_body() {
+    assert(m_head_size != 0 && !m_streaming && "No request head to stream the body of");
+    m_streaming = true;
+    m_begin += m_head_size;
+    m_head_size = 0;
+    m_pending = HttpRequestView {};
+    m_pending_base = nullptr;
+}
+
+bool HttpRequestViewParser::read_body(const std::function<void(std::string_view)>& on_data) {
+    if (m_failed || !m_streaming) {
+        return false;
+    }
+    std::string_view data = m_buffer.view().substr(m_begin);
+    bool finished;
+    if (m_chunked) {
+        m_begin += m_chunked_decoder.decode(data, on_data, [](std::string_view, std::string_view) {});
+        if (m_chunked_decoder.failed()) {
+            m_failed = true;
+            return false;
+        }
+        finished = m_chunked_decoder.finished();
+    } else {
+        auto size = std::min(data.size(), m_content_length);
+        if (size != 0) {
+            on_data(data.substr(0, size));
+        }
+        m_begin += size;
+        m_content_length -= size;
+        finished = m_content_length == 0;
+    }
+    if (finished) {
+        finish_request();
+    } else if (m_begin == m_buffer.size()) {
+        // handed over already, no need to keep the block around until the next bytes arrive
+        m_buffer = PooledBuffer {};
+        m_begin = 0;
+    }
+    return finished;
+}
+
+bool HttpRequestViewParser::failed() const {
+    return m_failed;
+}
+
+HttpReadPhase HttpRequestViewParser::phase() const {
+    if (m_head_size != 0 || m_streaming) {
+        return HttpReadPhase::BODY;
+    }
+    return m_begin == m_buffer.size() ? HttpReadPhase::IDLE : HttpReadPhase::HEADER;
+}
+
+std::string_view HttpRequestViewParser::pending() const {
+    return m_buffer.view().substr(m_begin);
 }
 
 std::optional<HttpResponse> HttpParser::read_res() {
@@ -296,18 +1173,50 @@ std::optional<HttpResponse> HttpParser::read_res() {
         res.set_version(m_res_parser.version())
             .set_status_code(static_cast<HttpResponseCode>(m_res_parser.status()))
             .set_reason(std::string(utils::dump_enum(res.status_code())))
-            .set_headers(m_res_parser.headers())
+            .set_headers(decoded_headers(m_res_parser))
             .set_body(m_res_parser.body());
         m_res_parser.reset_state();
-        add_res_read_buffer({});
+        add_res_read_buffer(PooledBuffer {});
         return res;
     }
     return std::nullopt;
 }
 
+std::optional<HttpResponse> HttpParser::read_res_head() {
+    if (m_res_head_reported || !m_res_parser.header_finished()) {
+        return std::nullopt;
+    }
+    m_res_head_reported = true;
+    HttpResponse res;
+    res.set_version(m_res_parser.version())
+        .set_status_code(static_cast<HttpResponseCode>(m_res_parser.status()))
+        .set_reason(std::string(utils::dump_enum(res.status_code())))
+        .set_headers(m_res_parser.headers());
+    return res;
+}
+
+bool HttpParser::read_res_body(std::string& piece) {
+    piece = m_res_parser.read_some_body();
+    if (!m_res_parser.request_finished()) {
+        return false;
+    }
+    m_res_parser.reset_state();
+    m_res_head_reported = false;
+    // bytes of the next response may be waiting behind the body
+    add_res_read_buffer(PooledBuffer {});
+    return true;
+}
+
+bool HttpParser::res_failed() const {
+    return m_res_parser.failed();
+}
+
 void HttpParser::add_res_read_buffer(const std::vector<uint8_t>& buffer) {
-    m_res_read_buffer.insert(m_res_read_buffer.end(), buffer.begin(), buffer.end());
-    m_res_parser.push_chunk(m_res_read_buffer);
+    feed(m_res_parser, m_res_read_buffer, { reinterpret_cast<const char*>(buffer.data()), buffer.size() });
+}
+
+void HttpParser::add_res_read_buffer(const PooledBuffer& buffer) {
+    feed(m_res_parser, m_res_read_buffer, buffer.view());
 }
 
 } // namespace net
\ No newline at end of file
@@ -1,10 +1,13 @@
 #include "http_server.hpp"
+#include "defines.hpp"
 #include "enum_parser.hpp"
 #include "event_loop.hpp"
+#include "http2.hpp"
 #include "http_parser.hpp"
 #include "remote_target.hpp"
 #include "ssl.hpp"
 #include "timer.hpp"
+#include <algorithm>
 #include <cassert>
 #include <format>
 #include <functional>
@@ -12,15 +15,51 @@
 #include <iostream>
 #include <memory>
 #include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <optional>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <sys/socket.h>
 #include <unistd.h>
 #include <utility>
 
 namespace net {
 
+namespace {
+
+    /**
+     * @return true if the comma separated list holds token, compared case insensitively
+     */
+    bool has_token(std::string_view list, std::string_view token) {
+        while (!list.empty()) {
+            auto comma = list.find(',');
+            auto item = list.substr(0, comma);
+            list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+            while (!item.empty() && (item.front() == ' ' || item.front() == '\t')) {
+                item.remove_prefix(1);
+            }
+            while (!item.empty() && (item.back() == ' ' || item.back() == '\t')) {
+                item.remove_suffix(1);
+            }
+            if (iequals(item, token)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief send small writes right away, a HTTP/2 peer may be waiting on a WINDOW_UPDATE or an ACK in them
+     */
+    void disable_nagle(int fd) {
+        int enable = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    }
+
+} // namespace
+
 HttpServer::HttpServer(const std::string& ip, const std::string& service, std::shared_ptr<SSLContext> ctx):
     m_handlers {
         { HttpMethod::GET, m_get_handlers },        { HttpMethod::POST, m_post_handlers },
@@ -30,6 +69,7 @@ HttpServer::HttpServer(const std::string& ip, const std::string& service, std::s
         { HttpMethod::HEAD, m_head_handler },
     } {
     if (ctx) {
+        m_ssl_ctx = ctx;
         m_server = std::make_shared<SSLServer>(ctx, ip, service);
     } else {
         m_server = std::make_shared<TcpServer>(ip, service);
@@ -38,39 +78,81 @@ HttpServer::HttpServer(const std::string& ip, const std::string& service, std::s
 }
 
 void HttpServer::get(const std::string path, std::function<HttpResponse(const HttpRequest&)> handler) {
-    m_handlers.at(HttpMethod::GET).insert_or_assign(path, handler);
+    m_handlers.at(HttpMethod::GET).insert(path, handler);
 }
 
 void HttpServer::post(const std::string path, std::function<HttpResponse(const HttpRequest&)> handler) {
-    m_handlers.at(HttpMethod::POST).insert_or_assign(path, handler);
+    m_handlers.at(HttpMethod::POST).insert(path, handler);
 }
 
 void HttpServer::put(const std::string path, std::function<HttpResponse(const HttpRequest&)> handler) {
-    m_handlers.at(HttpMethod::PUT).insert_or_assign(path, handler);
+    m_handlers.at(HttpMethod::PUT).insert(path, handler);
 }
 
 void HttpServer::del(const std::string path, std::function<HttpResponse(const HttpRequest&)> handler) {
-    m_handlers.at(HttpMethod::DELETE).insert_or_assign(path, handler);
+    m_handlers.at(HttpMethod::DELETE).insert(path, handler);
 }
 
 void HttpServer::head(const std::string path, std::function<HttpResponse(const HttpRequest&)> handler) {
-    m_handlers.at(HttpMethod::HEAD).insert_or_assign(path, handler);
+    m_handlers.at(HttpMethod::HEAD).insert(path, handler);
 }
 
 void HttpServer::trace(const std::string path, std::function<HttpResponse(const HttpRequest&)> handler) {
-    m_handlers.at(HttpMethod::TRACE).insert_or_assign(path, handler);
+    m_handlers.at(HttpMethod::TRACE).insert(path, handler);
 }
 
 void HttpServer::connect(const std::string path, std::function<HttpResponse(const HttpRequest&)> handler) {
-    m_handlers.at(HttpMethod::CONNECT).insert_or_assign(path, handler);
+    m_handlers.at(HttpMethod::CONNECT).insert(path, handler);
 }
 
 void HttpServer::options(const std::string path, std::function<HttpResponse(const HttpRequest&)> handler) {
-    m_handlers.at(HttpMethod::OPTIONS).insert_or_assign(path, handler);
+    m_handlers.at(HttpMethod::OPTIONS).insert(path, handler);
 }
 
 void HttpServer::patch(const std::string path, std::function<HttpResponse(const HttpRequest&)> handler) {
-    m_handlers.at(HttpMethod::PATCH).insert_or_assign(path, handler);
+    m_handlers.at(HttpMethod::PATCH).insert(path, handler);
+}
+
+void HttpServer::route(
+    HttpMethod method,
+    const std::string path,
+    std::function<HttpResponse(const HttpRequestView&)> handler
+) {
+    assert(m_handlers.contains(method) && "Unsupported http method");
+    m_view_handlers[method].insert(path, handler);
+}
+
+void HttpServer::serve_static(const std::string& url_prefix, const std::string& root, StaticFileOptions options) {
+    auto files = std::make_shared<StaticFiles>(root, std::move(options));
+    auto prefix = url_prefix;
+    while (!prefix.empty() && prefix.back() == '/') {
+        prefix.pop_back();
+    }
+    auto handler = [files](const HttpRequestView& request) {
+        return files->serve(request, request.param("path"));
+    };
+    route(HttpMethod::GET, prefix + "/*path", handler);
+    route(HttpMethod::HEAD, prefix + "/*path", handler);
+}
+
+void HttpServer::enable_compression(CompressionOptions options) {
+    m_compressor = std::make_shared<ResponseCompressor>(std::move(options));
+}
+
+void HttpServer::enable_http2(Http2Options options) {
+    m_http2_options = options;
+    if (m_ssl_ctx) {
+        m_ssl_ctx->set_alpn_protocols({ "h2", "http/1.1" });
+    }
+}
+
+void HttpServer::route_stream(
+    HttpMethod method,
+    const std::string path,
+    std::function<HttpBodyReader::SharedPtr(const HttpRequestView& head)> on_head
+) {
+    assert(m_handlers.contains(method) && "Unsupported http method");
+    m_stream_handlers[method].insert(path, on_head);
 }
 
 std::optional<NetError> HttpServer::listen() {
@@ -105,102 +187,649 @@ void HttpServer::add_error_handler(HttpResponseCode err_code, std::function<Http
     m_error_handlers[err_code] = handler;
 }
 
-void HttpServer::enable_thread_pool(std::size_t worker_num) {
-    m_server->enable_thread_pool(worker_num);
+void HttpServer::enable_thread_pool(std::size_t worker_num, utils::ThreadPoolMode mode) {
+    m_server->enable_thread_pool(worker_num, mode);
+}
+
+std::optional<NetError>
+HttpServer::enable_event_loop(EventLoopType type, std::size_t reactor_num, std::size_t max_events, bool adaptive) {
+    return m_server->enable_event_loop(type, -1, reactor_num, max_events, adaptive);
 }
 
-std::optional<NetError> HttpServer::enable_event_loop(EventLoopType type) {
-    return m_server->enable_event_loop(type);
+std::vector<EventLoopStats> HttpServer::event_loop_stats() const {
+    return m_server->event_loop_stats();
 }
 
 void HttpServer::set_logger(const utils::LoggerManager::Logger& logger) {
     m_server->set_logger(logger);
 }
 
+void HttpServer::set_idle_timeout(std::chrono::milliseconds idle_timeout) {
+    m_server->set_idle_timeout(idle_timeout);
+}
+
+void HttpServer::set_keep_alive_timeout(std::chrono::milliseconds keep_alive_timeout) {
+    m_keep_alive_timeout = keep_alive_timeout;
+}
+
+void HttpServer::set_header_timeout(std::chrono::milliseconds header_timeout) {
+    m_header_timeout = header_timeout;
+}
+
+void HttpServer::set_body_timeout(std::chrono::milliseconds body_timeout) {
+    m_body_timeout = body_timeout;
+}
+
+void HttpServer::set_max_requests_per_connection(std::size_t max_requests) {
+    m_max_requests = max_requests;
+}
+
+HttpResponse HttpServer::error_response(HttpResponseCode code, const HttpRequestView& request) {
+    if (m_error_handlers.find(code) != m_error_handlers.end()) {
+        return m_error_handlers.at(code)(request.to_request());
+    }
+    HttpResponse response;
+    response.set_version(HTTP_VERSION_1_1)
+        .set_status_code(code)
+        .set_reason(std::string(utils::dump_enum(code)))
+        .set_header("Content-Length", "0");
+    return response;
+}
+
+HttpResponse HttpServer::handle_request(HttpRequestView& request) {
+    auto method = request.method();
+    auto path = request.path();
+    // if method is wrong
+    if (m_handlers.find(method) == m_handlers.end()) {
+        return error_response(HttpResponseCode::METHOD_NOT_ALLOWED, request);
+    }
+    try {
+        RouteParams params;
+        auto view_handlers = m_view_handlers.find(method);
+        if (view_handlers != m_view_handlers.end()) {
+            if (auto handler = view_handlers->second.match(path, params)) {
+                request.set_params(params);
+                return (*handler)(request);
+            }
+        }
+        auto handler = m_handlers.at(method).match(path, params);
+        // if method is correct but path is wrong
+        if (handler == nullptr) {
+            return error_response(HttpResponseCode::NOT_FOUND, request);
+        }
+        request.set_params(params);
+        return (*handler)(request.to_request());
+    } catch (const HttpResponseCode& e) {
+        return error_response(e, request);
+    }
+}
+
 void HttpServer::set_handler() {
     auto handler_thread_func = [this](RemoteTarget::SharedPtr remote) {
+        std::shared_ptr<HttpParser> parser;
         {
             std::lock_guard<std::mutex> lock_guard(m_parsers_mutex);
             if (!m_parsers.contains(remote->fd())) {
                 m_parsers.insert({ remote->fd(), std::make_shared<HttpParser>() });
             }
+            // copied, an expired deadline may erase the parser while this request is handled
+            parser = m_parsers.at(remote->fd());
         }
-        auto& parser = m_parsers.at(remote->fd());
-        // parse request
-        std::vector<uint8_t> req(1024);
-        std::vector<uint8_t> res;
-        auto err = m_server->read(req, remote);
-        if (err.has_value()) {
-            std::cerr << std::format("Failed to read from socket: {}\n", err.value().msg) << std::endl;
-            erase_parser(remote->fd());
-            return;
-        }
-        std::optional<HttpRequest> req_opt;
-        parser->add_req_read_buffer(req);
+        // taken in bounded pieces, a streamed body is handed on piece by piece instead of piling up in one buffer
         while (true) {
-            req_opt = parser->read_req();
-            if (!req_opt.has_value()) {
-                break;
+            PooledBuffer req;
+            auto err = m_server->read(req, remote, READ_SIZE);
+            if (err.has_value()) {
+                std::cerr << std::format("Failed to read from socket: {}\n", err.value().msg) << std::endl;
+                erase_parser(remote->fd());
+                return;
             }
-            auto& request = req_opt.value();
-            HttpResponse response;
-            auto method = request.method();
-            auto path = request.url();
-
-            std::function<HttpResponse(const HttpRequest&)> handler;
-            // if method is wrong
-            if (m_handlers.find(method) == m_handlers.end()) {
-                if (m_error_handlers.find(HttpResponseCode::METHOD_NOT_ALLOWED) != m_error_handlers.end()) {
-                    response = m_error_handlers.at(HttpResponseCode::METHOD_NOT_ALLOWED)(request);
-                } else {
-                    response.set_version(HTTP_VERSION_1_1)
-                        .set_status_code(HttpResponseCode::METHOD_NOT_ALLOWED)
-                        .set_reason(std::string(utils::dump_enum(HttpResponseCode::METHOD_NOT_ALLOWED)))
-                        .set_header("Content-Length", "0");
-                }
-            } else {
-                // if method is correct but path is wrong
-                if (m_handlers.at(method).find(path) == m_handlers.at(method).end()) {
-                    if (m_error_handlers.find(HttpResponseCode::NOT_FOUND) != m_error_handlers.end()) {
-                        response = m_error_handlers.at(HttpResponseCode::NOT_FOUND)(request);
-                    } else {
-                        response.set_version(HTTP_VERSION_1_1)
-                            .set_status_code(HttpResponseCode::NOT_FOUND)
-                            .set_reason(std::string(utils::dump_enum(HttpResponseCode::NOT_FOUND)))
-                            .set_header("Content-Length", "0");
-                    }
-                } else {
-                    // if method and path are correct
-                    handler = m_handlers.at(method).at(path);
-                    try {
-                        response = handler(request);
-                    } catch (const HttpResponseCode& e) {
-                        if (m_error_handlers.find(e) != m_error_handlers.end()) {
-                            response = m_error_handlers.at(e)(request);
-                        } else {
-                            response.set_version(HTTP_VERSION_1_1)
-                                .set_status_code(e)
-                                .set_reason(std::string(utils::dump_enum(e)))
-                                .set_header("Content-Length", "0");
-                        }
+            if (req.empty()) {
+                return;
+            }
+            bool drained = req.size() < READ_SIZE;
+            if (m_http2_options.has_value()) {
+                if (auto session = http2_session(remote, parser, req.view())) {
+                    if (!serve_http2(remote, session, req.view()) || drained) {
+                        return;
                     }
+                    continue;
                 }
             }
-
-            // write response to socket
-            auto res = parser->write_res(response);
-            auto err = m_server->write(res, remote);
-            if (err.has_value()) {
-                std::cerr << std::format("Failed to write to socket: {}\n", err.value().msg);
-                erase_parser(remote->fd());
-                break;
+            // the parser keeps the received bytes, requests refer to them instead of copying
+            parser->add_req_view_buffer(std::move(req));
+            bool streaming;
+            {
+                std::lock_guard<std::mutex> lock_guard(m_parsers_mutex);
+                auto current = m_parsers.find(remote->fd());
+                if (current == m_parsers.end() || current->second != parser) {
+                    // closed by the last response
+                    return;
+                }
+                auto state = m_connections.find(remote->fd());
+                streaming = state != m_connections.end() && state->second.m_streaming;
+            }
+            // pipelined behind a streamed response, served once its body is out
+            if (!streaming) {
+                serve_requests(remote, parser);
+            }
+            if (drained) {
+                return;
             }
-        };
+        }
     };
     m_server->on_start(handler_thread_func);
     m_server->on_read(handler_thread_func);
+    m_server->on_low_watermark([this](RemoteTarget::SharedPtr remote) { resume_stream(remote); });
+    // a connection closed by the socket layer (idle timeout, peer reset) leaves its parser behind, the next
+    // connection reusing the fd must not inherit it
+    m_server->on_accept([this](RemoteTarget::SharedPtr remote) { erase_parser(remote->fd()); });
 };
 
+void HttpServer::serve_requests(RemoteTarget::SharedPtr remote, std::shared_ptr<HttpParser> parser) {
+    ResponseBatch batch;
+    while (true) {
+        bool reading_body;
+        {
+            std::lock_guard<std::mutex> lock_guard(m_parsers_mutex);
+            auto state = m_connections.find(remote->fd());
+            reading_body = state != m_connections.end() && state->second.m_body_reader != nullptr;
+        }
+        if (reading_body) {
+            if (!read_streamed_body(remote, parser, batch)) {
+                break;
+            }
+            continue;
+        }
+        if (!m_stream_handlers.empty() && open_body_reader(remote, parser, batch)) {
+            continue;
+        }
+        auto req_opt = parser->read_req_view();
+        if (!req_opt.has_value()) {
+            if (parser->req_view_failed() && flush_responses(remote, batch)) {
+                reject_request(remote, parser);
+                return;
+            }
+            break;
+        }
+        auto& request = req_opt.value();
+        request.set_remote_fd(remote->fd());
+        if (m_http2_options.has_value() && m_ssl_ctx == nullptr && request.has_header("HTTP2-Settings")
+            && has_token(request.header("Upgrade"), "h2c"))
+        {
+            // the switch must not overtake the responses queued so far
+            if (!flush_responses(remote, batch)) {
+                return;
+            }
+            if (upgrade_http2(remote, parser, request)) {
+                return;
+            }
+        }
+        auto close_requested = has_token(request.header("Connection"), "close");
+        auto response = handle_request(request);
+        if (m_compressor) {
+            m_compressor->apply(request.header("Accept-Encoding"), response);
+        }
+        if (!send_response(remote, parser, request.method(), std::move(response), close_requested, &batch)) {
+            return;
+        }
+    };
+    if (!flush_responses(remote, batch)) {
+        return;
+    }
+    update_deadline(remote, parser->req_phase());
+}
+
+bool HttpServer::open_body_reader(
+    RemoteTarget::SharedPtr remote,
+    std::shared_ptr<HttpParser> parser,
+    ResponseBatch& batch
+) {
+    auto head = parser->read_req_view_head();
+    if (!head.has_value()) {
+        return false;
+    }
+    auto handlers = m_stream_handlers.find(head->method());
+    if (handlers == m_stream_handlers.end()) {
+        return false;
+    }
+    RouteParams params;
+    auto on_head = handlers->second.match(head->path(), params);
+    if (on_head == nullptr) {
+        return false;
+    }
+    head->set_params(params);
+    head->set_remote_fd(remote->fd());
+    HttpBodyReader::SharedPtr reader;
+    try {
+        reader = (*on_head)(head.value());
+    } catch (const HttpResponseCode& e) {
+        // the body is still on its way, the connection can't be reused
+        parser->stream_req_view_body();
+        send_response(remote, parser, head->method(), error_response(e, head.value()), true, &batch);
+        return false;
+    }
+    if (reader == nullptr) {
+        return false;
+    }
+    parser->stream_req_view_body();
+    std::lock_guard<std::mutex> lock_guard(m_parsers_mutex);
+    auto& state = m_connections[remote->fd()];
+    state.m_body_reader = std::move(reader);
+    state.m_body_head = std::move(head.value());
+    return true;
+}
+
+bool HttpServer::read_streamed_body(
+    RemoteTarget::SharedPtr remote,
+    std::shared_ptr<HttpParser> parser,
+    ResponseBatch& batch
+) {
+    HttpBodyReader::SharedPtr reader;
+    HttpRequestView head;
+    {
+        std::lock_guard<std::mutex> lock_guard(m_parsers_mutex);
+        auto& state = m_connections[remote->fd()];
+        reader = state.m_body_reader;
+        head = state.m_body_head;
+    }
+    HttpResponse response;
+    bool body_complete = false;
+    try {
+        body_complete = parser->read_req_view_body(reader->m_on_data);
+        if (!body_complete) {
+            if (parser->req_view_failed() && flush_responses(remote, batch)) {
+                reject_request(remote, parser);
+            }
+            return false;
+        }
+        response = reader->m_on_end();
+    } catch (const HttpResponseCode& e) {
+        // given up halfway through the body, the rest of it can't be told apart from the next request
+        response = error_response(e, head);
+    }
+    {
+        std::lock_guard<std::mutex> lock_guard(m_parsers_mutex);
+        auto& state = m_connections[remote->fd()];
+        state.m_body_reader.reset();
+        state.m_body_head = HttpRequestView {};
+    }
+    if (m_compressor) {
+        m_compressor->apply(head.header("Accept-Encoding"), response);
+    }
+    auto close_requested = !body_complete || has_token(head.header("Connection"), "close");
+    return send_response(remote, parser, head.method(), std::move(response), close_requested, &batch);
+}
+
+void HttpServer::reject_request(RemoteTarget::SharedPtr remote, std::shared_ptr<HttpParser> parser) {
+    HttpResponse response;
+    response.set_version(HTTP_VERSION_1_1)
+        .set_status_code(HttpResponseCode::BAD_REQUEST)
+        .set_reason(std::string(utils::dump_enum(HttpResponseCode::BAD_REQUEST)))
+        .set_header("Content-Length", "0")
+        .set_header("Connection", "close");
+    m_server->write(parser->write_res(response), remote);
+    erase_parser(remote->fd());
+    m_server->close_remote(remote);
+}
+
+bool HttpServer::send_response(
+    RemoteTarget::SharedPtr remote,
+    std::shared_ptr<HttpParser> parser,
+    HttpMethod method,
+    HttpResponse response,
+    bool close_requested,
+    ResponseBatch* batch
+) {
+    bool close_connection = count_request(remote, close_requested);
+    if (close_connection) {
+        response.set_header("Connection", "close");
+    }
+    if (method == HttpMethod::HEAD && !response.body_view().empty()) {
+        // the head announces the body it would have carried
+        if (!response.has_header("Content-Length")) {
+            response.set_header("Content-Length", std::to_string(response.body_view().size()));
+        }
+        response.set_body("");
+    }
+    bool stream_body = (response.body_producer() || response.body_file()) && method != HttpMethod::HEAD;
+    if (stream_body) {
+        std::lock_guard<std::mutex> lock_guard(m_parsers_mutex);
+        m_connections[remote->fd()].m_streaming = true;
+        // the body may take longer than any read deadline
+        cancel_deadline(remote->fd());
+    }
+    auto producer = response.body_producer();
+    auto file = response.body_file();
+    auto file_offset = response.body_file_offset();
+    auto file_size = response.body_file_size();
+    bool chunked = file == nullptr && !response.has_header("Content-Length");
+    // write response to socket
+    if (batch != nullptr) {
+        batch->m_responses.push_back(std::move(response));
+        // neither a streamed body nor closing the connection may overtake the queued responses
+        if ((stream_body || close_connection) && !flush_responses(remote, *batch)) {
+            return false;
+        }
+    } else {
+        auto res = parser->write_res(response);
+        auto err = m_server->write(res, remote);
+        if (err.has_value()) {
+            std::cerr << std::format("Failed to write to socket: {}\n", err.value().msg);
+            erase_parser(remote->fd());
+            return false;
+        }
+    }
+    if (stream_body) {
+        auto stream = std::make_shared<ResponseStream>(ResponseStream {
+            std::move(producer),
+            parser,
+            chunked,
+            close_connection,
+            std::move(file),
+            file_offset,
+            file_size,
+        });
+        return pump_stream(remote, stream);
+    }
+    if (close_connection) {
+        erase_parser(remote->fd());
+        m_server->close_remote(remote);
+        return false;
+    }
+    return true;
+}
+
+bool HttpServer::flush_responses(RemoteTarget::SharedPtr remote, ResponseBatch& batch) {
+    if (batch.m_responses.empty()) {
+        return true;
+    }
+    auto size = batch.m_responses.size();
+    if (batch.m_serializers.size() < size) {
+        batch.m_serializers.resize(size);
+    }
+    batch.m_iov.resize(size * HttpResponseSerializer::MAX_IOV);
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < size; i++) {
+        count += batch.m_serializers[i].serialize(batch.m_responses[i], batch.m_iov.data() + count);
+    }
+    auto err = m_server->writev(batch.m_iov.data(), count, remote);
+    batch.m_responses.clear();
+    if (err.has_value()) {
+        std::cerr << std::format("Failed to write to socket: {}\n", err.value().msg);
+        erase_parser(remote->fd());
+        return false;
+    }
+    return true;
+}
+
+bool HttpServer::pump_stream(RemoteTarget::SharedPtr remote, std::shared_ptr<ResponseStream> stream) {
+    auto above_high_watermark = [&remote]() {
+        auto& output = remote->output_buffer();
+        std::lock_guard<std::mutex> lock_guard(output.mutex());
+        return output.m_above_high_watermark;
+    };
+    // park the stream until the output drains, returns true if it may go on right away
+    auto park = [&]() {
+        {
+            std::lock_guard<std::mutex> lock_guard(m_parsers_mutex);
+            auto state = m_connections.find(remote->fd());
+            if (!m_parsers.contains(remote->fd()) || state == m_connections.end()) {
+                return false;
+            }
+            state->second.m_parked_stream = stream;
+        }
+        // the output may have drained before the stream was parked, whoever takes it back goes on
+        if (above_high_watermark()) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock_guard(m_parsers_mutex);
+        auto state = m_connections.find(remote->fd());
+        if (state == m_connections.end() || state->second.m_parked_stream != stream) {
+            return false;
+        }
+        state->second.m_parked_stream.reset();
+        return true;
+    };
+    while (stream->m_file != nullptr && stream->m_file_size > 0) {
+        if (above_high_watermark() && !park()) {
+            return false;
+        }
+        auto offset = stream->m_file_offset;
+        auto err = m_server->send_file(*stream->m_file, stream->m_file_offset, stream->m_file_size, remote);
+        stream->m_file_size -= static_cast<std::size_t>(stream->m_file_offset - offset);
+        if (err.has_value()) {
+            std::cerr << std::format("Failed to send file to socket: {}\n", err.value().msg);
+            erase_parser(remote->fd());
+            if (err->error_code == NET_FILE_TRUNCATED_CODE) {
+                // the connection is fine but the promised length can't be kept
+                m_server->close_remote(remote);
+            }
+            return false;
+        }
+    }
+    std::string chunk;
+    bool more = static_cast<bool>(stream->m_producer);
+    while (more) {
+        if (above_high_watermark() && !park()) {
+            return false;
+        }
+        chunk.clear();
+        try {
+            more = stream->m_producer(chunk);
+        } catch (const std::exception& e) {
+            // half a body is out already, the only way to tell the client is to drop the connection
+            std::cerr << std::format("Response body producer failed: {}\n", e.what());
+            erase_parser(remote->fd());
+            m_server->close_remote(remote);
+            return false;
+        }
+        std::vector<uint8_t> data;
+        if (stream->m_chunked) {
+            data = stream->m_parser->write_res_chunk(chunk);
+            if (!more) {
+                auto last = stream->m_parser->write_res_last_chunk();
+                data.insert(data.end(), last.begin(), last.end());
+            }
+        } else {
+            data.assign(chunk.begin(), chunk.end());
+        }
+        if (data.empty()) {
+            continue;
+        }
+        auto err = m_server->write(data, remote);
+        if (err.has_value()) {
+            std::cerr << std::format("Failed to write to socket: {}\n", err.value().msg);
+            erase_parser(remote->fd());
+            return false;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock_guard(m_parsers_mutex);
+        auto state = m_connections.find(remote->fd());
+        if (state != m_connections.end()) {
+            state->second.m_streaming = false;
+        }
+    }
+    if (stream->m_close) {
+        erase_parser(remote->fd());
+        m_server->close_remote(remote);
+        return false;
+    }
+    return true;
+}
+
+void HttpServer::resume_stream(RemoteTarget::SharedPtr remote) {
+    std::shared_ptr<ResponseStream> stream;
+    std::shared_ptr<Http2Session> session;
+    {
+        std::lock_guard<std::mutex> lock_guard(m_parsers_mutex);
+        auto state = m_connections.find(remote->fd());
+        if (state == m_connections.end()) {
+            return;
+        }
+        session = state->second.m_http2;
+        if (session == nullptr) {
+            if (state->second.m_parked_stream == nullptr) {
+                return;
+            }
+            stream = std::move(state->second.m_parked_stream);
+        }
+    }
+    if (session != nullptr) {
+        // bodies held back by the watermark go on, the session keeps track of them itself
+        std::lock_guard<std::mutex> lock_guard(session->m_mutex);
+        flush_http2(remote, *session);
+        return;
+    }
+    if (pump_stream(remote, stream)) {
+        // requests which arrived meanwhile
+        serve_requests(remote, stream->m_parser);
+    }
+}
+
+std::shared_ptr<HttpServer::Http2Session>
+HttpServer::http2_session(RemoteTarget::SharedPtr remote, std::shared_ptr<HttpParser> parser, std::string_view data) {
+    std::lock_guard<std::mutex> lock_guard(m_parsers_mutex);
+    if (!m_parsers.contains(remote->fd())) {
+        return nullptr;
+    }
+    auto& state = m_connections[remote->fd()];
+    // only a fresh connection can start speaking HTTP/2
+    if (state.m_http2 != nullptr || state.m_requests != 0 || parser->req_phase() != HttpParser::ReadPhase::IDLE) {
+        return state.m_http2;
+    }
+    bool http2 = false;
+    if (auto ssl_remote = std::dynamic_pointer_cast<SSLRemoteTarget>(remote)) {
+        http2 = ssl_remote->alpn_protocol() == "h2";
+    }
+    if (!http2) {
+        // no HTTP/1.1 method starts with "PRI", fewer bytes are left to the HTTP/1.1 parser
+        auto size = std::min(data.size(), http2::PREFACE.size());
+        http2 = size >= 3 && data.substr(0, size) == http2::PREFACE.substr(0, size);
+    }
+    if (http2) {
+        state.m_http2 = std::make_shared<Http2Session>(m_http2_options.value());
+        disable_nagle(remote->fd());
+    }
+    return state.m_http2;
+}
+
+bool HttpServer::upgrade_http2(
+    RemoteTarget::SharedPtr remote,
+    std::shared_ptr<HttpParser> parser,
+    HttpRequestView& request
+) {
+    auto session = std::make_shared<Http2Session>(m_http2_options.value());
+    if (!session->m_connection.upgrade(request.header("HTTP2-Settings"), request)) {
+        return false;
+    }
+    static constexpr std::string_view SWITCHING_PROTOCOLS =
+        "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+    struct iovec iov { const_cast<char*>(SWITCHING_PROTOCOLS.data()), SWITCHING_PROTOCOLS.size() };
+    auto err = m_server->writev(&iov, 1, remote);
+    if (err.has_value()) {
+        std::cerr << std::format("Failed to write to socket: {}\n", err.value().msg);
+        erase_parser(remote->fd());
+        return true;
+    }
+    {
+        std::lock_guard<std::mutex> lock_guard(m_parsers_mutex);
+        if (!m_parsers.contains(remote->fd())) {
+            return true;
+        }
+        m_connections[remote->fd()].m_http2 = session;
+        cancel_deadline(remote->fd());
+    }
+    disable_nagle(remote->fd());
+    // the client may have sent its preface right behind the request
+    serve_http2(remote, session, parser->req_view_pending());
+    return true;
+}
+
+bool HttpServer::serve_http2(
+    RemoteTarget::SharedPtr remote,
+    std::shared_ptr<Http2Session> session,
+    std::string_view data
+) {
+    std::lock_guard<std::mutex> lock_guard(session->m_mutex);
+    auto& connection = session->m_connection;
+    connection.feed(data);
+    while (auto next = connection.next_request()) {
+        auto& request = next->m_request;
+        request.set_remote_fd(remote->fd());
+        auto response = handle_http2_request(request);
+        if (m_compressor) {
+            m_compressor->apply(request.header("Accept-Encoding"), response);
+        }
+        connection.submit_response(next->m_stream_id, std::move(response), request.method() == HttpMethod::HEAD);
+    }
+    return flush_http2(remote, *session);
+}
+
+HttpResponse HttpServer::handle_http2_request(HttpRequestView& request) {
+    auto handlers = m_stream_handlers.find(request.method());
+    if (handlers != m_stream_handlers.end()) {
+        RouteParams params;
+        if (auto on_head = handlers->second.match(request.path(), params)) {
+            request.set_params(params);
+            try {
+                if (auto reader = (*on_head)(request)) {
+                    reader->m_on_data(request.body());
+                    return reader->m_on_end();
+                }
+            } catch (const HttpResponseCode& e) {
+                return error_response(e, request);
+            }
+        }
+    }
+    return handle_request(request);
+}
+
+bool HttpServer::flush_http2(RemoteTarget::SharedPtr remote, Http2Session& session) {
+    auto above_high_watermark = [&remote]() {
+        auto& output = remote->output_buffer();
+        std::lock_guard<std::mutex> lock_guard(output.mutex());
+        return output.m_above_high_watermark;
+    };
+    auto& connection = session.m_connection;
+    while (true) {
+        connection.produce(HTTP2_WRITE_SIZE);
+        if (!connection.has_output()) {
+            break;
+        }
+        connection.output(session.m_iov);
+        auto err = m_server->writev(session.m_iov.data(), session.m_iov.size(), remote);
+        connection.consume_output();
+        if (err.has_value()) {
+            std::cerr << std::format("Failed to write to socket: {}\n", err.value().msg);
+            erase_parser(remote->fd());
+            return false;
+        }
+        // the rest waits for resume_stream
+        if (!connection.has_pending_bodies() || above_high_watermark()) {
+            break;
+        }
+    }
+    if (connection.closed()) {
+        erase_parser(remote->fd());
+        m_server->close_remote(remote);
+        return false;
+    }
+    return true;
+}
+
+void HttpServer::cancel_deadline(int remote_fd) {
+    auto& state = m_connections[remote_fd];
+    if (state.m_deadline != 0) {
+        if (auto timer_service = state.m_timer_service.lock()) {
+            timer_service->cancel(state.m_deadline);
+        }
+        state.m_deadline = 0;
+    }
+    ++state.m_epoch;
+}
+
 HttpServer::~HttpServer() {
     if (m_server) {
         if (m_server->status() == SocketStatus::CONNECTED) {
@@ -209,6 +838,8 @@ HttpServer::~HttpServer() {
         m_server.reset();
     }
     m_parsers.clear();
+    m_connections.clear();
+    m_view_handlers.clear();
     m_error_handlers.clear();
     m_delete_handlers.clear();
     m_get_handlers.clear();
@@ -229,6 +860,88 @@ std::shared_ptr<TcpServer> HttpServer::convert2tcp() {
 void HttpServer::erase_parser(int remote_fd) {
     std::lock_guard<std::mutex> lock_guard(m_parsers_mutex);
     m_parsers.erase(remote_fd);
+    auto it = m_connections.find(remote_fd);
+    if (it == m_connections.end()) {
+        return;
+    }
+    if (it->second.m_deadline != 0) {
+        if (auto timer_service = it->second.m_timer_service.lock()) {
+            timer_service->cancel(it->second.m_deadline);
+        }
+    }
+    m_connections.erase(it);
+}
+
+bool HttpServer::count_request(RemoteTarget::SharedPtr remote, bool close_requested) {
+    std::size_t requests;
+    {
+        std::lock_guard<std::mutex> lock_guard(m_parsers_mutex);
+        requests = ++m_connections[remote->fd()].m_requests;
+    }
+    return close_requested || (m_max_requests != 0 && requests >= m_max_requests);
+}
+
+void HttpServer::update_deadline(RemoteTarget::SharedPtr remote, HttpParser::ReadPhase phase) {
+    std::chrono::milliseconds timeout;
+    switch (phase) {
+        case HttpParser::ReadPhase::IDLE:
+            timeout = m_keep_alive_timeout;
+            break;
+        case HttpParser::ReadPhase::HEADER:
+            timeout = m_header_timeout;
+            break;
+        case HttpParser::ReadPhase::BODY:
+            timeout = m_body_timeout;
+            break;
+    }
+    if (m_keep_alive_timeout.count() <= 0 && m_header_timeout.count() <= 0 && m_body_timeout.count() <= 0) {
+        return;
+    }
+    auto timer_service = m_server->timer_service(remote->fd());
+    if (timer_service == nullptr) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock_guard(m_parsers_mutex);
+    if (!m_parsers.contains(remote->fd())) {
+        // already closed
+        return;
+    }
+    auto& state = m_connections[remote->fd()];
+    if (state.m_phase == phase && state.m_deadline != 0) {
+        return;
+    }
+    if (state.m_deadline != 0) {
+        timer_service->cancel(state.m_deadline);
+        state.m_deadline = 0;
+    }
+    state.m_phase = phase;
+    ++state.m_epoch;
+    if (timeout.count() <= 0) {
+        return;
+    }
+    state.m_timer_service = timer_service;
+    RemoteTarget::WeakPtr weak_remote = remote;
+    state.m_deadline = timer_service->schedule(timeout, [this, weak_remote, epoch = state.m_epoch]() {
+        expire_connection(weak_remote, epoch);
+    });
+}
+
+void HttpServer::expire_connection(RemoteTarget::WeakPtr weak_remote, uint64_t epoch) {
+    auto remote = weak_remote.lock();
+    if (remote == nullptr || !remote->is_active()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock_guard(m_parsers_mutex);
+        auto it = m_connections.find(remote->fd());
+        if (it == m_connections.end() || it->second.m_epoch != epoch) {
+            return;
+        }
+        it->second.m_deadline = 0;
+    }
+    // runs on the loop thread, nothing is written, the socket is just dropped and its parser reclaimed
+    erase_parser(remote->fd());
+    m_server->close_remote(remote);
 }
 
 } // namespace net
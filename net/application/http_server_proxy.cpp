@@ -1,108 +1,485 @@
 #include "http_server_proxy.hpp"
+#include "http_client.hpp"
 #include "http_parser.hpp"
+#include "load_balancer.hpp"
 #include "remote_target.hpp"
 #include "socket_base.hpp"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <array>
+#include <cctype>
+#include <chrono>
+#include <exception>
+#include <format>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace net {
 
+namespace {
+
+    // meaningful for a single connection only, never passed on, RFC 9110 section 7.6.1
+    constexpr std::array<std::string_view, 8> HOP_BY_HOP_HEADERS = { "connection", "keep-alive",
+                                                                     "proxy-connection", "proxy-authorization",
+                                                                     "te", "trailer",
+                                                                     "transfer-encoding", "upgrade" };
+
+    std::string lowercase(std::string_view value) {
+        std::string result(value);
+        std::transform(result.begin(), result.end(), result.begin(), [](unsigned char c) { return std::tolower(c); });
+        return result;
+    }
+
+    std::string peer_ip(int fd) {
+        ::sockaddr_storage address;
+        ::socklen_t length = sizeof(address);
+        if (::getpeername(fd, reinterpret_cast<::sockaddr*>(&address), &length) == -1) {
+            return "";
+        }
+        char buffer[INET6_ADDRSTRLEN] = {};
+        if (address.ss_family == AF_INET) {
+            ::inet_ntop(AF_INET, &reinterpret_cast<::sockaddr_in*>(&address)->sin_addr, buffer, sizeof(buffer));
+        } else if (address.ss_family == AF_INET6) {
+            ::inet_ntop(AF_INET6, &reinterpret_cast<::sockaddr_in6*>(&address)->sin6_addr, buffer, sizeof(buffer));
+        }
+        return buffer;
+    }
+
+    /**
+     * @brief head of the request as it goes to an upstream, hop-by-hop headers are dropped
+     *        A body keeps the content-length the client sent, one whose length isn't known up front goes out as
+     *        chunks. The body itself is relayed apart from the head.
+     * @param forwarded add the client to X-Forwarded-For and X-Forwarded-Proto
+     */
+    HttpRequest upstream_head(const HttpRequestView& head, std::string url, bool forwarded, bool tls) {
+        std::unordered_map<std::string, std::string> headers;
+        for (auto it = head.headers_begin(); it != head.headers_end(); ++it) {
+            headers.emplace(lowercase(it->key), std::string(it->value));
+        }
+        // the connection header may name more headers meant for this hop only
+        auto connection = headers.find("connection");
+        if (connection != headers.end()) {
+            std::string_view tokens = connection->second;
+            while (!tokens.empty()) {
+                auto comma = tokens.find(',');
+                auto token = tokens.substr(0, comma);
+                auto begin = token.find_first_not_of(" \t");
+                auto end = token.find_last_not_of(" \t");
+                if (begin != std::string_view::npos) {
+                    headers.erase(lowercase(token.substr(begin, end - begin + 1)));
+                }
+                tokens = comma == std::string_view::npos ? std::string_view() : tokens.substr(comma + 1);
+            }
+        }
+        bool chunked = headers.contains("transfer-encoding");
+        for (auto header: HOP_BY_HOP_HEADERS) {
+            headers.erase(std::string(header));
+        }
+        if (chunked) {
+            // transfer-encoding overrides content-length, the body arrives decoded and is framed anew
+            headers.erase("content-length");
+        }
+        if (forwarded) {
+            auto client = peer_ip(head.remote_fd());
+            auto& forwarded_for = headers["x-forwarded-for"];
+            forwarded_for = forwarded_for.empty() ? client : forwarded_for + ", " + client;
+            headers["x-forwarded-proto"] = tls ? "https" : "http";
+        }
+        HttpRequest request;
+        request.set_method(head.method())
+            .set_url(std::move(url))
+            .set_version(std::string(head.version()))
+            .set_headers(headers);
+        return request;
+    }
+
+    /**
+     * @brief whether a body follows the head of the request, HTTP/2 requests come with their body already
+     */
+    bool has_body(const HttpRequestView& head) {
+        return head.has_header("Content-Length") || head.has_header("Transfer-Encoding") || !head.body().empty();
+    }
+
+    /**
+     * @brief "/path?query" of the absolute url a forward proxy is asked for, other urls are kept as they are
+     */
+    std::string origin_form(std::string_view url) {
+        auto scheme = url.find("://");
+        if (scheme == std::string_view::npos) {
+            return std::string(url);
+        }
+        auto path = url.find('/', scheme + 3);
+        return path == std::string_view::npos ? "/" : std::string(url.substr(path));
+    }
+
+    /**
+     * @brief request whose body is relayed to the upstream piece by piece as it arrives
+     *        The first error stops the relay, the rest of the body is still taken from the client so that the
+     *        request can be answered.
+     */
+    struct Upload {
+        std::shared_ptr<HttpConnectionPool::Lease> m_lease = std::make_shared<HttpConnectionPool::Lease>();
+        std::optional<NetError> m_error;
+
+        void write(std::string_view piece) {
+            if (!m_error.has_value()) {
+                m_error = (*m_lease)->write_http_body(piece);
+            }
+        }
+
+        /**
+         * @brief end the body and read the head of the response
+         */
+        std::optional<NetError> finish(HttpConnectionPool& pool, HttpResponse& res) {
+            if (!m_error.has_value()) {
+                m_error = (*m_lease)->end_http_body();
+            }
+            if (!m_error.has_value()) {
+                m_error = pool.receive(*m_lease, res);
+            }
+            return m_error;
+        }
+    };
+
+    /**
+     * @brief relay the body of res, whose head came in over lease, piece by piece as the client connection drains
+     *        The lease is released once the body is through. on_end is told once the body is through or failed.
+     * @return error of reading the first piece, res is to be answered otherwise then
+     */
+    std::optional<NetError> relay_body(
+        HttpMethod method,
+        HttpResponse& res,
+        std::shared_ptr<HttpConnectionPool::Lease> lease,
+        std::function<void(bool ok)> on_end
+    ) {
+        for (auto header: HOP_BY_HOP_HEADERS) {
+            res.remove_header(header);
+        }
+        if (method == HttpMethod::HEAD || res.status_code() == HttpResponseCode::NO_CONTENT
+            || res.status_code() == HttpResponseCode::NOT_MODIFIED)
+        {
+            // how the upstream frames what follows is not known, the connection is not reused
+            lease->discard();
+            on_end(true);
+            return std::nullopt;
+        }
+        std::string piece;
+        bool finished = false;
+        auto err = (*lease)->read_http_body(piece, finished);
+        if (err.has_value()) {
+            lease->discard();
+            on_end(false);
+            return err;
+        }
+        if (finished) {
+            // came in with the head, nothing worth streaming
+            if (!res.has_header("Content-Length") && !piece.empty()) {
+                res.set_header("content-length", std::to_string(piece.size()));
+            }
+            res.set_body(piece);
+            lease->release();
+            on_end(true);
+            return std::nullopt;
+        }
+        // the upstream connection stays on loan until the body is through, it is closed if the client leaves
+        // halfway. With a content-length from the upstream the body is relayed as is, otherwise it is framed as
+        // chunks
+        auto first = std::make_shared<std::string>(std::move(piece));
+        res.set_body_producer([lease, first, on_end](std::string& chunk) {
+            if (!first->empty()) {
+                chunk.swap(*first);
+                return true;
+            }
+            bool finished = false;
+            auto err = (*lease)->read_http_body(chunk, finished);
+            if (err.has_value()) {
+                on_end(false);
+                throw std::runtime_error(err.value().msg);
+            }
+            if (finished) {
+                lease->release();
+                on_end(true);
+            }
+            return !finished;
+        });
+        return std::nullopt;
+    }
+
+    HttpResponseCode gateway_error(const NetError& err) {
+        return err.error_code == NET_NO_UPSTREAM_CODE ? HttpResponseCode::SERVICE_UNAVAILABLE
+            : err.error_code == NET_TIMEOUT_CODE      ? HttpResponseCode::GATEWAY_TIMEOUT
+                                                      : HttpResponseCode::BAD_GATEWAY;
+    }
+
+} // namespace
+
 HttpServerProxyForward::HttpServerProxyForward(
     const std::string& ip,
     const std::string& service,
     std::shared_ptr<SSLContext> ctx
 ):
     HttpServer(ip, service, ctx) {
-    m_clients = std::make_shared<HttpClientGroup>();
-    this->set_handler();
+    m_pool = std::make_shared<HttpConnectionPool>();
+    for (auto& [method, handlers]: m_handlers) {
+        route_stream(method, "*url", [this](const HttpRequestView& head) { return open_upstream(head); });
+    }
 }
 
-void HttpServerProxyForward::set_handler() {
-    auto handler_thread_func = [this](RemoteTarget::SharedPtr remote) {
-        {
-            std::lock_guard<std::mutex> lock_guard(m_parsers_mutex);
-            if (!m_parsers.contains(remote->fd())) {
-                m_parsers.insert({ remote->fd(), std::make_shared<HttpParser>() });
+HttpBodyReader::SharedPtr HttpServerProxyForward::open_upstream(const HttpRequestView& head) {
+    auto reader = std::make_shared<HttpBodyReader>();
+    reader->m_on_data = [](std::string_view) {};
+    auto target = head.header("Host");
+    if (target.empty()) {
+        reader->m_on_end = [this, head]() { return error_response(HttpResponseCode::BAD_REQUEST, head); };
+        return reader;
+    }
+    auto colon = target.find(':');
+    std::string target_ip(target.substr(0, colon));
+    std::string target_service = colon == std::string_view::npos ? "80" : std::string(target.substr(colon + 1));
+    auto request = upstream_head(head, origin_form(head.url()), false, false);
+    auto upload = std::make_shared<Upload>();
+    if (!has_body(head)) {
+        reader->m_on_end = [this, head, request, upload, target_ip, target_service]() {
+            HttpResponse res;
+            auto err = m_pool->send(*upload->m_lease, res, target_ip, target_service, request);
+            return relay_response(head, err, std::move(res), upload->m_lease);
+        };
+        return reader;
+    }
+    upload->m_error = m_pool->send_head(*upload->m_lease, target_ip, target_service, request);
+    reader->m_on_data = [upload](std::string_view piece) { upload->write(piece); };
+    reader->m_on_end = [this, head, upload]() {
+        HttpResponse res;
+        auto err = upload->finish(*m_pool, res);
+        return relay_response(head, err, std::move(res), upload->m_lease);
+    };
+    return reader;
+}
+
+HttpResponse HttpServerProxyForward::relay_response(
+    const HttpRequestView& head,
+    std::optional<NetError> err,
+    HttpResponse res,
+    std::shared_ptr<HttpConnectionPool::Lease> lease
+) {
+    if (!err.has_value()) {
+        err = relay_body(head.method(), res, lease, [](bool) {});
+    }
+    if (err.has_value()) {
+        std::cerr << std::format("Failed to forward request: {}\n", err.value().msg) << std::endl;
+        return error_response(gateway_error(err.value()), head);
+    }
+    return res;
+}
+
+HttpServerProxyReverse::Attempt::Attempt(LoadBalancer::SharedPtr balancer, std::size_t index):
+    m_balancer(std::move(balancer)),
+    m_index(index) {
+    m_balancer->on_start(m_index);
+}
+
+HttpServerProxyReverse::Attempt::~Attempt() {
+    m_balancer->on_finish(m_index, m_latency, m_ok);
+}
+
+HttpServerProxyReverse::HttpServerProxyReverse(
+    const std::string& ip,
+    const std::string& service,
+    std::vector<Upstream> upstreams,
+    HttpReverseProxyOptions options,
+    std::shared_ptr<SSLContext> ctx
+):
+    HttpServer(ip, service, ctx),
+    m_options(std::move(options)) {
+    m_balancer = std::make_shared<LoadBalancer>(std::move(upstreams), m_options.m_balancer);
+    m_pool = std::make_shared<HttpConnectionPool>(m_options.m_pool);
+    for (auto& [method, handlers]: m_handlers) {
+        route_stream(method, "*url", [this](const HttpRequestView& head) { return open_upstream(head); });
+    }
+    if (!m_options.m_health_check_path.empty()) {
+        m_health_thread = std::thread([this]() { check_health(); });
+    }
+}
+
+HttpServerProxyReverse::~HttpServerProxyReverse() {
+    {
+        std::lock_guard<std::mutex> lock(m_health_mutex);
+        m_health_stop = true;
+    }
+    m_health_cv.notify_all();
+    if (m_health_thread.joinable()) {
+        m_health_thread.join();
+    }
+}
+
+HttpBodyReader::SharedPtr HttpServerProxyReverse::open_upstream(const HttpRequestView& head) {
+    auto request = upstream_head(head, std::string(head.url()), true, m_ssl_ctx != nullptr);
+    auto upload = std::make_shared<Upload>();
+    auto reader = std::make_shared<HttpBodyReader>();
+    if (!has_body(head)) {
+        reader->m_on_data = [](std::string_view) {};
+        reader->m_on_end = [this, head, request, upload]() {
+            HttpResponse res;
+            std::shared_ptr<Attempt> attempt;
+            auto err = forward(request, &res, *upload->m_lease, attempt);
+            return relay_response(head, err, std::move(res), upload->m_lease, std::move(attempt));
+        };
+        return reader;
+    }
+    // the upstream is picked and the head sent right away, the body follows as it arrives
+    std::shared_ptr<Attempt> attempt;
+    upload->m_error = forward(request, nullptr, *upload->m_lease, attempt);
+    reader->m_on_data = [upload](std::string_view piece) { upload->write(piece); };
+    reader->m_on_end = [this, head, upload, attempt]() mutable {
+        HttpResponse res;
+        auto err = upload->finish(*m_pool, res);
+        if (attempt != nullptr) {
+            attempt->m_latency = std::chrono::steady_clock::now() - attempt->m_start;
+            attempt->m_ok = !err.has_value();
+        }
+        return relay_response(head, err, std::move(res), upload->m_lease, std::move(attempt));
+    };
+    return reader;
+}
+
+HttpResponse HttpServerProxyReverse::relay_response(
+    const HttpRequestView& head,
+    std::optional<NetError> err,
+    HttpResponse res,
+    std::shared_ptr<HttpConnectionPool::Lease> lease,
+    std::shared_ptr<Attempt> attempt
+) {
+    if (!err.has_value()) {
+        // the attempt is reported to the balancer once the body is through
+        err = relay_body(head.method(), res, lease, [attempt = std::move(attempt)](bool ok) mutable {
+            if (attempt != nullptr && !ok) {
+                attempt->m_ok = false;
             }
+            attempt.reset();
+        });
+    }
+    if (err.has_value()) {
+        std::cerr << std::format("Failed to forward request: {}\n", err.value().msg) << std::endl;
+        return error_response(gateway_error(err.value()), head);
+    }
+    return res;
+}
+
+std::optional<NetError> HttpServerProxyReverse::forward(
+    const HttpRequest& req,
+    HttpResponse* res,
+    HttpConnectionPool::Lease& lease,
+    std::shared_ptr<Attempt>& attempt
+) {
+    std::string key;
+    if (m_options.m_balancer.m_policy == LoadBalancePolicy::CONSISTENT_HASH) {
+        if (!m_options.m_hash_header.empty()) {
+            key = req.header(lowercase(m_options.m_hash_header));
         }
-        auto& parser = m_parsers.at(remote->fd());
-        // parse request
-        std::vector<uint8_t> req(1024);
-        std::vector<uint8_t> res;
-        auto err = m_server->read(req, remote);
-        if (err.has_value()) {
-            std::cerr << std::format("Failed to read from socket: {}\n", err.value().msg) << std::endl;
-            erase_parser(remote->fd());
-            return;
+        if (key.empty()) {
+            key = req.url();
         }
-        std::optional<HttpRequest> req_opt;
-        parser->add_req_read_buffer(req);
-        while (true) {
-            HttpResponse res;
-            req_opt = parser->read_req();
-            if (!req_opt.has_value()) {
-                break;
-            }
-            auto& request = req_opt.value();
-            // find the path in the request
-            size_t third_slash_pos = request.url().find("/", request.url().find("/", request.url().find("/") + 1) + 1);
-            request.set_url(request.url().substr(third_slash_pos));
-            auto target = request.headers().find("host");
-            if (target == request.headers().end()) {
-                // if the target is not found, return a 400 Bad Request response
-                auto handler = m_error_handlers.find(HttpResponseCode::BAD_REQUEST);
-                if (handler == m_error_handlers.end()) {
-                    res.set_version(HTTP_VERSION_1_1)
-                        .set_status_code(HttpResponseCode::BAD_REQUEST)
-                        .set_reason(std::string(utils::dump_enum(HttpResponseCode::BAD_REQUEST)))
-                        .set_header("Content-Length", "0");
-                } else {
-                    res = handler->second(request);
-                }
+    }
+    std::vector<std::size_t> tried;
+    std::optional<NetError> err;
+    while (tried.size() <= m_options.m_max_retries) {
+        auto index = m_balancer->pick(key, tried);
+        if (index == LoadBalancer::npos) {
+            break;
+        }
+        tried.push_back(index);
+        const auto& upstream = m_balancer->upstream(index);
+        attempt = std::make_shared<Attempt>(m_balancer, index);
+        // nothing went out before the connection is there, whatever the method
+        err = m_pool->acquire(lease, upstream.m_ip, upstream.m_service, m_options.m_upstream_ssl_ctx);
+        bool sent = !err.has_value();
+        if (sent && res != nullptr) {
+            err = m_pool->send(lease, *res, upstream.m_ip, upstream.m_service, req, m_options.m_upstream_ssl_ctx);
+        } else if (sent) {
+            err = m_pool->send_head(lease, upstream.m_ip, upstream.m_service, req, m_options.m_upstream_ssl_ctx);
+        }
+        if (!err.has_value()) {
+            if (res != nullptr) {
+                attempt->m_latency = std::chrono::steady_clock::now() - attempt->m_start;
             }
+            return std::nullopt;
+        }
+        attempt->m_ok = false;
+        attempt.reset();
+        // a head which failed to go out reached nothing, whatever the method
+        if (sent && res != nullptr && !idempotent(req.method())) {
+            break;
+        }
+    }
+    if (!err.has_value()) {
+        return NetError { NET_NO_UPSTREAM_CODE, "No upstream available" };
+    }
+    return err;
+}
 
-            std::string target_ip = target->second.substr(0, target->second.find(':'));
-            std::string target_service = target->second.substr(target->second.find(':') + 1);
-            auto client = m_clients->get_client(target_ip, target_service);
-            if (!client) {
-                auto err = m_clients->add_client(target_ip, target_service);
-                if (err.has_value()) {
-                    std::cerr << std::format("Failed to add client: {}\n", err.value().msg) << std::endl;
-                    return;
-                }
-                client = m_clients->get_client(target_ip, target_service);
-                if (!client) {
-                    std::cerr << "Failed to get client" << std::endl;
-                    return;
-                }
+void HttpServerProxyReverse::check_health() {
+    auto count = m_balancer->size();
+    std::vector<std::size_t> passes(count, 0);
+    std::vector<std::size_t> fails(count, 0);
+    std::vector<bool> healthy(count, true);
+    std::unique_lock<std::mutex> lock(m_health_mutex);
+    while (!m_health_stop) {
+        lock.unlock();
+        for (std::size_t i = 0; i < count; i++) {
+            if (probe(m_balancer->upstream(i))) {
+                fails[i] = 0;
+                passes[i]++;
+            } else {
+                passes[i] = 0;
+                fails[i]++;
             }
-            if (client->status() == SocketStatus::DISCONNECTED) {
-                err = client->connect_server();
-                if (err.has_value()) {
-                    std::cerr << std::format("Failed to connect to client: {}\n", err.value().msg) << std::endl;
-                    return;
-                }
-            }
-            err = client->write_http(request);
-            if (err.has_value()) {
-                std::cerr << std::format("Failed to write to client: {}\n", err.value().msg) << std::endl;
-                return;
-            }
-            err = client->read_http(res);
-            if (err.has_value()) {
-                std::cerr << std::format("Failed to read from client: {}\n", err.value().msg) << std::endl;
-                return;
-            }
-            auto buffer = parser->write_res(res);
-            err = m_server->write(buffer, remote);
-            if (err.has_value()) {
-                std::cerr << std::format("Failed to write to socket: {}\n", err.value().msg) << std::endl;
-                erase_parser(remote->fd());
-                break;
+            // told on a change only, a passing probe must not cut short a passive fail timeout
+            if (!healthy[i] && passes[i] >= m_options.m_healthy_threshold) {
+                healthy[i] = true;
+                m_balancer->set_healthy(i, true);
+            } else if (healthy[i] && fails[i] >= m_options.m_unhealthy_threshold) {
+                healthy[i] = false;
+                m_balancer->set_healthy(i, false);
             }
         }
-    };
+        lock.lock();
+        m_health_cv.wait_for(lock, m_options.m_health_check_interval, [this]() { return m_health_stop; });
+    }
+}
 
-    m_server->on_start(handler_thread_func);
-    m_server->on_read(handler_thread_func);
+bool HttpServerProxyReverse::probe(const Upstream& upstream) {
+    auto timeout = static_cast<std::size_t>(m_options.m_health_check_timeout.count());
+    try {
+        HttpClient client(upstream.m_ip, upstream.m_service, m_options.m_upstream_ssl_ctx);
+        client.set_read_timeout(timeout);
+        if (client.connect_server(timeout).has_value()) {
+            return false;
+        }
+        HttpRequest req;
+        req.set_method(HttpMethod::GET)
+            .set_url(m_options.m_health_check_path)
+            .set_version(HTTP_VERSION_1_1)
+            .set_header("Host", upstream.m_ip)
+            .set_header("Connection", "close");
+        HttpResponse res;
+        bool ok = !client.write_http(req).has_value() && !client.read_http(res).has_value();
+        client.close();
+        auto status = static_cast<int>(res.status_code());
+        return ok && status >= 200 && status < 400;
+    } catch (const std::exception&) {
+        return false;
+    }
 }
 
-} // namespace net
\ No newline at end of file
+} // namespace net
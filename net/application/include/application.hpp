@@ -1,7 +1,12 @@
 #pragma once
 
+#include "http2.hpp"
+#include "http_async_client.hpp"
 #include "http_client.hpp"
 #include "http_parser.hpp"
 #include "http_server.hpp"
+#include "http_server_proxy.hpp"
+#include "load_balancer.hpp"
+#include "static_files.hpp"
 #include "websocket.hpp"
 #include "websocket_utils.hpp"
\ No newline at end of file
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace net {
+
+namespace hpack {
+
+    // size of the dynamic table both sides start with, RFC 7541 section 4.2
+    constexpr std::size_t DEFAULT_TABLE_SIZE = 4096;
+
+    /**
+     * @brief append value as an integer with an n bit prefix, first holds the bits above the prefix
+     */
+    void encode_integer(uint64_t value, uint8_t prefix_bits, uint8_t first, std::string& out);
+
+    /**
+     * @brief decode an integer with an n bit prefix starting at pos, pos is moved behind it
+     * @return false if input ends early or the value doesn't fit in 32 bits
+     */
+    bool decode_integer(std::string_view input, std::size_t& pos, uint8_t prefix_bits, uint64_t& value);
+
+    /**
+     * @return length of text once Huffman coded, in bytes
+     */
+    std::size_t huffman_size(std::string_view text);
+
+    void huffman_encode(std::string_view text, std::string& out);
+
+    /**
+     * @brief append the decoded text to out
+     * @return false if the input holds EOS or its padding is not a prefix of EOS, RFC 7541 section 5.2
+     */
+    bool huffman_decode(std::string_view input, std::string& out);
+
+} // namespace hpack
+
+/**
+ * @brief Index space of HPACK, the static table followed by the dynamic one
+ *        Dynamic entries are kept newest first and sized the way RFC 7541 section 4.1 counts them.
+ */
+class HpackTable {
+public:
+    // every entry counts its name and value plus this much
+    static constexpr std::size_t ENTRY_OVERHEAD = 32;
+    static constexpr std::size_t STATIC_SIZE = 61;
+
+    explicit HpackTable(std::size_t max_size = hpack::DEFAULT_TABLE_SIZE);
+
+    /**
+     * @brief entry at index in the combined index space, 1 to 61 are the static table
+     * @return nullopt if index is out of range
+     */
+    [[nodiscard]] std::optional<std::pair<std::string_view, std::string_view>> get(std::size_t index) const;
+
+    /**
+     * @return index of the entry matching name and value, 0 if there is none, name_index is set to an entry with
+     *         that name only, 0 if there is none either
+     */
+    std::size_t find(std::string_view name, std::string_view value, std::size_t& name_index) const;
+
+    /**
+     * @brief add a dynamic entry, older ones are evicted to make room, an entry larger than the table only empties it
+     */
+    void insert(std::string_view name, std::string_view value);
+
+    void set_max_size(std::size_t max_size);
+
+    [[nodiscard]] std::size_t max_size() const;
+
+    [[nodiscard]] std::size_t size() const;
+
+    [[nodiscard]] std::size_t entries() const;
+
+private:
+    void evict(std::size_t max_size);
+
+    std::deque<std::pair<std::string, std::string>> m_entries;
+    std::size_t m_size = 0;
+    std::size_t m_max_size;
+};
+
+/**
+ * @brief HPACK decoder of the header blocks of one connection, RFC 7541
+ */
+class HpackDecoder {
+public:
+    /**
+     * @param max_table_size the SETTINGS_HEADER_TABLE_SIZE advertised to the peer, table size updates above it
+     *        are errors
+     */
+    explicit HpackDecoder(std::size_t max_table_size = hpack::DEFAULT_TABLE_SIZE);
+
+    /**
+     * @brief decode a complete header block, every field goes to on_field, the views are only valid during the call
+     * @return false on a compression error, the connection can't be used afterwards
+     */
+    bool decode(std::string_view block, const std::function<void(std::string_view, std::string_view)>& on_field);
+
+    [[nodiscard]] const HpackTable& table() const;
+
+private:
+    /**
+     * @brief read a string literal at pos into out, Huffman coded or not
+     */
+    bool read_string(std::string_view block, std::size_t& pos, std::string& out);
+
+    HpackTable m_table;
+    std::size_t m_max_table_size;
+    std::string m_name;
+    std::string m_value;
+};
+
+/**
+ * @brief HPACK encoder of the header blocks of one connection
+ *        Fields matching a table entry become an index, others are added to the dynamic table unless they are
+ *        unlikely to repeat. Strings are Huffman coded when that makes them shorter.
+ */
+class HpackEncoder {
+public:
+    /**
+     * @brief limit the dynamic table to what the peer's SETTINGS_HEADER_TABLE_SIZE allows
+     *        The change is announced at the start of the next header block.
+     */
+    void set_max_table_size(std::size_t max_size);
+
+    /**
+     * @brief start a header block in out, a pending table size change goes first
+     */
+    void begin_block(std::string& out);
+
+    /**
+     * @brief append a field to the header block in out, names must be lowercase
+     * @param sensitive never index the field, neither here nor in intermediaries, for credentials
+     */
+    void encode(std::string_view name, std::string_view value, std::string& out, bool sensitive = false);
+
+    [[nodiscard]] const HpackTable& table() const;
+
+private:
+    void write_string(std::string_view text, std::string& out);
+
+    HpackTable m_table;
+    // smallest size the table was set to since the last block, both it and the current size are announced
+    std::size_t m_pending_min_size = 0;
+    bool m_size_update = false;
+};
+
+} // namespace net
@@ -0,0 +1,336 @@
+#pragma once
+
+#include "defines.hpp"
+#include "hpack.hpp"
+#include "http_parser.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/uio.h>
+#include <unordered_map>
+#include <vector>
+
+namespace net {
+
+enum class Http2FrameType : uint8_t {
+    DATA = 0x0,
+    HEADERS = 0x1,
+    PRIORITY = 0x2,
+    RST_STREAM = 0x3,
+    SETTINGS = 0x4,
+    PUSH_PROMISE = 0x5,
+    PING = 0x6,
+    GOAWAY = 0x7,
+    WINDOW_UPDATE = 0x8,
+    CONTINUATION = 0x9,
+};
+
+enum class Http2ErrorCode : uint32_t {
+    NO_ERROR = 0x0,
+    PROTOCOL_ERROR = 0x1,
+    INTERNAL_ERROR = 0x2,
+    FLOW_CONTROL_ERROR = 0x3,
+    SETTINGS_TIMEOUT = 0x4,
+    STREAM_CLOSED = 0x5,
+    FRAME_SIZE_ERROR = 0x6,
+    REFUSED_STREAM = 0x7,
+    CANCEL = 0x8,
+    COMPRESSION_ERROR = 0x9,
+    CONNECT_ERROR = 0xa,
+    ENHANCE_YOUR_CALM = 0xb,
+    INADEQUATE_SECURITY = 0xc,
+    HTTP_1_1_REQUIRED = 0xd,
+};
+
+enum class Http2Setting : uint16_t {
+    HEADER_TABLE_SIZE = 0x1,
+    ENABLE_PUSH = 0x2,
+    MAX_CONCURRENT_STREAMS = 0x3,
+    INITIAL_WINDOW_SIZE = 0x4,
+    MAX_FRAME_SIZE = 0x5,
+    MAX_HEADER_LIST_SIZE = 0x6,
+};
+
+namespace http2 {
+
+    // first bytes a client sends on every connection, RFC 9113 section 3.4
+    constexpr std::string_view PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+    constexpr uint8_t FLAG_END_STREAM = 0x1;
+    constexpr uint8_t FLAG_ACK = 0x1;
+    constexpr uint8_t FLAG_END_HEADERS = 0x4;
+    constexpr uint8_t FLAG_PADDED = 0x8;
+    constexpr uint8_t FLAG_PRIORITY = 0x20;
+
+    constexpr uint32_t DEFAULT_WINDOW_SIZE = 65535;
+    constexpr uint32_t MAX_WINDOW_SIZE = 0x7fffffff;
+    constexpr uint32_t DEFAULT_MAX_FRAME_SIZE = 16384;
+    constexpr uint32_t MAX_FRAME_SIZE = 0xffffff;
+
+} // namespace http2
+
+struct Http2FrameHeader {
+    static constexpr std::size_t SIZE = 9;
+
+    uint32_t m_length = 0;
+    Http2FrameType m_type = Http2FrameType::DATA;
+    uint8_t m_flags = 0;
+    uint32_t m_stream_id = 0;
+
+    /**
+     * @brief read a header from the SIZE bytes at data, the reserved bit of the stream id is dropped
+     */
+    static Http2FrameHeader parse(const uint8_t* data);
+
+    /**
+     * @brief append the SIZE bytes of the header to out
+     */
+    void write(std::string& out) const;
+};
+
+struct Http2Options {
+    // streams a client may have open at once
+    uint32_t m_max_concurrent_streams = 128;
+    // how much of a request body a client may send ahead, per stream and for the whole connection
+    uint32_t m_stream_window_size = 1024 * 1024;
+    uint32_t m_connection_window_size = 16 * 1024 * 1024;
+    // largest frame payload accepted
+    uint32_t m_max_frame_size = http2::DEFAULT_MAX_FRAME_SIZE;
+    // decoded size of a request header block, counted like SETTINGS_MAX_HEADER_LIST_SIZE
+    uint32_t m_max_header_list_size = 64 * 1024;
+};
+
+/**
+ * @brief Request received on a HTTP/2 stream
+ */
+struct Http2Request {
+    uint32_t m_stream_id;
+    HttpRequestView m_request;
+};
+
+/**
+ * @brief Server side of one HTTP/2 connection, RFC 9113, free of any I/O
+ *        Received bytes go in through feed, complete requests come out of next_request with their header block
+ *        decoded and their body gathered. They are views with version "HTTP/2.0", header names in lowercase and
+ *        :authority as the host header, so handlers written for HTTP/1.1 take them as they are. Responses are
+ *        handed back with submit_response in any order, their bodies leave as DATA frames generated by produce as
+ *        far as the flow control windows of the peer allow, taking turns between streams. Everything to be sent
+ *        piles up until output hands it out as iovecs, bodies set with set_body_view are referred to in place.
+ *        SETTINGS, PING and WINDOW_UPDATE are answered on their own, receive windows are topped up as requests
+ *        are read. A protocol error queues GOAWAY and closes the connection, see closed.
+ * @note not thread safe, one connection is driven by one thread at a time
+ */
+class Http2Connection {
+public:
+    NET_DECLARE_PTRS(Http2Connection)
+
+    explicit Http2Connection(Http2Options options = {});
+
+    /**
+     * @brief take over a connection upgraded from HTTP/1.1 with "Upgrade: h2c", RFC 9113 section 3.2 in its 7540
+     *        edition. settings is the HTTP2-Settings header of the request, request itself becomes stream 1 and is
+     *        handed out by next_request to be answered like the others.
+     * @return false if settings is malformed
+     */
+    bool upgrade(std::string_view settings, HttpRequestView request);
+
+    /**
+     * @brief process bytes received from the client, frames may be split anywhere
+     */
+    void feed(std::string_view data);
+
+    /**
+     * @return next complete request, nullopt if there is none
+     */
+    std::optional<Http2Request> next_request();
+
+    /**
+     * @brief answer the request on stream_id, ignored if the client reset the stream meanwhile
+     * @param head_only send the headers only, for HEAD requests, Content-Length still tells the size of the body
+     */
+    void submit_response(uint32_t stream_id, HttpResponse response, bool head_only = false);
+
+    /**
+     * @brief turn pending response bodies into DATA frames, streams take turns a frame at a time
+     * @param budget stop once this many body bytes are queued, the rest waits for the next call
+     */
+    void produce(std::size_t budget);
+
+    /**
+     * @brief bytes waiting to be sent, valid until consume_output or the next call changing the connection
+     */
+    void output(std::vector<struct iovec>& iov);
+
+    /**
+     * @brief everything output returned was sent
+     */
+    void consume_output();
+
+    [[nodiscard]] bool has_output() const;
+
+    /**
+     * @return true if a response body waits for produce, which may still be blocked by flow control
+     */
+    [[nodiscard]] bool has_pending_bodies() const;
+
+    /**
+     * @return true once the connection should be closed after the output is sent, after a protocol error or
+     *         once the client sent GOAWAY and every stream is done
+     */
+    [[nodiscard]] bool closed() const;
+
+    [[nodiscard]] std::size_t open_streams() const;
+
+private:
+    struct Field {
+        uint32_t m_name_offset;
+        uint32_t m_name_size;
+        uint32_t m_value_offset;
+        uint32_t m_value_size;
+    };
+
+    struct Stream {
+        uint32_t m_id;
+        // END_STREAM received from the client and sent to it
+        bool m_remote_closed = false;
+        bool m_local_closed = false;
+        int64_t m_send_window;
+        // body bytes received since the last WINDOW_UPDATE of the stream
+        uint32_t m_unacked = 0;
+        // decoded header fields of the request, names and values packed in m_field_data
+        std::string m_field_data;
+        std::vector<Field> m_fields;
+        std::string m_body;
+        std::optional<std::size_t> m_content_length;
+        // response whose body is being sent, from m_body_view, its producer or its file
+        HttpResponse m_response;
+        std::string_view m_body_view;
+        HttpBodyProducer m_producer;
+        std::string m_chunk;
+        std::size_t m_chunk_offset = 0;
+        bool m_producer_done = false;
+        std::shared_ptr<const int> m_file;
+        off_t m_file_offset = 0;
+        std::size_t m_file_size = 0;
+        bool m_sending = false;
+    };
+
+    /**
+     * @brief piece of the output, frames are written to m_frames, bodies set by view are referred to in place
+     */
+    struct Segment {
+        // nullptr if the bytes are at m_offset in m_frames, which may move while it grows
+        const char* m_data;
+        std::size_t m_offset;
+        std::size_t m_size;
+    };
+
+    /**
+     * @return false once the connection failed, the rest of the input is dropped
+     */
+    bool handle_frame(const Http2FrameHeader& header, std::string_view payload);
+
+    bool handle_data(const Http2FrameHeader& header, std::string_view payload);
+
+    bool handle_headers(const Http2FrameHeader& header, std::string_view payload);
+
+    bool handle_settings(const Http2FrameHeader& header, std::string_view payload);
+
+    bool handle_window_update(const Http2FrameHeader& header, std::string_view payload);
+
+    /**
+     * @brief decode the header block gathered for m_header_stream once it is complete
+     */
+    bool end_header_block();
+
+    /**
+     * @brief check the decoded request fields of stream, RFC 9113 section 8.3
+     * @return false if the request is malformed
+     */
+    bool validate_request(const Stream& stream) const;
+
+    /**
+     * @brief the request of stream is complete, build its view and queue it for next_request
+     */
+    void finish_request(Stream& stream);
+
+    bool apply_settings(std::string_view payload);
+
+    /**
+     * @brief strip the padding of a PADDED frame
+     * @return false if the padding is longer than the frame
+     */
+    static bool remove_padding(const Http2FrameHeader& header, std::string_view& payload);
+
+    void write_frame(Http2FrameType type, uint8_t flags, uint32_t stream_id, std::string_view payload);
+
+    void write_headers(Stream& stream, const HttpResponse& response, bool end_stream);
+
+    /**
+     * @brief queue the next DATA frame of stream, at most max_size bytes of body
+     * @return body bytes queued
+     */
+    std::size_t produce_frame(Stream& stream, std::size_t max_size);
+
+    void reset_stream(uint32_t stream_id, Http2ErrorCode code);
+
+    /**
+     * @brief connection error, queue GOAWAY and stop reading
+     */
+    bool fail(Http2ErrorCode code);
+
+    /**
+     * @brief the whole body of stream is queued
+     */
+    void finish_sending(Stream& stream);
+
+    /**
+     * @brief erase stream, its response lives on until the output is sent
+     */
+    void close_stream(uint32_t stream_id);
+
+    /**
+     * @brief queue size bytes at data, or the ones at offset in m_frames if data is nullptr
+     */
+    void append_segment(const char* data, std::size_t offset, std::size_t size);
+
+    Http2Options m_options;
+    HpackDecoder m_decoder;
+    HpackEncoder m_encoder;
+
+    std::string m_input;
+    bool m_preface_received = false;
+    // the first frame after the preface has to be SETTINGS
+    bool m_settings_received = false;
+    bool m_failed = false;
+    bool m_goaway_received = false;
+
+    std::unordered_map<uint32_t, std::unique_ptr<Stream>> m_streams;
+    // streams with a body to send, in the order they take turns
+    std::deque<uint32_t> m_sending;
+    std::deque<Http2Request> m_requests;
+    uint32_t m_last_stream_id = 0;
+
+    // header block being gathered from HEADERS and CONTINUATION frames, 0 if none is
+    uint32_t m_header_stream = 0;
+    bool m_header_end_stream = false;
+    std::string m_header_block;
+
+    // settings of the peer
+    uint32_t m_peer_max_frame_size = http2::DEFAULT_MAX_FRAME_SIZE;
+    uint32_t m_peer_initial_window = http2::DEFAULT_WINDOW_SIZE;
+    int64_t m_send_window = http2::DEFAULT_WINDOW_SIZE;
+    // body bytes received since the last WINDOW_UPDATE of the connection
+    uint32_t m_unacked = 0;
+
+    std::string m_frames;
+    std::vector<Segment> m_segments;
+    // closed streams whose response bodies queued segments may still refer to
+    std::vector<std::unique_ptr<Stream>> m_retired;
+};
+
+} // namespace net
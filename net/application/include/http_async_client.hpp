@@ -0,0 +1,245 @@
+#pragma once
+
+#include "address_resolver.hpp"
+#include "defines.hpp"
+#include "dns_resolver.hpp"
+#include "event_loop.hpp"
+#include "http_parser.hpp"
+#include "timing_wheel.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace net {
+
+struct HttpAsyncClientOptions {
+    // event loop threads the requests are spread over
+    std::size_t m_event_loops = 1;
+    // connections to one host from one event loop, in use or idle
+    std::size_t m_max_connections_per_host = 32;
+    // idle connections are closed after this long, 0 keeps them until the server closes them
+    std::chrono::milliseconds m_idle_timeout { 60000 };
+    // for requests sent without a timeout of their own, 0 means no limit
+    std::chrono::milliseconds m_timeout { 0 };
+};
+
+struct HttpResult {
+    std::optional<NetError> m_error;
+    HttpResponse m_response;
+};
+
+/**
+ * @brief HTTP/1.1 client running any number of requests at once on a few event loop threads
+ *        Requests are handed to the loops in turn. Each loop keeps its own keep-alive connections per host, up to
+ *        m_max_connections_per_host, requests beyond wait in line for the next free one. Connecting, sending and
+ *        reading are non-blocking and driven by epoll, timeouts by the timer service of the loop, so a request
+ *        in flight costs a connection and a few hundred bytes, not a thread. A reused connection the server closed
+ *        meanwhile is replaced and the request sent again, unless the server may have acted on it already and
+ *        the method is not idempotent.
+ *        Host names are resolved with DnsResolver::shared() off the loop thread and looked up again once their
+ *        TTL runs out, the old address serving meanwhile.
+ * @note plain TCP only, the first address of a host is used
+ */
+class HttpAsyncClient {
+public:
+    NET_DECLARE_PTRS(HttpAsyncClient)
+
+    /**
+     * @brief called on an event loop thread once the response is complete or the request failed, it must not block
+     */
+    using Callback = std::function<void(std::optional<NetError>, HttpResponse)>;
+
+    explicit HttpAsyncClient(HttpAsyncClientOptions options = {});
+
+    HttpAsyncClient(const HttpAsyncClient&) = delete;
+
+    HttpAsyncClient& operator=(const HttpAsyncClient&) = delete;
+
+    /**
+     * @brief stop the event loops, requests still in flight fail
+     */
+    ~HttpAsyncClient();
+
+    /**
+     * @brief send req to ip:service, safe to call from any thread including the callbacks
+     * @param timeout for the whole exchange, waiting for a connection included, 0 takes the one of the options
+     */
+    void request(
+        const std::string& ip,
+        const std::string& service,
+        HttpRequest req,
+        Callback callback,
+        std::chrono::milliseconds timeout = std::chrono::milliseconds(0)
+    );
+
+    std::future<HttpResult> request(
+        const std::string& ip,
+        const std::string& service,
+        HttpRequest req,
+        std::chrono::milliseconds timeout = std::chrono::milliseconds(0)
+    );
+
+    /**
+     * @return requests sent whose callback has not run yet
+     */
+    std::size_t in_flight() const;
+
+private:
+    struct Connection;
+
+    struct Pending {
+        HttpRequest m_request;
+        Callback m_callback;
+        std::chrono::milliseconds m_timeout;
+        // serialized once, kept for a second attempt
+        std::vector<uint8_t> m_data;
+        TimerId m_timer = 0;
+        std::weak_ptr<Connection> m_connection;
+        bool m_retried = false;
+        bool m_done = false;
+    };
+
+    struct Host;
+
+    struct Connection {
+        int m_fd;
+        Host* m_host;
+        HttpParser m_parser;
+        std::shared_ptr<Pending> m_pending;
+        std::size_t m_sent = 0;
+        bool m_connecting = true;
+        bool m_watching_writable = true;
+        // served a request before the current one, and got any byte of the current response
+        bool m_reused = false;
+        bool m_received = false;
+        bool m_closed = false;
+        TimerId m_idle_timer = 0;
+    };
+
+    struct Host {
+        std::string m_ip;
+        std::string m_service;
+        std::optional<addressResolver::address> m_address;
+        std::chrono::steady_clock::time_point m_expires;
+        bool m_resolving = false;
+        std::deque<std::shared_ptr<Pending>> m_waiting;
+        // most recently released at the back
+        std::vector<std::shared_ptr<Connection>> m_idle;
+        std::unordered_map<int, std::shared_ptr<Connection>> m_connections;
+    };
+
+    struct Submission {
+        std::string m_ip;
+        std::string m_service;
+        std::shared_ptr<Pending> m_pending;
+    };
+
+    struct Resolution {
+        std::pair<std::string, std::string> m_key;
+        std::optional<NetError> m_error;
+        DnsAnswer m_answer;
+    };
+
+    /**
+     * @brief answers of the resolver on their way to a worker, shared with the callbacks so that one arriving
+     *        after the worker is gone finds it closed
+     */
+    struct Resolutions {
+        std::mutex m_mutex;
+        std::vector<Resolution> m_done;
+        int m_wake_fd = -1;
+        bool m_closed = false;
+    };
+
+    /**
+     * @brief one event loop thread with the hosts and connections it drives, everything but m_submissions is
+     *        touched by that thread only
+     */
+    class Worker {
+    public:
+        Worker(const HttpAsyncClientOptions& options, std::atomic<std::size_t>& in_flight);
+
+        ~Worker();
+
+        void submit(Submission submission);
+
+    private:
+        void run();
+
+        void take_submissions();
+
+        void start(Submission& submission);
+
+        void resolve(Host& host);
+
+        /**
+         * @brief take the new addresses, or fail the requests of hosts that have none
+         */
+        void take_resolutions();
+
+        /**
+         * @brief hand waiting requests of host to idle connections, or to new ones while below the limit
+         */
+        void dispatch(Host& host);
+
+        std::optional<NetError> connect(Host& host, std::shared_ptr<Connection>& conn);
+
+        void assign(const std::shared_ptr<Connection>& conn, std::shared_ptr<Pending> pending);
+
+        void send(const std::shared_ptr<Connection>& conn);
+
+        void on_writable(const std::shared_ptr<Connection>& conn);
+
+        void on_readable(const std::shared_ptr<Connection>& conn);
+
+        void watch_writable(Connection& conn, bool enable);
+
+        /**
+         * @brief the connection broke, its request is tried once more on a fresh one if that is safe
+         */
+        void fail_connection(const std::shared_ptr<Connection>& conn, NetError error);
+
+        void release(const std::shared_ptr<Connection>& conn);
+
+        void close(const std::shared_ptr<Connection>& conn);
+
+        void on_timeout(const std::shared_ptr<Pending>& pending);
+
+        void finish(Pending& pending, std::optional<NetError> error, HttpResponse response = {});
+
+        HttpAsyncClientOptions m_options;
+        std::atomic<std::size_t>& m_in_flight;
+        EpollEventLoop::SharedPtr m_event_loop;
+        TimerService::SharedPtr m_timer_service;
+        int m_wake_fd;
+        std::atomic<bool> m_stop = false;
+        std::thread m_thread;
+
+        std::mutex m_mutex;
+        std::vector<Submission> m_submissions;
+        std::shared_ptr<Resolutions> m_resolutions;
+
+        std::map<std::pair<std::string, std::string>, std::unique_ptr<Host>> m_hosts;
+        std::vector<uint8_t> m_buffer;
+    };
+
+    HttpAsyncClientOptions m_options;
+    std::atomic<std::size_t> m_in_flight = 0;
+    std::atomic<std::size_t> m_next_worker = 0;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+};
+
+} // namespace net
@@ -7,12 +7,18 @@
 #include "ssl.hpp"
 #include "ssl_utils.hpp"
 #include "tcp.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
 #include <future>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <shared_mutex>
 #include <string>
+#include <string_view>
 #include <tuple>
 
 namespace net {
@@ -39,6 +45,11 @@ public:
         const std::unordered_map<std::string, std::string>& headers = {},
         const std::string& version = HTTP_VERSION_1_1);
 
+    /**
+     * @brief get on a thread of its own, response has to outlive the future, the other arguments are copied
+     *        Every call costs a thread and calls share the one connection of the client, HttpAsyncClient runs
+     *        many requests at once without either.
+     */
     virtual std::future<std::optional<NetError>> async_get(
         HttpResponse& response,
         const std::string& path,
@@ -166,7 +177,37 @@ public:
 
     virtual std::optional<NetError> read_http(HttpResponse& res);
 
-    std::optional<NetError> connect_server();
+    /**
+     * @brief read only the head of the next response, its body follows through read_http_body
+     */
+    virtual std::optional<NetError> read_http_head(HttpResponse& res);
+
+    /**
+     * @brief read the next piece of the body of the response read_http_head returned, blocks until some arrives
+     * @param finished set once the body is complete, piece may still carry its last bytes
+     */
+    virtual std::optional<NetError> read_http_body(std::string& piece, bool& finished);
+
+    /**
+     * @brief write only the head of req, its body follows through write_http_body and end_http_body
+     *        The body is framed as chunks unless req carries a Content-Length, req's own body is not written.
+     */
+    virtual std::optional<NetError> write_http_head(const HttpRequest& req);
+
+    /**
+     * @brief write the next piece of the body of the request write_http_head started
+     */
+    virtual std::optional<NetError> write_http_body(std::string_view piece);
+
+    /**
+     * @brief end the body of the request write_http_head started, writes the last chunk if it is chunked
+     */
+    virtual std::optional<NetError> end_http_body();
+
+    /**
+     * @param time_out milliseconds, 0 means no limit
+     */
+    std::optional<NetError> connect_server(std::size_t time_out = 0);
 
     std::optional<NetError> close();
 
@@ -189,6 +230,16 @@ public:
 
     void unset_proxy();
 
+    /**
+     * @brief see TcpClient::set_parallel_connect
+     */
+    void set_parallel_connect(bool enable);
+
+    /**
+     * @brief give up on a response once the server stays silent for time_out milliseconds, 0 waits forever
+     */
+    void set_read_timeout(std::size_t time_out);
+
 protected:
     std::shared_ptr<HttpParser> m_parser;
     std::shared_ptr<TcpClient> m_client;
@@ -203,6 +254,10 @@ protected:
     std::string m_proxy_password;
 
     std::shared_ptr<SSLContext> m_ssl_ctx;
+    bool m_parallel_connect = false;
+    std::size_t m_read_timeout = 0;
+    // the body of the request written by write_http_head goes out as chunks
+    bool m_chunked_upload = false;
 };
 
 class HttpClientGroup {
@@ -229,4 +284,215 @@ private:
     std::map<std::tuple<std::string, std::string>, std::shared_ptr<HttpClient>> m_clients;
 };
 
-} // namespace net
\ No newline at end of file
+struct HttpConnectionPoolOptions {
+    // connections open to one host at once, in use or idle
+    std::size_t m_max_connections_per_host = 32;
+    // idle connections kept per host, the ones released beyond are closed
+    std::size_t m_max_idle_per_host = 32;
+    // idle connections older than this are closed, 0 keeps them until the server closes them
+    std::chrono::milliseconds m_idle_timeout { 60000 };
+    // how long acquire waits once a host is at its limit, 0 waits as long as it takes
+    std::chrono::milliseconds m_acquire_timeout { 0 };
+    std::chrono::milliseconds m_connect_timeout { 0 };
+    // longest silence of a server within a response, see HttpClient::set_read_timeout
+    std::chrono::milliseconds m_read_timeout { 0 };
+    // race every address a host resolves to when connecting, see TcpClient::set_parallel_connect
+    bool m_parallel_connect = false;
+};
+
+/**
+ * @brief Keep-alive connections to any number of hosts, each lent to one caller at a time
+ *        Connections are kept per (ip, service, ssl context) and reused most recently released first, so the
+ *        ones not needed age out. A host has its own lock held only to pop or push a connection, connecting
+ *        happens outside of it, callers for different hosts never meet past a shared lookup of the host.
+ *        An idle connection the server closed meanwhile is noticed when it is picked and replaced by a fresh
+ *        one, see send for requests running into a close on the wire.
+ */
+class HttpConnectionPool {
+    struct Host;
+
+public:
+    NET_DECLARE_PTRS(HttpConnectionPool)
+
+    /**
+     * @brief Connection on loan from the pool, closed when the lease goes away unless it was released
+     */
+    class Lease {
+    public:
+        Lease() = default;
+
+        Lease(const Lease&) = delete;
+
+        Lease& operator=(const Lease&) = delete;
+
+        Lease(Lease&& other) noexcept;
+
+        Lease& operator=(Lease&& other) noexcept;
+
+        ~Lease();
+
+        HttpClient* operator->() const {
+            return m_client.get();
+        }
+
+        HttpClient& operator*() const {
+            return *m_client;
+        }
+
+        explicit operator bool() const {
+            return m_client != nullptr;
+        }
+
+        /**
+         * @return true if the connection served a request before this lease
+         */
+        [[nodiscard]] bool reused() const {
+            return m_reused;
+        }
+
+        /**
+         * @brief hand the connection back once the response is read completely, it is closed instead if the
+         *        server asked for that in the last response
+         */
+        void release();
+
+        /**
+         * @brief close the connection, for one left in an unknown state
+         */
+        void discard();
+
+    private:
+        friend class HttpConnectionPool;
+
+        std::shared_ptr<Host> m_host;
+        HttpClient::SharedPtr m_client;
+        bool m_reused = false;
+        bool m_keep_alive = true;
+    };
+
+    explicit HttpConnectionPool(HttpConnectionPoolOptions options = {});
+
+    /**
+     * @brief lend a connection to ip:service, an idle one if there is one, a new one while the host is below its
+     *        limit, otherwise the next one released
+     * @param ctx connect with TLS, connections with different contexts are kept apart
+     */
+    std::optional<NetError> acquire(
+        Lease& lease,
+        const std::string& ip,
+        const std::string& service,
+        std::shared_ptr<SSLContext> ctx = nullptr
+    );
+
+    /**
+     * @brief send req over a pooled connection and read the head of the response, its body follows through
+     *        read_http_body of the lease, which is released or discarded by the caller afterwards. A lease that
+     *        holds a connection from acquire already is sent over that one first.
+     *        A reused connection that turns out to be closed by the server is replaced and req sent once more,
+     *        unless the server may have acted on it already and the method is not idempotent.
+     */
+    std::optional<NetError> send(
+        Lease& lease,
+        HttpResponse& res,
+        const std::string& ip,
+        const std::string& service,
+        const HttpRequest& req,
+        std::shared_ptr<SSLContext> ctx = nullptr
+    );
+
+    /**
+     * @brief write the head of req over a pooled connection, its body follows through write_http_body and
+     *        end_http_body of the lease and receive reads the response. For a body relayed as it arrives, the
+     *        request is only written again on a fresh connection if the head didn't make it out.
+     */
+    std::optional<NetError> send_head(
+        Lease& lease,
+        const std::string& ip,
+        const std::string& service,
+        const HttpRequest& req,
+        std::shared_ptr<SSLContext> ctx = nullptr
+    );
+
+    /**
+     * @brief read the head of the response to the request started by send_head, see send
+     */
+    std::optional<NetError> receive(Lease& lease, HttpResponse& res);
+
+    /**
+     * @brief send req and read the whole response, the connection goes back to the pool afterwards
+     */
+    std::optional<NetError> request(
+        HttpResponse& res,
+        const std::string& ip,
+        const std::string& service,
+        const HttpRequest& req,
+        std::shared_ptr<SSLContext> ctx = nullptr
+    );
+
+    /**
+     * @brief close the connections idle for longer than the idle timeout, otherwise done lazily on acquire
+     */
+    void evict_idle();
+
+    /**
+     * @return connections open to ip:service, in use or idle
+     */
+    std::size_t open_connections(
+        const std::string& ip,
+        const std::string& service,
+        const std::shared_ptr<SSLContext>& ctx = nullptr
+    );
+
+    std::size_t idle_connections(
+        const std::string& ip,
+        const std::string& service,
+        const std::shared_ptr<SSLContext>& ctx = nullptr
+    );
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Idle {
+        HttpClient::SharedPtr m_client;
+        Clock::time_point m_since;
+    };
+
+    struct Host {
+        std::string m_ip;
+        std::string m_service;
+        std::shared_ptr<SSLContext> m_ssl_ctx;
+        HttpConnectionPoolOptions m_options;
+
+        std::mutex m_mutex;
+        std::condition_variable m_released;
+        // most recently released at the back
+        std::deque<Idle> m_idle;
+        std::size_t m_open = 0;
+
+        /**
+         * @brief take back a connection, or only its slot if client is nullptr
+         */
+        void put_back(HttpClient::SharedPtr client);
+
+        /**
+         * @brief pop the idle connections past the idle timeout into expired, closed by the caller outside the lock
+         */
+        void take_expired(std::vector<HttpClient::SharedPtr>& expired);
+    };
+
+    using Key = std::tuple<std::string, std::string, SSLContext*>;
+
+    std::shared_ptr<Host>
+    find_host(const std::string& ip, const std::string& service, const std::shared_ptr<SSLContext>& ctx, bool create);
+
+    /**
+     * @return true if client still looks usable, the server has not closed it nor sent anything unasked
+     */
+    static bool alive(const HttpClient& client);
+
+    HttpConnectionPoolOptions m_options;
+    std::shared_mutex m_mutex;
+    std::map<Key, std::shared_ptr<Host>> m_hosts;
+};
+
+} // namespace net
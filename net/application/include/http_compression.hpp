@@ -0,0 +1,147 @@
+#pragma once
+
+#include "defines.hpp"
+#include "http_parser.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace net {
+
+enum class ContentCoding : uint8_t { IDENTITY = 0, GZIP, DEFLATE, BROTLI };
+
+/**
+ * @return token of coding in Accept-Encoding and Content-Encoding
+ */
+std::string_view coding_name(ContentCoding coding);
+
+/**
+ * @return codings this build can compress with, best first, brotli only if it was found at build time
+ */
+std::span<const ContentCoding> supported_codings();
+
+/**
+ * @brief pick the coding of available that accept_encoding allows with the highest q value, ties go to the one
+ *        listed first in available
+ * @return IDENTITY if none of them is acceptable
+ */
+ContentCoding negotiate_coding(std::string_view accept_encoding, std::span<const ContentCoding> available);
+
+/**
+ * @brief Incremental encoder of one body
+ */
+class Compressor {
+public:
+    NET_DECLARE_PTRS(Compressor)
+
+    enum class Flush {
+        // buffer as much as the encoder likes
+        NONE,
+        // everything given so far becomes decodable, for streamed bodies whose pieces should reach the client
+        SYNC,
+        // end the stream, the compressor can't be used afterwards
+        FINISH,
+    };
+
+    /**
+     * @param level 1 to 9 for gzip and deflate, 0 to 11 for brotli, -1 picks the default of the coding
+     * @return nullptr for IDENTITY and codings not built in
+     */
+    static UniquePtr create(ContentCoding coding, int level = -1);
+
+    virtual ~Compressor() = default;
+
+    /**
+     * @brief compress input and append what the encoder produced to out
+     * @throw std::runtime_error if the encoder fails
+     */
+    virtual void compress(std::string_view input, std::string& out, Flush flush) = 0;
+};
+
+struct CompressionOptions {
+    // bodies smaller than this go out as they are, the coding overhead eats the savings
+    std::size_t m_min_size = 1024;
+    // media types which are compressed, a trailing "/*" matches every subtype
+    std::vector<std::string> m_mime_types = {
+        "text/*",          "application/json",      "application/javascript", "application/xml",
+        "image/svg+xml",   "application/wasm",      "application/manifest+json",
+    };
+    // codings offered, in order of preference when the client accepts several equally
+    std::vector<ContentCoding> m_codings { supported_codings().begin(), supported_codings().end() };
+    int m_gzip_level = 6;
+    int m_brotli_quality = 5;
+    // total size of the cached compressed responses, 0 disables the cache
+    std::size_t m_cache_capacity = 16 * 1024 * 1024;
+    // larger bodies are compressed every time
+    std::size_t m_max_cached_body = 256 * 1024;
+};
+
+/**
+ * @brief Content-Encoding stage of HttpServer, see HttpServer::enable_compression
+ *        Responses with a compressible Content-Type get "Vary: Accept-Encoding" and, if the client accepts one of
+ *        the codings, a compressed body with a matching Content-Length and ETag. A body producer is wrapped and
+ *        compressed piece by piece. A body seen twice is hot: its compressed form is cached, keyed by coding and
+ *        content, and later responses point into the cache instead of compressing it again.
+ *        Responses which already carry a Content-Encoding, partial responses, body files and bodies marked
+ *        "Cache-Control: no-transform" are left alone.
+ */
+class ResponseCompressor {
+public:
+    NET_DECLARE_PTRS(ResponseCompressor)
+
+    explicit ResponseCompressor(CompressionOptions options = {});
+
+    /**
+     * @brief compress the body of response for a request which sent accept_encoding
+     */
+    void apply(std::string_view accept_encoding, HttpResponse& response);
+
+    /**
+     * @return number of cached compressed bodies and their total size, originals included
+     */
+    [[nodiscard]] std::size_t cached_entries() const;
+    [[nodiscard]] std::size_t cached_size() const;
+
+private:
+    struct Entry {
+        ContentCoding m_coding;
+        uint64_t m_key;
+        std::string m_body;
+        // empty if the body doesn't get smaller
+        std::string m_compressed;
+    };
+
+    [[nodiscard]] bool compressible_type(std::string_view content_type) const;
+
+    [[nodiscard]] int level(ContentCoding coding) const;
+
+    std::string compress(ContentCoding coding, std::string_view body) const;
+
+    /**
+     * @return the cached entry of body, nullptr if there is none
+     * @param hot set if body was seen before without being cached, it is remembered as seen otherwise
+     */
+    std::shared_ptr<const Entry> cached(ContentCoding coding, uint64_t key, std::string_view body, bool& hot);
+
+    void insert(std::shared_ptr<const Entry> entry);
+
+    CompressionOptions m_options;
+
+    mutable std::mutex m_mutex;
+    // most recently used first
+    std::list<std::shared_ptr<const Entry>> m_lru;
+    std::unordered_map<uint64_t, std::list<std::shared_ptr<const Entry>>::iterator> m_entries;
+    std::size_t m_cached_size = 0;
+    // keys of bodies seen once, direct mapped so that forgetting is free
+    std::array<uint64_t, 1024> m_seen {};
+};
+
+} // namespace net
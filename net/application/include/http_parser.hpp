@@ -1,21 +1,33 @@
 #pragma once
 
+#include "buffer_pool.hpp"
 #include "enum_parser.hpp"
+#include "simd_scan.hpp"
 #include <algorithm>
+#include <array>
 #include <cassert>
+#include <charconv>
 #include <cstddef>
 #include <cstdint>
+#include <ctime>
+#include <functional>
 #include <memory>
 #include <optional>
 #include <stdexcept>
 #include <string>
 #include <string_view>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unordered_map>
 #include <vector>
 
 namespace net {
 
+/**
+ * @brief compare header names or tokens, ignoring the case of ASCII letters
+ */
+bool iequals(std::string_view lhs, std::string_view rhs);
+
 enum class HttpMethod {
     UNKNOWN = -1,
     GET,
@@ -29,6 +41,11 @@ enum class HttpMethod {
     CONNECT,
 };
 
+/**
+ * @return true if sending a request twice has the same effect as sending it once, RFC 9110 section 9.2.2
+ */
+bool idempotent(HttpMethod method);
+
 enum class HttpResponseCode {
     UNKNOWN = -1,
     CONTINUE = 100,
@@ -100,28 +117,147 @@ enum class HttpResponseCode {
 #define HTTP_VERSION_1_1 "HTTP/1.1"
 #define HTTP_VERSION_2_0 "HTTP/2.0"
 
+/**
+ * @brief fills chunk with the next piece of a streamed body
+ * @return false once the body is complete, chunk may still carry its last piece
+ */
+using HttpBodyProducer = std::function<bool(std::string& chunk)>;
+
+/**
+ * @brief Path parameters captured by a route, see HttpRouter
+ *        Names point into the router which matched them. Values are kept as offsets into the matched path and
+ *        read back through it, so a request owning its url can be copied without them dangling.
+ */
+class RouteParams {
+public:
+    static constexpr std::size_t MAX_PARAMS = 8;
+
+    /**
+     * @return false if all MAX_PARAMS slots are taken
+     */
+    bool push(std::string_view name, std::size_t offset, std::size_t size);
+
+    void pop();
+
+    void clear();
+
+    [[nodiscard]] std::size_t size() const;
+
+    [[nodiscard]] bool empty() const;
+
+    [[nodiscard]] std::string_view name(std::size_t index) const;
+
+    /**
+     * @return value of the index th parameter, path is the one the route was matched on
+     */
+    [[nodiscard]] std::string_view value(std::string_view path, std::size_t index) const;
+
+    /**
+     * @return value of the parameter called name, empty if there is none
+     */
+    [[nodiscard]] std::string_view get(std::string_view path, std::string_view name) const;
+
+private:
+    struct Param {
+        std::string_view name;
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    std::array<Param, MAX_PARAMS> m_params;
+    std::size_t m_size = 0;
+};
+
 struct HttpResponse {
 public:
+    // size of the reads set_body_fd streams the file with
+    static constexpr std::size_t BODY_FD_CHUNK_SIZE = 64 * 1024;
+
     HttpResponse& set_version(const std::string& version);
     HttpResponse& set_status_code(HttpResponseCode status_code);
     HttpResponse& set_reason(const std::string& reason);
     HttpResponse& set_header(const std::string& key, const std::string& value);
     HttpResponse& set_headers(const std::unordered_map<std::string, std::string>& headers);
+
+    /**
+     * @brief remove every header named key, ignoring the case of the key
+     */
+    HttpResponse& remove_header(std::string_view key);
     HttpResponse& set_body(const std::string& body);
 
+    /**
+     * @brief stream the body from producer instead of m_body, it is pulled as the connection drains
+     *        Sent with "Transfer-Encoding: chunked" unless a Content-Length header is set.
+     */
+    HttpResponse& set_body_producer(HttpBodyProducer producer);
+
+    /**
+     * @brief stream the body from fd until end of file, the response owns fd and closes it afterwards
+     *        Content-Length is taken from the file size when fd is a regular file. Reads block, so fd should be a
+     *        file or a pipe which keeps up.
+     */
+    HttpResponse& set_body_fd(int fd);
+
+    /**
+     * @brief stream the body from generator, every call returns the next piece and nullopt ends the body
+     */
+    HttpResponse& set_body_generator(std::function<std::optional<std::string>()> generator);
+
+    /**
+     * @brief send body without copying it into the response, owner keeps the memory it points into alive for as
+     *        long as the response or one of its copies needs it. body() stays empty, see body_view.
+     */
+    HttpResponse& set_body_view(std::string_view body, std::shared_ptr<const void> owner);
+
+    /**
+     * @brief send size bytes of file starting at offset as the body, the server hands them to sendfile so they
+     *        never pass through userspace. The descriptor is shared, whoever created it decides when it is closed.
+     *        Content-Length is size unless a header says otherwise.
+     */
+    HttpResponse& set_body_file(std::shared_ptr<const int> file, off_t offset, std::size_t size);
+
     [[nodiscard]] const std::string& version() const;
     [[nodiscard]] HttpResponseCode status_code() const;
     [[nodiscard]] const std::string& reason() const;
+
+    /**
+     * @brief value of the header named key, ignoring the case of the key, empty if it is not set
+     */
     [[nodiscard]] const std::string& header(const std::string& key) const;
     [[nodiscard]] const std::unordered_map<std::string, std::string>& headers() const;
+
+    /**
+     * @brief whether a header named key is set, ignoring the case of the key
+     */
+    [[nodiscard]] bool has_header(std::string_view key) const;
+
+    /**
+     * @return true if the server keeps the connection open after this response, RFC 9112 section 9.3
+     */
+    [[nodiscard]] bool keep_alive() const;
     [[nodiscard]] const std::string& body() const;
 
+    /**
+     * @return the body set by set_body_view, otherwise body()
+     */
+    [[nodiscard]] std::string_view body_view() const;
+    [[nodiscard]] const HttpBodyProducer& body_producer() const;
+    [[nodiscard]] const std::shared_ptr<const int>& body_file() const;
+    [[nodiscard]] off_t body_file_offset() const;
+    [[nodiscard]] std::size_t body_file_size() const;
+
 private:
     std::string m_version;
     HttpResponseCode m_status_code;
     std::string m_reason;
     std::unordered_map<std::string, std::string> m_headers;
     std::string m_body;
+    std::string_view m_body_view;
+    std::shared_ptr<const void> m_body_owner;
+    HttpBodyProducer m_body_producer;
+    std::shared_ptr<const int> m_body_file;
+    off_t m_body_file_offset = 0;
+    std::size_t m_body_file_size = 0;
 };
 
 struct HttpRequest {
@@ -132,9 +268,26 @@ public:
     HttpRequest& set_headers(const std::unordered_map<std::string, std::string>& headers);
     HttpRequest& set_body(const std::string& body);
     HttpRequest& set_method(HttpMethod method);
+    HttpRequest& set_params(const RouteParams& params);
 
     [[nodiscard]] HttpMethod method() const;
     [[nodiscard]] const std::string& url() const;
+
+    /**
+     * @brief url without the query string
+     */
+    [[nodiscard]] std::string_view path() const;
+
+    /**
+     * @brief query string of the url without the '?', empty if there is none
+     */
+    [[nodiscard]] std::string_view query() const;
+
+    /**
+     * @return value of the path parameter called name in the route the request matched, empty if there is none
+     */
+    [[nodiscard]] std::string_view param(std::string_view name) const;
+    [[nodiscard]] const RouteParams& params() const;
     [[nodiscard]] const std::string& version() const;
     [[nodiscard]] const std::string& header(const std::string& key) const;
     [[nodiscard]] const std::unordered_map<std::string, std::string>& headers() const;
@@ -146,6 +299,278 @@ private:
     std::string m_version;
     std::unordered_map<std::string, std::string> m_headers;
     std::string m_body;
+    RouteParams m_params;
+};
+
+/**
+ * @brief Incremental decoder of the chunked transfer coding, RFC 9112 section 7.1
+ *        Input may be split anywhere, decode consumes what it can and the rest is fed again with more bytes
+ *        appended. Chunk extensions are ignored, trailer fields are handed to on_trailer.
+ */
+class ChunkedDecoder {
+public:
+    // a chunk size or trailer line longer than this fails the decoder
+    static constexpr std::size_t MAX_LINE_SIZE = 4096;
+
+    void reset() {
+        m_state = State::SIZE;
+        m_remaining = 0;
+    }
+
+    [[nodiscard]] bool finished() const {
+        return m_state == State::DONE;
+    }
+
+    [[nodiscard]] bool failed() const {
+        return m_state == State::FAILED;
+    }
+
+    /**
+     * @param on_data called with every piece of chunk data, views point into input
+     * @param on_trailer called with key and value of every trailer field
+     * @return number of bytes of input consumed
+     */
+    template<class OnData, class OnTrailer>
+    std::size_t decode(std::string_view input, OnData&& on_data, OnTrailer&& on_trailer) {
+        std::size_t pos = 0;
+        while (m_state != State::DONE && m_state != State::FAILED && pos < input.size()) {
+            if (m_state == State::DATA) {
+                auto size = std::min(m_remaining, input.size() - pos);
+                on_data(input.substr(pos, size));
+                pos += size;
+                m_remaining -= size;
+                if (m_remaining == 0) {
+                    m_state = State::DATA_END;
+                }
+                continue;
+            }
+            if (m_state == State::DATA_END) {
+                if (input.size() - pos < 2) {
+                    break;
+                }
+                m_state = input.substr(pos, 2) == "\r\n" ? State::SIZE : State::FAILED;
+                pos += 2;
+                continue;
+            }
+            // SIZE and TRAILER work on whole lines
+            auto line_end = simd::find_crlf(input, pos);
+            if (line_end == std::string_view::npos) {
+                if (input.size() - pos > MAX_LINE_SIZE) {
+                    m_state = State::FAILED;
+                }
+                break;
+            }
+            auto line = input.substr(pos, line_end - pos);
+            pos = line_end + 2;
+            if (m_state == State::SIZE) {
+                auto size = parse_size(line);
+                if (!size.has_value()) {
+                    m_state = State::FAILED;
+                } else {
+                    m_remaining = size.value();
+                    m_state = m_remaining == 0 ? State::TRAILER : State::DATA;
+                }
+            } else if (line.empty()) {
+                m_state = State::DONE;
+            } else {
+                auto colon = simd::find_char(line, ':');
+                if (colon == std::string_view::npos || colon == 0) {
+                    m_state = State::FAILED;
+                } else {
+                    auto value = line.substr(colon + 1);
+                    auto first = value.find_first_not_of(" \t");
+                    auto last = value.find_last_not_of(" \t");
+                    value = first == std::string_view::npos ? std::string_view {}
+                                                            : value.substr(first, last - first + 1);
+                    on_trailer(line.substr(0, colon), value);
+                }
+            }
+        }
+        return pos;
+    }
+
+    /**
+     * @brief size of a chunk size line, extensions after ';' are skipped, nullopt if malformed
+     */
+    static std::optional<std::size_t> parse_size(std::string_view line) {
+        auto digits = line.substr(0, line.find_first_of("; \t"));
+        // 15 hex digits at most, the size must not overflow
+        if (digits.empty() || digits.size() > 15) {
+            return std::nullopt;
+        }
+        std::size_t size = 0;
+        auto [ptr, ec] = std::from_chars(digits.data(), digits.data() + digits.size(), size, 16);
+        if (ec != std::errc() || ptr != digits.data() + digits.size()) {
+            return std::nullopt;
+        }
+        return size;
+    }
+
+private:
+    enum class State : uint8_t { SIZE, DATA, DATA_END, TRAILER, DONE, FAILED };
+
+    State m_state = State::SIZE;
+    // bytes of the current chunk not decoded yet
+    std::size_t m_remaining = 0;
+};
+
+/**
+ * @brief how far the request being read has come, IDLE means no byte of the next request arrived yet
+ */
+enum class HttpReadPhase : uint8_t { IDLE, HEADER, BODY };
+
+struct HttpHeaderView {
+    std::string_view key;
+    std::string_view value;
+};
+
+/**
+ * @brief Parsed request whose fields point into the buffer it was received in
+ *        The view holds a reference on that buffer, so the fields stay valid for as long as the view (or a copy
+ *        of it) lives. Header lookup ignores the case of the key without allocating.
+ */
+class HttpRequestView {
+public:
+    static constexpr std::size_t MAX_HEADERS = 64;
+
+    [[nodiscard]] HttpMethod method() const;
+    [[nodiscard]] std::string_view url() const;
+
+    /**
+     * @brief url without the query string
+     */
+    [[nodiscard]] std::string_view path() const;
+
+    /**
+     * @brief query string of the url without the '?', empty if there is none
+     */
+    [[nodiscard]] std::string_view query() const;
+
+    /**
+     * @return value of the path parameter called name in the route the request matched, empty if there is none
+     */
+    [[nodiscard]] std::string_view param(std::string_view name) const;
+    [[nodiscard]] const RouteParams& params() const;
+    void set_params(const RouteParams& params);
+    [[nodiscard]] std::string_view version() const;
+    [[nodiscard]] std::string_view body() const;
+
+    /**
+     * @return value of the first header named key, empty if there is none
+     */
+    [[nodiscard]] std::string_view header(std::string_view key) const;
+    [[nodiscard]] bool has_header(std::string_view key) const;
+    [[nodiscard]] const HttpHeaderView* headers_begin() const;
+    [[nodiscard]] const HttpHeaderView* headers_end() const;
+
+    /**
+     * @return fd of the connection the request came in on, set by the server, -1 if unknown
+     */
+    [[nodiscard]] int remote_fd() const;
+    void set_remote_fd(int fd);
+
+    /**
+     * @brief copy into an owning HttpRequest, header keys are lowercased like the copying parser does
+     */
+    [[nodiscard]] HttpRequest to_request() const;
+
+private:
+    friend class HttpRequestViewParser;
+    friend class Http2Connection;
+
+    PooledBuffer m_buffer;
+    HttpMethod m_method = HttpMethod::UNKNOWN;
+    std::string_view m_url;
+    std::string_view m_version;
+    std::string_view m_body;
+    std::array<HttpHeaderView, MAX_HEADERS> m_headers;
+    std::size_t m_header_num = 0;
+    RouteParams m_params;
+    int m_remote_fd = -1;
+};
+
+/**
+ * @brief Zero copy HTTP/1.1 request parser
+ *        Received buffers are adopted rather than copied whenever nothing is pending, and parsing only records
+ *        where the fields are. A finished request shares the buffer with the parser, bytes behind it are only
+ *        ever appended, so views handed out earlier never move. Chunked bodies are decoded in place into a
+ *        contiguous body, their trailer fields are skipped.
+ */
+class HttpRequestViewParser {
+public:
+    // a header block larger than this fails the parser
+    static constexpr std::size_t MAX_HEADER_SIZE = 64 * 1024;
+
+    void feed(PooledBuffer&& buffer);
+
+    void feed(std::string_view data);
+
+    /**
+     * @return next complete request, nullopt if more bytes are needed or the parser failed
+     */
+    std::optional<HttpRequestView> next();
+
+    /**
+     * @brief head of the pending request with an empty body, handed out once as soon as the header is complete
+     *        Unless stream_body is called next carries on buffering the body as usual.
+     */
+    std::optional<HttpRequestView> next_head();
+
+    /**
+     * @brief hand the body of the request whose head next_head returned to read_body instead of buffering it
+     */
+    void stream_body();
+
+    /**
+     * @brief pass the body bytes received so far to on_data, consumed buffers are released right away
+     * @return true once the body is complete, next goes on with the following request from then on
+     */
+    bool read_body(const std::function<void(std::string_view)>& on_data);
+
+    /**
+     * @brief true once a malformed request was seen, the connection can't be recovered
+     */
+    [[nodiscard]] bool failed() const;
+
+    [[nodiscard]] HttpReadPhase phase() const;
+
+    /**
+     * @brief bytes received behind the last request handed out, for a connection switching protocols
+     */
+    [[nodiscard]] std::string_view pending() const;
+
+private:
+    bool parse_head(std::string_view head);
+
+    /**
+     * @brief find and parse the header of the pending request
+     * @return true once it is parsed, false if more bytes are needed or it is malformed
+     */
+    bool locate_head();
+
+    void finish_request();
+
+    PooledBuffer m_buffer;
+    // offset of the request being parsed in m_buffer
+    std::size_t m_begin = 0;
+    // bytes after m_begin already searched for the end of the header
+    std::size_t m_scanned = 0;
+    // length of the header including the blank line, 0 while it is incomplete
+    std::size_t m_head_size = 0;
+    std::size_t m_content_length = 0;
+    // chunked bodies are decoded in place, the data is moved down over the framing as it arrives
+    bool m_chunked = false;
+    ChunkedDecoder m_chunked_decoder;
+    // encoded bytes consumed and decoded bytes produced behind the head
+    std::size_t m_chunked_raw = 0;
+    std::size_t m_chunked_body = 0;
+    // m_buffer.data() when m_pending was filled, the fields are located again if the data has moved since
+    const uint8_t* m_pending_base = nullptr;
+    HttpRequestView m_pending;
+    bool m_head_reported = false;
+    // the body of the pending request goes through read_body, m_content_length counts down what is left of it
+    bool m_streaming = false;
+    bool m_failed = false;
 };
 
 struct http11_header_parser {
@@ -154,7 +579,7 @@ struct http11_header_parser {
     std::string m_headline; // "GET / HTTP/1.1"
     std::unordered_map<std::string, std::string> m_header_keys; // {"Host": "142857.red", "Accept": "*/*",
     // "RemoteTarget: close"}
-    std::string m_body; // 不小心超量读取的正文（如果有的话）
+    std::string m_body; // 正文，由 _http_base_parser 填充
     bool m_header_finished = false;
 
     void reset_state();
@@ -163,7 +588,10 @@ struct http11_header_parser {
 
     void _extract_headers();
 
-    void push_chunk(std::string& chunk);
+    /**
+     * @return bytes of chunk taken into the header, the rest belongs to the body
+     */
+    std::size_t push_chunk(std::string_view chunk);
 
     std::string& headline();
 
@@ -180,12 +608,18 @@ struct _http_base_parser {
     size_t m_content_length = 0;
     size_t body_accumulated_size = 0;
     bool m_body_finished = false;
+    bool m_chunked = false;
+    ChunkedDecoder m_chunked_decoder;
+    std::unordered_map<std::string, std::string> m_trailers;
 
     void reset_state() {
         m_header_parser.reset_state();
         m_content_length = 0;
         body_accumulated_size = 0;
         m_body_finished = false;
+        m_chunked = false;
+        m_chunked_decoder.reset();
+        m_trailers.clear();
     }
 
     [[nodiscard]] bool header_finished() {
@@ -196,6 +630,24 @@ struct _http_base_parser {
         return m_body_finished;
     }
 
+    /**
+     * @brief true once a malformed chunked body was seen, the stream can't be recovered
+     */
+    [[nodiscard]] bool failed() const {
+        return m_chunked_decoder.failed();
+    }
+
+    [[nodiscard]] bool chunked() const {
+        return m_chunked;
+    }
+
+    /**
+     * @brief trailer fields of a chunked body, keys lowercased like the headers
+     */
+    std::unordered_map<std::string, std::string>& trailers() {
+        return m_trailers;
+    }
+
     std::string& headers_raw() {
         return m_header_parser.headers_raw();
     }
@@ -264,34 +716,74 @@ struct _http_base_parser {
         }
     }
 
-    void push_chunk(std::string& chunk) {
+    bool _extract_chunked() {
+        // transfer-encoding overrides content-length, chunked has to be the last coding
+        auto& headers = m_header_parser.headers();
+        auto it = headers.find("transfer-encoding");
+        if (it == headers.end()) {
+            return false;
+        }
+        std::string_view coding = it->second;
+        coding = coding.substr(coding.empty() ? 0 : coding.find_last_of(',') + 1);
+        coding = coding.substr(std::min(coding.find_first_not_of(" \t"), coding.size()));
+        coding = coding.substr(0, coding.find_last_not_of(" \t") + 1);
+        return coding.size() == 7 && std::equal(coding.begin(), coding.end(), "chunked", [](char a, char b) {
+                   return (a | 0x20) == b;
+               });
+    }
+
+    /**
+     * @brief parse chunk in place, only the header and the body are copied out of it
+     * @return bytes of chunk consumed, the rest belongs to what follows the message
+     */
+    std::size_t push_chunk(std::string_view chunk) {
         assert(!m_body_finished);
+        std::size_t consumed = 0;
         if (!m_header_parser.header_finished()) {
-            m_header_parser.push_chunk(chunk);
-            if (m_header_parser.header_finished()) {
-                body_accumulated_size = body().size();
-                m_content_length = _extract_content_length();
-                if (body_accumulated_size >= m_content_length) {
-                    m_body_finished = true;
-                }
+            consumed = m_header_parser.push_chunk(chunk);
+            if (!m_header_parser.header_finished()) {
+                return consumed;
             }
-        } else {
-            auto sub = chunk.substr(
-                0,
-                m_content_length - body_accumulated_size > chunk.size() ? chunk.size()
-                                                                        : m_content_length - body_accumulated_size
-            );
-            chunk = chunk.substr(sub.size());
-            body().append(sub);
-            body_accumulated_size += sub.size();
-            if (body_accumulated_size >= m_content_length) {
+            m_chunked = _extract_chunked();
+            m_content_length = m_chunked ? 0 : _extract_content_length();
+            body_accumulated_size = 0;
+            if (!m_chunked && m_content_length == 0) {
                 m_body_finished = true;
+                return consumed;
             }
+            chunk.remove_prefix(consumed);
         }
+        if (m_chunked) {
+            consumed += m_chunked_decoder.decode(
+                chunk,
+                [this](std::string_view data) {
+                    body().append(data);
+                    body_accumulated_size += data.size();
+                },
+                [this](std::string_view key, std::string_view value) {
+                    std::string lower(key);
+                    std::transform(lower.begin(), lower.end(), lower.begin(), [](char c) {
+                        return 'A' <= c && c <= 'Z' ? static_cast<char>(c + 'a' - 'A') : c;
+                    });
+                    m_trailers.insert_or_assign(std::move(lower), std::string(value));
+                }
+            );
+            m_body_finished = m_chunked_decoder.finished();
+            return consumed;
+        }
+        auto sub = chunk.substr(0, std::min(chunk.size(), m_content_length - body_accumulated_size));
+        body().append(sub);
+        body_accumulated_size += sub.size();
+        if (body_accumulated_size >= m_content_length) {
+            m_body_finished = true;
+        }
+        return consumed + sub.size();
     }
 
     std::string read_some_body() {
-        return std::move(body());
+        std::string piece;
+        piece.swap(body());
+        return piece;
     }
 };
 
@@ -367,6 +859,35 @@ struct _http_base_writer {
     void write_body(std::string_view body) {
         m_header_writer.buffer().append(body);
     }
+
+    /**
+     * @brief append body as one chunk of the chunked transfer coding, an empty body writes nothing since a zero
+     *        sized chunk ends the body
+     */
+    void write_chunk(std::string_view body) {
+        if (body.empty()) {
+            return;
+        }
+        char size[16];
+        auto [ptr, ec] = std::to_chars(size, size + sizeof(size), body.size(), 16);
+        auto& buffer = m_header_writer.buffer();
+        buffer.append(size, ptr);
+        buffer.append("\r\n");
+        buffer.append(body);
+        buffer.append("\r\n");
+    }
+
+    void write_last_chunk(const std::unordered_map<std::string, std::string>& trailers = {}) {
+        auto& buffer = m_header_writer.buffer();
+        buffer.append("0\r\n");
+        for (auto& [key, value]: trailers) {
+            buffer.append(key);
+            buffer.append(": ");
+            buffer.append(value);
+            buffer.append("\r\n");
+        }
+        buffer.append("\r\n");
+    }
 };
 
 template<class HeaderWriter = http11_header_writer>
@@ -376,35 +897,161 @@ struct http_request_writer: _http_base_writer<HeaderWriter> {
     }
 };
 
+/**
+ * @return "HTTP/1.1 <code> <reason>\r\n" of code, looked up in a table built at compile time, empty if code is
+ *         not in it
+ */
+std::string_view status_line(HttpResponseCode code);
+
+/**
+ * @return reason phrase of code as RFC 9110 names it, empty if code is not in the status line table
+ */
+std::string_view reason_phrase(HttpResponseCode code);
+
+/**
+ * @return "Date: <IMF-fixdate>\r\n" of the current second, formatted at most once a second by each thread
+ */
+std::string_view date_header();
+
+/**
+ * @return time as an IMF-fixdate, "Sun, 06 Nov 1994 08:49:37 GMT"
+ */
+std::string http_date(std::time_t time);
+
+/**
+ * @return time of an IMF-fixdate, nullopt if date is not one
+ */
+std::optional<std::time_t> parse_http_date(std::string_view date);
+
 template<class HeaderWriter = http11_header_writer>
 struct http_response_writer: _http_base_writer<HeaderWriter> {
     void begin_header(int status) {
-        this->_begin_header("HTTP/1.1", std::to_string(status), "OK");
+        this->_begin_header("HTTP/1.1", std::to_string(status), reason_phrase(static_cast<HttpResponseCode>(status)));
     }
 };
 
+/**
+ * @brief Scatter gather serializer of responses
+ *        Only the header fields are formatted, into a buffer of the serializer which is reused across responses.
+ *        The status line comes from the status line table, Date from the per thread cache, and the body is
+ *        pointed at where it lies in the response, so nothing is concatenated before the writev.
+ */
+class HttpResponseSerializer {
+public:
+    // status line, header fields and body
+    static constexpr std::size_t MAX_IOV = 3;
+
+    /**
+     * @brief serialize res into at most MAX_IOV entries of iov
+     *        The entries refer to res and to this serializer, both must stay untouched until they are written.
+     *        Date is added unless res has one, Content-Length and Transfer-Encoding like HttpParser::write_res.
+     *        With a body producer or a body file only the head is serialized. A reason which is neither the standard phrase nor
+     *        the name of the code is written as is.
+     * @return number of entries used
+     */
+    std::size_t serialize(const HttpResponse& res, struct iovec* iov);
+
+private:
+    std::string m_head;
+};
+
 class HttpParser: public std::enable_shared_from_this<HttpParser> {
 public:
+    using ReadPhase = HttpReadPhase;
+
     HttpParser() = default;
 
     std::vector<uint8_t> write_req(const HttpRequest& req);
 
+    std::vector<uint8_t> write_req_chunk(std::string_view body);
+
+    std::vector<uint8_t> write_req_last_chunk();
+
+    /**
+     * @brief with a body producer set only the head is written, the body follows through write_res_chunk and
+     *        write_res_last_chunk, framed as chunks unless the response carries a Content-Length
+     */
     std::vector<uint8_t> write_res(const HttpResponse& res);
 
+    std::vector<uint8_t> write_res_chunk(std::string_view body);
+
+    std::vector<uint8_t> write_res_last_chunk(const std::unordered_map<std::string, std::string>& trailers = {});
+
+    /**
+     * @brief a chunked body is handed out decoded, with Content-Length in place of Transfer-Encoding and the
+     *        trailer fields merged into the headers
+     */
     std::optional<HttpRequest> read_req();
 
     void add_req_read_buffer(const std::vector<uint8_t>& buffer);
 
+    void add_req_read_buffer(const PooledBuffer& buffer);
+
+    ReadPhase req_phase();
+
+    /**
+     * @brief zero copy mode, requests are handed out as views into the received buffers
+     * @note don't mix with add_req_read_buffer and read_req on the same parser
+     */
+    void add_req_view_buffer(PooledBuffer&& buffer);
+
+    std::optional<HttpRequestView> read_req_view();
+
+    /**
+     * @brief streaming counterparts of read_req_view, see HttpRequestViewParser::next_head
+     */
+    std::optional<HttpRequestView> read_req_view_head();
+
+    void stream_req_view_body();
+
+    bool read_req_view_body(const std::function<void(std::string_view)>& on_data);
+
+    [[nodiscard]] bool req_view_failed() const;
+
+    [[nodiscard]] std::string_view req_view_pending() const;
+
     std::optional<HttpResponse> read_res();
 
+    /**
+     * @brief head of the response being read, handed out once as soon as it is complete, the body is left to
+     *        read_res_body
+     * @note don't mix with read_res on the same response
+     */
+    std::optional<HttpResponse> read_res_head();
+
+    /**
+     * @brief move the body bytes decoded so far into piece
+     * @return true once the body is complete
+     */
+    bool read_res_body(std::string& piece);
+
+    /**
+     * @brief true once a malformed chunked response was seen
+     */
+    [[nodiscard]] bool res_failed() const;
+
     void add_res_read_buffer(const std::vector<uint8_t>& buffer);
 
+    void add_res_read_buffer(const PooledBuffer& buffer);
+
 private:
     http_response_parser<> m_res_parser;
+    bool m_res_head_reported = false;
     http_request_parser<> m_req_parser;
+    HttpRequestViewParser m_req_view_parser;
+    bool m_view_mode = false;
     http_request_writer<> m_req_writer;
     http_response_writer<> m_res_writer;
+    HttpResponseSerializer m_res_serializer;
+
+    /**
+     * @brief push data to parser, bytes it leaves over wait in pending for the next message
+     *        Received data is parsed where it is, only what is left of it once a message ends is copied.
+     */
+    template<class Parser>
+    static void feed(Parser& parser, std::string& pending, std::string_view data);
 
+    // bytes received behind the message being parsed, empty most of the time
     std::string m_req_read_buffer;
     std::string m_res_read_buffer;
     std::string m_req_write_buffer;
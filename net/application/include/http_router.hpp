@@ -0,0 +1,185 @@
+#pragma once
+
+#include "http_parser.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace net {
+
+/**
+ * @brief Radix tree mapping route patterns to handlers
+ *        A pattern is a path whose segments may be ":name", matching one non empty segment, or end with "*name",
+ *        matching the rest of the path including slashes. Static text is stored in compressed edges, so a lookup
+ *        walks the path once without hashing or allocating. Static edges win over parameters and parameters win
+ *        over wildcards, a branch which fails further down is backtracked. Not thread safe, routes are meant to
+ *        be registered before the server starts.
+ */
+template<class Handler>
+class HttpRouter {
+public:
+    /**
+     * @brief register handler for pattern, replacing the handler of an identical pattern
+     * @throw std::invalid_argument if the pattern is malformed, has more than RouteParams::MAX_PARAMS
+     *        parameters, or names a parameter differently than an already registered route at the same place
+     */
+    void insert(std::string_view pattern, Handler handler) {
+        std::size_t params = 0;
+        insert(m_root, pattern, std::move(handler), params);
+    }
+
+    /**
+     * @brief find the handler of path, which must not carry a query string
+     * @param params filled with the parameters of the matched route, cleared first
+     * @return nullptr if no route matches
+     */
+    const Handler* match(std::string_view path, RouteParams& params) const {
+        params.clear();
+        return match(m_root, path, path, params);
+    }
+
+    [[nodiscard]] bool empty() const {
+        return m_size == 0;
+    }
+
+    [[nodiscard]] std::size_t size() const {
+        return m_size;
+    }
+
+    void clear() {
+        m_root = Node {};
+        m_size = 0;
+    }
+
+private:
+    struct Node {
+        // static text of the edge leading here, empty for the root and for parameter nodes
+        std::string m_prefix;
+        // static children, no two share the first character of their prefix
+        std::vector<std::unique_ptr<Node>> m_children;
+        std::unique_ptr<Node> m_param;
+        std::unique_ptr<Node> m_wildcard;
+        // name of the parameter or wildcard this node captures
+        std::string m_name;
+        std::optional<Handler> m_handler;
+    };
+
+    void insert(Node& node, std::string_view pattern, Handler&& handler, std::size_t& params) {
+        if (pattern.empty()) {
+            if (!node.m_handler.has_value()) {
+                ++m_size;
+            }
+            node.m_handler = std::move(handler);
+            return;
+        }
+        if (pattern.front() == ':' || pattern.front() == '*') {
+            bool wildcard = pattern.front() == '*';
+            auto end = wildcard ? pattern.size() : std::min(pattern.find('/'), pattern.size());
+            auto name = pattern.substr(1, end - 1);
+            if (name.empty() || (wildcard && name.find('/') != std::string_view::npos)) {
+                throw std::invalid_argument(std::string("Malformed route parameter in ") + std::string(pattern));
+            }
+            if (++params > RouteParams::MAX_PARAMS) {
+                throw std::invalid_argument("Too many route parameters");
+            }
+            auto& child = wildcard ? node.m_wildcard : node.m_param;
+            if (child == nullptr) {
+                child = std::make_unique<Node>();
+                child->m_name = name;
+            } else if (child->m_name != name) {
+                throw std::invalid_argument(
+                    std::string("Route parameter ") + std::string(name) + " conflicts with " + child->m_name
+                );
+            }
+            insert(*child, pattern.substr(end), std::move(handler), params);
+            return;
+        }
+        // static text runs up to the next segment starting with a parameter or wildcard
+        auto end = pattern.size();
+        for (std::size_t i = 1; i < pattern.size(); i++) {
+            if (pattern[i - 1] == '/' && (pattern[i] == ':' || pattern[i] == '*')) {
+                end = i;
+                break;
+            }
+        }
+        insert_static(node, pattern.substr(0, end), pattern.substr(end), std::move(handler), params);
+    }
+
+    void insert_static(
+        Node& node,
+        std::string_view text,
+        std::string_view rest,
+        Handler&& handler,
+        std::size_t& params
+    ) {
+        auto it = std::find_if(node.m_children.begin(), node.m_children.end(), [text](const auto& child) {
+            return child->m_prefix.front() == text.front();
+        });
+        if (it == node.m_children.end()) {
+            auto& child = node.m_children.emplace_back(std::make_unique<Node>());
+            child->m_prefix = text;
+            insert(*child, rest, std::move(handler), params);
+            return;
+        }
+        auto& child = *it;
+        auto common = std::mismatch(text.begin(), text.end(), child->m_prefix.begin(), child->m_prefix.end());
+        auto length = static_cast<std::size_t>(common.first - text.begin());
+        if (length < child->m_prefix.size()) {
+            // split the edge, the shared part becomes a node of its own
+            auto split = std::make_unique<Node>();
+            split->m_prefix = child->m_prefix.substr(0, length);
+            child->m_prefix.erase(0, length);
+            split->m_children.push_back(std::move(child));
+            child = std::move(split);
+        }
+        if (length == text.size()) {
+            insert(*child, rest, std::move(handler), params);
+        } else {
+            insert_static(*child, text.substr(length), rest, std::move(handler), params);
+        }
+    }
+
+    const Handler*
+    match(const Node& node, std::string_view path, std::string_view rest, RouteParams& params) const {
+        if (rest.empty() && node.m_handler.has_value()) {
+            return &node.m_handler.value();
+        }
+        if (!rest.empty()) {
+            for (const auto& child: node.m_children) {
+                if (child->m_prefix.front() != rest.front()) {
+                    continue;
+                }
+                if (rest.starts_with(child->m_prefix)) {
+                    if (auto handler = match(*child, path, rest.substr(child->m_prefix.size()), params)) {
+                        return handler;
+                    }
+                }
+                break;
+            }
+        }
+        if (node.m_param != nullptr && !rest.empty() && rest.front() != '/') {
+            auto end = std::min(rest.find('/'), rest.size());
+            params.push(node.m_param->m_name, rest.data() - path.data(), end);
+            if (auto handler = match(*node.m_param, path, rest.substr(end), params)) {
+                return handler;
+            }
+            params.pop();
+        }
+        if (node.m_wildcard != nullptr && node.m_wildcard->m_handler.has_value()) {
+            params.push(node.m_wildcard->m_name, rest.data() - path.data(), rest.size());
+            return &node.m_wildcard->m_handler.value();
+        }
+        return nullptr;
+    }
+
+    Node m_root;
+    std::size_t m_size = 0;
+};
+
+} // namespace net
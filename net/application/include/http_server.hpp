@@ -1,26 +1,50 @@
 #pragma once
 
 #include "event_loop.hpp"
+#include "http2.hpp"
+#include "http_compression.hpp"
 #include "http_parser.hpp"
+#include "http_router.hpp"
 #include "remote_target.hpp"
 #include "ssl.hpp"
+#include "static_files.hpp"
 #include "tcp.hpp"
+#include "thread_pool.hpp"
+#include "timing_wheel.hpp"
+#include <chrono>
 #include <cstdint>
 #include <functional>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <optional>
 #include <queue>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
 namespace net {
 
+/**
+ * @brief Receiver of a request body streamed into a handler, see HttpServer::route_stream
+ */
+struct HttpBodyReader {
+    NET_DECLARE_PTRS(HttpBodyReader)
+
+    // every piece of the body as it arrives, the view is only valid during the call
+    std::function<void(std::string_view piece)> m_on_data = nullptr;
+    // the body is complete, returns the response
+    std::function<HttpResponse()> m_on_end = nullptr;
+};
+
 /**
  * @brief HttpServer class
  * 
  * This class is used to create a http server
+ * Paths of handlers are route patterns, ":name" matches one segment and a trailing "*name" the rest of the path,
+ * see HttpRouter. Requests are matched on their path without the query string, captured values are available
+ * through param() of the request.
  * @note if you need to handle http failure, you can add error handler, and throw HttpResponseCode in your handler if 
  *       you want to response with error code, and the server will call the error handler you set
  */
@@ -28,6 +52,11 @@ class HttpServer {
 public:
     NET_DECLARE_PTRS(HttpServer)
 
+    // most bytes taken from a connection in one read before they are handed to the parser
+    static constexpr std::size_t READ_SIZE = BufferPool::SIZE_CLASSES.back();
+    // most response body bytes framed for one gathered write of a HTTP/2 connection
+    static constexpr std::size_t HTTP2_WRITE_SIZE = 4 * READ_SIZE;
+
     HttpServer(const std::string& ip, const std::string& service, std::shared_ptr<SSLContext> ctx = nullptr);
 
     HttpServer(const HttpServer&) = delete;
@@ -58,18 +87,109 @@ public:
 
     virtual void patch(const std::string path, std::function<HttpResponse(const HttpRequest&)> handler);
 
+    /**
+     * @brief register a handler which gets the request as views into the receive buffer, nothing is copied
+     *        Takes precedence over a handler of the same method registered by get, post and so on whose route
+     *        matches the request as well.
+     */
+    virtual void
+    route(HttpMethod method, const std::string path, std::function<HttpResponse(const HttpRequestView&)> handler);
+
+    /**
+     * @brief register a handler which takes the request body piece by piece as it arrives instead of buffering it
+     *        on_head gets the request with an empty body as soon as its header is complete and returns the reader
+     *        of the body, or nullptr to have the body buffered and the request handled like any other. Takes
+     *        precedence over every other handler of the same method and path. Throwing a HttpResponseCode answers
+     *        with that error and closes the connection, since the rest of the body can't be told apart anymore.
+     */
+    virtual void route_stream(
+        HttpMethod method,
+        const std::string path,
+        std::function<HttpBodyReader::SharedPtr(const HttpRequestView& head)> on_head
+    );
+
+    /**
+     * @brief serve the files below root to GET and HEAD requests for url_prefix/<path>, see StaticFiles
+     * @throw std::runtime_error if root is not a directory
+     */
+    void serve_static(const std::string& url_prefix, const std::string& root, StaticFileOptions options = {});
+
+    /**
+     * @brief compress the bodies of responses for clients which accept it, see ResponseCompressor
+     * @note call before start, responses an upstream of a proxy encoded already are relayed as they come
+     */
+    void enable_compression(CompressionOptions options = {});
+
+    /**
+     * @brief speak HTTP/2 to clients which ask for it, see Http2Connection
+     *        Over TLS "h2" is offered by ALPN ahead of "http/1.1". In clear text a connection starting with the
+     *        HTTP/2 preface is taken as HTTP/2 with prior knowledge, and a request with "Upgrade: h2c" and
+     *        HTTP2-Settings is answered with 101 and its response goes out on stream 1. Every handler serves both
+     *        versions, the requests of a connection are handled one after the other in the order they complete.
+     *        Streaming handlers get the whole body at once, HTTP/2 flow control already bounds what a client sends.
+     * @note call before start, the header, body and keep alive timeouts and the request limit only apply to
+     *       HTTP/1.1 connections, the idle timeout to both
+     */
+    void enable_http2(Http2Options options = {});
+
     std::optional<NetError> listen();
 
     std::optional<NetError> close();
 
     std::optional<NetError> start();
 
-    std::optional<NetError> enable_event_loop(EventLoopType type = EventLoopType::EPOLL);
-
-    void enable_thread_pool(std::size_t worker_num);
+    /**
+     * @brief enable event loop for the server
+     * @param reactor_num 0 means one loop dispatching requests to the thread pool, otherwise requests are accepted,
+     *        parsed, handled and written on reactor_num event loop threads, see SocketServer::enable_event_loop
+     * @param max_events, adaptive batch of an epoll loop, see SocketServer::enable_event_loop
+     */
+    std::optional<NetError> enable_event_loop(
+        EventLoopType type = EventLoopType::EPOLL,
+        std::size_t reactor_num = 0,
+        std::size_t max_events = 1024,
+        bool adaptive = false
+    );
+
+    /**
+     * @brief see SocketServer::event_loop_stats
+     */
+    std::vector<EventLoopStats> event_loop_stats() const;
+
+    /**
+     * @brief see SocketServer::enable_thread_pool
+     */
+    void
+    enable_thread_pool(std::size_t worker_num, utils::ThreadPoolMode mode = utils::ThreadPoolMode::WORK_STEALING);
 
     void set_logger(const utils::LoggerManager::Logger& logger);
 
+    /**
+     * @brief close connections which send nothing for idle_timeout, see SocketServer::set_idle_timeout
+     */
+    void set_idle_timeout(std::chrono::milliseconds idle_timeout);
+
+    /**
+     * @brief close connections which don't start a new request within keep_alive_timeout after the last one
+     */
+    void set_keep_alive_timeout(std::chrono::milliseconds keep_alive_timeout);
+
+    /**
+     * @brief close connections whose request header isn't complete header_timeout after its first byte
+     * @note the deadline is not pushed back by further bytes, so trickling a header byte by byte doesn't help
+     */
+    void set_header_timeout(std::chrono::milliseconds header_timeout);
+
+    /**
+     * @brief close connections whose request body isn't complete body_timeout after the header
+     */
+    void set_body_timeout(std::chrono::milliseconds body_timeout);
+
+    /**
+     * @brief answer the max_requests th request of a connection with "Connection: close" and close it, 0 disables it
+     */
+    void set_max_requests_per_connection(std::size_t max_requests);
+
     int get_fd() const;
 
     std::string get_ip() const;
@@ -87,7 +207,157 @@ protected:
 
     virtual void erase_parser(int remote_fd);
 
-    using MethodHandlers = std::unordered_map<std::string, std::function<HttpResponse(const HttpRequest&)>>;
+    /**
+     * @brief arm the deadline of the phase the connection is in, kept as is if the phase didn't change
+     * @note timeouts only work with event loop enabled, the timers live in the timing wheel of each loop
+     */
+    void update_deadline(RemoteTarget::SharedPtr remote, HttpParser::ReadPhase phase);
+
+    /**
+     * @brief count a request of the connection
+     * @return true if the connection should be closed after the response
+     */
+    bool count_request(RemoteTarget::SharedPtr remote, bool close_requested);
+
+    /**
+     * @brief responses waiting to be written together, in the order of their requests
+     *        They are kept whole and serialized only by flush_responses, the iovecs refer to their bodies in place.
+     */
+    struct ResponseBatch {
+        std::vector<HttpResponse> m_responses;
+        std::vector<HttpResponseSerializer> m_serializers;
+        std::vector<struct iovec> m_iov;
+    };
+
+    /**
+     * @brief answer every complete request buffered in parser, in order
+     *        Responses to pipelined requests are gathered and written by a single writev once nothing is left to
+     *        serve. Stops early when a streamed response has to wait for the socket, resume_stream carries on from
+     *        there.
+     */
+    virtual void serve_requests(RemoteTarget::SharedPtr remote, std::shared_ptr<HttpParser> parser);
+
+    /**
+     * @brief pick up the head of a request with a streaming handler, its body then goes to the returned reader
+     * @return false if the request is left to the buffering handlers
+     */
+    bool open_body_reader(RemoteTarget::SharedPtr remote, std::shared_ptr<HttpParser> parser, ResponseBatch& batch);
+
+    /**
+     * @brief feed what arrived of a streamed request body to its reader, answers the request once it is complete
+     * @return false if the body is incomplete or the connection is gone
+     */
+    bool read_streamed_body(RemoteTarget::SharedPtr remote, std::shared_ptr<HttpParser> parser, ResponseBatch& batch);
+
+    /**
+     * @brief write the response to a request of method, with its body streamed if it has a producer or a file
+     * @param close_requested close the connection after the response
+     * @param batch queue the response there instead of writing it, it is flushed right away only if the body is
+     *        streamed or the connection closed
+     * @return false if no further request of the connection may be served now
+     */
+    bool send_response(
+        RemoteTarget::SharedPtr remote,
+        std::shared_ptr<HttpParser> parser,
+        HttpMethod method,
+        HttpResponse response,
+        bool close_requested,
+        ResponseBatch* batch = nullptr
+    );
+
+    /**
+     * @brief write the responses queued in batch with one gathered write
+     * @return false if the write failed and the connection is gone
+     */
+    bool flush_responses(RemoteTarget::SharedPtr remote, ResponseBatch& batch);
+
+    /**
+     * @brief answer a malformed request with 400 and close the connection
+     */
+    void reject_request(RemoteTarget::SharedPtr remote, std::shared_ptr<HttpParser> parser);
+
+    struct ResponseStream {
+        HttpBodyProducer m_producer;
+        std::shared_ptr<HttpParser> m_parser;
+        bool m_chunked;
+        // close the connection once the body is out
+        bool m_close;
+        // body file instead of a producer, m_file_offset and m_file_size cover what is left of it
+        std::shared_ptr<const int> m_file;
+        off_t m_file_offset = 0;
+        std::size_t m_file_size = 0;
+    };
+
+    /**
+     * @brief write the body of stream until it ends or the output of the connection crosses the high watermark
+     * @return true if the body is complete and the connection stays open
+     */
+    bool pump_stream(RemoteTarget::SharedPtr remote, std::shared_ptr<ResponseStream> stream);
+
+    /**
+     * @brief continue a stream parked by pump_stream, called once the output drains to the low watermark
+     */
+    void resume_stream(RemoteTarget::SharedPtr remote);
+
+    /**
+     * @brief run the handler whose route matches request, the captured path parameters are set on request
+     */
+    HttpResponse handle_request(HttpRequestView& request);
+
+    HttpResponse error_response(HttpResponseCode code, const HttpRequestView& request);
+
+    struct Http2Session {
+        explicit Http2Session(Http2Options options): m_connection(options) {}
+
+        // held while the connection is fed and flushed, by reads and by resume_stream
+        std::mutex m_mutex;
+        Http2Connection m_connection;
+        std::vector<struct iovec> m_iov;
+    };
+
+    /**
+     * @brief HTTP/2 session of the connection, started if the first bytes it sends are the preface or ALPN
+     *        selected h2
+     * @return nullptr if the connection speaks HTTP/1.1
+     */
+    std::shared_ptr<Http2Session>
+    http2_session(RemoteTarget::SharedPtr remote, std::shared_ptr<HttpParser> parser, std::string_view data);
+
+    /**
+     * @brief switch the connection to HTTP/2 for a request with "Upgrade: h2c", the request becomes stream 1
+     * @return false if the upgrade is refused and the request is to be answered over HTTP/1.1
+     */
+    bool upgrade_http2(RemoteTarget::SharedPtr remote, std::shared_ptr<HttpParser> parser, HttpRequestView& request);
+
+    /**
+     * @brief feed data to the session and answer every request it completes
+     * @return false if the connection is gone
+     */
+    bool serve_http2(RemoteTarget::SharedPtr remote, std::shared_ptr<Http2Session> session, std::string_view data);
+
+    /**
+     * @brief run the handler of a HTTP/2 request, streaming handlers are handed the body in one piece
+     */
+    HttpResponse handle_http2_request(HttpRequestView& request);
+
+    /**
+     * @brief write what the session has to send, response bodies until the output crosses the high watermark
+     * @note called with the session mutex held
+     * @return false if the connection is gone
+     */
+    bool flush_http2(RemoteTarget::SharedPtr remote, Http2Session& session);
+
+    /**
+     * @brief stop the deadline of the connection, for phases no read deadline applies to
+     * @note called with m_parsers_mutex held
+     */
+    void cancel_deadline(int remote_fd);
+
+    void expire_connection(RemoteTarget::WeakPtr weak_remote, uint64_t epoch);
+
+    using MethodHandlers = HttpRouter<std::function<HttpResponse(const HttpRequest&)>>;
+    using ViewHandlers = HttpRouter<std::function<HttpResponse(const HttpRequestView&)>>;
+    using StreamHandlers = HttpRouter<std::function<HttpBodyReader::SharedPtr(const HttpRequestView&)>>;
     MethodHandlers m_get_handlers;
     MethodHandlers m_post_handlers;
     MethodHandlers m_put_handlers;
@@ -99,12 +369,44 @@ protected:
     MethodHandlers m_patch_handler;
 
     const std::unordered_map<HttpMethod, MethodHandlers&> m_handlers;
+    std::unordered_map<HttpMethod, ViewHandlers> m_view_handlers;
+    std::unordered_map<HttpMethod, StreamHandlers> m_stream_handlers;
 
     std::map<int, std::shared_ptr<HttpParser>> m_parsers;
     std::mutex m_parsers_mutex;
 
+    struct ConnectionState {
+        std::size_t m_requests = 0;
+        HttpParser::ReadPhase m_phase = HttpParser::ReadPhase::IDLE;
+        TimerId m_deadline = 0;
+        // bumped on every rearm, a deadline which already left the wheel can tell it is stale
+        uint64_t m_epoch = 0;
+        std::weak_ptr<TimerService> m_timer_service;
+        // set while a response body is streamed, later requests wait for it
+        bool m_streaming = false;
+        // stream waiting for the output to drain
+        std::shared_ptr<ResponseStream> m_parked_stream;
+        // reader of the request body being streamed in, and the head of that request
+        HttpBodyReader::SharedPtr m_body_reader;
+        HttpRequestView m_body_head;
+        // set once the connection speaks HTTP/2, everything it sends goes to the session from then on
+        std::shared_ptr<Http2Session> m_http2;
+    };
+    // guarded by m_parsers_mutex as well
+    std::map<int, ConnectionState> m_connections;
+
+    std::chrono::milliseconds m_keep_alive_timeout { 0 };
+    std::chrono::milliseconds m_header_timeout { 0 };
+    std::chrono::milliseconds m_body_timeout { 0 };
+    std::size_t m_max_requests = 0;
+
     std::unordered_map<HttpResponseCode, std::function<HttpResponse(const HttpRequest&)>> m_error_handlers;
 
+    ResponseCompressor::SharedPtr m_compressor;
+
+    std::shared_ptr<SSLContext> m_ssl_ctx;
+    std::optional<Http2Options> m_http2_options;
+
     std::shared_ptr<TcpServer> m_server;
 };
 
@@ -4,9 +4,24 @@
 #include "http_client.hpp"
 #include "http_parser.hpp"
 #include "http_server.hpp"
+#include "load_balancer.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
 
 namespace net {
 
+/**
+ * @brief Forward proxy, requests name their upstream in the Host header
+ *        Request bodies are relayed to the upstream piece by piece as they arrive, with the content-length of the
+ *        client or as chunks, and response bodies piece by piece as the client connection drains.
+ */
 class HttpServerProxyForward: public HttpServer {
 public:
     NET_DECLARE_PTRS(HttpServerProxyForward)
@@ -20,9 +35,134 @@ public:
     virtual ~HttpServerProxyForward() = default;
 
 private:
-    virtual void set_handler() override;
+    /**
+     * @brief streaming handler of every request, sends the head upstream and returns the reader relaying its body
+     */
+    HttpBodyReader::SharedPtr open_upstream(const HttpRequestView& head);
 
-    HttpClientGroup::SharedPtr m_clients;
+    /**
+     * @brief the response to head, read over lease, or the error answering err
+     */
+    HttpResponse relay_response(
+        const HttpRequestView& head,
+        std::optional<NetError> err,
+        HttpResponse res,
+        std::shared_ptr<HttpConnectionPool::Lease> lease
+    );
+
+    HttpConnectionPool::SharedPtr m_pool;
+};
+
+struct HttpReverseProxyOptions {
+    LoadBalancerOptions m_balancer;
+    // keep-alive connections to the upstreams, m_read_timeout bounds the wait for a response
+    HttpConnectionPoolOptions m_pool;
+    // other upstreams an idempotent request is tried on after a failure, or any request that was not sent yet
+    std::size_t m_max_retries = 2;
+    // path probed on every upstream with GET, anything but a 2xx or 3xx status fails the probe, empty turns
+    // active checks off
+    std::string m_health_check_path;
+    std::chrono::milliseconds m_health_check_interval { 5000 };
+    // for connecting and for the response of one probe
+    std::chrono::milliseconds m_health_check_timeout { 2000 };
+    // probes in a row failing or passing to take an upstream out or back in
+    std::size_t m_unhealthy_threshold = 2;
+    std::size_t m_healthy_threshold = 2;
+    // request header whose value CONSISTENT_HASH hashes, the url if empty or missing
+    std::string m_hash_header;
+    // talk TLS to the upstreams
+    std::shared_ptr<SSLContext> m_upstream_ssl_ctx;
+};
+
+/**
+ * @brief Reverse proxy spreading requests over a fixed group of upstreams
+ *        Each request goes to the upstream the load balancer picks, over a keep-alive connection of the pool.
+ *        An upstream failing a request, by refusing the connection, breaking it or timing out, is reported to
+ *        the balancer and the request tried on another one if that is safe. The response head is answered
+ *        with 502, or 504 for a timeout, once no upstream is left, and 503 if none was available at all.
+ *        Bodies are relayed piece by piece both ways, a request with a body is sent to the upstream as soon as its
+ *        head is complete and only tried on another one if that head didn't make it out. Hop-by-hop headers are
+ *        dropped both ways and the client is added to X-Forwarded-For.
+ */
+class HttpServerProxyReverse: public HttpServer {
+public:
+    NET_DECLARE_PTRS(HttpServerProxyReverse)
+
+    HttpServerProxyReverse(
+        const std::string& ip,
+        const std::string& service,
+        std::vector<Upstream> upstreams,
+        HttpReverseProxyOptions options = {},
+        std::shared_ptr<SSLContext> ctx = nullptr
+    );
+
+    /**
+     * @brief stop the health checks
+     */
+    virtual ~HttpServerProxyReverse();
+
+    LoadBalancer& balancer() {
+        return *m_balancer;
+    }
+
+private:
+    /**
+     * @brief one request on one upstream, reported to the balancer once it is over
+     */
+    struct Attempt {
+        LoadBalancer::SharedPtr m_balancer;
+        std::size_t m_index;
+        std::chrono::steady_clock::time_point m_start = std::chrono::steady_clock::now();
+        std::chrono::nanoseconds m_latency { 0 };
+        bool m_ok = true;
+
+        Attempt(LoadBalancer::SharedPtr balancer, std::size_t index);
+
+        ~Attempt();
+    };
+
+    /**
+     * @brief streaming handler of every request, see HttpServerProxyForward::open_upstream
+     */
+    HttpBodyReader::SharedPtr open_upstream(const HttpRequestView& head);
+
+    /**
+     * @brief the response to head, read over lease, or the error answering err, attempt is reported once the body
+     *        is through
+     */
+    HttpResponse relay_response(
+        const HttpRequestView& head,
+        std::optional<NetError> err,
+        HttpResponse res,
+        std::shared_ptr<HttpConnectionPool::Lease> lease,
+        std::shared_ptr<Attempt> attempt
+    );
+
+    /**
+     * @brief send req to upstreams until one answers with a response head, or none is left to try
+     * @param res nullptr to send only the head of req, its body is written through lease and the response read by
+     *        HttpConnectionPool::receive
+     * @param attempt set to the one that got the response, its body is read through lease
+     */
+    std::optional<NetError> forward(
+        const HttpRequest& req,
+        HttpResponse* res,
+        HttpConnectionPool::Lease& lease,
+        std::shared_ptr<Attempt>& attempt
+    );
+
+    void check_health();
+
+    bool probe(const Upstream& upstream);
+
+    HttpReverseProxyOptions m_options;
+    LoadBalancer::SharedPtr m_balancer;
+    HttpConnectionPool::SharedPtr m_pool;
+
+    std::mutex m_health_mutex;
+    std::condition_variable m_health_cv;
+    bool m_health_stop = false;
+    std::thread m_health_thread;
 };
 
 } // namespace net
\ No newline at end of file
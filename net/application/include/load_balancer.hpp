@@ -0,0 +1,123 @@
+#pragma once
+
+#include "defines.hpp"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace net {
+
+/**
+ * @brief ROUND_ROBIN hands requests out in turn by weight, LEAST_CONNECTIONS to the upstream with the fewest
+ *        requests in flight per weight, EWMA_LATENCY to the one with the lowest decayed response latency times
+ *        its requests in flight plus one, CONSISTENT_HASH to the one owning the hash of a request key on a ring
+ */
+enum class LoadBalancePolicy : uint8_t { ROUND_ROBIN = 0, LEAST_CONNECTIONS, EWMA_LATENCY, CONSISTENT_HASH };
+
+struct Upstream {
+    std::string m_ip;
+    std::string m_service;
+    // share of the requests relative to the other upstreams, ignored by EWMA_LATENCY
+    std::size_t m_weight = 1;
+};
+
+struct LoadBalancerOptions {
+    LoadBalancePolicy m_policy = LoadBalancePolicy::ROUND_ROBIN;
+    // failed requests in a row after which an upstream is left out for m_fail_timeout, 0 never leaves one out
+    std::size_t m_max_fails = 1;
+    std::chrono::milliseconds m_fail_timeout { 10000 };
+    // a latency sample this old weighs 1/e of a new one
+    std::chrono::milliseconds m_ewma_decay { 10000 };
+    // points of an upstream on the CONSISTENT_HASH ring per unit of weight
+    std::size_t m_virtual_nodes = 160;
+};
+
+/**
+ * @brief Picks the upstream for each request and keeps what the picking depends on
+ *        An upstream takes part while the active health check finds it healthy and it is not left out after
+ *        passive failures. The ring of CONSISTENT_HASH is placed by the addresses of the upstreams, so a key
+ *        moves only if the upstream it was on goes away. Thread safe, one short lock per call.
+ */
+class LoadBalancer {
+public:
+    NET_DECLARE_PTRS(LoadBalancer)
+
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    explicit LoadBalancer(std::vector<Upstream> upstreams, LoadBalancerOptions options = {});
+
+    /**
+     * @param key hashed by CONSISTENT_HASH, ignored otherwise
+     * @param tried upstreams not to pick again, the ones a request failed on already
+     * @return index of the upstream, npos if none is left
+     */
+    std::size_t pick(const std::string& key = "", const std::vector<std::size_t>& tried = {});
+
+    /**
+     * @brief a request is sent to the upstream at index
+     */
+    void on_start(std::size_t index);
+
+    /**
+     * @brief the request sent to index is over
+     * @param latency until the head of the response, a sample for EWMA_LATENCY if ok
+     * @param ok false if the upstream failed it, counted towards m_max_fails
+     */
+    void on_finish(std::size_t index, std::chrono::nanoseconds latency, bool ok);
+
+    /**
+     * @brief verdict of the active health check
+     */
+    void set_healthy(std::size_t index, bool healthy);
+
+    /**
+     * @return true if the upstream may be picked now
+     */
+    bool available(std::size_t index) const;
+
+    std::size_t in_flight(std::size_t index) const;
+
+    const Upstream& upstream(std::size_t index) const {
+        return m_upstreams[index];
+    }
+
+    std::size_t size() const {
+        return m_upstreams.size();
+    }
+
+    static uint64_t hash(const std::string& key);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct State {
+        std::size_t m_in_flight = 0;
+        // smooth weighted round robin
+        int64_t m_current_weight = 0;
+        // nanoseconds, 0 until the first sample
+        double m_ewma = 0;
+        Clock::time_point m_ewma_at;
+        std::size_t m_fails = 0;
+        Clock::time_point m_down_until;
+        bool m_healthy = true;
+    };
+
+    bool usable(std::size_t index, Clock::time_point now, const std::vector<std::size_t>& tried) const;
+
+    std::vector<Upstream> m_upstreams;
+    LoadBalancerOptions m_options;
+    // hash of a point and the upstream owning it, sorted
+    std::vector<std::pair<uint64_t, std::size_t>> m_ring;
+
+    mutable std::mutex m_mutex;
+    std::vector<State> m_states;
+    // where LEAST_CONNECTIONS and EWMA_LATENCY start looking, spreads ties
+    std::size_t m_next = 0;
+};
+
+} // namespace net
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "defines.hpp"
+#include "http_compression.hpp"
+#include "http_parser.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
+namespace net {
+
+struct StaticFileOptions {
+    // files up to this size are mapped once and kept in the cache, larger ones are sent with sendfile
+    std::size_t m_max_cached_file_size = 1024 * 1024;
+    // total size of the mapped files the cache keeps, least recently used ones are dropped beyond it
+    std::size_t m_cache_capacity = 64 * 1024 * 1024;
+    // file served for a path naming a directory
+    std::string m_index_file = "index.html";
+    // Cache-Control sent with every file, none if empty
+    std::string m_cache_control;
+    // serve path.br or path.gz in place of path to clients which accept that coding, if the sibling exists
+    bool m_precompressed = true;
+};
+
+/**
+ * @brief Files under a root directory served to GET and HEAD requests, see HttpServer::serve_static
+ *        Small files are mapped into memory once, together with their ETag, Last-Modified and Content-Type, and
+ *        every response points into the mapping, so a hit costs no syscall and no copy. Larger files go from the
+ *        page cache to the socket with sendfile. If-None-Match and If-Modified-Since are answered with 304 and a
+ *        single byte range with 206. Precompressed siblings, "app.js.br" next to "app.js", are picked by
+ *        Accept-Encoding and served like any other file, with their own validators. An inotify watch on the directories of cached files drops entries as soon as
+ *        the files change.
+ * @note replace files by renaming a new version over them, truncating a mapped file in place makes reading the
+ *       cut off part fault
+ */
+class StaticFiles {
+public:
+    NET_DECLARE_PTRS(StaticFiles)
+
+    /**
+     * @throw std::runtime_error if root is not a directory
+     */
+    StaticFiles(const std::string& root, StaticFileOptions options = {});
+
+    StaticFiles(const StaticFiles&) = delete;
+
+    StaticFiles(StaticFiles&&) = delete;
+
+    StaticFiles& operator=(const StaticFiles&) = delete;
+
+    StaticFiles& operator=(StaticFiles&&) = delete;
+
+    ~StaticFiles();
+
+    /**
+     * @brief answer a GET or HEAD request for path, relative to the root and still percent encoded
+     * @throw HttpResponseCode NOT_FOUND if path doesn't name a readable regular file below the root
+     */
+    HttpResponse serve(const HttpRequestView& request, std::string_view path);
+
+    /**
+     * @return number of cached files and the bytes mapped for them
+     */
+    [[nodiscard]] std::size_t cached_files() const;
+    [[nodiscard]] std::size_t cached_size() const;
+
+private:
+    struct File {
+        File() = default;
+        File(const File&) = delete;
+        File& operator=(const File&) = delete;
+        ~File();
+
+        std::string m_path;
+        std::size_t m_size = 0;
+        std::time_t m_mtime = 0;
+        std::string m_etag;
+        std::string m_last_modified;
+        std::string_view m_content_type;
+        // bit 1 << coding set for every precompressed sibling found when the file was opened
+        uint8_t m_encodings = 0;
+        // mapping of the whole file if it is cached, otherwise the open file for sendfile
+        const char* m_data = nullptr;
+        int m_fd = -1;
+    };
+
+    /**
+     * @return the file path resolves to, from the cache or freshly opened, nullptr if there is none
+     */
+    std::shared_ptr<const File> lookup(const std::string& path);
+
+    std::shared_ptr<const File> cached(const std::string& path);
+
+    void insert(std::shared_ptr<const File> file, uint64_t generation);
+
+    void watch_directory(const std::string& path);
+
+    /**
+     * @brief drop the cache entry of path, and of everything below it if it is a directory
+     * @note must be called with m_mutex held
+     */
+    void invalidate(const std::string& path, bool directory);
+
+    void run_watcher();
+
+    std::string m_root;
+    StaticFileOptions m_options;
+
+    mutable std::mutex m_mutex;
+    // most recently used first
+    std::list<std::shared_ptr<const File>> m_lru;
+    std::unordered_map<std::string, std::list<std::shared_ptr<const File>>::iterator> m_entries;
+    std::size_t m_cached_size = 0;
+    // bumped by every invalidation, a file opened before one happened is not cached
+    uint64_t m_generation = 0;
+    std::unordered_map<int, std::string> m_watches;
+    std::unordered_map<std::string, int> m_watched_directories;
+
+    // -1 if inotify is not available, nothing is cached then
+    int m_inotify_fd = -1;
+    int m_stop_fd = -1;
+    std::thread m_watcher;
+};
+
+} // namespace net
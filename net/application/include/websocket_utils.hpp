@@ -1,5 +1,6 @@
 #pragma once
 
+#include "buffer_pool.hpp"
 #include <cstddef>
 #include <cstdint>
 #include <openssl/bio.h>
@@ -9,6 +10,7 @@
 #include <optional>
 #include <queue>
 #include <string>
+#include <string_view>
 #include <sys/types.h>
 #include <vector>
 
@@ -73,7 +75,7 @@ public:
     WebSocketFrame& set_mask(uint32_t mask);
     WebSocketFrame& set_opcode(WebSocketOpcode opcode);
     WebSocketFrame& set_fin(bool fin);
-    WebSocketFrame& set_payload(const std::string& payload);
+    WebSocketFrame& set_payload(std::string payload);
     WebSocketFrame& append_payload(const std::string& payload);
 
     void clear();
@@ -96,14 +98,23 @@ private:
 };
 
 struct websocket_parser {
+    // bytes of a frame that is not complete yet
     std::string m_buffer;
     std::queue<WebSocketFrame> m_frames;
     bool m_header_find = false;
     bool m_finished_frame = false;
 
-    void push_chunk(std::string& chunk);
+    /**
+     * @brief parse the complete frames of chunk where they are, only an incomplete one at the end is copied
+     */
+    void push_chunk(std::string_view chunk);
 
-    std::size_t find_header(const std::vector<uint8_t>& buffer);
+    /**
+     * @return bytes of data the first frame takes, 0 if data doesn't hold all of it yet
+     */
+    std::size_t parse_frame(std::string_view data);
+
+    std::size_t find_header(std::string_view buffer);
 
     void reset_state();
 
@@ -138,6 +149,8 @@ public:
 
     std::optional<WebSocketFrame> read_frame(const std::vector<uint8_t>& data);
 
+    std::optional<WebSocketFrame> read_frame(const PooledBuffer& data);
+
     void reset_state();
 
     bool has_finished_frame();
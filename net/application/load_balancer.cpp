@@ -0,0 +1,184 @@
+#include "load_balancer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace net {
+
+LoadBalancer::LoadBalancer(std::vector<Upstream> upstreams, LoadBalancerOptions options):
+    m_upstreams(std::move(upstreams)),
+    m_options(options),
+    m_states(m_upstreams.size()) {
+    if (m_options.m_policy != LoadBalancePolicy::CONSISTENT_HASH) {
+        return;
+    }
+    for (std::size_t i = 0; i < m_upstreams.size(); i++) {
+        auto& upstream = m_upstreams[i];
+        auto points = m_options.m_virtual_nodes * std::max<std::size_t>(upstream.m_weight, 1);
+        for (std::size_t point = 0; point < points; point++) {
+            m_ring.emplace_back(hash(upstream.m_ip + ":" + upstream.m_service + "#" + std::to_string(point)), i);
+        }
+    }
+    std::sort(m_ring.begin(), m_ring.end());
+}
+
+std::size_t LoadBalancer::pick(const std::string& key, const std::vector<std::size_t>& tried) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto now = Clock::now();
+    auto count = m_upstreams.size();
+    std::size_t best = npos;
+    switch (m_options.m_policy) {
+        case LoadBalancePolicy::ROUND_ROBIN: {
+            // every upstream gains its weight, the one ahead is picked and set back by the sum of the weights
+            int64_t total = 0;
+            for (std::size_t i = 0; i < count; i++) {
+                if (!usable(i, now, tried)) {
+                    continue;
+                }
+                auto weight = static_cast<int64_t>(std::max<std::size_t>(m_upstreams[i].m_weight, 1));
+                m_states[i].m_current_weight += weight;
+                total += weight;
+                if (best == npos || m_states[i].m_current_weight > m_states[best].m_current_weight) {
+                    best = i;
+                }
+            }
+            if (best != npos) {
+                m_states[best].m_current_weight -= total;
+            }
+            return best;
+        }
+        case LoadBalancePolicy::LEAST_CONNECTIONS: {
+            auto start = count == 0 ? 0 : m_next++ % count;
+            for (std::size_t k = 0; k < count; k++) {
+                auto i = (start + k) % count;
+                if (!usable(i, now, tried)) {
+                    continue;
+                }
+                // in_flight[i] / weight[i] < in_flight[best] / weight[best]
+                if (best == npos
+                    || m_states[i].m_in_flight * std::max<std::size_t>(m_upstreams[best].m_weight, 1)
+                        < m_states[best].m_in_flight * std::max<std::size_t>(m_upstreams[i].m_weight, 1))
+                {
+                    best = i;
+                }
+            }
+            return best;
+        }
+        case LoadBalancePolicy::EWMA_LATENCY: {
+            auto start = count == 0 ? 0 : m_next++ % count;
+            double best_cost = 0;
+            for (std::size_t k = 0; k < count; k++) {
+                auto i = (start + k) % count;
+                if (!usable(i, now, tried)) {
+                    continue;
+                }
+                // one not measured yet costs nothing and gets measured first
+                auto cost = m_states[i].m_ewma * static_cast<double>(m_states[i].m_in_flight + 1);
+                if (best == npos || cost < best_cost) {
+                    best = i;
+                    best_cost = cost;
+                }
+            }
+            return best;
+        }
+        case LoadBalancePolicy::CONSISTENT_HASH: {
+            if (m_ring.empty()) {
+                return npos;
+            }
+            auto point = std::lower_bound(m_ring.begin(), m_ring.end(), std::make_pair(hash(key), std::size_t(0)));
+            // the next point clockwise whose upstream is usable
+            for (std::size_t k = 0; k < m_ring.size(); k++, point++) {
+                if (point == m_ring.end()) {
+                    point = m_ring.begin();
+                }
+                if (usable(point->second, now, tried)) {
+                    return point->second;
+                }
+            }
+            return npos;
+        }
+    }
+    return npos;
+}
+
+void LoadBalancer::on_start(std::size_t index) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_states[index].m_in_flight++;
+}
+
+void LoadBalancer::on_finish(std::size_t index, std::chrono::nanoseconds latency, bool ok) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto& state = m_states[index];
+    auto now = Clock::now();
+    if (state.m_in_flight > 0) {
+        state.m_in_flight--;
+    }
+    if (!ok) {
+        state.m_fails++;
+        if (m_options.m_max_fails != 0 && state.m_fails >= m_options.m_max_fails) {
+            state.m_down_until = now + m_options.m_fail_timeout;
+            state.m_fails = 0;
+        }
+        return;
+    }
+    state.m_fails = 0;
+    auto sample = static_cast<double>(latency.count());
+    if (state.m_ewma == 0) {
+        state.m_ewma = sample;
+    } else {
+        auto elapsed = std::chrono::duration<double>(now - state.m_ewma_at).count();
+        auto decay = std::chrono::duration<double>(m_options.m_ewma_decay).count();
+        auto weight = decay > 0 ? std::exp(-elapsed / decay) : 0.0;
+        state.m_ewma = state.m_ewma * weight + sample * (1 - weight);
+    }
+    state.m_ewma_at = now;
+}
+
+void LoadBalancer::set_healthy(std::size_t index, bool healthy) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_states[index].m_healthy = healthy;
+    if (healthy) {
+        // back from an outage, earlier passive failures are forgotten
+        m_states[index].m_fails = 0;
+        m_states[index].m_down_until = {};
+    }
+}
+
+bool LoadBalancer::available(std::size_t index) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return usable(index, Clock::now(), {});
+}
+
+std::size_t LoadBalancer::in_flight(std::size_t index) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_states[index].m_in_flight;
+}
+
+uint64_t LoadBalancer::hash(const std::string& key) {
+    // FNV-1a, then the finalizer of MurmurHash3 to spread similar keys over the whole ring
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c: key) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+bool LoadBalancer::usable(std::size_t index, Clock::time_point now, const std::vector<std::size_t>& tried) const {
+    const auto& state = m_states[index];
+    return state.m_healthy && now >= state.m_down_until
+        && std::find(tried.begin(), tried.end(), index) == tried.end();
+}
+
+} // namespace net
@@ -0,0 +1,600 @@
+#include "static_files.hpp"
+#include "http_parser.hpp"
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <fcntl.h>
+#include <format>
+#include <iostream>
+#include <optional>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+namespace net {
+
+namespace {
+
+struct ContentType {
+    std::string_view extension;
+    std::string_view type;
+};
+
+constexpr ContentType CONTENT_TYPES[] = {
+    { "html", "text/html; charset=utf-8" },
+    { "htm", "text/html; charset=utf-8" },
+    { "css", "text/css; charset=utf-8" },
+    { "js", "text/javascript; charset=utf-8" },
+    { "mjs", "text/javascript; charset=utf-8" },
+    { "json", "application/json" },
+    { "map", "application/json" },
+    { "txt", "text/plain; charset=utf-8" },
+    { "md", "text/markdown; charset=utf-8" },
+    { "csv", "text/csv; charset=utf-8" },
+    { "xml", "application/xml" },
+    { "svg", "image/svg+xml" },
+    { "png", "image/png" },
+    { "jpg", "image/jpeg" },
+    { "jpeg", "image/jpeg" },
+    { "gif", "image/gif" },
+    { "webp", "image/webp" },
+    { "avif", "image/avif" },
+    { "ico", "image/x-icon" },
+    { "woff", "font/woff" },
+    { "woff2", "font/woff2" },
+    { "ttf", "font/ttf" },
+    { "otf", "font/otf" },
+    { "wasm", "application/wasm" },
+    { "pdf", "application/pdf" },
+    { "zip", "application/zip" },
+    { "gz", "application/gzip" },
+    { "mp3", "audio/mpeg" },
+    { "ogg", "audio/ogg" },
+    { "mp4", "video/mp4" },
+    { "webm", "video/webm" },
+};
+
+constexpr std::string_view DEFAULT_CONTENT_TYPE = "application/octet-stream";
+
+struct Precompressed {
+    ContentCoding coding;
+    std::string_view suffix;
+};
+
+// in order of preference
+constexpr Precompressed PRECOMPRESSED[] = {
+    { ContentCoding::BROTLI, ".br" },
+    { ContentCoding::GZIP, ".gz" },
+};
+
+uint8_t coding_bit(ContentCoding coding) {
+    return static_cast<uint8_t>(1u << static_cast<unsigned>(coding));
+}
+
+constexpr uint32_t WATCH_MASK = IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM
+    | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+
+std::string_view content_type(std::string_view path) {
+    auto dot = path.rfind('.');
+    if (dot == std::string_view::npos || path.find('/', dot) != std::string_view::npos) {
+        return DEFAULT_CONTENT_TYPE;
+    }
+    auto extension = path.substr(dot + 1);
+    for (auto& entry: CONTENT_TYPES) {
+        if (std::equal(
+                extension.begin(),
+                extension.end(),
+                entry.extension.begin(),
+                entry.extension.end(),
+                [](char a, char b) { return std::tolower(static_cast<unsigned char>(a)) == b; }
+            ))
+        {
+            return entry.type;
+        }
+    }
+    return DEFAULT_CONTENT_TYPE;
+}
+
+int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+/**
+ * @brief percent decode path and drop its empty and "." segments
+ * @return "" or "/a/b", nullopt if a segment is "..", a byte is NUL or an escape is malformed
+ */
+std::optional<std::string> normalize_path(std::string_view path) {
+    std::string decoded;
+    decoded.reserve(path.size());
+    for (std::size_t i = 0; i < path.size(); i++) {
+        char c = path[i];
+        if (c == '%') {
+            if (i + 2 >= path.size()) {
+                return std::nullopt;
+            }
+            auto high = hex_value(path[i + 1]);
+            auto low = hex_value(path[i + 2]);
+            if (high < 0 || low < 0) {
+                return std::nullopt;
+            }
+            c = static_cast<char>(high * 16 + low);
+            i += 2;
+        }
+        if (c == '\0') {
+            return std::nullopt;
+        }
+        decoded.push_back(c);
+    }
+    std::string normalized;
+    normalized.reserve(decoded.size() + 1);
+    std::size_t start = 0;
+    while (start <= decoded.size()) {
+        auto end = std::min(decoded.find('/', start), decoded.size());
+        auto segment = std::string_view(decoded).substr(start, end - start);
+        if (segment == "..") {
+            return std::nullopt;
+        }
+        if (!segment.empty() && segment != ".") {
+            normalized.push_back('/');
+            normalized.append(segment);
+        }
+        start = end + 1;
+    }
+    return normalized;
+}
+
+/**
+ * @brief weak comparison of etag against the comma separated list of an If-None-Match
+ */
+bool etag_listed(std::string_view list, std::string_view etag) {
+    std::size_t start = 0;
+    while (start < list.size()) {
+        auto end = std::min(list.find(',', start), list.size());
+        auto tag = list.substr(start, end - start);
+        auto first = tag.find_first_not_of(" \t");
+        tag = first == std::string_view::npos ? std::string_view {} : tag.substr(first);
+        tag = tag.substr(0, tag.find_last_not_of(" \t") + 1);
+        if (tag.starts_with("W/")) {
+            tag.remove_prefix(2);
+        }
+        if (tag == "*" || tag == etag) {
+            return true;
+        }
+        // the compression stage of the server tells its variants apart by the coding appended to the etag
+        if (tag.size() > etag.size() && tag.back() == '"' && tag.starts_with(etag.substr(0, etag.size() - 1))
+            && tag[etag.size() - 1] == '-')
+        {
+            auto name = tag.substr(etag.size(), tag.size() - etag.size() - 1);
+            for (auto coding: { ContentCoding::GZIP, ContentCoding::DEFLATE, ContentCoding::BROTLI }) {
+                if (name == coding_name(coding)) {
+                    return true;
+                }
+            }
+        }
+        start = end + 1;
+    }
+    return false;
+}
+
+enum class RangeResult { NONE, UNSATISFIABLE, RANGE };
+
+/**
+ * @brief parse a Range header of a single byte range against a representation of size bytes
+ *        Other units, several ranges and malformed values are NONE, the whole representation is served then.
+ */
+RangeResult parse_range(std::string_view header, std::size_t size, std::size_t& first, std::size_t& last) {
+    constexpr std::string_view UNIT = "bytes=";
+    if (header.size() < UNIT.size()
+        || !std::equal(UNIT.begin(), UNIT.end(), header.begin(), [](char a, char b) {
+               return a == std::tolower(static_cast<unsigned char>(b));
+           }))
+    {
+        return RangeResult::NONE;
+    }
+    auto spec = header.substr(UNIT.size());
+    auto dash = spec.find('-');
+    if (dash == std::string_view::npos || spec.find(',') != std::string_view::npos) {
+        return RangeResult::NONE;
+    }
+    auto number = [](std::string_view text, std::size_t& value) {
+        auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+        return !text.empty() && ec == std::errc() && ptr == text.data() + text.size();
+    };
+    auto first_text = spec.substr(0, dash);
+    auto last_text = spec.substr(dash + 1);
+    if (first_text.empty()) {
+        // suffix range, the last n bytes
+        std::size_t suffix = 0;
+        if (!number(last_text, suffix)) {
+            return RangeResult::NONE;
+        }
+        if (suffix == 0 || size == 0) {
+            return RangeResult::UNSATISFIABLE;
+        }
+        first = size - std::min(suffix, size);
+        last = size - 1;
+        return RangeResult::RANGE;
+    }
+    if (!number(first_text, first)) {
+        return RangeResult::NONE;
+    }
+    if (last_text.empty()) {
+        last = size - 1;
+    } else if (!number(last_text, last) || last < first) {
+        return RangeResult::NONE;
+    }
+    if (first >= size) {
+        return RangeResult::UNSATISFIABLE;
+    }
+    last = std::min(last, size - 1);
+    return RangeResult::RANGE;
+}
+
+} // namespace
+
+StaticFiles::File::~File() {
+    if (m_data != nullptr) {
+        ::munmap(const_cast<char*>(m_data), m_size);
+    }
+    if (m_fd != -1) {
+        ::close(m_fd);
+    }
+}
+
+StaticFiles::StaticFiles(const std::string& root, StaticFileOptions options):
+    m_root(root),
+    m_options(std::move(options)) {
+    while (m_root.size() > 1 && m_root.back() == '/') {
+        m_root.pop_back();
+    }
+    struct stat st;
+    if (::stat(m_root.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        throw std::runtime_error(std::format("Static file root {} is not a directory", m_root));
+    }
+    m_inotify_fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_inotify_fd != -1) {
+        m_stop_fd = ::eventfd(0, EFD_CLOEXEC);
+    }
+    if (m_inotify_fd == -1 || m_stop_fd == -1) {
+        // without invalidation a cached file could go stale, so every file is opened per request
+        std::cerr << std::format("Failed to watch {} for changes, static files won't be cached\n", m_root);
+        if (m_inotify_fd != -1) {
+            ::close(m_inotify_fd);
+            m_inotify_fd = -1;
+        }
+        return;
+    }
+    m_watcher = std::thread(&StaticFiles::run_watcher, this);
+}
+
+StaticFiles::~StaticFiles() {
+    if (m_watcher.joinable()) {
+        uint64_t stop = 1;
+        auto unused = ::write(m_stop_fd, &stop, sizeof(stop));
+        (void)unused;
+        m_watcher.join();
+    }
+    if (m_stop_fd != -1) {
+        ::close(m_stop_fd);
+    }
+    if (m_inotify_fd != -1) {
+        ::close(m_inotify_fd);
+    }
+}
+
+HttpResponse StaticFiles::serve(const HttpRequestView& request, std::string_view path) {
+    auto relative = normalize_path(path);
+    if (!relative.has_value()) {
+        throw HttpResponseCode::NOT_FOUND;
+    }
+    auto file = lookup(m_root + relative.value());
+    if (file == nullptr) {
+        throw HttpResponseCode::NOT_FOUND;
+    }
+    auto type = file->m_content_type;
+    auto coding = ContentCoding::IDENTITY;
+    if (file->m_encodings != 0) {
+        std::array<ContentCoding, std::size(PRECOMPRESSED)> available;
+        std::size_t count = 0;
+        for (auto& sibling: PRECOMPRESSED) {
+            if (file->m_encodings & coding_bit(sibling.coding)) {
+                available[count++] = sibling.coding;
+            }
+        }
+        coding = negotiate_coding(request.header("Accept-Encoding"), { available.data(), count });
+        for (auto& sibling: PRECOMPRESSED) {
+            if (sibling.coding != coding) {
+                continue;
+            }
+            // from here on the sibling is the representation, with its own size and validators
+            if (auto variant = lookup(file->m_path + std::string(sibling.suffix))) {
+                file = std::move(variant);
+            } else {
+                coding = ContentCoding::IDENTITY;
+            }
+        }
+    }
+    HttpResponse response;
+    response.set_version("HTTP/1.1")
+        .set_status_code(HttpResponseCode::OK)
+        .set_header("ETag", file->m_etag)
+        .set_header("Last-Modified", file->m_last_modified)
+        .set_header("Accept-Ranges", "bytes");
+    if (!m_options.m_cache_control.empty()) {
+        response.set_header("Cache-Control", m_options.m_cache_control);
+    }
+    if (file->m_encodings != 0 || coding != ContentCoding::IDENTITY) {
+        response.set_header("Vary", "Accept-Encoding");
+    }
+    if (coding != ContentCoding::IDENTITY) {
+        response.set_header("Content-Encoding", std::string(coding_name(coding)));
+    }
+    // If-None-Match decides alone when present, RFC 9110 13.2.2
+    auto if_none_match = request.header("If-None-Match");
+    bool not_modified = false;
+    if (!if_none_match.empty()) {
+        not_modified = etag_listed(if_none_match, file->m_etag);
+    } else if (auto since = parse_http_date(request.header("If-Modified-Since"))) {
+        not_modified = file->m_mtime <= since.value();
+    }
+    if (not_modified) {
+        return response.set_status_code(HttpResponseCode::NOT_MODIFIED);
+    }
+    response.set_header("Content-Type", std::string(type));
+    std::size_t offset = 0;
+    std::size_t length = file->m_size;
+    auto range = request.header("Range");
+    auto if_range = request.header("If-Range");
+    // a range of an older version than the client has would corrupt it, If-Range falls back to the whole file
+    bool range_valid = if_range.empty()
+        || (if_range.starts_with('"') ? if_range == file->m_etag
+                                      : parse_http_date(if_range) == std::optional<std::time_t>(file->m_mtime));
+    if (request.method() == HttpMethod::GET && !range.empty() && range_valid) {
+        std::size_t first = 0;
+        std::size_t last = 0;
+        switch (parse_range(range, file->m_size, first, last)) {
+            case RangeResult::UNSATISFIABLE:
+                return response.set_status_code(HttpResponseCode::RANGE_NOT_SATISFIABLE)
+                    .set_header("Content-Range", std::format("bytes */{}", file->m_size))
+                    .set_header("Content-Length", "0");
+            case RangeResult::RANGE:
+                offset = first;
+                length = last - first + 1;
+                response.set_status_code(HttpResponseCode::PARTIAL_CONTENT)
+                    .set_header("Content-Range", std::format("bytes {}-{}/{}", first, last, file->m_size));
+                break;
+            case RangeResult::NONE:
+                break;
+        }
+    }
+    response.set_header("Content-Length", std::to_string(length));
+    if (length == 0) {
+        return response;
+    }
+    if (file->m_data != nullptr) {
+        response.set_body_view({ file->m_data + offset, length }, file);
+    } else {
+        response.set_body_file(std::shared_ptr<const int>(file, &file->m_fd), static_cast<off_t>(offset), length);
+    }
+    return response;
+}
+
+std::size_t StaticFiles::cached_files() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_entries.size();
+}
+
+std::size_t StaticFiles::cached_size() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_cached_size;
+}
+
+std::shared_ptr<const StaticFiles::File> StaticFiles::lookup(const std::string& path) {
+    if (auto file = cached(path)) {
+        return file;
+    }
+    auto slash = path.rfind('/');
+    watch_directory(slash == 0 ? std::string("/") : path.substr(0, slash));
+    uint64_t generation = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        generation = m_generation;
+    }
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return nullptr;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        bool directory = S_ISDIR(st.st_mode);
+        ::close(fd);
+        if (!directory || m_options.m_index_file.empty() || path.ends_with("/" + m_options.m_index_file)) {
+            return nullptr;
+        }
+        return lookup(path + "/" + m_options.m_index_file);
+    }
+    auto file = std::make_shared<File>();
+    file->m_path = path;
+    file->m_size = static_cast<std::size_t>(st.st_size);
+    file->m_mtime = st.st_mtim.tv_sec;
+    file->m_etag = std::format(
+        "\"{:x}-{:x}\"",
+        static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000 + static_cast<uint64_t>(st.st_mtim.tv_nsec),
+        file->m_size
+    );
+    file->m_last_modified = http_date(st.st_mtim.tv_sec);
+    file->m_content_type = content_type(path);
+    bool sibling = std::any_of(std::begin(PRECOMPRESSED), std::end(PRECOMPRESSED), [&path](auto& precompressed) {
+        return path.ends_with(precompressed.suffix);
+    });
+    if (m_options.m_precompressed && !sibling) {
+        for (auto& precompressed: PRECOMPRESSED) {
+            struct stat sibling_st;
+            auto sibling_path = path + std::string(precompressed.suffix);
+            if (::stat(sibling_path.c_str(), &sibling_st) == 0 && S_ISREG(sibling_st.st_mode)) {
+                file->m_encodings |= coding_bit(precompressed.coding);
+            }
+        }
+    }
+    if (m_inotify_fd == -1 || file->m_size > m_options.m_max_cached_file_size) {
+        file->m_fd = fd;
+        return file;
+    }
+    if (file->m_size > 0) {
+        auto data = ::mmap(nullptr, file->m_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        if (data == MAP_FAILED) {
+            file->m_fd = fd;
+            return file;
+        }
+        file->m_data = static_cast<const char*>(data);
+    }
+    ::close(fd);
+    insert(file, generation);
+    return file;
+}
+
+std::shared_ptr<const StaticFiles::File> StaticFiles::cached(const std::string& path) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto entry = m_entries.find(path);
+    if (entry == m_entries.end()) {
+        return nullptr;
+    }
+    m_lru.splice(m_lru.begin(), m_lru, entry->second);
+    return *entry->second;
+}
+
+void StaticFiles::insert(std::shared_ptr<const File> file, uint64_t generation) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // the file changed while it was read, the mapping may be stale already
+    if (generation != m_generation || m_entries.contains(file->m_path)) {
+        return;
+    }
+    m_cached_size += file->m_size;
+    m_lru.push_front(file);
+    m_entries.emplace(file->m_path, m_lru.begin());
+    while (m_cached_size > m_options.m_cache_capacity && !m_lru.empty()) {
+        // responses still sending the mapping keep it alive until they are done
+        m_cached_size -= m_lru.back()->m_size;
+        m_entries.erase(m_lru.back()->m_path);
+        m_lru.pop_back();
+    }
+}
+
+void StaticFiles::watch_directory(const std::string& path) {
+    if (m_inotify_fd == -1) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_watched_directories.contains(path)) {
+            return;
+        }
+    }
+    auto wd = ::inotify_add_watch(m_inotify_fd, path.c_str(), WATCH_MASK);
+    if (wd == -1) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_watched_directories[path] = wd;
+    m_watches[wd] = path;
+}
+
+void StaticFiles::invalidate(const std::string& path, bool directory) {
+    ++m_generation;
+    auto erase = [this](const std::string& key) {
+        auto entry = m_entries.find(key);
+        if (entry != m_entries.end()) {
+            m_cached_size -= (*entry->second)->m_size;
+            m_lru.erase(entry->second);
+            m_entries.erase(entry);
+        }
+    };
+    erase(path);
+    // the file a precompressed sibling belongs to has to find out again which siblings it has
+    for (auto& precompressed: PRECOMPRESSED) {
+        if (path.ends_with(precompressed.suffix)) {
+            erase(path.substr(0, path.size() - precompressed.suffix.size()));
+        }
+    }
+    if (!directory) {
+        return;
+    }
+    // a directory moved away takes everything below it along, its old path may be reused by another one
+    auto prefix = path + "/";
+    for (auto it = m_lru.begin(); it != m_lru.end();) {
+        auto& file = *it++;
+        if (file->m_path.starts_with(prefix)) {
+            erase(file->m_path);
+        }
+    }
+    std::erase_if(m_watched_directories, [&](const auto& entry) {
+        return entry.first == path || entry.first.starts_with(prefix);
+    });
+}
+
+void StaticFiles::run_watcher() {
+    std::array<struct pollfd, 2> fds { { { m_inotify_fd, POLLIN, 0 }, { m_stop_fd, POLLIN, 0 } } };
+    alignas(struct inotify_event) std::array<char, 4096> buffer;
+    while (true) {
+        if (::poll(fds.data(), fds.size(), -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << std::format("Failed to wait for changes below {}, static files won't be invalidated\n", m_root);
+            return;
+        }
+        if (fds[1].revents != 0) {
+            return;
+        }
+        ssize_t size = 0;
+        while ((size = ::read(m_inotify_fd, buffer.data(), buffer.size())) > 0) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto ptr = buffer.data(); ptr < buffer.data() + size;) {
+                auto event = reinterpret_cast<const struct inotify_event*>(ptr);
+                ptr += sizeof(struct inotify_event) + event->len;
+                if (event->mask & IN_Q_OVERFLOW) {
+                    // events were lost, nothing cached can be trusted
+                    ++m_generation;
+                    m_lru.clear();
+                    m_entries.clear();
+                    m_cached_size = 0;
+                    continue;
+                }
+                auto watch = m_watches.find(event->wd);
+                if (watch == m_watches.end()) {
+                    continue;
+                }
+                if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                    invalidate(watch->second, true);
+                    if (!(event->mask & IN_IGNORED)) {
+                        ::inotify_rm_watch(m_inotify_fd, event->wd);
+                    }
+                    m_watches.erase(watch);
+                    continue;
+                }
+                if (event->len > 0) {
+                    invalidate(watch->second + "/" + event->name, event->mask & IN_ISDIR);
+                }
+            }
+        }
+    }
+}
+
+} // namespace net
@@ -304,7 +304,7 @@ std::optional<NetError> WebSocketServer::accept_ws_connection(const HttpRequest&
 
 void WebSocketServer::set_handler() {
     auto http_handler = [this](RemoteTarget::SharedPtr remote) {
-        std::vector<uint8_t> req(1024);
+        PooledBuffer req;
         std::vector<uint8_t> res;
         auto err = m_server->read(req, remote);
         if (err.has_value()) {
@@ -329,7 +329,7 @@ void WebSocketServer::set_handler() {
             HttpResponse response;
             auto method = request.method();
             auto path = request.url();
-            std::unordered_map<std::string, std::function<HttpResponse(const HttpRequest&)>>::iterator handler;
+            const std::function<HttpResponse(const HttpRequest&)>* handler = nullptr;
             // check if the request is a websocket upgrade request
             if (request.headers().find("upgrade") != request.headers().end() && m_allowed_paths.contains(path)) {
                 // check if request is correct
@@ -366,9 +366,13 @@ void WebSocketServer::set_handler() {
             }
 
             // handle normal http request
-            try {
-                handler = m_handlers.at(method).find(path);
-            } catch (const std::out_of_range& e) {
+            auto handlers = m_handlers.find(method);
+            if (handlers != m_handlers.end()) {
+                RouteParams params;
+                handler = handlers->second.match(request.path(), params);
+                request.set_params(params);
+            }
+            if (handlers == m_handlers.end()) {
                 if (m_error_handlers.find(HttpResponseCode::BAD_REQUEST) != m_error_handlers.end()) {
                     response = m_error_handlers.at(HttpResponseCode::BAD_REQUEST)(request);
                 } else {
@@ -377,9 +381,7 @@ void WebSocketServer::set_handler() {
                         .set_reason(std::string(utils::dump_enum(HttpResponseCode::BAD_REQUEST)))
                         .set_header("Content-Length", "0");
                 }
-            }
-
-            if (handler == m_handlers.at(method).end()) {
+            } else if (handler == nullptr) {
                 if (m_error_handlers.find(HttpResponseCode::NOT_FOUND) != m_error_handlers.end()) {
                     response = m_error_handlers.at(HttpResponseCode::NOT_FOUND)(request);
                 } else {
@@ -390,7 +392,7 @@ void WebSocketServer::set_handler() {
                 }
             } else {
                 try {
-                    response = handler->second(request);
+                    response = (*handler)(request);
                 } catch (const HttpResponseCode& e) {
                     if (m_error_handlers.find(e) != m_error_handlers.end()) {
                         response = m_error_handlers.at(e)(request);
@@ -421,7 +423,8 @@ void WebSocketServer::set_handler() {
         }
     };
 
-    m_server->on_start(std::move(handler));
+    m_server->on_start(handler);
+    m_server->on_read(std::move(handler));
 }
 
 void WebSocketServer::erase_parser(int remote_fd) {
@@ -456,7 +459,7 @@ WebSocketServer::write_websocket_frame(const WebSocketFrame& frame, RemoteTarget
 std::optional<NetError> WebSocketServer::read_websocket_frame(WebSocketFrame& frame, RemoteTarget::SharedPtr remote) {
     assert(m_ws_connections_flag.contains(remote->fd()) && "RemoteTarget is not a websocket connection");
     auto parser = m_ws_parsers.at(remote->fd());
-    std::vector<uint8_t> data(1024);
+    PooledBuffer data;
     auto err = m_server->read(data, remote);
     if (err.has_value()) {
         return err;
@@ -9,6 +9,9 @@
 #include <netinet/in.h>
 #include <optional>
 #include <random>
+#include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 namespace net {
@@ -137,8 +140,8 @@ WebSocketFrame& WebSocketFrame::set_fin(bool fin) {
     return *this;
 }
 
-WebSocketFrame& WebSocketFrame::set_payload(const std::string& payload) {
-    m_payload = payload;
+WebSocketFrame& WebSocketFrame::set_payload(std::string payload) {
+    m_payload = std::move(payload);
     if (m_payload.size() < 126) {
         m_payload_length_1 = m_payload.size();
         m_payload_length_2 = 0;
@@ -202,9 +205,9 @@ std::optional<WebSocketFrame> websocket_parser::read_frame() {
     if (m_frames.empty()) {
         return std::nullopt;
     }
-    WebSocketFrame frame = m_frames.front();
+    WebSocketFrame frame = std::move(m_frames.front());
     m_frames.pop();
-    m_finished_frame = false;
+    m_finished_frame = !m_frames.empty();
     return frame;
 }
 
@@ -212,11 +215,9 @@ bool is_valid_opcode(uint8_t opcode) {
     return opcode == 0x0 || opcode == 0x1 || opcode == 0x2 || opcode == 0x8 || opcode == 0x9 || opcode == 0xA;
 }
 
-std::size_t websocket_parser::find_header(const std::vector<uint8_t>& buffer) {
-    assert(buffer.size() >= 2 && "Invalid header size");
-    for (std::size_t i = 0; i < buffer.size() - 1; ++i) {
-        auto byte1 = buffer[i];
-        auto opcode = byte1 & 0x0F;
+std::size_t websocket_parser::find_header(std::string_view buffer) {
+    for (std::size_t i = 0; i < buffer.size(); ++i) {
+        auto opcode = static_cast<uint8_t>(buffer[i]) & 0x0F;
         if (is_valid_opcode(opcode)) {
             m_header_find = true;
             return i;
@@ -230,71 +231,79 @@ bool websocket_parser::buffer_empty() const {
     return m_buffer.empty();
 }
 
-void websocket_parser::push_chunk(std::string& chunk) {
-    auto start = 0;
+void websocket_parser::push_chunk(std::string_view chunk) {
     if (!m_header_find) {
-        start = find_header(std::vector<uint8_t>(chunk.begin(), chunk.end()));
+        chunk.remove_prefix(find_header(chunk));
     }
-    if (!m_finished_frame) {
-        m_buffer.append(chunk.substr(start));
-        if (m_buffer.size() < 2) {
-            return;
+    if (m_buffer.empty()) {
+        while (auto consumed = parse_frame(chunk)) {
+            chunk.remove_prefix(consumed);
         }
-        uint8_t byte1 = m_buffer[0];
-        uint8_t byte2 = m_buffer[1];
-        WebSocketFrame frame;
-        frame.set_fin(byte1 & 0x80)
-            .set_rsv1(byte1 & 0x40)
-            .set_rsv2(byte1 & 0x20)
-            .set_rsv3(byte1 & 0x10)
-            .set_opcode(static_cast<WebSocketOpcode>(byte1 & 0x0F));
-        bool masked = byte2 & 0x80;
-        uint8_t payload_length = byte2 & 0x7F;
-        uint64_t length = 0;
-        uint8_t head_size = 2;
-        if (payload_length < 126) {
-            length = payload_length;
-            head_size = 2;
-        } else if (payload_length == 126) {
-            if (m_buffer.size() < 4) {
-                return;
-            }
-            length = (static_cast<uint64_t>(m_buffer[2]) << 8) | m_buffer[3];
-            head_size = 4;
-        } else {
-            if (m_buffer.size() < 10) {
-                return;
-            }
-            for (int i = 2; i < 10; ++i) {
-                length = (length << 8) | m_buffer[i];
-            }
-            head_size = 10;
+        m_buffer.assign(chunk);
+    } else {
+        m_buffer.append(chunk);
+        std::string_view data = m_buffer;
+        std::size_t offset = 0;
+        while (auto consumed = parse_frame(data.substr(offset))) {
+            offset += consumed;
         }
-        if (masked) {
-            if (m_buffer.size() < head_size + 4) {
-                return;
-            }
-            frame.set_mask(
-                (m_buffer[head_size] << 24) | (m_buffer[head_size + 1] << 16) | (m_buffer[head_size + 2] << 8)
-                | m_buffer[head_size + 3]
-            );
+        m_buffer.erase(0, offset);
+    }
+    m_finished_frame = !m_frames.empty();
+}
+
+std::size_t websocket_parser::parse_frame(std::string_view data) {
+    if (data.size() < 2) {
+        return 0;
+    }
+    auto byte = [&data](std::size_t i) { return static_cast<uint8_t>(data[i]); };
+    uint8_t byte1 = byte(0);
+    uint8_t byte2 = byte(1);
+    WebSocketFrame frame;
+    frame.set_fin(byte1 & 0x80)
+        .set_rsv1(byte1 & 0x40)
+        .set_rsv2(byte1 & 0x20)
+        .set_rsv3(byte1 & 0x10)
+        .set_opcode(static_cast<WebSocketOpcode>(byte1 & 0x0F));
+    bool masked = byte2 & 0x80;
+    uint8_t payload_length = byte2 & 0x7F;
+    uint64_t length = 0;
+    std::size_t head_size = 2;
+    if (payload_length < 126) {
+        length = payload_length;
+    } else if (payload_length == 126) {
+        if (data.size() < 4) {
+            return 0;
         }
-        uint8_t mask_size = frame.masked() ? 4 : 0;
-        auto pay_load = m_buffer.substr(head_size + mask_size, length);
-        if (frame.masked()) {
-            apply_mask(pay_load, frame.mask());
+        length = (static_cast<uint64_t>(byte(2)) << 8) | byte(3);
+        head_size = 4;
+    } else {
+        if (data.size() < 10) {
+            return 0;
         }
-        frame.set_payload(pay_load);
-
-        m_buffer = m_buffer.substr(head_size + mask_size + length);
-        auto frames_size = m_frames.size();
-        m_frames.push(frame);
-        if (frames_size < m_frames.size()) {
-            m_finished_frame = true;
-        } else {
-            m_finished_frame = false;
+        for (std::size_t i = 2; i < 10; ++i) {
+            length = (length << 8) | byte(i);
         }
+        head_size = 10;
+    }
+    std::size_t mask_size = masked ? 4 : 0;
+    // the payload is cut out only once all of it is there
+    if (data.size() < head_size + mask_size || length > data.size() - head_size - mask_size) {
+        return 0;
+    }
+    if (masked) {
+        frame.set_mask(
+            (static_cast<uint32_t>(byte(head_size)) << 24) | (byte(head_size + 1) << 16)
+            | (byte(head_size + 2) << 8) | byte(head_size + 3)
+        );
     }
+    std::string pay_load(data.substr(head_size + mask_size, length));
+    if (masked) {
+        apply_mask(pay_load, frame.mask());
+    }
+    frame.set_payload(std::move(pay_load));
+    m_frames.push(std::move(frame));
+    return head_size + mask_size + length;
 }
 
 std::string& websocket_writer::buffer() {
@@ -359,12 +368,23 @@ std::optional<WebSocketFrame> WebSocketParser::read_frame(const std::vector<uint
         m_parser.reset_state();
     }
 
-    std::string chunk(data.begin(), data.end());
-    m_parser.push_chunk(chunk);
+    m_parser.push_chunk({ reinterpret_cast<const char*>(data.data()), data.size() });
+    if (m_parser.has_finished_frame()) {
+        return m_parser.read_frame();
+    }
+    return std::nullopt;
+}
+
+std::optional<WebSocketFrame> WebSocketParser::read_frame(const PooledBuffer& data) {
+    if (m_parser.buffer_empty()) {
+        m_parser.reset_state();
+    }
+
+    m_parser.push_chunk(data.view());
     if (m_parser.has_finished_frame()) {
         return m_parser.read_frame();
     }
     return std::nullopt;
 }
 
-} // namespace net
\ No newline at end of file
+} // namespace net
@@ -0,0 +1,148 @@
+#include "buffer_pool.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <utility>
+
+namespace net {
+
+namespace {
+
+    // trivially destructible, stays readable while thread local objects of an exiting thread are destroyed
+    thread_local bool t_pool_alive = false;
+
+} // namespace
+
+BufferPool::~BufferPool() {
+    t_pool_alive = false;
+    for (auto& blocks: m_free_blocks) {
+        for (auto block: blocks) {
+            delete[] block;
+        }
+    }
+}
+
+BufferPool& BufferPool::local() {
+    thread_local BufferPool pool;
+    t_pool_alive = true;
+    return pool;
+}
+
+std::size_t BufferPool::size_class(std::size_t size) {
+    for (std::size_t i = 0; i < SIZE_CLASSES.size(); ++i) {
+        if (size <= SIZE_CLASSES[i]) {
+            return i;
+        }
+    }
+    return SIZE_CLASSES.size();
+}
+
+uint8_t* BufferPool::acquire(std::size_t size, std::size_t& capacity) {
+    auto index = size_class(size);
+    if (index == SIZE_CLASSES.size()) {
+        capacity = size;
+        return new uint8_t[size];
+    }
+    capacity = SIZE_CLASSES[index];
+    auto& blocks = local().m_free_blocks[index];
+    if (blocks.empty()) {
+        return new uint8_t[capacity];
+    }
+    auto block = blocks.back();
+    blocks.pop_back();
+    return block;
+}
+
+void BufferPool::release(uint8_t* block, std::size_t capacity) {
+    auto index = size_class(capacity);
+    // odd sized blocks and releases during thread exit are not cached
+    if (index == SIZE_CLASSES.size() || SIZE_CLASSES[index] != capacity || !t_pool_alive) {
+        delete[] block;
+        return;
+    }
+    auto& blocks = local().m_free_blocks[index];
+    if (blocks.size() >= MAX_CACHED_BLOCKS) {
+        delete[] block;
+        return;
+    }
+    blocks.push_back(block);
+}
+
+PooledBuffer::Block::Block(std::size_t size): m_data(BufferPool::acquire(size, m_capacity)) {}
+
+PooledBuffer::Block::~Block() {
+    BufferPool::release(m_data, m_capacity);
+}
+
+PooledBuffer::PooledBuffer(std::size_t capacity): m_block(std::make_shared<Block>(capacity)) {}
+
+PooledBuffer::PooledBuffer(PooledBuffer&& other) noexcept:
+    m_block(std::move(other.m_block)),
+    m_size(std::exchange(other.m_size, 0)) {}
+
+PooledBuffer& PooledBuffer::operator=(PooledBuffer&& other) noexcept {
+    if (this != &other) {
+        m_block = std::move(other.m_block);
+        m_size = std::exchange(other.m_size, 0);
+    }
+    return *this;
+}
+
+uint8_t* PooledBuffer::data() {
+    return m_block ? m_block->m_data : nullptr;
+}
+
+const uint8_t* PooledBuffer::data() const {
+    return m_block ? m_block->m_data : nullptr;
+}
+
+std::size_t PooledBuffer::size() const {
+    return m_size;
+}
+
+std::size_t PooledBuffer::capacity() const {
+    return m_block ? m_block->m_capacity : 0;
+}
+
+bool PooledBuffer::empty() const {
+    return size() == 0;
+}
+
+uint8_t* PooledBuffer::tail() {
+    return data() + size();
+}
+
+std::size_t PooledBuffer::writable() const {
+    return capacity() - size();
+}
+
+void PooledBuffer::commit(std::size_t size) {
+    assert(size <= writable() && "Commit exceeds capacity of buffer");
+    m_size += size;
+}
+
+void PooledBuffer::reserve(std::size_t capacity) {
+    if (capacity <= this->capacity()) {
+        return;
+    }
+    // grow geometrically so a long read loop doesn't copy on every chunk
+    auto block = std::make_shared<Block>(std::max(capacity, this->capacity() * 2));
+    if (m_block) {
+        std::memcpy(block->m_data, m_block->m_data, m_size);
+    }
+    m_block = std::move(block);
+}
+
+void PooledBuffer::clear() {
+    // writing over the front of a shared block would change the bytes the other handles see
+    if (m_block.use_count() > 1) {
+        m_block.reset();
+    }
+    m_size = 0;
+}
+
+std::string_view PooledBuffer::view() const {
+    return { reinterpret_cast<const char*>(data()), size() };
+}
+
+} // namespace net
@@ -1,10 +1,25 @@
 #include "event_loop.hpp"
 #include "defines.hpp"
 #include "remote_target.hpp"
+#include "timing_wheel.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
 #include <format>
+#include <linux/io_uring.h>
 #include <memory>
+#include <poll.h>
 #include <stdexcept>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
 
 namespace net {
 
@@ -56,36 +71,138 @@ void Event::on_trigger() {
     }
 }
 
+void Event::on_accept(int client_fd) {
+    if (m_handler->m_on_accept) {
+        m_handler->m_on_accept(m_client_fd, client_fd);
+    }
+}
+
+bool Event::accepts() const {
+    return m_handler->m_on_accept != nullptr;
+}
+
+bool Event::loop_io() const {
+    return m_handler->m_loop_io;
+}
+
 std::shared_ptr<Event> EventLoop::get_event(int event_fd) {
-    return std::dynamic_pointer_cast<Event>(m_remote_pool.get_remote(event_fd));
+    return m_remote_pool.get_remote(event_fd);
 }
 
-SelectEventLoop::SelectEventLoop(int time_out): m_max_fd(0), time_out(time_out) {}
+bool EventLoop::remove_event(const std::shared_ptr<Event>& event) {
+    // only the caller which takes the event out of the pool unregisters and closes it, the fd stays open until then
+    // so its number can't be reused in between
+    if (!m_remote_pool.take_remote(event)) {
+        return false;
+    }
+    unregister_event(event->fd());
+    event->close_remote();
+    return true;
+}
 
-void SelectEventLoop::add_event(std::shared_ptr<Event> event) {
-    m_max_fd = std::max(m_max_fd, event->fd());
-    if (static_cast<uint8_t>(event->type()) & static_cast<uint8_t>(EventType::READ)) {
-        FD_SET(event->fd(), &read_fds);
+void EventLoop::remove_event(int event_fd) {
+    auto event = get_event(event_fd);
+    if (event != nullptr) {
+        remove_event(event);
     }
-    if (static_cast<uint8_t>(event->type()) & static_cast<uint8_t>(EventType::WRITE)) {
-        FD_SET(event->fd(), &write_fds);
+}
+
+std::shared_ptr<TimerService> EventLoop::timer_service() {
+    std::lock_guard<std::mutex> lock(m_timer_service_mutex);
+    if (m_timer_service == nullptr) {
+        auto timer_service = std::make_shared<TimerService>();
+        timer_service->attach(*this);
+        m_timer_service = std::move(timer_service);
     }
-    if (static_cast<uint8_t>(event->type()) & static_cast<uint8_t>(EventType::ERROR)
-        || static_cast<uint8_t>(event->type()) & static_cast<uint8_t>(EventType::HUP))
-    {
-        FD_SET(event->fd(), &error_fds);
+    return m_timer_service;
+}
+
+InterestQueue::InterestQueue(): m_wake_fd(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+    if (m_wake_fd == -1) {
+        throw std::runtime_error("Failed to create eventfd");
+    }
+}
+
+InterestQueue::~InterestQueue() {
+    ::close(m_wake_fd);
+}
+
+void InterestQueue::push(int fd, Op op, EventType type) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_changes.push_back({ fd, op, type });
+    if (m_changes.size() == 1) {
+        uint64_t one = 1;
+        // fails only once the counter is full, it is readable then anyway
+        auto unused = ::write(m_wake_fd, &one, sizeof(one));
+        (void)unused;
+    }
+}
+
+std::vector<InterestQueue::Change> InterestQueue::take() {
+    std::vector<Change> changes;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_changes.empty()) {
+        return changes;
     }
+    uint64_t count;
+    auto unused = ::read(m_wake_fd, &count, sizeof(count));
+    (void)unused;
+    changes.swap(m_changes);
+    return changes;
+}
+
+SelectEventLoop::SelectEventLoop(int time_out): m_max_fd(0), time_out(time_out) {
+    m_max_fd = m_changes.wake_fd();
+    FD_ZERO(&read_fds);
+    FD_ZERO(&write_fds);
+    FD_ZERO(&error_fds);
+    FD_SET(m_changes.wake_fd(), &read_fds);
+}
+
+void SelectEventLoop::add_event(std::shared_ptr<Event> event) {
+    m_changes.push(event->fd(), InterestQueue::Op::ADD, event->type());
     m_remote_pool.add_remote(event);
 }
 
-void SelectEventLoop::remove_event(int event_fd) {
-    FD_CLR(event_fd, &read_fds);
-    FD_CLR(event_fd, &write_fds);
-    FD_CLR(event_fd, &error_fds);
-    m_remote_pool.remove_remote(event_fd);
+void SelectEventLoop::unregister_event(int event_fd) {
+    m_changes.push(event_fd, InterestQueue::Op::REMOVE);
+}
+
+void SelectEventLoop::watch_writable(int event_fd, bool enable) {
+    m_changes.push(event_fd, enable ? InterestQueue::Op::WATCH_WRITABLE : InterestQueue::Op::UNWATCH_WRITABLE);
+}
+
+void SelectEventLoop::apply_changes() {
+    for (auto& change: m_changes.take()) {
+        switch (change.m_op) {
+            case InterestQueue::Op::ADD:
+                m_max_fd = std::max(m_max_fd, change.m_fd);
+                if (static_cast<uint8_t>(change.m_type) & static_cast<uint8_t>(EventType::READ)) {
+                    FD_SET(change.m_fd, &read_fds);
+                }
+                if (static_cast<uint8_t>(change.m_type) & static_cast<uint8_t>(EventType::ERROR)
+                    || static_cast<uint8_t>(change.m_type) & static_cast<uint8_t>(EventType::HUP))
+                {
+                    FD_SET(change.m_fd, &error_fds);
+                }
+                break;
+            case InterestQueue::Op::REMOVE:
+                FD_CLR(change.m_fd, &read_fds);
+                FD_CLR(change.m_fd, &write_fds);
+                FD_CLR(change.m_fd, &error_fds);
+                break;
+            case InterestQueue::Op::WATCH_WRITABLE:
+                FD_SET(change.m_fd, &write_fds);
+                break;
+            case InterestQueue::Op::UNWATCH_WRITABLE:
+                FD_CLR(change.m_fd, &write_fds);
+                break;
+        }
+    }
 }
 
 void SelectEventLoop::wait_for_events() {
+    apply_changes();
     fd_set temp_read_fds = read_fds;
     fd_set temp_write_fds = write_fds;
     fd_set temp_error_fds = error_fds;
@@ -94,14 +211,17 @@ void SelectEventLoop::wait_for_events() {
         .tv_sec = time_out / 1000, .tv_usec = (time_out % 1000) * 1000
     };
 
-    int result = select(m_max_fd + 1, &temp_read_fds, &temp_write_fds, &temp_error_fds, &tv);
+    int result = select(m_max_fd + 1, &temp_read_fds, &temp_write_fds, &temp_error_fds, time_out < 0 ? nullptr : &tv);
+    // EBADF, a connection was closed before its removal got applied, the next wait applies it
+    if (result < 0 && (errno == EINTR || errno == EBADF)) {
+        return;
+    }
     if (result < 0) {
         auto error = GET_ERROR_MSG();
         throw std::runtime_error(error.msg);
     }
 
-    m_remote_pool.iterate([&temp_read_fds, &temp_write_fds, &temp_error_fds](RemoteTarget::SharedPtr remote) {
-        auto event = std::dynamic_pointer_cast<Event>(remote);
+    m_remote_pool.iterate([&temp_read_fds, &temp_write_fds, &temp_error_fds](Event::SharedPtr event) {
         if (FD_ISSET(event->fd(), &temp_read_fds)) {
             event->on_read();
         }
@@ -114,36 +234,64 @@ void SelectEventLoop::wait_for_events() {
     });
 }
 
-PollEventLoop::PollEventLoop(int time_out): time_out(time_out) {}
+PollEventLoop::PollEventLoop(int time_out): time_out(time_out) {
+    m_poll_fds.push_back({ m_changes.wake_fd(), POLLIN, 0 });
+}
 
 void PollEventLoop::add_event(std::shared_ptr<Event> event) {
-    m_poll_fds.push_back({ event->fd(), POLLIN | POLLOUT | POLLERR | POLLHUP, 0 });
+    m_changes.push(event->fd(), InterestQueue::Op::ADD);
     m_remote_pool.add_remote(event);
 }
 
-void PollEventLoop::remove_event(int event_fd) {
-    for (size_t i = 0; i < m_poll_fds.size(); ++i) {
-        if (m_poll_fds[i].fd == event_fd) {
-            m_poll_fds.erase(m_poll_fds.begin() + i);
-            break;
+void PollEventLoop::unregister_event(int event_fd) {
+    m_changes.push(event_fd, InterestQueue::Op::REMOVE);
+}
+
+void PollEventLoop::watch_writable(int event_fd, bool enable) {
+    m_changes.push(event_fd, enable ? InterestQueue::Op::WATCH_WRITABLE : InterestQueue::Op::UNWATCH_WRITABLE);
+}
+
+void PollEventLoop::apply_changes() {
+    for (auto& change: m_changes.take()) {
+        if (change.m_op == InterestQueue::Op::ADD) {
+            m_poll_fds.push_back({ change.m_fd, POLLIN | POLLERR | POLLHUP, 0 });
+            continue;
+        }
+        auto it = std::find_if(m_poll_fds.begin() + 1, m_poll_fds.end(), [&change](const pollfd& poll_fd) {
+            return poll_fd.fd == change.m_fd;
+        });
+        if (it == m_poll_fds.end()) {
+            continue;
+        }
+        if (change.m_op == InterestQueue::Op::REMOVE) {
+            m_poll_fds.erase(it);
+        } else if (change.m_op == InterestQueue::Op::WATCH_WRITABLE) {
+            it->events |= POLLOUT;
+        } else {
+            it->events &= ~POLLOUT;
         }
     }
-
-    m_remote_pool.remove_remote(event_fd);
 }
 
 void PollEventLoop::wait_for_events() {
+    apply_changes();
     int result = ::poll(m_poll_fds.data(), m_poll_fds.size(), time_out);
+    if (result < 0 && errno == EINTR) {
+        return;
+    }
     if (result < 0) {
         auto error = GET_ERROR_MSG();
         throw std::runtime_error(error.msg);
     }
 
-    for (size_t i = 0; i < m_poll_fds.size(); ++i) {
+    // the eventfd at 0 is only there to end the wait, apply_changes consumes it
+    for (size_t i = 1; i < m_poll_fds.size(); ++i) {
         if (m_poll_fds[i].revents != 0) {
-            // Trigger event based on revents
-            // Handle accordingly, like using m_events[i]->trigger()
             auto event = get_event(m_poll_fds[i].fd);
+            // removed while the loop waited, the removal is applied before the next wait
+            if (event == nullptr) {
+                continue;
+            }
             if (m_poll_fds[i].revents & POLLIN) {
                 event->on_read();
             }
@@ -157,7 +305,12 @@ void PollEventLoop::wait_for_events() {
     }
 }
 
-EpollEventLoop::EpollEventLoop(int time_out): m_epoll_fd(epoll_create1(0)), time_out(time_out) {
+EpollEventLoop::EpollEventLoop(int time_out, std::size_t max_events, bool adaptive):
+    m_epoll_fd(epoll_create1(0)),
+    time_out(time_out),
+    m_adaptive(adaptive),
+    m_events(std::max<std::size_t>(max_events, 1)),
+    m_batch_size(m_events.size()) {
     if (m_epoll_fd == -1) {
         throw std::runtime_error("Failed to create epoll instance");
     }
@@ -169,7 +322,7 @@ EpollEventLoop::~EpollEventLoop() {
 
 void EpollEventLoop::add_event(std::shared_ptr<Event> event) {
     struct epoll_event ev;
-    ev.events = EPOLLIN | EPOLLOUT | EPOLLERR | EPOLLHUP | EPOLLET;
+    ev.events = EPOLLIN | EPOLLERR | EPOLLHUP | EPOLLET;
     ev.data.fd = event->fd();
     if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, event->fd(), &ev) == -1) {
         throw std::runtime_error("Failed to add event to epoll");
@@ -177,37 +330,535 @@ void EpollEventLoop::add_event(std::shared_ptr<Event> event) {
     m_remote_pool.add_remote(event);
 }
 
-void EpollEventLoop::remove_event(int event_fd) {
+void EpollEventLoop::unregister_event(int event_fd) {
     if (epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, event_fd, nullptr) == -1) {
         throw std::runtime_error("Failed to remove event from epoll");
     }
-    m_remote_pool.remove_remote(event_fd);
 }
 
-void EpollEventLoop::wait_for_events() {
-    std::vector<struct epoll_event> events(1024);
+void EpollEventLoop::watch_writable(int event_fd, bool enable) {
+    struct epoll_event ev;
+    ev.events =
+        EPOLLIN | EPOLLERR | EPOLLHUP | EPOLLET | (enable ? static_cast<uint32_t>(EPOLLOUT) : static_cast<uint32_t>(0));
+    ev.data.fd = event_fd;
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, event_fd, &ev) == -1) {
+        throw std::runtime_error("Failed to modify event of epoll");
+    }
+}
 
-    int num_events = epoll_wait(m_epoll_fd, events.data(), events.size(), time_out);
+void EpollEventLoop::wait_for_events() {
+    int num_events = epoll_wait(m_epoll_fd, m_events.data(), static_cast<int>(m_events.size()), time_out);
     if (num_events < 0) {
         auto error = GET_ERROR_MSG();
         throw std::runtime_error(error.msg);
     }
 
+    auto ready = static_cast<std::size_t>(num_events);
+    m_waits.fetch_add(1, std::memory_order_relaxed);
+    m_ready_events.fetch_add(ready, std::memory_order_relaxed);
+    m_last_ready.store(ready, std::memory_order_relaxed);
+    if (ready > m_max_ready.load(std::memory_order_relaxed)) {
+        m_max_ready.store(ready, std::memory_order_relaxed);
+    }
+
     for (int i = 0; i < num_events; ++i) {
-        auto event = get_event(events[i].data.fd);
+        auto event = get_event(m_events[i].data.fd);
         if (event == nullptr) {
             continue;
         }
-        if (events[i].events & EPOLLIN) {
+        if (m_events[i].events & EPOLLIN) {
             event->on_read();
         }
-        if (events[i].events & EPOLLOUT) {
+        if (m_events[i].events & EPOLLOUT) {
             event->on_write();
         }
-        if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+        if (m_events[i].events & (EPOLLERR | EPOLLHUP)) {
             event->on_error();
         }
     }
+
+    // a full batch means more events may be pending, fetch more of them per wait next time
+    if (m_adaptive && ready == m_events.size() && m_events.size() < MAX_ADAPTIVE_EVENTS) {
+        m_events.resize(std::min(m_events.size() * 2, MAX_ADAPTIVE_EVENTS));
+        m_batch_size.store(m_events.size(), std::memory_order_relaxed);
+    }
+}
+
+EventLoopStats EpollEventLoop::stats() const {
+    EventLoopStats stats;
+    stats.waits = m_waits.load(std::memory_order_relaxed);
+    stats.ready_events = m_ready_events.load(std::memory_order_relaxed);
+    stats.last_ready = m_last_ready.load(std::memory_order_relaxed);
+    stats.max_ready = m_max_ready.load(std::memory_order_relaxed);
+    stats.batch_size = m_batch_size.load(std::memory_order_relaxed);
+    return stats;
+}
+
+namespace {
+
+    constexpr uint64_t k_uring_internal_user_data = ~0ULL;
+    constexpr uint16_t k_recv_buffer_group = 0;
+
+    inline unsigned load_acquire(unsigned* ptr) {
+        return std::atomic_ref<unsigned>(*ptr).load(std::memory_order_acquire);
+    }
+
+    inline void store_release(unsigned* ptr, unsigned value) {
+        std::atomic_ref<unsigned>(*ptr).store(value, std::memory_order_release);
+    }
+
+} // namespace
+
+IoUringEventLoop::IoUringEventLoop(int time_out, unsigned entries): time_out(time_out) {
+    struct io_uring_params params;
+    ::memset(&params, 0, sizeof(params));
+    m_ring_fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+    if (m_ring_fd == -1) {
+        auto error = GET_ERROR_MSG();
+        throw std::runtime_error(std::format("Failed to create io_uring instance: {}", error.msg));
+    }
+    if (!(params.features & IORING_FEAT_EXT_ARG)) {
+        ::close(m_ring_fd);
+        throw std::runtime_error("io_uring of this kernel doesn't support IORING_FEAT_EXT_ARG");
+    }
+
+    m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+    }
+    m_sq_ring = ::mmap(
+        nullptr,
+        m_sq_ring_size,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE,
+        m_ring_fd,
+        IORING_OFF_SQ_RING
+    );
+    if (m_sq_ring == MAP_FAILED) {
+        ::close(m_ring_fd);
+        throw std::runtime_error("Failed to map io_uring submission queue");
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        m_cq_ring = m_sq_ring;
+    } else {
+        m_cq_ring = ::mmap(
+            nullptr,
+            m_cq_ring_size,
+            PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE,
+            m_ring_fd,
+            IORING_OFF_CQ_RING
+        );
+        if (m_cq_ring == MAP_FAILED) {
+            ::munmap(m_sq_ring, m_sq_ring_size);
+            ::close(m_ring_fd);
+            throw std::runtime_error("Failed to map io_uring completion queue");
+        }
+    }
+    m_sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    auto sqes = ::mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        if (m_cq_ring != m_sq_ring) {
+            ::munmap(m_cq_ring, m_cq_ring_size);
+        }
+        ::munmap(m_sq_ring, m_sq_ring_size);
+        ::close(m_ring_fd);
+        throw std::runtime_error("Failed to map io_uring submission entries");
+    }
+    m_sqes = static_cast<struct io_uring_sqe*>(sqes);
+
+    auto sq_base = static_cast<char*>(m_sq_ring);
+    m_sq_head = reinterpret_cast<unsigned*>(sq_base + params.sq_off.head);
+    m_sq_tail = reinterpret_cast<unsigned*>(sq_base + params.sq_off.tail);
+    m_sq_mask = reinterpret_cast<unsigned*>(sq_base + params.sq_off.ring_mask);
+    m_sq_array = reinterpret_cast<unsigned*>(sq_base + params.sq_off.array);
+    m_sq_entries = params.sq_entries;
+    auto cq_base = static_cast<char*>(m_cq_ring);
+    m_cq_head = reinterpret_cast<unsigned*>(cq_base + params.cq_off.head);
+    m_cq_tail = reinterpret_cast<unsigned*>(cq_base + params.cq_off.tail);
+    m_cq_mask = reinterpret_cast<unsigned*>(cq_base + params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<struct io_uring_cqe*>(cq_base + params.cq_off.cqes);
+    m_completions.reserve(params.cq_entries);
+
+    try {
+        setup_recv_buffers();
+    } catch (const std::runtime_error&) {
+        release();
+        throw;
+    }
+}
+
+IoUringEventLoop::~IoUringEventLoop() {
+    release();
+}
+
+void IoUringEventLoop::release() {
+    ::munmap(m_sqes, m_sqes_size);
+    if (m_cq_ring != m_sq_ring) {
+        ::munmap(m_cq_ring, m_cq_ring_size);
+    }
+    ::munmap(m_sq_ring, m_sq_ring_size);
+    // the buffer ring is unregistered together with the ring
+    ::close(m_ring_fd);
+    if (m_recv_ring != nullptr) {
+        ::munmap(m_recv_ring, m_recv_ring_size);
+    }
+}
+
+void IoUringEventLoop::setup_recv_buffers() {
+    static_assert(
+        (RECV_BUFFER_COUNT & (RECV_BUFFER_COUNT - 1)) == 0 && RECV_BUFFER_COUNT <= 32768,
+        "Provided buffer ring size must be a power of 2 up to 32768"
+    );
+    // multishot recv has no probe entry of its own, IORING_OP_SEND_ZC came with the same release (linux 6.0)
+    std::vector<uint8_t> probe_data(sizeof(io_uring_probe) + IORING_OP_LAST * sizeof(io_uring_probe_op));
+    auto probe = reinterpret_cast<io_uring_probe*>(probe_data.data());
+    if (::syscall(__NR_io_uring_register, m_ring_fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) < 0
+        || probe->last_op < IORING_OP_SEND_ZC) {
+        throw std::runtime_error("io_uring of this kernel doesn't support multishot recv");
+    }
+
+    m_recv_ring_size = RECV_BUFFER_COUNT * sizeof(io_uring_buf);
+    auto ring = ::mmap(nullptr, m_recv_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+        throw std::runtime_error("Failed to map io_uring provided buffer ring");
+    }
+    m_recv_ring = static_cast<io_uring_buf_ring*>(ring);
+    struct io_uring_buf_reg reg;
+    ::memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(ring);
+    reg.ring_entries = RECV_BUFFER_COUNT;
+    reg.bgid = k_recv_buffer_group;
+    if (::syscall(__NR_io_uring_register, m_ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        auto error = GET_ERROR_MSG();
+        throw std::runtime_error(std::format("Failed to register io_uring provided buffers: {}", error.msg));
+    }
+    m_recv_buffers.resize(RECV_BUFFER_COUNT * RECV_BUFFER_SIZE);
+    for (unsigned i = 0; i < RECV_BUFFER_COUNT; ++i) {
+        recycle_recv_buffer(static_cast<uint16_t>(i));
+    }
+}
+
+void IoUringEventLoop::recycle_recv_buffer(uint16_t buffer_id) {
+    // the empty struct in front of bufs takes a byte in C++ and moves them, the entries start with the ring
+    auto& buffer = reinterpret_cast<io_uring_buf*>(m_recv_ring)[m_recv_ring_tail & (RECV_BUFFER_COUNT - 1)];
+    buffer.addr = reinterpret_cast<uint64_t>(m_recv_buffers.data() + buffer_id * RECV_BUFFER_SIZE);
+    buffer.len = RECV_BUFFER_SIZE;
+    buffer.bid = buffer_id;
+    std::atomic_ref<uint16_t>(m_recv_ring->tail).store(++m_recv_ring_tail, std::memory_order_release);
+}
+
+io_uring_sqe* IoUringEventLoop::get_sqe() {
+    // must be called with m_submit_mutex held
+    unsigned tail = *m_sq_tail;
+    if (tail - load_acquire(m_sq_head) >= m_sq_entries) {
+        // submission queue is full, hand the batch to the kernel first
+        enter(std::exchange(m_pending, 0), 0, 0);
+        if (tail - load_acquire(m_sq_head) >= m_sq_entries) {
+            throw std::runtime_error("io_uring submission queue is full");
+        }
+    }
+    unsigned index = tail & *m_sq_mask;
+    auto sqe = &m_sqes[index];
+    ::memset(sqe, 0, sizeof(*sqe));
+    m_sq_array[index] = index;
+    store_release(m_sq_tail, tail + 1);
+    ++m_pending;
+    return sqe;
+}
+
+void IoUringEventLoop::arm(int fd, const Registration& registration) {
+    auto sqe = get_sqe();
+    sqe->fd = fd;
+    sqe->user_data = registration.user_data;
+    switch (registration.request) {
+        case Request::POLL:
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->poll32_events = registration.events;
+            sqe->len = IORING_POLL_ADD_MULTI;
+            break;
+        case Request::ACCEPT:
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+            sqe->accept_flags = SOCK_NONBLOCK;
+            break;
+        case Request::RECV:
+            sqe->opcode = IORING_OP_RECV;
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = k_recv_buffer_group;
+            break;
+    }
+}
+
+void IoUringEventLoop::cancel(uint64_t user_data) {
+    auto sqe = get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = user_data;
+    sqe->user_data = k_uring_internal_user_data;
+}
+
+void IoUringEventLoop::start_send(int fd, Registration& registration, std::shared_ptr<Event> event) {
+    // must be called with m_submit_mutex and the mutex of the output buffer held
+    auto [data, size] = event->output_buffer().begin_send();
+    auto sqe = get_sqe();
+    sqe->fd = fd;
+    sqe->user_data = registration.send_user_data = next_user_data(fd);
+    if (size == 0) {
+        // nothing queued, the caller waits for the socket to take more of something it sends itself
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->poll32_events = POLLOUT;
+    } else {
+        sqe->opcode = IORING_OP_SEND;
+        sqe->addr = reinterpret_cast<uint64_t>(data);
+        sqe->len = static_cast<uint32_t>(std::min<std::size_t>(size, UINT32_MAX));
+        sqe->msg_flags = MSG_NOSIGNAL;
+    }
+    m_sends.insert_or_assign(registration.send_user_data, Send { std::move(event), size == 0 });
+}
+
+uint64_t IoUringEventLoop::next_user_data(int fd) {
+    return (static_cast<uint64_t>(++m_generation) << 32) | static_cast<uint32_t>(fd);
+}
+
+int IoUringEventLoop::enter(unsigned to_submit, unsigned min_complete, int time_out) {
+    unsigned flags = 0;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    ::memset(&arg, 0, sizeof(arg));
+    if (min_complete > 0) {
+        flags |= IORING_ENTER_GETEVENTS;
+        if (time_out >= 0) {
+            ts.tv_sec = time_out / 1000;
+            ts.tv_nsec = (time_out % 1000) * 1000000LL;
+            arg.ts = reinterpret_cast<uint64_t>(&ts);
+            flags |= IORING_ENTER_EXT_ARG;
+        }
+    }
+    if (to_submit == 0 && min_complete == 0) {
+        return 0;
+    }
+    return static_cast<int>(::syscall(
+        __NR_io_uring_enter,
+        m_ring_fd,
+        to_submit,
+        min_complete,
+        flags,
+        (flags & IORING_ENTER_EXT_ARG) ? &arg : nullptr,
+        (flags & IORING_ENTER_EXT_ARG) ? sizeof(arg) : 0
+    ));
+}
+
+void IoUringEventLoop::add_event(std::shared_ptr<Event> event) {
+    int fd = event->fd();
+    auto request = event->accepts() ? Request::ACCEPT : (event->loop_io() ? Request::RECV : Request::POLL);
+    m_remote_pool.add_remote(event);
+    std::lock_guard<std::mutex> lock(m_submit_mutex);
+    Registration registration { request, next_user_data(fd), POLLIN | POLLERR | POLLHUP };
+    arm(fd, registration);
+    m_registrations.insert_or_assign(fd, registration);
+    // registrations made on the loop thread ride along with the next wait, others must not wait for it
+    if (std::this_thread::get_id() != m_loop_thread) {
+        if (enter(std::exchange(m_pending, 0), 0, 0) < 0) {
+            throw std::runtime_error("Failed to add event to io_uring");
+        }
+    }
+}
+
+void IoUringEventLoop::unregister_event(int event_fd) {
+    std::lock_guard<std::mutex> lock(m_submit_mutex);
+    auto it = m_registrations.find(event_fd);
+    if (it == m_registrations.end()) {
+        throw std::runtime_error("Failed to remove event from io_uring");
+    }
+    cancel(it->second.user_data);
+    if (it->second.send_user_data != 0) {
+        cancel(it->second.send_user_data);
+    }
+    m_registrations.erase(it);
+    // the fd is closed next, the removal has to reach the kernel before the number can be reused
+    if (enter(std::exchange(m_pending, 0), 0, 0) < 0) {
+        throw std::runtime_error("Failed to remove event from io_uring");
+    }
+}
+
+void IoUringEventLoop::watch_writable(int event_fd, bool enable) {
+    std::lock_guard<std::mutex> lock(m_submit_mutex);
+    auto it = m_registrations.find(event_fd);
+    if (it == m_registrations.end()) {
+        throw std::runtime_error("Failed to modify event of io_uring");
+    }
+    auto& registration = it->second;
+    if (registration.request == Request::RECV) {
+        // a send in flight picks up what was queued behind it, sending stops once the output buffer is empty
+        if (!enable || registration.send_user_data != 0) {
+            return;
+        }
+        auto event = get_event(event_fd);
+        if (event == nullptr) {
+            return;
+        }
+        start_send(event_fd, registration, std::move(event));
+    } else {
+        uint32_t events = enable ? (registration.events | POLLOUT) : (registration.events & ~POLLOUT);
+        if (events == registration.events) {
+            return;
+        }
+        // replace the armed request, completions still in flight for the old one are dropped by their tag
+        cancel(registration.user_data);
+        registration.user_data = next_user_data(event_fd);
+        registration.events = events;
+        arm(event_fd, registration);
+    }
+    if (std::this_thread::get_id() != m_loop_thread) {
+        if (enter(std::exchange(m_pending, 0), 0, 0) < 0) {
+            throw std::runtime_error("Failed to modify event of io_uring");
+        }
+    }
+}
+
+bool IoUringEventLoop::completion_based() const {
+    return true;
+}
+
+void IoUringEventLoop::handle_completion(const io_uring_cqe& cqe) {
+    if (cqe.user_data == k_uring_internal_user_data) {
+        return;
+    }
+    int fd = static_cast<int>(cqe.user_data & 0xffffffffULL);
+    auto request = Request::POLL;
+    bool current = false;
+    {
+        std::unique_lock<std::mutex> lock(m_submit_mutex);
+        auto send = m_sends.find(cqe.user_data);
+        if (send != m_sends.end()) {
+            auto completed = std::move(send->second);
+            m_sends.erase(send);
+            lock.unlock();
+            handle_send(fd, cqe, completed);
+            return;
+        }
+        auto it = m_registrations.find(fd);
+        // otherwise the completion of a request which was removed already
+        if (it != m_registrations.end() && it->second.user_data == cqe.user_data) {
+            current = true;
+            request = it->second.request;
+            // a recv ends for good once the peer closed the connection or receiving failed
+            bool ended = request == Request::RECV && cqe.res <= 0 && cqe.res != -ENOBUFS;
+            // multishot requests may be terminated by the kernel (e.g. on overflow), arm them again
+            if (!(cqe.flags & IORING_CQE_F_MORE) && cqe.res != -ECANCELED && !ended) {
+                arm(fd, it->second);
+            }
+        }
+    }
+    auto event = current ? get_event(fd) : nullptr;
+    if ((cqe.flags & IORING_CQE_F_BUFFER) || (event != nullptr && request == Request::RECV)) {
+        handle_recv(std::move(event), cqe);
+        return;
+    }
+    if (event == nullptr || cqe.res < 0) {
+        return;
+    }
+    if (request == Request::ACCEPT) {
+        event->on_accept(cqe.res);
+        return;
+    }
+    if (cqe.res & POLLIN) {
+        event->on_read();
+    }
+    if (cqe.res & POLLOUT) {
+        event->on_write();
+    }
+    if (cqe.res & (POLLERR | POLLHUP)) {
+        event->on_error();
+    }
+}
+
+void IoUringEventLoop::handle_recv(std::shared_ptr<Event> event, const io_uring_cqe& cqe) {
+    // running out of provided buffers only ends the request, it is armed again and nothing was received
+    bool received = event != nullptr && cqe.res != -ENOBUFS;
+    bool notify = false;
+    if (received) {
+        auto& input = event->input_buffer();
+        std::lock_guard<std::mutex> lock(input.mutex());
+        // readers take all there is, like an edge only the first bytes after that need to be reported
+        notify = input.empty() || cqe.res <= 0;
+        if (cqe.res > 0) {
+            auto buffer_id = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+            input.append(m_recv_buffers.data() + buffer_id * RECV_BUFFER_SIZE, static_cast<std::size_t>(cqe.res));
+        } else {
+            input.m_closed = true;
+            input.m_error = -cqe.res;
+        }
+    }
+    // copied out already, or nobody takes the bytes anymore
+    if (cqe.flags & IORING_CQE_F_BUFFER) {
+        recycle_recv_buffer(static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+    }
+    if (notify) {
+        event->on_read();
+    }
+    if (received && cqe.res < 0) {
+        event->on_error();
+    }
+}
+
+void IoUringEventLoop::handle_send(int fd, const io_uring_cqe& cqe, const Send& send) {
+    {
+        auto& output = send.event->output_buffer();
+        std::lock_guard<std::mutex> output_lock(output.mutex());
+        std::lock_guard<std::mutex> lock(m_submit_mutex);
+        auto it = m_registrations.find(fd);
+        if (it == m_registrations.end() || it->second.send_user_data != cqe.user_data) {
+            // the connection was removed meanwhile
+            return;
+        }
+        it->second.send_user_data = 0;
+        if (!send.poll) {
+            // what a failed send didn't take is dropped, the recv of the connection reports the failure as well
+            output.finish_send(cqe.res < 0 ? output.begin_send().second : static_cast<std::size_t>(cqe.res));
+        }
+        if (cqe.res >= 0 && !output.empty()) {
+            start_send(fd, it->second, send.event);
+        }
+    }
+    if (cqe.res < 0) {
+        send.event->on_error();
+    } else {
+        send.event->on_write();
+    }
+}
+
+void IoUringEventLoop::wait_for_events() {
+    unsigned to_submit;
+    {
+        std::lock_guard<std::mutex> lock(m_submit_mutex);
+        m_loop_thread = std::this_thread::get_id();
+        to_submit = std::exchange(m_pending, 0);
+    }
+    // batched registrations and the wait share one syscall
+    int ret = enter(to_submit, 1, time_out);
+    if (ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY) {
+        auto error = GET_ERROR_MSG();
+        throw std::runtime_error(error.msg);
+    }
+
+    unsigned head = *m_cq_head;
+    unsigned tail = load_acquire(m_cq_tail);
+    while (head != tail) {
+        // copy out before releasing the slot to the kernel, handlers may submit and complete more
+        m_completions.clear();
+        for (; head != tail; ++head) {
+            m_completions.push_back(m_cqes[head & *m_cq_mask]);
+        }
+        store_release(m_cq_head, head);
+        for (const auto& cqe: m_completions) {
+            handle_completion(cqe);
+        }
+        tail = load_acquire(m_cq_tail);
+    }
 }
 
-} // namespace net
\ No newline at end of file
+} // namespace net
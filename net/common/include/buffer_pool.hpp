@@ -0,0 +1,125 @@
+#pragma once
+
+#include "defines.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace net {
+
+/**
+ * @brief Thread local cache of I/O buffers in fixed size classes
+ *        Blocks are taken from and given back to the pool of the calling thread without locking. A block released
+ *        on another thread joins that thread's pool, so buffers may migrate but are never shared between pools.
+ *        Requests larger than the biggest class are served by plain allocations.
+ */
+class BufferPool {
+public:
+    static constexpr std::array<std::size_t, 3> SIZE_CLASSES = { 4 * 1024, 16 * 1024, 64 * 1024 };
+    // blocks kept per size class, the rest is freed on release
+    static constexpr std::size_t MAX_CACHED_BLOCKS = 64;
+
+    BufferPool() = default;
+
+    BufferPool(const BufferPool&) = delete;
+
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    ~BufferPool();
+
+    /**
+     * @brief pool of the calling thread
+     */
+    static BufferPool& local();
+
+    /**
+     * @brief get a block of at least size bytes, capacity is set to the real size of the block
+     */
+    static uint8_t* acquire(std::size_t size, std::size_t& capacity);
+
+    static void release(uint8_t* block, std::size_t capacity);
+
+private:
+    static std::size_t size_class(std::size_t size);
+
+    std::array<std::vector<uint8_t*>, SIZE_CLASSES.size()> m_free_blocks;
+};
+
+/**
+ * @brief Ref-counted handle of a pooled buffer
+ *        Copies share the same bytes, the block goes back to the pool when the last handle is gone. Data is
+ *        appended at tail() and committed with commit(), so reads can land in the buffer directly. The size
+ *        belongs to the handle, a copy keeps seeing what was committed when it was made, whatever the handle it
+ *        came from appends or clears afterwards.
+ */
+class PooledBuffer {
+public:
+    PooledBuffer() = default;
+
+    explicit PooledBuffer(std::size_t capacity);
+
+    PooledBuffer(const PooledBuffer&) = default;
+
+    PooledBuffer& operator=(const PooledBuffer&) = default;
+
+    /**
+     * @brief other is left empty
+     */
+    PooledBuffer(PooledBuffer&& other) noexcept;
+
+    PooledBuffer& operator=(PooledBuffer&& other) noexcept;
+
+    uint8_t* data();
+
+    const uint8_t* data() const;
+
+    std::size_t size() const;
+
+    std::size_t capacity() const;
+
+    bool empty() const;
+
+    /**
+     * @brief first byte after the committed data
+     */
+    uint8_t* tail();
+
+    std::size_t writable() const;
+
+    /**
+     * @brief mark size bytes written at tail() as part of the data
+     */
+    void commit(std::size_t size);
+
+    /**
+     * @brief make sure at least capacity bytes fit, moves the data into a larger block if needed
+     */
+    void reserve(std::size_t capacity);
+
+    /**
+     * @brief drop the data of this handle, a block still shared with other handles is left to them
+     */
+    void clear();
+
+    std::string_view view() const;
+
+private:
+    struct Block {
+        NET_DECLARE_PTRS(Block)
+
+        explicit Block(std::size_t size);
+
+        ~Block();
+
+        std::size_t m_capacity;
+        uint8_t* m_data;
+    };
+
+    Block::SharedPtr m_block;
+    std::size_t m_size = 0;
+};
+
+} // namespace net
@@ -27,6 +27,10 @@ struct NetError {
 #define NET_EARLY_END_OF_SOCKET 6
 #define NET_NO_CLIENT_FOUND 7
 #define NET_CLIENT_ALREADY_EXISTS 8
+#define NET_INVALID_HTTP_MESSAGE 9
+#define NET_FILE_TRUNCATED_CODE 10
+#define NET_HOST_NOT_FOUND_CODE 11
+#define NET_NO_UPSTREAM_CODE 12
 
 #define GET_ERROR_MSG() \
     NetError { errno, std::system_category().message(errno) }
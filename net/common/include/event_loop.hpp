@@ -2,6 +2,8 @@
 
 #include "defines.hpp"
 #include "remote_target.hpp"
+#include <atomic>
+#include <cstddef>
 #include <cstdint>
 #include <functional>
 #include <iostream>
@@ -12,11 +14,19 @@
 #include <sys/epoll.h>
 #include <sys/poll.h>
 #include <sys/select.h>
+#include <thread>
 #include <unordered_map>
+#include <vector>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
 
 namespace net {
 
-enum class EventLoopType : uint8_t { SELECT = 0x01, POLL = 0x02, EPOLL = 0x03 };
+class TimerService;
+
+enum class EventLoopType : uint8_t { SELECT = 0x01, POLL = 0x02, EPOLL = 0x03, IO_URING = 0x04 };
 
 enum class EventType : uint8_t { READ = 0x01, WRITE = 0x02, ERROR = 0x04, HUP = 0x08 };
 
@@ -28,6 +38,12 @@ struct EventHandler {
     Callback m_on_read = nullptr;
     Callback m_on_write = nullptr;
     Callback m_on_error = nullptr;
+
+    // the following are only used by completion based loops, see EventLoop::completion_based
+    // called with the listen fd and a non-blocking fd the loop accepted on it
+    std::function<void(int, int)> m_on_accept = nullptr;
+    // the loop receives into the input buffer of the event before m_on_read and sends its output buffer itself
+    bool m_loop_io = false;
 };
 
 class Event: virtual public RemoteTarget {
@@ -48,11 +64,28 @@ public:
 
     void on_trigger();
 
+    void on_accept(int client_fd);
+
+    bool accepts() const;
+
+    bool loop_io() const;
+
 private:
     EventType m_type;
     std::shared_ptr<EventHandler> m_handler;
 };
 
+/**
+ * @brief Statistics of ready events returned by the waits of an event loop
+ */
+struct EventLoopStats {
+    uint64_t waits = 0;
+    uint64_t ready_events = 0;
+    std::size_t last_ready = 0;
+    std::size_t max_ready = 0;
+    std::size_t batch_size = 0;
+};
+
 class EventLoop {
 public:
     NET_DECLARE_PTRS(EventLoop)
@@ -61,14 +94,104 @@ public:
 
     virtual void add_event(std::shared_ptr<Event> event) = 0;
 
-    virtual void remove_event(int event_fd) = 0;
+    /**
+     * @brief Remove event and close its fd, unless the loop holds another event for that fd by now
+     *        A caller which kept the event of a closed connection can't remove the connection that reused the fd.
+     * @return whether this call removed it
+     */
+    bool remove_event(const std::shared_ptr<Event>& event);
+
+    /**
+     * @brief Remove and close whatever event is registered for event_fd
+     */
+    void remove_event(int event_fd);
+
+    /**
+     * @brief Turn writable notification of a registered fd on or off
+     *        Events are registered for read and error only, write interest is meant to be armed only while the
+     *        connection has pending output, otherwise level triggered loops keep waking up on idle sockets.
+     *        Completion based loops start sending the output buffer of loop_io() events here instead, callers
+     *        hold the mutex of that buffer.
+     */
+    virtual void watch_writable(int event_fd, bool enable) = 0;
 
     virtual void wait_for_events() = 0;
 
+    /**
+     * @brief what the waits of this loop returned so far, all zero for loops that don't keep count
+     */
+    virtual EventLoopStats stats() const {
+        return {};
+    }
+
+    /**
+     * @brief whether the loop does the socket I/O of events itself instead of reporting readiness
+     *        Such a loop accepts on fds whose handler sets m_on_accept and receives and sends for fds whose handler
+     *        sets m_loop_io, m_on_write then reports that a send completed. Other events get readiness as usual.
+     */
+    virtual bool completion_based() const {
+        return false;
+    }
+
     std::shared_ptr<Event> get_event(int event_fd);
 
+    /**
+     * @brief timing wheel driven by this loop, created and registered on first use
+     *        Timer callbacks run on the thread waiting on this loop.
+     */
+    std::shared_ptr<TimerService> timer_service();
+
 protected:
-    RemotePool m_remote_pool;
+    /**
+     * @brief Drop the interest in event_fd, called once its event is taken out of m_remote_pool and before the fd
+     *        is closed
+     */
+    virtual void unregister_event(int event_fd) = 0;
+
+    BasicRemotePool<Event> m_remote_pool;
+    // declared after the pool, the service goes first and the pool then closes its timerfd
+    std::shared_ptr<TimerService> m_timer_service;
+    std::mutex m_timer_service_mutex;
+};
+
+/**
+ * @brief Changes of fd interest for loops whose waits read their fd sets in place
+ *        select and poll read the sets while they block, so only the thread waiting may change them. add_event,
+ *        remove_event and watch_writable queue the change instead, the loop applies what is queued before each
+ *        wait. The first change queued while the loop waits wakes it up through an eventfd.
+ */
+class InterestQueue {
+public:
+    enum class Op : uint8_t { ADD, REMOVE, WATCH_WRITABLE, UNWATCH_WRITABLE };
+
+    struct Change {
+        int m_fd;
+        Op m_op;
+        EventType m_type;
+    };
+
+    InterestQueue();
+
+    ~InterestQueue();
+
+    void push(int fd, Op op, EventType type = EventType::READ);
+
+    /**
+     * @brief the changes queued so far, in order, and the wakeup they caused is consumed
+     */
+    std::vector<Change> take();
+
+    /**
+     * @brief readable while changes are queued, to be waited on along with the fds of the loop
+     */
+    int wake_fd() const {
+        return m_wake_fd;
+    }
+
+private:
+    int m_wake_fd;
+    std::mutex m_mutex;
+    std::vector<Change> m_changes;
 };
 
 /**
@@ -84,14 +207,21 @@ public:
 
     void add_event(std::shared_ptr<Event> event) override;
 
-    void remove_event(int event_fd) override;
+    void watch_writable(int event_fd, bool enable) override;
 
     void wait_for_events() override;
 
+protected:
+    void unregister_event(int event_fd) override;
+
 private:
+    void apply_changes();
+
+    // only touched by the thread waiting on the loop
     fd_set read_fds, write_fds, error_fds;
     int m_max_fd;
     int time_out;
+    InterestQueue m_changes;
 };
 
 class PollEventLoop: public EventLoop {
@@ -102,32 +232,176 @@ public:
 
     void add_event(std::shared_ptr<Event> event) override;
 
-    void remove_event(int event_fd) override;
+    void watch_writable(int event_fd, bool enable) override;
 
     void wait_for_events() override;
 
+protected:
+    void unregister_event(int event_fd) override;
+
 private:
+    void apply_changes();
+
+    // only touched by the thread waiting on the loop, the eventfd of m_changes comes first
     std::vector<pollfd> m_poll_fds;
     int time_out;
+    InterestQueue m_changes;
 };
 
 class EpollEventLoop: public EventLoop {
 public:
     NET_DECLARE_PTRS(EpollEventLoop)
 
-    EpollEventLoop(int time_out = -1);
+    /**
+     * @brief Construct a new Epoll Event Loop object
+     *
+     * @param time_out timeout of epoll_wait in milliseconds, -1 blocks until events arrive
+     * @param max_events number of events fetched by one epoll_wait
+     * @param adaptive double the batch when a wait fills it, up to MAX_ADAPTIVE_EVENTS
+     */
+    EpollEventLoop(int time_out = -1, std::size_t max_events = 1024, bool adaptive = false);
 
     ~EpollEventLoop();
 
     void add_event(std::shared_ptr<Event> event) override;
 
-    void remove_event(int event_fd) override;
+    void watch_writable(int event_fd, bool enable) override;
 
     void wait_for_events() override;
 
+    EventLoopStats stats() const override;
+
+    static constexpr std::size_t MAX_ADAPTIVE_EVENTS = 65536;
+
+protected:
+    void unregister_event(int event_fd) override;
+
 private:
     int m_epoll_fd;
     int time_out;
+    bool m_adaptive;
+    // reused by every wait, only touched by the thread running the loop
+    std::vector<struct epoll_event> m_events;
+
+    std::atomic<uint64_t> m_waits = 0;
+    std::atomic<uint64_t> m_ready_events = 0;
+    std::atomic<std::size_t> m_last_ready = 0;
+    std::atomic<std::size_t> m_max_ready = 0;
+    std::atomic<std::size_t> m_batch_size = 0;
+};
+
+/**
+ * @brief Completion based event loop implementation using io_uring
+ *        Listen fds get a multishot accept and loop_io() connections a multishot recv which picks its buffers
+ *        from a ring of provided buffers, so one request of each stays armed for the whole life of the fd and
+ *        received bytes are copied to the input buffer of the event straight from the completion. Output is
+ *        sent by send requests, the next one goes out when the previous completes. Other fds get a multishot
+ *        poll and readiness as usual. Requests prepared on the loop thread are submitted together with the next
+ *        wait in a single io_uring_enter call. Constructor throws if the kernel lacks io_uring, IORING_FEAT_EXT_ARG
+ *        or multishot recv (linux 6.0), callers are expected to fall back to EpollEventLoop.
+ */
+class IoUringEventLoop: public EventLoop {
+public:
+    NET_DECLARE_PTRS(IoUringEventLoop)
+
+    IoUringEventLoop(int time_out = -1, unsigned entries = 4096);
+
+    ~IoUringEventLoop();
+
+    void add_event(std::shared_ptr<Event> event) override;
+
+    void watch_writable(int event_fd, bool enable) override;
+
+    void wait_for_events() override;
+
+    bool completion_based() const override;
+
+    static constexpr unsigned RECV_BUFFER_COUNT = 1024;
+    static constexpr std::size_t RECV_BUFFER_SIZE = 4 * 1024;
+
+protected:
+    void unregister_event(int event_fd) override;
+
+private:
+    enum class Request : uint8_t { POLL, ACCEPT, RECV };
+
+    struct Registration {
+        Request request;
+        // of the armed poll, accept or recv request
+        uint64_t user_data;
+        uint32_t events;
+        // of the send or writable poll in flight, 0 if there is none
+        uint64_t send_user_data = 0;
+    };
+
+    struct Send {
+        // its output buffer is read by the kernel, kept alive until the send completes
+        std::shared_ptr<Event> event;
+        // waits for the socket to become writable instead of sending
+        bool poll;
+    };
+
+    io_uring_sqe* get_sqe();
+
+    void arm(int fd, const Registration& registration);
+
+    void cancel(uint64_t user_data);
+
+    void start_send(int fd, Registration& registration, std::shared_ptr<Event> event);
+
+    void setup_recv_buffers();
+
+    void recycle_recv_buffer(uint16_t buffer_id);
+
+    void release();
+
+    uint64_t next_user_data(int fd);
+
+    int enter(unsigned to_submit, unsigned min_complete, int time_out);
+
+    void handle_completion(const io_uring_cqe& cqe);
+
+    void handle_recv(std::shared_ptr<Event> event, const io_uring_cqe& cqe);
+
+    void handle_send(int fd, const io_uring_cqe& cqe, const Send& send);
+
+    int m_ring_fd;
+    int time_out;
+
+    void* m_sq_ring = nullptr;
+    std::size_t m_sq_ring_size = 0;
+    void* m_cq_ring = nullptr;
+    std::size_t m_cq_ring_size = 0;
+    io_uring_sqe* m_sqes = nullptr;
+    std::size_t m_sqes_size = 0;
+
+    unsigned* m_sq_head;
+    unsigned* m_sq_tail;
+    unsigned* m_sq_mask;
+    unsigned* m_sq_array;
+    unsigned m_sq_entries;
+    unsigned* m_cq_head;
+    unsigned* m_cq_tail;
+    unsigned* m_cq_mask;
+    io_uring_cqe* m_cqes;
+    // completions copied out of the cq, reused across waits so a batch doesn't allocate
+    std::vector<io_uring_cqe> m_completions;
+
+    // provided buffers of multishot recv, only touched by the thread running the loop once registered
+    io_uring_buf_ring* m_recv_ring = nullptr;
+    std::size_t m_recv_ring_size = 0;
+    uint16_t m_recv_ring_tail = 0;
+    std::vector<uint8_t> m_recv_buffers;
+
+    // sqes prepared but not yet handed to the kernel
+    unsigned m_pending = 0;
+    uint32_t m_generation = 0;
+    // fd -> requests armed for it, lets stale completions of a reused fd be dropped
+    std::unordered_map<int, Registration> m_registrations;
+    // user_data -> send or writable poll in flight
+    std::unordered_map<uint64_t, Send> m_sends;
+    std::mutex m_submit_mutex;
+    std::thread::id m_loop_thread;
 };
 
-} // namespace net
\ No newline at end of file
+} // namespace net
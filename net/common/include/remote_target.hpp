@@ -1,18 +1,149 @@
 #pragma once
 
+#include "buffer_pool.hpp"
 #include "defines.hpp"
+#include <algorithm>
 #include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <format>
 #include <functional>
-#include <map>
 #include <memory>
 #include <mutex>
+#include <stdexcept>
 #include <sys/epoll.h>
 #include <unistd.h>
+#include <utility>
+#include <vector>
 
 namespace net {
 
+/**
+ * @brief Outbound bytes of a connection which the socket couldn't take yet
+ *        Access is guarded by mutex(), the owner decides when to flush it. Loops which send on their own take the
+ *        bytes with begin_send() instead of data(), those stay in place until the send completes while append()
+ *        goes on behind them.
+ */
+class OutputBuffer {
+public:
+    void append(const uint8_t* data, std::size_t size) {
+        m_buffer.insert(m_buffer.end(), data, data + size);
+    }
+
+    const uint8_t* data() const {
+        return m_buffer.data() + m_offset;
+    }
+
+    std::size_t size() const {
+        return m_buffer.size() - m_offset + m_sending.size() - m_sent;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    void consume(std::size_t size) {
+        m_offset += size;
+        if (m_offset == m_buffer.size()) {
+            m_buffer.clear();
+            m_offset = 0;
+        } else if (m_offset > m_buffer.size() / 2) {
+            // compact once the sent prefix dominates, keeps append amortized
+            m_buffer.erase(m_buffer.begin(), m_buffer.begin() + static_cast<std::ptrdiff_t>(m_offset));
+            m_offset = 0;
+        }
+    }
+
+    /**
+     * @brief bytes of the send in flight which the socket didn't take yet, queued bytes join them once all of
+     *        them are sent
+     */
+    std::pair<const uint8_t*, std::size_t> begin_send() {
+        if (m_sent == m_sending.size()) {
+            m_sending.clear();
+            m_sending.swap(m_buffer);
+            m_sent = m_offset;
+            m_offset = 0;
+        }
+        return { m_sending.data() + m_sent, m_sending.size() - m_sent };
+    }
+
+    void finish_send(std::size_t size) {
+        m_sent += size;
+    }
+
+    std::mutex& mutex() {
+        return m_mutex;
+    }
+
+    // set once the high watermark is crossed, cleared when draining reaches the low watermark
+    bool m_above_high_watermark = false;
+    // set by SocketServer::close_remote while output is pending, the connection is closed once it drains
+    bool m_close_when_drained = false;
+
+private:
+    std::vector<uint8_t> m_buffer;
+    std::size_t m_offset = 0;
+    // handed to the kernel by begin_send, m_sent of them went out so far
+    std::vector<uint8_t> m_sending;
+    std::size_t m_sent = 0;
+    std::mutex m_mutex;
+};
+
+/**
+ * @brief Inbound bytes of a connection received by a loop which receives on its own
+ *        The loop appends what arrives, reads of the server take it out. Access is guarded by mutex().
+ */
+class InputBuffer {
+public:
+    void append(const uint8_t* data, std::size_t size) {
+        if (m_buffer.writable() < size) {
+            m_buffer.reserve(m_buffer.size() + std::max(size, BufferPool::SIZE_CLASSES.front()));
+        }
+        std::copy(data, data + size, m_buffer.tail());
+        m_buffer.commit(size);
+    }
+
+    std::size_t size() const {
+        return m_buffer.size();
+    }
+
+    bool empty() const {
+        return m_buffer.empty();
+    }
+
+    /**
+     * @brief move at most max_size bytes into buffer, 0 means all of them
+     */
+    void take(PooledBuffer& buffer, std::size_t max_size) {
+        if (max_size == 0 || m_buffer.size() <= max_size) {
+            buffer = std::move(m_buffer);
+            return;
+        }
+        buffer.clear();
+        buffer.reserve(max_size);
+        std::copy(m_buffer.data(), m_buffer.data() + max_size, buffer.tail());
+        buffer.commit(max_size);
+        auto rest = m_buffer.size() - max_size;
+        std::copy(m_buffer.data() + max_size, m_buffer.data() + m_buffer.size(), m_buffer.data());
+        m_buffer.clear();
+        m_buffer.commit(rest);
+    }
+
+    std::mutex& mutex() {
+        return m_mutex;
+    }
+
+    // set once the peer closed the connection or receiving failed
+    bool m_closed = false;
+    // errno of the failed receive, 0 if the peer closed the connection
+    int m_error = 0;
+
+private:
+    PooledBuffer m_buffer;
+    std::mutex m_mutex;
+};
+
 class RemoteTarget {
 public:
     NET_DECLARE_PTRS(RemoteTarget)
@@ -41,49 +172,171 @@ public:
         return m_client_fd;
     }
 
+    OutputBuffer& output_buffer() {
+        return m_output_buffer;
+    }
+
+    InputBuffer& input_buffer() {
+        return m_input_buffer;
+    }
+
+    /**
+     * @brief id of the pending idle timeout timer of the connection, 0 if there is none
+     */
+    uint64_t idle_timer() const {
+        return m_idle_timer.load();
+    }
+
+    void set_idle_timer(uint64_t timer_id) {
+        m_idle_timer.store(timer_id);
+    }
+
 protected:
     int m_client_fd;
+    OutputBuffer m_output_buffer;
+    InputBuffer m_input_buffer;
+    std::atomic<uint64_t> m_idle_timer = 0;
     std::atomic<bool> m_status = true;
     std::mutex m_mutex;
 };
 
-class RemotePool {
+/**
+ * @brief Connection table indexed by fd
+ *        Slots live in lazily allocated fixed-size chunks, so a slot never moves once created and lookups
+ *        take no table wide lock: a read is one atomic load of the slot. That load is not lock free, libstdc++
+ *        guards std::atomic<std::shared_ptr> with a small lock of its own, but threads only contend on it for the
+ *        same slot. Inserts and removes are atomic per slot. Removing by remote only takes it out while the slot
+ *        still holds that remote, so a late removal can't close a new connection which reused the fd.
+ */
+template<typename T>
+class BasicRemotePool {
 public:
-    RemotePool() = default;
+    BasicRemotePool() = default;
+
+    BasicRemotePool(const BasicRemotePool&) = delete;
 
-    void add_remote(std::shared_ptr<RemoteTarget> remote) {
-        std::lock_guard<std::mutex> lock(m_mtx);
-        remotes[remote->fd()] = remote;
+    BasicRemotePool& operator=(const BasicRemotePool&) = delete;
+
+    ~BasicRemotePool() {
+        for (auto& chunk: m_chunks) {
+            delete chunk.load(std::memory_order_acquire);
+        }
+    }
+
+    void add_remote(std::shared_ptr<T> remote) {
+        auto slot = acquire_slot(remote->fd());
+        if (slot == nullptr) {
+            throw std::out_of_range(std::format("fd {} exceeds the capacity of remote pool", remote->fd()));
+        }
+        slot->remote.store(std::move(remote), std::memory_order_release);
     }
 
     void remove_remote(int fd) {
-        std::lock_guard<std::mutex> lock(m_mtx);
-        auto it = remotes.find(fd);
-        if (it != remotes.end()) {
-            it->second->close_remote();
-            remotes.erase(it);
+        auto slot = find_slot(fd);
+        if (slot == nullptr) {
+            return;
+        }
+        // only the thread which takes the remote out of the slot closes it
+        auto remote = slot->remote.exchange(nullptr, std::memory_order_acq_rel);
+        if (remote != nullptr) {
+            remote->close_remote();
         }
     }
 
-    RemoteTarget::SharedPtr get_remote(int fd) {
-        std::lock_guard<std::mutex> lock(m_mtx);
-        auto it = remotes.find(fd);
-        if (it != remotes.end()) {
-            return it->second;
+    /**
+     * @brief Remove and close remote if its slot still holds it
+     * @return whether this call removed it
+     */
+    bool remove_remote(const std::shared_ptr<T>& remote) {
+        if (!take_remote(remote)) {
+            return false;
         }
-        return nullptr;
+        remote->close_remote();
+        return true;
     }
 
-    void iterate(std::function<void(RemoteTarget::SharedPtr)> func) {
-        std::lock_guard<std::mutex> lock(m_mtx);
-        for (auto& [_, remote]: remotes) {
-            func(remote);
+    /**
+     * @brief Take remote out of its slot if the slot still holds it, without closing it
+     * @return whether this call took it, the caller closes it then
+     */
+    bool take_remote(const std::shared_ptr<T>& remote) {
+        auto slot = find_slot(remote->fd());
+        if (slot == nullptr) {
+            return false;
+        }
+        auto expected = remote;
+        return slot->remote.compare_exchange_strong(expected, nullptr, std::memory_order_acq_rel);
+    }
+
+    std::shared_ptr<T> get_remote(int fd) const {
+        auto slot = find_slot(fd);
+        if (slot == nullptr) {
+            return nullptr;
+        }
+        return slot->remote.load(std::memory_order_acquire);
+    }
+
+    void iterate(std::function<void(std::shared_ptr<T>)> func) const {
+        for (auto& chunk_ptr: m_chunks) {
+            auto chunk = chunk_ptr.load(std::memory_order_acquire);
+            if (chunk == nullptr) {
+                continue;
+            }
+            for (auto& slot: chunk->slots) {
+                auto remote = slot.remote.load(std::memory_order_acquire);
+                if (remote != nullptr) {
+                    func(std::move(remote));
+                }
+            }
         }
     }
 
 private:
-    std::map<int, std::shared_ptr<RemoteTarget>> remotes;
-    std::mutex m_mtx;
+    static constexpr std::size_t CHUNK_BITS = 10;
+    static constexpr std::size_t CHUNK_SIZE = 1 << CHUNK_BITS;
+    // 1024 chunks of 1024 slots cover the default nr_open limit of linux
+    static constexpr std::size_t MAX_CHUNKS = 1024;
+
+    struct Slot {
+        std::atomic<std::shared_ptr<T>> remote;
+    };
+
+    struct Chunk {
+        Slot slots[CHUNK_SIZE];
+    };
+
+    Slot* find_slot(int fd) const {
+        if (fd < 0 || static_cast<std::size_t>(fd) >= MAX_CHUNKS * CHUNK_SIZE) {
+            return nullptr;
+        }
+        auto chunk = m_chunks[fd >> CHUNK_BITS].load(std::memory_order_acquire);
+        if (chunk == nullptr) {
+            return nullptr;
+        }
+        return &chunk->slots[fd & (CHUNK_SIZE - 1)];
+    }
+
+    Slot* acquire_slot(int fd) {
+        if (fd < 0 || static_cast<std::size_t>(fd) >= MAX_CHUNKS * CHUNK_SIZE) {
+            return nullptr;
+        }
+        auto& chunk_ptr = m_chunks[fd >> CHUNK_BITS];
+        auto chunk = chunk_ptr.load(std::memory_order_acquire);
+        if (chunk == nullptr) {
+            auto new_chunk = new Chunk();
+            if (chunk_ptr.compare_exchange_strong(chunk, new_chunk, std::memory_order_acq_rel)) {
+                chunk = new_chunk;
+            } else {
+                // another thread installed the chunk first
+                delete new_chunk;
+            }
+        }
+        return &chunk->slots[fd & (CHUNK_SIZE - 1)];
+    }
+
+    std::atomic<Chunk*> m_chunks[MAX_CHUNKS] = {};
 };
 
+using RemotePool = BasicRemotePool<RemoteTarget>;
+
 } // namespace net
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace net::simd {
+
+enum class Isa : uint8_t { SCALAR = 0, SSE42, AVX2 };
+
+/**
+ * @brief instruction set the scanners use, picked once from what the cpu supports
+ */
+Isa active_isa();
+
+/**
+ * @brief switch the scanners to isa, falls back to the best supported one below it
+ * @note meant for tests and benchmarks, not safe while other threads are scanning
+ */
+void set_isa(Isa isa);
+
+/**
+ * @return position of the first "\r\n" at or after from, npos if there is none
+ */
+std::size_t find_crlf(std::string_view data, std::size_t from = 0);
+
+/**
+ * @return position of the first "\r\n\r\n" at or after from, npos if there is none
+ */
+std::size_t find_header_end(std::string_view data, std::size_t from = 0);
+
+/**
+ * @return position of the first c at or after from, npos if there is none
+ */
+std::size_t find_char(std::string_view data, char c, std::size_t from = 0);
+
+/**
+ * @return position of the first byte which is not a tchar of RFC 9110 (method names, header names), npos if
+ *         every byte is valid
+ */
+std::size_t find_invalid_token_char(std::string_view token);
+
+} // namespace net::simd
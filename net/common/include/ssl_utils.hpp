@@ -10,6 +10,8 @@
 #include <openssl/types.h>
 #include <signal.h>
 #include <string>
+#include <string_view>
+#include <vector>
 
 namespace net {
 
@@ -55,6 +57,24 @@ public:
         }
     }
 
+    /**
+     * @brief offer protocols by ALPN, in order of preference, the first one the client supports as well is selected
+     * @note a client offering none of them gets no protocol rather than a failed handshake
+     */
+    void set_alpn_protocols(const std::vector<std::string>& protocols) {
+        auto wire = std::make_shared<std::string>();
+        for (auto& protocol: protocols) {
+            if (protocol.empty() || protocol.size() > 255) {
+                throw std::runtime_error("Invalid ALPN protocol name");
+            }
+            wire->push_back(static_cast<char>(protocol.size()));
+            wire->append(protocol);
+        }
+        // kept apart from the context, the callback refers to it while the context may be moved
+        m_alpn_protocols = std::move(wire);
+        SSL_CTX_set_alpn_select_cb(m_ctx.get(), select_alpn_protocol, m_alpn_protocols.get());
+    }
+
     std::shared_ptr<SSL_CTX> get() {
         return m_ctx;
     }
@@ -64,9 +84,31 @@ public:
     }
 
 private:
+    static int select_alpn_protocol(
+        SSL*,
+        const unsigned char** out,
+        unsigned char* out_len,
+        const unsigned char* in,
+        unsigned int in_len,
+        void* arg
+    ) {
+        auto wire = static_cast<const std::string*>(arg);
+        auto result = SSL_select_next_proto(
+            const_cast<unsigned char**>(out),
+            out_len,
+            reinterpret_cast<const unsigned char*>(wire->data()),
+            static_cast<unsigned int>(wire->size()),
+            in,
+            in_len
+        );
+        return result == OPENSSL_NPN_NEGOTIATED ? SSL_TLSEXT_ERR_OK : SSL_TLSEXT_ERR_NOACK;
+    }
+
     inline static bool inited = false;
 
     std::shared_ptr<SSL_CTX> m_ctx;
+    // protocols offered by ALPN in wire format, each prefixed with its length
+    std::shared_ptr<std::string> m_alpn_protocols;
 };
 
 class SSLRemoteTarget: virtual public RemoteTarget {
@@ -89,6 +131,16 @@ public:
         m_ssl_handshaked = handshaked;
     }
 
+    /**
+     * @return protocol selected by ALPN during the handshake, empty if none was
+     */
+    std::string_view alpn_protocol() {
+        const unsigned char* protocol = nullptr;
+        unsigned int size = 0;
+        SSL_get0_alpn_selected(m_ssl.get(), &protocol, &size);
+        return { reinterpret_cast<const char*>(protocol), size };
+    }
+
     void close_remote() override {
         std::lock_guard<std::mutex> lock(m_mutex);
         if (m_status.load()) {
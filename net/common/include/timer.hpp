@@ -2,9 +2,12 @@
 
 #include <cassert>
 #include <chrono>
+#include <condition_variable>
 #include <cstdint>
 #include <functional>
 #include <future>
+#include <memory>
+#include <mutex>
 #include <thread>
 namespace net {
 
@@ -16,108 +19,155 @@ public:
     Timer(const Timer&) = delete;
     Timer(Timer&&) = default;
     Timer& operator=(const Timer&) = delete;
-    Timer& operator=(Timer&&) = default;
 
-    virtual ~Timer() = default;
+    // the running timer is stopped and waited for before it is replaced
+    Timer& operator=(Timer&& other) noexcept {
+        if (this != &other) {
+            join();
+            m_state = std::move(other.m_state);
+            m_future = std::move(other.m_future);
+        }
+        return *this;
+    }
+
+    virtual ~Timer() {
+        join();
+    }
 
     template<typename Rep, typename Period>
     void set_interval(std::chrono::duration<Rep, Period> interval) {
-        m_interval = std::chrono::duration_cast<std::chrono::nanoseconds>(interval);
+        m_state->m_interval = std::chrono::duration_cast<std::chrono::nanoseconds>(interval);
     }
 
     void set_rate(double rate) {
-        m_interval = std::chrono::nanoseconds(static_cast<uint64_t>(1e9 / rate));
+        m_state->m_interval = std::chrono::nanoseconds(static_cast<uint64_t>(1e9 / rate));
     }
 
     template<typename Rep, typename Period>
     void set_timeout(std::chrono::duration<Rep, Period> timeout) {
-        m_timeout = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout);
-        m_timeout_set = true;
+        m_state->m_timeout = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout);
+        m_state->m_timeout_set = true;
     }
 
     void sleep() const {
-        std::this_thread::sleep_for(m_interval);
+        std::this_thread::sleep_for(m_state->m_interval);
     }
 
     void start_timing() {
-        assert(m_timeout_set && "Timeout not set");
-        m_status = TimerStatus::RUNNING;
-        auto time_has_passed = std::chrono::nanoseconds(0);
-        auto start_time = std::chrono::high_resolution_clock::now();
-        while (time_has_passed < m_timeout) {
-            if (m_status == TimerStatus::PAUSED || m_status == TimerStatus::STOPPED) {
-                break;
-            }
-            auto end_time = std::chrono::high_resolution_clock::now();
-            time_has_passed = end_time - start_time;
-        }
-        m_timeout_flag = true;
-        m_status = TimerStatus::STOPPED;
-        if (m_timeout_action) {
-            m_timeout_action();
-        }
+        run_timing(*m_state);
     }
 
     void start_interval() {
-        m_status = TimerStatus::RUNNING;
-        while (m_status == TimerStatus::RUNNING) {
-            sleep();
-            if (m_interval_action) {
-                m_interval_action();
-            }
-        }
+        run_interval(*m_state);
     }
 
+    // the future is kept so the caller isn't blocked until the timer finishes, the thread holds the state and not
+    // this, so the timer may be moved while it runs
     void async_start_timing() {
-        auto unused_future = std::async(std::launch::async, [this]() { start_timing(); });
+        m_future = std::async(std::launch::async, [state = m_state]() { run_timing(*state); });
     }
 
     void async_start_interval() {
-        auto unused_future = std::async(std::launch::async, [this]() { start_interval(); });
+        m_future = std::async(std::launch::async, [state = m_state]() { run_interval(*state); });
     }
 
     TimerStatus status() const {
-        return m_status;
+        return m_state->status();
     }
 
     bool timeout() const {
-        return m_timeout_flag;
+        std::lock_guard<std::mutex> lock(m_state->m_mutex);
+        return m_state->m_timeout_flag;
     }
 
     void on_time_out(std::function<void()> action) {
-        m_timeout_action = action;
+        m_state->m_timeout_action = action;
     }
 
     void on_time_interval(std::function<void()> action) {
-        m_interval_action = action;
+        m_state->m_interval_action = action;
     }
 
     void pause() {
-        m_status = TimerStatus::PAUSED;
+        m_state->set_status(TimerStatus::PAUSED);
     }
 
     void resume() {
-        m_status = TimerStatus::RUNNING;
+        m_state->set_status(TimerStatus::RUNNING);
     }
 
     void stop() {
-        m_status = TimerStatus::STOPPED;
+        m_state->set_status(TimerStatus::STOPPED);
     }
 
     void reset() {
-        m_timeout_flag = false;
+        std::lock_guard<std::mutex> lock(m_state->m_mutex);
+        m_state->m_timeout_flag = false;
     }
 
 private:
-    std::chrono::nanoseconds m_interval;
-    std::chrono::nanoseconds m_timeout;
+    struct State {
+        TimerStatus status() const {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_status;
+        }
 
-    bool m_timeout_flag = false;
-    bool m_timeout_set = false;
-    std::function<void()> m_timeout_action;
-    std::function<void()> m_interval_action;
+        void set_status(TimerStatus status) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_status = status;
+            }
+            m_cv.notify_all();
+        }
+
+        std::chrono::nanoseconds m_interval;
+        std::chrono::nanoseconds m_timeout;
+
+        bool m_timeout_flag = false;
+        bool m_timeout_set = false;
+        std::function<void()> m_timeout_action;
+        std::function<void()> m_interval_action;
+
+        TimerStatus m_status = TimerStatus::STOPPED;
+        mutable std::mutex m_mutex;
+        std::condition_variable m_cv;
+    };
+
+    static void run_timing(State& state) {
+        assert(state.m_timeout_set && "Timeout not set");
+        {
+            // sleep until the deadline, stop() and pause() wake it up early
+            std::unique_lock<std::mutex> lock(state.m_mutex);
+            state.m_status = TimerStatus::RUNNING;
+            state.m_cv.wait_for(lock, state.m_timeout, [&state]() { return state.m_status != TimerStatus::RUNNING; });
+            state.m_timeout_flag = true;
+            state.m_status = TimerStatus::STOPPED;
+        }
+        if (state.m_timeout_action) {
+            state.m_timeout_action();
+        }
+    }
+
+    static void run_interval(State& state) {
+        state.set_status(TimerStatus::RUNNING);
+        while (state.status() == TimerStatus::RUNNING) {
+            std::this_thread::sleep_for(state.m_interval);
+            if (state.m_interval_action) {
+                state.m_interval_action();
+            }
+        }
+    }
+
+    void join() {
+        if (m_future.valid()) {
+            stop();
+            m_future.wait();
+        }
+    }
 
-    TimerStatus m_status = TimerStatus::STOPPED;
+    // shared with the thread started by async_start_*, a moved from timer is only destroyed or assigned to
+    std::shared_ptr<State> m_state = std::make_shared<State>();
+    std::future<void> m_future;
 };
 
 } // namespace net
\ No newline at end of file
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "defines.hpp"
+#include "event_loop.hpp"
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace net {
+
+using TimerId = uint64_t;
+
+/**
+ * @brief Hierarchical timing wheel
+ *        Four levels of 256 slots, level n covers 256^(n+1) ticks. Scheduling appends to a slot list and
+ *        cancelling unlinks the node through its stored position, both O(1). When a lower level wraps, the due
+ *        slot of the level above is cascaded down. Not thread safe, TimerService serializes access.
+ */
+class TimingWheel {
+public:
+    using Callback = std::function<void()>;
+
+    explicit TimingWheel(std::chrono::milliseconds tick = std::chrono::milliseconds(10));
+
+    /**
+     * @brief schedule callback to fire after delay, rounded up to whole ticks
+     * @return id of the timer, never 0
+     */
+    TimerId schedule(std::chrono::milliseconds delay, Callback callback);
+
+    /**
+     * @return false if the timer already fired or never existed
+     */
+    bool cancel(TimerId id);
+
+    /**
+     * @brief move the wheel ticks forward, callbacks of expired timers are appended to expired
+     */
+    void advance(uint64_t ticks, std::vector<Callback>& expired);
+
+    std::size_t size() const;
+
+    bool empty() const;
+
+    std::chrono::milliseconds tick() const;
+
+private:
+    static constexpr std::size_t LEVEL_BITS = 8;
+    static constexpr std::size_t SLOT_NUM = 1 << LEVEL_BITS;
+    static constexpr std::size_t LEVEL_NUM = 4;
+
+    struct Node {
+        TimerId id;
+        uint64_t expire_tick;
+        Callback callback;
+    };
+
+    using Slot = std::list<Node>;
+
+    struct Position {
+        Slot* slot;
+        Slot::iterator it;
+    };
+
+    Slot& slot_of(uint64_t expire_tick);
+
+    void cascade(std::size_t level);
+
+    std::array<std::array<Slot, SLOT_NUM>, LEVEL_NUM> m_slots;
+    std::unordered_map<TimerId, Position> m_positions;
+    std::chrono::milliseconds m_tick;
+    uint64_t m_current_tick = 0;
+    TimerId m_next_id = 1;
+};
+
+/**
+ * @brief Timing wheel driven by a timerfd registered in an event loop
+ *        The timerfd ticks only while timers are pending, so an idle service costs nothing. Timers may be
+ *        scheduled and cancelled from any thread, callbacks run on the thread of the owning event loop.
+ */
+class TimerService {
+public:
+    NET_DECLARE_PTRS(TimerService)
+
+    explicit TimerService(std::chrono::milliseconds tick = std::chrono::milliseconds(10));
+
+    TimerService(const TimerService&) = delete;
+
+    TimerService& operator=(const TimerService&) = delete;
+
+    TimerId schedule(std::chrono::milliseconds delay, TimingWheel::Callback callback);
+
+    bool cancel(TimerId id);
+
+    /**
+     * @brief register the timerfd in event_loop, the loop owns and closes it from now on
+     */
+    void attach(EventLoop& event_loop);
+
+    /**
+     * @brief drain the timerfd and fire every due timer, called by the event loop when the fd is readable
+     */
+    void on_expire();
+
+    std::size_t size() const;
+
+    int fd() const;
+
+private:
+    void arm(bool enable);
+
+    TimingWheel m_wheel;
+    Event::SharedPtr m_event;
+    std::chrono::steady_clock::time_point m_last_advance;
+    bool m_armed = false;
+    mutable std::mutex m_mutex;
+};
+
+} // namespace net
@@ -0,0 +1,285 @@
+#include "simd_scan.hpp"
+#include <array>
+#include <cstring>
+#include <string_view>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+    #define NET_SIMD_X86 1
+#endif
+
+namespace net::simd {
+
+namespace {
+
+    constexpr auto npos = std::string_view::npos;
+
+    constexpr bool is_tchar(uint8_t c) {
+        if (('0' <= c && c <= '9') || ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z')) {
+            return true;
+        }
+        return std::string_view("!#$%&'*+-.^_`|~").find(static_cast<char>(c)) != npos;
+    }
+
+    constexpr std::array<bool, 256> make_tchar_table() {
+        std::array<bool, 256> table {};
+        for (int c = 0; c < 256; c++) {
+            table[c] = is_tchar(static_cast<uint8_t>(c));
+        }
+        return table;
+    }
+
+    constexpr auto TCHAR_TABLE = make_tchar_table();
+
+    // tchar lookup by nibbles: byte c is valid iff LOW[c & 15] & HIGH[c >> 4] != 0, bit h of LOW[l] tells
+    // whether 0xhl is valid, bytes above 0x7f have no bit in HIGH
+    constexpr std::array<uint8_t, 16> make_low_nibble_table() {
+        std::array<uint8_t, 16> table {};
+        for (int c = 0; c < 128; c++) {
+            if (is_tchar(static_cast<uint8_t>(c))) {
+                table[c & 15] |= static_cast<uint8_t>(1 << (c >> 4));
+            }
+        }
+        return table;
+    }
+
+    constexpr auto LOW_NIBBLE_TABLE = make_low_nibble_table();
+    constexpr std::array<uint8_t, 16> HIGH_NIBBLE_TABLE = { 1, 2, 4, 8, 16, 32, 64, 128, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+    std::size_t find_crlf_scalar(std::string_view data, std::size_t from) {
+        return data.find("\r\n", from, 2);
+    }
+
+    std::size_t find_header_end_scalar(std::string_view data, std::size_t from) {
+        return data.find("\r\n\r\n", from, 4);
+    }
+
+    std::size_t find_char_scalar(std::string_view data, char c, std::size_t from) {
+        return data.find(c, from);
+    }
+
+    std::size_t find_invalid_token_char_scalar(std::string_view token, std::size_t from) {
+        for (std::size_t i = from; i < token.size(); i++) {
+            if (!TCHAR_TABLE[static_cast<uint8_t>(token[i])]) {
+                return i;
+            }
+        }
+        return npos;
+    }
+
+#ifdef NET_SIMD_X86
+
+    // the multi byte patterns compare shifted loads against each byte of the pattern, so a match straddling two
+    // blocks is still found, the few bytes too close to the end to load a whole block go to the scalar code
+
+    __attribute__((target("sse4.2"))) std::size_t find_crlf_sse42(std::string_view data, std::size_t from) {
+        auto ptr = data.data();
+        const __m128i cr = _mm_set1_epi8('\r');
+        const __m128i lf = _mm_set1_epi8('\n');
+        std::size_t i = from;
+        for (; i + 17 <= data.size(); i += 16) {
+            auto first = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr + i)), cr);
+            auto second = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr + i + 1)), lf);
+            auto mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_and_si128(first, second)));
+            if (mask != 0) {
+                return i + static_cast<std::size_t>(__builtin_ctz(mask));
+            }
+        }
+        return find_crlf_scalar(data, i);
+    }
+
+    __attribute__((target("avx2"))) std::size_t find_crlf_avx2(std::string_view data, std::size_t from) {
+        auto ptr = data.data();
+        const __m256i cr = _mm256_set1_epi8('\r');
+        const __m256i lf = _mm256_set1_epi8('\n');
+        std::size_t i = from;
+        for (; i + 33 <= data.size(); i += 32) {
+            auto first = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr + i)), cr);
+            auto second = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr + i + 1)), lf);
+            auto mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_and_si256(first, second)));
+            if (mask != 0) {
+                return i + static_cast<std::size_t>(__builtin_ctz(mask));
+            }
+        }
+        return find_crlf_sse42(data, i);
+    }
+
+    __attribute__((target("sse4.2"))) std::size_t find_header_end_sse42(std::string_view data, std::size_t from) {
+        auto ptr = data.data();
+        const __m128i cr = _mm_set1_epi8('\r');
+        const __m128i lf = _mm_set1_epi8('\n');
+        std::size_t i = from;
+        for (; i + 19 <= data.size(); i += 16) {
+            auto b0 = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr + i)), cr);
+            auto b1 = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr + i + 1)), lf);
+            auto b2 = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr + i + 2)), cr);
+            auto b3 = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr + i + 3)), lf);
+            auto match = _mm_and_si128(_mm_and_si128(b0, b1), _mm_and_si128(b2, b3));
+            auto mask = static_cast<unsigned>(_mm_movemask_epi8(match));
+            if (mask != 0) {
+                return i + static_cast<std::size_t>(__builtin_ctz(mask));
+            }
+        }
+        return find_header_end_scalar(data, i);
+    }
+
+    __attribute__((target("avx2"))) std::size_t find_header_end_avx2(std::string_view data, std::size_t from) {
+        auto ptr = data.data();
+        const __m256i cr = _mm256_set1_epi8('\r');
+        const __m256i lf = _mm256_set1_epi8('\n');
+        std::size_t i = from;
+        for (; i + 35 <= data.size(); i += 32) {
+            auto b0 = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr + i)), cr);
+            auto b1 = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr + i + 1)), lf);
+            auto b2 = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr + i + 2)), cr);
+            auto b3 = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr + i + 3)), lf);
+            auto match = _mm256_and_si256(_mm256_and_si256(b0, b1), _mm256_and_si256(b2, b3));
+            auto mask = static_cast<unsigned>(_mm256_movemask_epi8(match));
+            if (mask != 0) {
+                return i + static_cast<std::size_t>(__builtin_ctz(mask));
+            }
+        }
+        return find_header_end_sse42(data, i);
+    }
+
+    __attribute__((target("sse4.2"))) std::size_t find_char_sse42(std::string_view data, char c, std::size_t from) {
+        auto ptr = data.data();
+        const __m128i needle = _mm_set1_epi8(c);
+        std::size_t i = from;
+        for (; i + 16 <= data.size(); i += 16) {
+            auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr + i));
+            auto mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, needle)));
+            if (mask != 0) {
+                return i + static_cast<std::size_t>(__builtin_ctz(mask));
+            }
+        }
+        return find_char_scalar(data, c, i);
+    }
+
+    __attribute__((target("avx2"))) std::size_t find_char_avx2(std::string_view data, char c, std::size_t from) {
+        auto ptr = data.data();
+        const __m256i needle = _mm256_set1_epi8(c);
+        std::size_t i = from;
+        for (; i + 32 <= data.size(); i += 32) {
+            auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr + i));
+            auto mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle)));
+            if (mask != 0) {
+                return i + static_cast<std::size_t>(__builtin_ctz(mask));
+            }
+        }
+        return find_char_sse42(data, c, i);
+    }
+
+    __attribute__((target("sse4.2"))) std::size_t
+    find_invalid_token_char_sse42(std::string_view token, std::size_t from) {
+        auto ptr = token.data();
+        const __m128i low_table = _mm_loadu_si128(reinterpret_cast<const __m128i*>(LOW_NIBBLE_TABLE.data()));
+        const __m128i high_table = _mm_loadu_si128(reinterpret_cast<const __m128i*>(HIGH_NIBBLE_TABLE.data()));
+        const __m128i nibble = _mm_set1_epi8(0x0f);
+        std::size_t i = from;
+        for (; i + 16 <= token.size(); i += 16) {
+            auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr + i));
+            auto low = _mm_shuffle_epi8(low_table, _mm_and_si128(block, nibble));
+            auto high = _mm_shuffle_epi8(high_table, _mm_and_si128(_mm_srli_epi16(block, 4), nibble));
+            auto invalid = _mm_cmpeq_epi8(_mm_and_si128(low, high), _mm_setzero_si128());
+            auto mask = static_cast<unsigned>(_mm_movemask_epi8(invalid));
+            if (mask != 0) {
+                return i + static_cast<std::size_t>(__builtin_ctz(mask));
+            }
+        }
+        return find_invalid_token_char_scalar(token, i);
+    }
+
+    __attribute__((target("avx2"))) std::size_t
+    find_invalid_token_char_avx2(std::string_view token, std::size_t from) {
+        auto ptr = token.data();
+        const __m256i low_table = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(LOW_NIBBLE_TABLE.data()))
+        );
+        const __m256i high_table = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(HIGH_NIBBLE_TABLE.data()))
+        );
+        const __m256i nibble = _mm256_set1_epi8(0x0f);
+        std::size_t i = from;
+        for (; i + 32 <= token.size(); i += 32) {
+            auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr + i));
+            auto low = _mm256_shuffle_epi8(low_table, _mm256_and_si256(block, nibble));
+            auto high = _mm256_shuffle_epi8(high_table, _mm256_and_si256(_mm256_srli_epi16(block, 4), nibble));
+            auto invalid = _mm256_cmpeq_epi8(_mm256_and_si256(low, high), _mm256_setzero_si256());
+            auto mask = static_cast<unsigned>(_mm256_movemask_epi8(invalid));
+            if (mask != 0) {
+                return i + static_cast<std::size_t>(__builtin_ctz(mask));
+            }
+        }
+        return find_invalid_token_char_sse42(token, i);
+    }
+
+#endif
+
+    struct Kernels {
+        Isa isa;
+        std::size_t (*find_crlf)(std::string_view, std::size_t);
+        std::size_t (*find_header_end)(std::string_view, std::size_t);
+        std::size_t (*find_char)(std::string_view, char, std::size_t);
+        std::size_t (*find_invalid_token_char)(std::string_view, std::size_t);
+    };
+
+    Kernels kernels_for(Isa isa) {
+#ifdef NET_SIMD_X86
+        __builtin_cpu_init();
+        if (isa >= Isa::AVX2 && __builtin_cpu_supports("avx2")) {
+            return { Isa::AVX2, find_crlf_avx2, find_header_end_avx2, find_char_avx2, find_invalid_token_char_avx2 };
+        }
+        if (isa >= Isa::SSE42 && __builtin_cpu_supports("sse4.2")) {
+            return {
+                Isa::SSE42, find_crlf_sse42, find_header_end_sse42, find_char_sse42, find_invalid_token_char_sse42
+            };
+        }
+#endif
+        (void)isa;
+        return {
+            Isa::SCALAR, find_crlf_scalar, find_header_end_scalar, find_char_scalar, find_invalid_token_char_scalar
+        };
+    }
+
+    Kernels& kernels() {
+        static Kernels kernels = kernels_for(Isa::AVX2);
+        return kernels;
+    }
+
+} // namespace
+
+Isa active_isa() {
+    return kernels().isa;
+}
+
+void set_isa(Isa isa) {
+    kernels() = kernels_for(isa);
+}
+
+std::size_t find_crlf(std::string_view data, std::size_t from) {
+    if (from >= data.size()) {
+        return npos;
+    }
+    return kernels().find_crlf(data, from);
+}
+
+std::size_t find_header_end(std::string_view data, std::size_t from) {
+    if (from >= data.size()) {
+        return npos;
+    }
+    return kernels().find_header_end(data, from);
+}
+
+std::size_t find_char(std::string_view data, char c, std::size_t from) {
+    if (from >= data.size()) {
+        return npos;
+    }
+    return kernels().find_char(data, c, from);
+}
+
+std::size_t find_invalid_token_char(std::string_view token) {
+    return kernels().find_invalid_token_char(token, 0);
+}
+
+} // namespace net::simd
@@ -0,0 +1,177 @@
+#include "timing_wheel.hpp"
+#include "defines.hpp"
+#include "event_loop.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <format>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace net {
+
+TimingWheel::TimingWheel(std::chrono::milliseconds tick): m_tick(std::max(tick, std::chrono::milliseconds(1))) {}
+
+TimingWheel::Slot& TimingWheel::slot_of(uint64_t expire_tick) {
+    if (expire_tick <= m_current_tick) {
+        // due already, lands in the slot which is processed right after the cascade
+        return m_slots[0][m_current_tick & (SLOT_NUM - 1)];
+    }
+    uint64_t delta = expire_tick - m_current_tick;
+    for (std::size_t level = 0; level < LEVEL_NUM; ++level) {
+        if (delta < (1ULL << (LEVEL_BITS * (level + 1)))) {
+            return m_slots[level][(expire_tick >> (LEVEL_BITS * level)) & (SLOT_NUM - 1)];
+        }
+    }
+    // farther than the wheel reaches, park in the last slot of the top level and cascade from there
+    return m_slots[LEVEL_NUM - 1][((m_current_tick >> (LEVEL_BITS * (LEVEL_NUM - 1))) - 1) & (SLOT_NUM - 1)];
+}
+
+TimerId TimingWheel::schedule(std::chrono::milliseconds delay, Callback callback) {
+    auto ticks = static_cast<uint64_t>((std::max(delay.count(), int64_t(0)) + m_tick.count() - 1) / m_tick.count());
+    auto id = m_next_id++;
+    auto expire_tick = m_current_tick + std::max<uint64_t>(ticks, 1);
+    auto& slot = slot_of(expire_tick);
+    slot.push_back(Node { id, expire_tick, std::move(callback) });
+    m_positions.emplace(id, Position { &slot, std::prev(slot.end()) });
+    return id;
+}
+
+bool TimingWheel::cancel(TimerId id) {
+    auto it = m_positions.find(id);
+    if (it == m_positions.end()) {
+        return false;
+    }
+    it->second.slot->erase(it->second.it);
+    m_positions.erase(it);
+    return true;
+}
+
+void TimingWheel::cascade(std::size_t level) {
+    auto& slot = m_slots[level][(m_current_tick >> (LEVEL_BITS * level)) & (SLOT_NUM - 1)];
+    while (!slot.empty()) {
+        auto node = slot.begin();
+        auto& target = slot_of(node->expire_tick);
+        // splice keeps the iterator valid, only the owning slot changes
+        target.splice(target.end(), slot, node);
+        m_positions[node->id].slot = &target;
+    }
+}
+
+void TimingWheel::advance(uint64_t ticks, std::vector<Callback>& expired) {
+    for (uint64_t i = 0; i < ticks; ++i) {
+        ++m_current_tick;
+        for (std::size_t level = 1; level < LEVEL_NUM; ++level) {
+            if ((m_current_tick & ((1ULL << (LEVEL_BITS * level)) - 1)) != 0) {
+                break;
+            }
+            cascade(level);
+        }
+        auto& slot = m_slots[0][m_current_tick & (SLOT_NUM - 1)];
+        while (!slot.empty()) {
+            auto& node = slot.front();
+            m_positions.erase(node.id);
+            expired.push_back(std::move(node.callback));
+            slot.pop_front();
+        }
+        if (m_positions.empty()) {
+            // nothing left to expire, skip the rest of the ticks
+            m_current_tick += ticks - i - 1;
+            break;
+        }
+    }
+}
+
+std::size_t TimingWheel::size() const {
+    return m_positions.size();
+}
+
+bool TimingWheel::empty() const {
+    return m_positions.empty();
+}
+
+std::chrono::milliseconds TimingWheel::tick() const {
+    return m_tick;
+}
+
+TimerService::TimerService(std::chrono::milliseconds tick): m_wheel(tick) {
+    int timer_fd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd == -1) {
+        auto error = GET_ERROR_MSG();
+        throw std::runtime_error(std::format("Failed to create timerfd: {}", error.msg));
+    }
+    auto handler = std::make_shared<EventHandler>();
+    handler->m_on_read = [this](int) { on_expire(); };
+    m_event = std::make_shared<Event>(timer_fd, handler);
+}
+
+void TimerService::arm(bool enable) {
+    struct itimerspec spec;
+    ::memset(&spec, 0, sizeof(spec));
+    if (enable) {
+        auto tick = m_wheel.tick();
+        spec.it_interval.tv_sec = tick.count() / 1000;
+        spec.it_interval.tv_nsec = (tick.count() % 1000) * 1000000;
+        spec.it_value = spec.it_interval;
+    }
+    ::timerfd_settime(m_event->fd(), 0, &spec, nullptr);
+    m_armed = enable;
+}
+
+TimerId TimerService::schedule(std::chrono::milliseconds delay, TimingWheel::Callback callback) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_armed) {
+        // the wheel stood still while idle, count ticks from now on
+        m_last_advance = std::chrono::steady_clock::now();
+        arm(true);
+    }
+    return m_wheel.schedule(delay, std::move(callback));
+}
+
+bool TimerService::cancel(TimerId id) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_wheel.cancel(id);
+}
+
+void TimerService::attach(EventLoop& event_loop) {
+    event_loop.add_event(m_event);
+}
+
+void TimerService::on_expire() {
+    uint64_t expirations;
+    while (::read(m_event->fd(), &expirations, sizeof(expirations)) > 0) {}
+
+    std::vector<TimingWheel::Callback> expired;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_armed) {
+            return;
+        }
+        // advance by the clock rather than by the expiration count, late wakeups catch up in one go
+        auto now = std::chrono::steady_clock::now();
+        auto ticks = static_cast<uint64_t>((now - m_last_advance) / m_wheel.tick());
+        m_last_advance += ticks * m_wheel.tick();
+        m_wheel.advance(ticks, expired);
+        if (m_wheel.empty()) {
+            arm(false);
+        }
+    }
+    for (auto& callback: expired) {
+        callback();
+    }
+}
+
+std::size_t TimerService::size() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_wheel.size();
+}
+
+int TimerService::fd() const {
+    return m_event->fd();
+}
+
+} // namespace net
@@ -0,0 +1,709 @@
+#include "dns_resolver.hpp"
+#include "defines.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <netdb.h>
+#include <optional>
+#include <poll.h>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace net {
+
+namespace {
+
+    constexpr uint16_t DNS_TYPE_A = 1;
+    constexpr uint16_t DNS_TYPE_AAAA = 28;
+    constexpr uint16_t DNS_CLASS_IN = 1;
+    constexpr int DNS_RCODE_NXDOMAIN = 3;
+    constexpr std::size_t DNS_HEADER_SIZE = 12;
+
+    std::mutex g_shared_mutex;
+    DnsResolver::SharedPtr g_shared;
+
+    /**
+     * @brief names are case insensitive and the root label is implied
+     */
+    std::string normalize(const std::string& name) {
+        std::string key(name);
+        if (!key.empty() && key.back() == '.') {
+            key.pop_back();
+        }
+        std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return std::tolower(c); });
+        return key;
+    }
+
+    bool parse_ip(const std::string& ip, uint16_t port, ::sockaddr_storage& address) {
+        ::memset(&address, 0, sizeof(address));
+        auto* v4 = reinterpret_cast<::sockaddr_in*>(&address);
+        if (::inet_pton(AF_INET, ip.c_str(), &v4->sin_addr) == 1) {
+            v4->sin_family = AF_INET;
+            v4->sin_port = port;
+            return true;
+        }
+        auto* v6 = reinterpret_cast<::sockaddr_in6*>(&address);
+        if (::inet_pton(AF_INET6, ip.c_str(), &v6->sin6_addr) == 1) {
+            v6->sin6_family = AF_INET6;
+            v6->sin6_port = port;
+            return true;
+        }
+        return false;
+    }
+
+    void set_port(::sockaddr_storage& address, uint16_t port) {
+        if (address.ss_family == AF_INET) {
+            reinterpret_cast<::sockaddr_in*>(&address)->sin_port = port;
+        } else if (address.ss_family == AF_INET6) {
+            reinterpret_cast<::sockaddr_in6*>(&address)->sin6_port = port;
+        }
+    }
+
+    bool same_address(const ::sockaddr_storage& a, const ::sockaddr_storage& b) {
+        if (a.ss_family != b.ss_family) {
+            return false;
+        }
+        if (a.ss_family == AF_INET) {
+            return ::memcmp(
+                       &reinterpret_cast<const ::sockaddr_in*>(&a)->sin_addr,
+                       &reinterpret_cast<const ::sockaddr_in*>(&b)->sin_addr,
+                       sizeof(::in_addr)
+                   )
+                == 0;
+        }
+        return ::memcmp(
+                   &reinterpret_cast<const ::sockaddr_in6*>(&a)->sin6_addr,
+                   &reinterpret_cast<const ::sockaddr_in6*>(&b)->sin6_addr,
+                   sizeof(::in6_addr)
+               )
+            == 0;
+    }
+
+    void add_unique(std::vector<::sockaddr_storage>& addresses, const ::sockaddr_storage& address) {
+        for (const auto& known: addresses) {
+            if (same_address(known, address)) {
+                return;
+            }
+        }
+        addresses.push_back(address);
+    }
+
+    /**
+     * @param port in network byte order
+     */
+    std::optional<NetError> service_port(const std::string& service, int socktype, uint16_t& port) {
+        if (service.empty()) {
+            port = 0;
+            return std::nullopt;
+        }
+        if (std::all_of(service.begin(), service.end(), [](unsigned char c) { return std::isdigit(c); })) {
+            if (service.size() > 5 || std::stoul(service) > std::numeric_limits<uint16_t>::max()) {
+                return NetError { EINVAL, std::format("Invalid port {}", service) };
+            }
+            port = htons(static_cast<uint16_t>(std::stoul(service)));
+            return std::nullopt;
+        }
+        struct ::servent entry;
+        struct ::servent* found = nullptr;
+        char buffer[1024];
+        ::getservbyname_r(
+            service.c_str(),
+            socktype == SOCK_DGRAM ? "udp" : "tcp",
+            &entry,
+            buffer,
+            sizeof(buffer),
+            &found
+        );
+        if (found == nullptr) {
+            return NetError { EINVAL, std::format("Unknown service {}", service) };
+        }
+        port = static_cast<uint16_t>(found->s_port);
+        return std::nullopt;
+    }
+
+    /**
+     * @brief "ip", "ip:port" or "[ip]:port", the port defaults to 53
+     */
+    ::sockaddr_storage parse_nameserver(const std::string& spec) {
+        std::string ip = spec;
+        std::string port = "53";
+        if (!spec.empty() && spec.front() == '[') {
+            auto close = spec.find(']');
+            if (close == std::string::npos) {
+                throw std::invalid_argument(std::format("Invalid name server {}", spec));
+            }
+            ip = spec.substr(1, close - 1);
+            if (close + 1 < spec.size()) {
+                if (spec[close + 1] != ':') {
+                    throw std::invalid_argument(std::format("Invalid name server {}", spec));
+                }
+                port = spec.substr(close + 2);
+            }
+        } else if (std::count(spec.begin(), spec.end(), ':') == 1) {
+            auto colon = spec.find(':');
+            ip = spec.substr(0, colon);
+            port = spec.substr(colon + 1);
+        }
+        uint16_t network_port;
+        ::sockaddr_storage address;
+        if (port.empty() || service_port(port, SOCK_DGRAM, network_port).has_value()
+            || !parse_ip(ip, network_port, address))
+        {
+            throw std::invalid_argument(std::format("Invalid name server {}", spec));
+        }
+        return address;
+    }
+
+    bool build_query(uint16_t id, const std::string& name, uint16_t type, std::vector<uint8_t>& query) {
+        // recursion desired, one question
+        query = { static_cast<uint8_t>(id >> 8), static_cast<uint8_t>(id), 0x01, 0x00, 0, 1, 0, 0, 0, 0, 0, 0 };
+        if (name.empty()) {
+            return false;
+        }
+        std::size_t start = 0;
+        while (start < name.size()) {
+            auto end = name.find('.', start);
+            if (end == std::string::npos) {
+                end = name.size();
+            }
+            auto length = end - start;
+            if (length == 0 || length > 63) {
+                return false;
+            }
+            query.push_back(static_cast<uint8_t>(length));
+            query.insert(query.end(), name.begin() + start, name.begin() + end);
+            start = end + 1;
+        }
+        query.push_back(0);
+        if (query.size() - DNS_HEADER_SIZE > 255) {
+            return false;
+        }
+        query.push_back(static_cast<uint8_t>(type >> 8));
+        query.push_back(static_cast<uint8_t>(type));
+        query.push_back(static_cast<uint8_t>(DNS_CLASS_IN >> 8));
+        query.push_back(static_cast<uint8_t>(DNS_CLASS_IN));
+        return true;
+    }
+
+    bool skip_name(const uint8_t* data, std::size_t size, std::size_t& pos) {
+        while (pos < size) {
+            auto length = data[pos];
+            if ((length & 0xC0) == 0xC0) {
+                // a pointer ends the name
+                pos += 2;
+                return pos <= size;
+            }
+            if ((length & 0xC0) != 0) {
+                return false;
+            }
+            pos += 1 + length;
+            if (length == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    uint16_t read16(const uint8_t* data) {
+        return static_cast<uint16_t>((data[0] << 8) | data[1]);
+    }
+
+    uint32_t read32(const uint8_t* data) {
+        return (static_cast<uint32_t>(data[0]) << 24) | (static_cast<uint32_t>(data[1]) << 16)
+            | (static_cast<uint32_t>(data[2]) << 8) | data[3];
+    }
+
+    struct Reply {
+        uint16_t m_id = 0;
+        int m_rcode = 0;
+        std::vector<::sockaddr_storage> m_addresses;
+        uint32_t m_ttl = std::numeric_limits<uint32_t>::max();
+    };
+
+    /**
+     * @brief take the A and AAAA records of the answer section, those of CNAME targets included
+     */
+    bool parse_reply(const uint8_t* data, std::size_t size, Reply& reply) {
+        if (size < DNS_HEADER_SIZE || (data[2] & 0x80) == 0) {
+            return false;
+        }
+        reply.m_id = read16(data);
+        reply.m_rcode = data[3] & 0x0F;
+        auto questions = read16(data + 4);
+        auto answers = read16(data + 6);
+        std::size_t pos = DNS_HEADER_SIZE;
+        for (uint16_t i = 0; i < questions; i++) {
+            if (!skip_name(data, size, pos) || pos + 4 > size) {
+                return false;
+            }
+            pos += 4;
+        }
+        for (uint16_t i = 0; i < answers; i++) {
+            if (!skip_name(data, size, pos) || pos + 10 > size) {
+                return false;
+            }
+            auto type = read16(data + pos);
+            auto klass = read16(data + pos + 2);
+            auto ttl = read32(data + pos + 4);
+            auto length = read16(data + pos + 8);
+            pos += 10;
+            if (pos + length > size) {
+                return false;
+            }
+            ::sockaddr_storage address;
+            ::memset(&address, 0, sizeof(address));
+            if (klass == DNS_CLASS_IN && type == DNS_TYPE_A && length == sizeof(::in_addr)) {
+                auto* v4 = reinterpret_cast<::sockaddr_in*>(&address);
+                v4->sin_family = AF_INET;
+                ::memcpy(&v4->sin_addr, data + pos, length);
+            } else if (klass == DNS_CLASS_IN && type == DNS_TYPE_AAAA && length == sizeof(::in6_addr)) {
+                auto* v6 = reinterpret_cast<::sockaddr_in6*>(&address);
+                v6->sin6_family = AF_INET6;
+                ::memcpy(&v6->sin6_addr, data + pos, length);
+            } else {
+                pos += length;
+                continue;
+            }
+            pos += length;
+            add_unique(reply.m_addresses, address);
+            reply.m_ttl = std::min(reply.m_ttl, ttl);
+        }
+        return true;
+    }
+
+    uint16_t random_id() {
+        thread_local std::mt19937 generator(std::random_device {}());
+        return static_cast<uint16_t>(generator());
+    }
+
+    /**
+     * @brief ask server for the A and AAAA records of name at once
+     * @param negative set if the server says the name has no address
+     */
+    std::optional<NetError> ask(
+        const ::sockaddr_storage& server,
+        const std::string& name,
+        std::chrono::milliseconds timeout,
+        std::vector<::sockaddr_storage>& addresses,
+        uint32_t& ttl,
+        bool& negative
+    ) {
+        negative = false;
+        uint16_t ids[2] = { random_id(), random_id() };
+        if (ids[0] == ids[1]) {
+            ids[1]++;
+        }
+        std::vector<uint8_t> queries[2];
+        if (!build_query(ids[0], name, DNS_TYPE_A, queries[0]) || !build_query(ids[1], name, DNS_TYPE_AAAA, queries[1]))
+        {
+            negative = true;
+            return NetError { NET_HOST_NOT_FOUND_CODE, std::format("Invalid host name {}", name) };
+        }
+        int fd = ::socket(server.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd == -1) {
+            return GET_ERROR_MSG();
+        }
+        // only the server can answer a connected socket
+        if (::connect(fd, reinterpret_cast<const ::sockaddr*>(&server), DnsResolver::address_length(server)) == -1) {
+            auto error = GET_ERROR_MSG();
+            ::close(fd);
+            return error;
+        }
+        for (auto& query: queries) {
+            if (::send(fd, query.data(), query.size(), 0) == -1) {
+                auto error = GET_ERROR_MSG();
+                ::close(fd);
+                return error;
+            }
+        }
+        std::optional<Reply> replies[2];
+        std::optional<NetError> error;
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        uint8_t buffer[4096];
+        while (!replies[0].has_value() || !replies[1].has_value()) {
+            auto left =
+                std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            if (left.count() <= 0) {
+                break;
+            }
+            struct ::pollfd pfd { fd, POLLIN, 0 };
+            int ready = ::poll(&pfd, 1, static_cast<int>(left.count()));
+            if (ready == -1 && errno == EINTR) {
+                continue;
+            }
+            if (ready <= 0) {
+                break;
+            }
+            auto n = ::recv(fd, buffer, sizeof(buffer), 0);
+            if (n == -1) {
+                if (errno == EAGAIN || errno == EINTR) {
+                    continue;
+                }
+                // refused by ICMP, nobody serves there
+                error = GET_ERROR_MSG();
+                break;
+            }
+            Reply reply;
+            if (!parse_reply(buffer, static_cast<std::size_t>(n), reply)) {
+                continue;
+            }
+            for (int i = 0; i < 2; i++) {
+                if (reply.m_id == ids[i] && !replies[i].has_value()) {
+                    replies[i] = std::move(reply);
+                    break;
+                }
+            }
+        }
+        ::close(fd);
+
+        addresses.clear();
+        ttl = std::numeric_limits<uint32_t>::max();
+        bool all_answered = true;
+        for (auto& reply: replies) {
+            if (!reply.has_value()) {
+                all_answered = false;
+                continue;
+            }
+            if (reply->m_rcode == DNS_RCODE_NXDOMAIN) {
+                negative = true;
+                return NetError { NET_HOST_NOT_FOUND_CODE, std::format("Host {} not found", name) };
+            }
+            if (reply->m_rcode != 0) {
+                return NetError { NET_HOST_NOT_FOUND_CODE,
+                                  std::format("Name server failed to resolve {}, code {}", name, reply->m_rcode) };
+            }
+            for (const auto& address: reply->m_addresses) {
+                add_unique(addresses, address);
+            }
+            ttl = std::min(ttl, reply->m_ttl);
+        }
+        if (!addresses.empty()) {
+            return std::nullopt;
+        }
+        if (all_answered) {
+            negative = true;
+            return NetError { NET_HOST_NOT_FOUND_CODE, std::format("Host {} has no address", name) };
+        }
+        if (error.has_value()) {
+            return error;
+        }
+        return NetError { NET_TIMEOUT_CODE, std::format("Name server did not answer for {}", name) };
+    }
+
+} // namespace
+
+DnsResolver::DnsResolver(DnsResolverOptions options): m_options(std::move(options)) {
+    for (const auto& spec: m_options.m_nameservers) {
+        m_nameservers.push_back(parse_nameserver(spec));
+    }
+}
+
+DnsResolver::~DnsResolver() {
+    if (m_pool != nullptr) {
+        m_pool->stop();
+    }
+}
+
+DnsResolver::SharedPtr DnsResolver::shared() {
+    std::lock_guard<std::mutex> lock(g_shared_mutex);
+    if (g_shared == nullptr) {
+        g_shared = std::make_shared<DnsResolver>();
+    }
+    return g_shared;
+}
+
+void DnsResolver::set_shared(SharedPtr resolver) {
+    std::lock_guard<std::mutex> lock(g_shared_mutex);
+    g_shared = std::move(resolver);
+}
+
+::socklen_t DnsResolver::address_length(const ::sockaddr_storage& address) {
+    return address.ss_family == AF_INET6 ? sizeof(::sockaddr_in6) : sizeof(::sockaddr_in);
+}
+
+std::optional<NetError>
+DnsResolver::resolve(const std::string& name, const std::string& service, DnsAnswer& answer, int socktype) {
+    uint16_t port;
+    auto err = service_port(service, socktype, port);
+    if (err.has_value()) {
+        return err;
+    }
+    ::sockaddr_storage numeric;
+    if (parse_ip(name, port, numeric)) {
+        answer.m_addresses = { numeric };
+        answer.m_expires = std::chrono::steady_clock::time_point::max();
+        return std::nullopt;
+    }
+    auto key = normalize(name);
+    std::shared_ptr<Entry> entry;
+    bool owner;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        owner = claim(key, entry);
+    }
+    if (owner) {
+        complete(key, entry);
+    } else {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_ready.wait(lock, [&entry]() { return entry->m_ready; });
+    }
+    // a ready entry is never changed again
+    answer.m_addresses = entry->m_addresses;
+    for (auto& address: answer.m_addresses) {
+        set_port(address, port);
+    }
+    answer.m_expires = entry->m_expires;
+    return entry->m_error;
+}
+
+void DnsResolver::async_resolve(
+    const std::string& name,
+    const std::string& service,
+    Callback callback,
+    int socktype
+) {
+    uint16_t port;
+    auto err = service_port(service, socktype, port);
+    if (err.has_value()) {
+        callback(err, {});
+        return;
+    }
+    ::sockaddr_storage numeric;
+    if (parse_ip(name, port, numeric)) {
+        callback(std::nullopt, DnsAnswer { { numeric }, std::chrono::steady_clock::time_point::max() });
+        return;
+    }
+    auto key = normalize(name);
+    std::shared_ptr<Entry> entry;
+    auto deliver = [callback = std::move(callback), port](const Entry& entry) {
+        DnsAnswer answer { entry.m_addresses, entry.m_expires };
+        for (auto& address: answer.m_addresses) {
+            set_port(address, port);
+        }
+        callback(entry.m_error, std::move(answer));
+    };
+    bool owner;
+    bool ready;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        owner = claim(key, entry);
+        ready = entry->m_ready;
+        if (!ready) {
+            // raw pointer, the entry owns its waiters
+            entry->m_waiters.push_back([deliver = std::move(deliver), raw = entry.get()]() { deliver(*raw); });
+        }
+    }
+    if (ready) {
+        deliver(*entry);
+        return;
+    }
+    if (owner) {
+        std::call_once(m_pool_started, [this]() {
+            m_pool = std::make_unique<utils::ThreadPool>(std::max<std::size_t>(m_options.m_threads, 1));
+        });
+        m_pool->post([this, key, entry]() { complete(key, entry); });
+    }
+}
+
+void DnsResolver::clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.clear();
+}
+
+std::size_t DnsResolver::size() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_entries.size();
+}
+
+bool DnsResolver::claim(const std::string& name, std::shared_ptr<Entry>& entry) {
+    auto now = std::chrono::steady_clock::now();
+    auto it = m_entries.find(name);
+    if (it != m_entries.end() && (!it->second->m_ready || now < it->second->m_expires)) {
+        entry = it->second;
+        return false;
+    }
+    if (it == m_entries.end() && m_entries.size() >= m_options.m_max_entries) {
+        evict(now);
+    }
+    entry = std::make_shared<Entry>();
+    m_entries[name] = entry;
+    return true;
+}
+
+void DnsResolver::complete(const std::string& name, const std::shared_ptr<Entry>& entry) {
+    auto result = lookup(name);
+    auto now = std::chrono::steady_clock::now();
+    std::vector<std::function<void()>> waiters;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        entry->m_error = std::move(result.m_error);
+        entry->m_addresses = std::move(result.m_addresses);
+        if (entry->m_error.has_value() && !result.m_negative) {
+            // a failure says nothing about the name, the next lookup asks again
+            entry->m_expires = now;
+            auto it = m_entries.find(name);
+            if (it != m_entries.end() && it->second == entry) {
+                m_entries.erase(it);
+            }
+        } else {
+            entry->m_expires = now + result.m_ttl;
+        }
+        entry->m_ready = true;
+        waiters.swap(entry->m_waiters);
+    }
+    m_ready.notify_all();
+    for (auto& waiter: waiters) {
+        waiter();
+    }
+}
+
+DnsResolver::Lookup DnsResolver::lookup(const std::string& name) {
+    Lookup result;
+    result.m_ttl = m_options.m_default_ttl;
+    if (lookup_hosts(name, result)) {
+        return result;
+    }
+    if (m_nameservers.empty()) {
+        lookup_system(name, result);
+    } else {
+        lookup_nameservers(name, result);
+    }
+    if (result.m_negative) {
+        result.m_ttl = m_options.m_negative_ttl;
+    }
+    return result;
+}
+
+bool DnsResolver::lookup_hosts(const std::string& name, Lookup& result) {
+    if (m_options.m_hosts_file.empty()) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(m_hosts_mutex);
+    struct ::stat status;
+    if (::stat(m_options.m_hosts_file.c_str(), &status) == -1) {
+        m_hosts.clear();
+        m_hosts_loaded = false;
+        return false;
+    }
+    if (!m_hosts_loaded || status.st_mtim.tv_sec != m_hosts_mtime.tv_sec
+        || status.st_mtim.tv_nsec != m_hosts_mtime.tv_nsec)
+    {
+        m_hosts.clear();
+        std::ifstream file(m_options.m_hosts_file);
+        std::string line;
+        while (std::getline(file, line)) {
+            auto comment = line.find('#');
+            if (comment != std::string::npos) {
+                line.resize(comment);
+            }
+            std::istringstream fields(line);
+            std::string ip;
+            ::sockaddr_storage address;
+            if (!(fields >> ip) || !parse_ip(ip, 0, address)) {
+                continue;
+            }
+            std::string host;
+            while (fields >> host) {
+                add_unique(m_hosts[normalize(host)], address);
+            }
+        }
+        m_hosts_mtime = status.st_mtim;
+        m_hosts_loaded = true;
+    }
+    auto it = m_hosts.find(name);
+    if (it == m_hosts.end()) {
+        return false;
+    }
+    result.m_addresses = it->second;
+    return true;
+}
+
+void DnsResolver::lookup_nameservers(const std::string& name, Lookup& result) {
+    result.m_error = NetError { NET_TIMEOUT_CODE, std::format("No name server answered for {}", name) };
+    for (std::size_t attempt = 0; attempt < std::max<std::size_t>(m_options.m_attempts, 1); attempt++) {
+        for (const auto& server: m_nameservers) {
+            uint32_t ttl;
+            bool negative;
+            auto err = ask(server, name, m_options.m_query_timeout, result.m_addresses, ttl, negative);
+            if (!err.has_value()) {
+                result.m_error.reset();
+                result.m_ttl = std::min(std::chrono::seconds(ttl), m_options.m_max_ttl);
+                return;
+            }
+            result.m_error = std::move(err);
+            if (negative) {
+                result.m_negative = true;
+                return;
+            }
+        }
+    }
+}
+
+void DnsResolver::lookup_system(const std::string& name, Lookup& result) {
+    struct ::addrinfo hints;
+    ::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_V4MAPPED | AI_ADDRCONFIG;
+    struct ::addrinfo* head = nullptr;
+    int err = ::getaddrinfo(name.c_str(), nullptr, &hints, &head);
+    if (err != 0) {
+        if (err == EAI_SYSTEM) {
+            result.m_error = GET_ERROR_MSG();
+            return;
+        }
+        result.m_error = NetError { err == EAI_AGAIN ? NET_TIMEOUT_CODE : NET_HOST_NOT_FOUND_CODE,
+                                    std::format("Failed to resolve {}: {}", name, ::gai_strerror(err)) };
+#ifdef EAI_NODATA
+        result.m_negative = err == EAI_NONAME || err == EAI_NODATA;
+#else
+        result.m_negative = err == EAI_NONAME;
+#endif
+        return;
+    }
+    for (auto* entry = head; entry != nullptr; entry = entry->ai_next) {
+        ::sockaddr_storage address;
+        ::memset(&address, 0, sizeof(address));
+        ::memcpy(&address, entry->ai_addr, entry->ai_addrlen);
+        set_port(address, 0);
+        add_unique(result.m_addresses, address);
+    }
+    ::freeaddrinfo(head);
+}
+
+void DnsResolver::evict(std::chrono::steady_clock::time_point now) {
+    std::erase_if(m_entries, [now](const auto& item) {
+        return item.second->m_ready && item.second->m_expires <= now;
+    });
+    if (m_entries.size() < m_options.m_max_entries) {
+        return;
+    }
+    auto soonest = m_entries.end();
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+        if (it->second->m_ready && (soonest == m_entries.end() || it->second->m_expires < soonest->second->m_expires)) {
+            soonest = it;
+        }
+    }
+    if (soonest != m_entries.end()) {
+        m_entries.erase(soonest);
+    }
+}
+
+} // namespace net
@@ -1,16 +1,21 @@
 #pragma once
 
+#include "defines.hpp"
+#include "dns_resolver.hpp"
 #include <arpa/inet.h>
 #include <array>
 #include <cassert>
+#include <cstddef>
 #include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <string>
 #include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <system_error>
 #include <unistd.h>
+#include <vector>
 
 namespace net {
 
@@ -58,24 +63,71 @@ public:
         }
     };
 
+    /**
+     * @brief names go through the cache of DnsResolver::shared(), hints pick the socket type and family of the
+     *        entries, a passive lookup or one without a name is left to getaddrinfo
+     */
     address_info resolve(const std::string& name, const std::string& service, struct ::addrinfo* hints = nullptr) {
-        int err = ::getaddrinfo(name.c_str(), service.c_str(), hints, &m_head);
-        if (err != 0) {
-            throw std::system_error(err, std::system_category(), "Failed to resolve address");
+        release();
+        if (name.empty() || (hints != nullptr && (hints->ai_flags & AI_PASSIVE) != 0)) {
+            int err = ::getaddrinfo(name.empty() ? nullptr : name.c_str(), service.c_str(), hints, &m_head);
+            if (err != 0) {
+                throw std::system_error(err, std::system_category(), "Failed to resolve address");
+            }
+            return { m_head };
+        }
+        int socktype = hints != nullptr && hints->ai_socktype != 0 ? hints->ai_socktype : SOCK_STREAM;
+        int family = hints != nullptr ? hints->ai_family : AF_UNSPEC;
+        DnsAnswer answer;
+        auto err = DnsResolver::shared()->resolve(name, service, answer, socktype);
+        if (err.has_value()) {
+            throw std::system_error(err->error_code, std::system_category(), "Failed to resolve address: " + err->msg);
+        }
+        for (const auto& address: answer.m_addresses) {
+            if (family == AF_UNSPEC || family == address.ss_family) {
+                m_addresses.push_back(address);
+            }
+        }
+        if (m_addresses.empty()) {
+            throw std::system_error(NET_HOST_NOT_FOUND_CODE, std::system_category(), "No address of that family");
+        }
+        m_entries.resize(m_addresses.size());
+        for (std::size_t i = 0; i < m_entries.size(); i++) {
+            auto& entry = m_entries[i];
+            entry.ai_family = m_addresses[i].ss_family;
+            entry.ai_socktype = socktype;
+            entry.ai_protocol = socktype == SOCK_STREAM ? IPPROTO_TCP : socktype == SOCK_DGRAM ? IPPROTO_UDP : 0;
+            entry.ai_addrlen = DnsResolver::address_length(m_addresses[i]);
+            entry.ai_addr = reinterpret_cast<struct ::sockaddr*>(&m_addresses[i]);
+            entry.ai_next = i + 1 < m_entries.size() ? &m_entries[i + 1] : nullptr;
         }
-        return { m_head };
+        return { m_entries.data() };
     }
 
     addressResolver() = default;
 
+    addressResolver(const addressResolver&) = delete;
+
+    addressResolver& operator=(const addressResolver&) = delete;
+
     ~addressResolver() {
+        release();
+    }
+
+private:
+    void release() {
         if (m_head != nullptr) {
             ::freeaddrinfo(m_head);
+            m_head = nullptr;
         }
+        m_entries.clear();
+        m_addresses.clear();
     }
 
-private:
     struct addrinfo* m_head = nullptr;
+    // the chain handed out for cached names, pointing into m_addresses
+    std::vector<struct ::addrinfo> m_entries;
+    std::vector<::sockaddr_storage> m_addresses;
 };
 
 } // namespace net
\ No newline at end of file
@@ -0,0 +1,165 @@
+#pragma once
+
+#include "defines.hpp"
+#include "thread_pool.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <optional>
+#include <string>
+#include <sys/socket.h>
+#include <unordered_map>
+#include <vector>
+
+namespace net {
+
+struct DnsResolverOptions {
+    // "ip" or "ip:port" ("[ip]:port" for IPv6) asked over UDP in turn, empty leaves the lookup to getaddrinfo
+    std::vector<std::string> m_nameservers;
+    // looked up before anything else and read again once it changes, empty to skip it
+    std::string m_hosts_file = "/etc/hosts";
+    // how long answers without a TTL of their own are kept, the hosts file and getaddrinfo give none
+    std::chrono::seconds m_default_ttl { 30 };
+    // caps the TTL a name server hands out
+    std::chrono::seconds m_max_ttl { 300 };
+    // how long a name that does not exist, or has no address, is known not to
+    std::chrono::seconds m_negative_ttl { 5 };
+    // for each query to a name server
+    std::chrono::milliseconds m_query_timeout { 1000 };
+    // rounds over all name servers before giving up
+    std::size_t m_attempts = 2;
+    // threads running async_resolve, started on its first use
+    std::size_t m_threads = 2;
+    // expired names are dropped beyond it, then the ones closest to expiry
+    std::size_t m_max_entries = 4096;
+};
+
+struct DnsAnswer {
+    // with the port of the service filled in, in the order they were found
+    std::vector<::sockaddr_storage> m_addresses;
+    // the addresses may be used until then without asking again
+    std::chrono::steady_clock::time_point m_expires;
+};
+
+/**
+ * @brief Caching stub resolver behind addressResolver
+ *        Names are looked up in the hosts file, then with the configured name servers or getaddrinfo, and kept for
+ *        the TTL of the answer. Names that do not exist are kept for m_negative_ttl, failures like timeouts are not
+ *        kept at all. Concurrent lookups of one name wait for the first of them instead of asking again, blocking
+ *        callers and async ones alike. Numeric addresses are converted right away and never cached.
+ * @note queries go out with recursion desired and no search domains, truncated answers are used as they are
+ */
+class DnsResolver {
+public:
+    NET_DECLARE_PTRS(DnsResolver)
+
+    /**
+     * @brief called once with the answer, on a thread of the resolver, or right away on the calling one if the
+     *        answer is cached. It must not block
+     */
+    using Callback = std::function<void(std::optional<NetError>, DnsAnswer)>;
+
+    explicit DnsResolver(DnsResolverOptions options = {});
+
+    DnsResolver(const DnsResolver&) = delete;
+
+    DnsResolver& operator=(const DnsResolver&) = delete;
+
+    /**
+     * @brief pending async lookups are dropped without their callback
+     */
+    ~DnsResolver();
+
+    /**
+     * @brief the resolver of the process, used by addressResolver, made with the default options on first use
+     */
+    static SharedPtr shared();
+
+    /**
+     * @brief replace the resolver of the process, later lookups use resolver
+     */
+    static void set_shared(SharedPtr resolver);
+
+    /**
+     * @brief resolve name and service, blocking until answered
+     * @param socktype picks the protocol a named service is looked up for
+     * @return NET_HOST_NOT_FOUND_CODE if the name has no address, NET_TIMEOUT_CODE if no name server answered
+     */
+    std::optional<NetError>
+    resolve(const std::string& name, const std::string& service, DnsAnswer& answer, int socktype = SOCK_STREAM);
+
+    void
+    async_resolve(const std::string& name, const std::string& service, Callback callback, int socktype = SOCK_STREAM);
+
+    /**
+     * @brief forget every cached name, lookups in flight still finish
+     */
+    void clear();
+
+    /**
+     * @return names cached or being looked up
+     */
+    std::size_t size() const;
+
+    static ::socklen_t address_length(const ::sockaddr_storage& address);
+
+private:
+    struct Entry {
+        bool m_ready = false;
+        std::optional<NetError> m_error;
+        std::vector<::sockaddr_storage> m_addresses;
+        std::chrono::steady_clock::time_point m_expires;
+        // async lookups waiting for the one in flight
+        std::vector<std::function<void()>> m_waiters;
+    };
+
+    struct Lookup {
+        std::optional<NetError> m_error;
+        std::vector<::sockaddr_storage> m_addresses;
+        std::chrono::seconds m_ttl;
+        // the name surely has no address, worth remembering
+        bool m_negative = false;
+    };
+
+    /**
+     * @brief find the entry of name or start one, true if the caller has to look the name up
+     */
+    bool claim(const std::string& name, std::shared_ptr<Entry>& entry);
+
+    /**
+     * @brief look the name up and publish the result in entry, waking everyone waiting for it
+     */
+    void complete(const std::string& name, const std::shared_ptr<Entry>& entry);
+
+    Lookup lookup(const std::string& name);
+
+    bool lookup_hosts(const std::string& name, Lookup& result);
+
+    void lookup_nameservers(const std::string& name, Lookup& result);
+
+    void lookup_system(const std::string& name, Lookup& result);
+
+    void evict(std::chrono::steady_clock::time_point now);
+
+    DnsResolverOptions m_options;
+    std::vector<::sockaddr_storage> m_nameservers;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_ready;
+    std::unordered_map<std::string, std::shared_ptr<Entry>> m_entries;
+
+    std::mutex m_hosts_mutex;
+    std::unordered_map<std::string, std::vector<::sockaddr_storage>> m_hosts;
+    struct ::timespec m_hosts_mtime {};
+    bool m_hosts_loaded = false;
+
+    std::once_flag m_pool_started;
+    std::unique_ptr<utils::ThreadPool> m_pool;
+};
+
+} // namespace net
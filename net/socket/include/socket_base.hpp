@@ -1,11 +1,14 @@
 #pragma once
 
 #include "address_resolver.hpp"
+#include "buffer_pool.hpp"
 #include "event_loop.hpp"
 #include "logger.hpp"
 #include "remote_target.hpp"
 #include "thread_pool.hpp"
 #include "timer.hpp"
+#include "timing_wheel.hpp"
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <functional>
@@ -19,6 +22,8 @@
 #include <string>
 #include <sys/epoll.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -69,13 +74,30 @@ public:
 
     SocketStatus status() const;
 
-    virtual std::optional<NetError> read(std::vector<uint8_t>& data, std::size_t time_out = 0) = 0;
+    /**
+     * @brief wait for data and read everything available
+     * @param max_size stop once data holds this many bytes, 0 means no limit
+     */
+    virtual std::optional<NetError>
+    read(std::vector<uint8_t>& data, std::size_t time_out = 0, std::size_t max_size = 0) = 0;
 
     virtual std::optional<NetError> write(const std::vector<uint8_t>& data, std::size_t time_out = 0) = 0;
 
 protected:
+    using Deadline = std::optional<std::chrono::steady_clock::time_point>;
+
     std::optional<NetError> set_non_blocking_socket(int fd);
 
+    /**
+     * @brief deadline time_out milliseconds from now, 0 means no deadline
+     */
+    static Deadline make_deadline(std::size_t time_out);
+
+    /**
+     * @brief sleep in poll until m_fd is ready for events, returns NET_TIMEOUT_CODE once the deadline passes
+     */
+    std::optional<NetError> wait_ready(short events, const Deadline& deadline);
+
     int m_fd;
     addressResolver m_addr_resolver;
     addressResolver::address_info m_addr_info;
@@ -115,9 +137,37 @@ public:
 
     int get_fd() const;
 
-    void enable_thread_pool(std::size_t worker_num);
-
-    std::optional<NetError> enable_event_loop(EventLoopType type = EventLoopType::EPOLL, int time_out = -1);
+    /**
+     * @brief run handlers on a pool of worker_num threads
+     * @param mode WORK_STEALING by default, a SHARED_QUEUE pool hands tasks over through one locked queue but is
+     *        the one whose workers can be added and deleted later
+     */
+    void
+    enable_thread_pool(std::size_t worker_num, utils::ThreadPoolMode mode = utils::ThreadPoolMode::WORK_STEALING);
+
+    /**
+     * @brief enable event loop for the server
+     *
+     * @param type type of the event loop
+     * @param time_out time out of one wait in milliseconds, -1 means wait forever
+     * @param reactor_num 0 means one accept loop dispatching ready fds to the thread pool, otherwise the server starts
+     *        reactor_num event loop threads, each one owns its own SO_REUSEPORT listen socket and its connections, and
+     *        the handlers are called directly on the loop thread without any cross-thread handoff
+     * @param max_events events fetched by one wait of an epoll loop
+     * @param adaptive let an epoll loop double max_events whenever a wait fills them, see EpollEventLoop
+     */
+    std::optional<NetError> enable_event_loop(
+        EventLoopType type = EventLoopType::EPOLL,
+        int time_out = -1,
+        std::size_t reactor_num = 0,
+        std::size_t max_events = 1024,
+        bool adaptive = false
+    );
+
+    /**
+     * @brief statistics of the event loop, or of every reactor in order, empty without an event loop
+     */
+    std::vector<EventLoopStats> event_loop_stats() const;
 
     void set_logger(const utils::LoggerManager::Logger& logger);
 
@@ -139,19 +189,94 @@ public:
 
     void on_start(CallBack handler);
 
+    /**
+     * @brief set the output buffer watermarks of every connection
+     *
+     * @param high on_high_watermark is called once the pending output of a connection reaches this size
+     * @param low on_low_watermark is called once the pending output drains back to this size
+     */
+    void set_write_watermark(std::size_t high, std::size_t low);
+
+    void on_high_watermark(CallBack handler);
+
+    /**
+     * @brief close connections which stay silent for idle_timeout, 0 disables it
+     * @note only works with event loop enabled, the timers live in the timing wheel of each loop
+     */
+    void set_idle_timeout(std::chrono::milliseconds idle_timeout);
+
+    void on_low_watermark(CallBack handler);
+
+    /**
+     * @brief close a connection from the server side, pending output is flushed before the socket is closed
+     */
+    void close_remote(RemoteTarget::SharedPtr remote);
+
+    /**
+     * @brief timing wheel of the event loop serving fd, nullptr if fd is not served by an event loop
+     */
+    std::shared_ptr<TimerService> timer_service(int fd);
+
     virtual std::optional<NetError> read(std::vector<uint8_t>& data, RemoteTarget::SharedPtr remote) = 0;
 
+    /**
+     * @brief read everything available into a pooled buffer, bytes land in the buffer without extra copies
+     * @param max_size stop once the buffer holds this many bytes, 0 means no limit. Callers with a limit read
+     *        again while the buffer comes back full, a drained socket then yields an empty buffer, not an error.
+     */
+    virtual std::optional<NetError>
+    read(PooledBuffer& buffer, RemoteTarget::SharedPtr remote, std::size_t max_size = 0) = 0;
+
     virtual std::optional<NetError> write(const std::vector<uint8_t>& data, RemoteTarget::SharedPtr remote) = 0;
 
+    /**
+     * @brief write the iov_count buffers of iov back to back, gathered into as few syscalls as possible
+     *        Ordering and buffering of what the socket doesn't take are the same as for write.
+     */
+    virtual std::optional<NetError>
+    writev(const struct iovec* iov, std::size_t iov_count, RemoteTarget::SharedPtr remote) = 0;
+
+    /**
+     * @brief send up to count bytes of file_fd starting at offset, which is advanced past what was sent
+     *        Stops early once the connection is above its high watermark, on_low_watermark then reports when to
+     *        go on. This default reads the file in pieces and writes them, servers which can hand the file to the
+     *        kernel override it.
+     */
+    virtual std::optional<NetError>
+    send_file(int file_fd, off_t& offset, std::size_t count, RemoteTarget::SharedPtr remote);
+
 protected:
     virtual void handle_connection(RemoteTarget::SharedPtr remote) = 0;
 
     virtual RemoteTarget::SharedPtr create_remote(int remote_fd) = 0;
 
-    virtual void add_remote_event(int fd) = 0;
+    virtual void add_remote_event(int fd, EventLoop* event_loop) = 0;
 
     std::optional<NetError> set_non_blocking_socket(int fd);
 
+    bool event_loop_enabled() const;
+
+    EventLoop::SharedPtr get_event_loop(int fd);
+
+    /**
+     * @brief close remote and drop it from its event loop or the remote pool
+     *        Nothing happens if remote was removed already, even when its fd was reused by a new connection.
+     */
+    void remove_remote(RemoteTarget::SharedPtr remote);
+
+    void dispatch(std::function<void()> task);
+
+    /**
+     * @brief queue data the socket didn't take, arm write interest and check the high watermark
+     * @note must be called with the output buffer mutex held, returns true if on_high_watermark should be called
+     */
+    bool buffer_output(RemoteTarget::SharedPtr remote, const uint8_t* data, std::size_t size);
+
+    /**
+     * @brief restart the idle timeout of a connection, called on accept and on every read event
+     */
+    void refresh_idle_timer(RemoteTarget::SharedPtr remote, EventLoop* event_loop);
+
     int m_listen_fd;
     addressResolver m_addr_resolver;
     addressResolver::address_info m_addr_info;
@@ -163,12 +288,22 @@ protected:
     CallBack m_on_write;
     CallBack m_on_error;
     CallBack m_on_accept;
+    CallBack m_on_high_watermark;
+    CallBack m_on_low_watermark;
+
+    std::size_t m_high_watermark = 4 * 1024 * 1024;
+    std::size_t m_low_watermark = 1024 * 1024;
+    std::chrono::milliseconds m_idle_timeout { 0 };
 
     RemotePool m_remotes;
 
     utils::ThreadPool::SharedPtr m_thread_pool;
     EventLoop::SharedPtr m_event_loop;
 
+    std::vector<EventLoop::SharedPtr> m_reactors;
+    std::vector<int> m_reactor_listen_fds;
+    std::vector<std::thread> m_reactor_threads;
+
     bool m_stop;
 
     std::thread m_accept_thread;
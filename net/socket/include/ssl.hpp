@@ -32,7 +32,8 @@ public:
 
     std::optional<NetError> write(const std::vector<uint8_t>& data, std::size_t time_out = 0) override;
 
-    std::optional<NetError> read(std::vector<uint8_t>& data, std::size_t time_out = 0) override;
+    std::optional<NetError>
+    read(std::vector<uint8_t>& data, std::size_t time_out = 0, std::size_t max_size = 0) override;
 
     std::optional<NetError> connect(std::size_t time_out = 0) override;
 
@@ -41,7 +42,10 @@ public:
     std::optional<NetError> close() override;
 
 protected:
-    std::optional<NetError> ssl_connect(std::size_t time_out = 0);
+    /**
+     * @brief run the handshake on the connected socket, sleeping in poll whenever it waits for the server
+     */
+    std::optional<NetError> ssl_connect(const Deadline& deadline);
 
     std::shared_ptr<SSL> m_ssl;
     std::shared_ptr<SSLContext> m_ctx;
@@ -66,16 +70,37 @@ public:
 
     std::optional<NetError> read(std::vector<uint8_t>& data, RemoteTarget::SharedPtr remote) override;
 
+    std::optional<NetError>
+    read(PooledBuffer& buffer, RemoteTarget::SharedPtr remote, std::size_t max_size = 0) override;
+
     std::optional<NetError> write(const std::vector<uint8_t>& data, RemoteTarget::SharedPtr remote) override;
 
+    std::optional<NetError>
+    writev(const struct iovec* iov, std::size_t iov_count, RemoteTarget::SharedPtr remote) override;
+
+    /**
+     * @brief records have to be encrypted in userspace, so this is the copying SocketServer::send_file
+     */
+    std::optional<NetError>
+    send_file(int file_fd, off_t& offset, std::size_t count, RemoteTarget::SharedPtr remote) override;
+
 protected:
+    /**
+     * @brief drive the handshake of a connection of the event loop
+     * @return true if it is done and there may be input to read, false while it is still going on or failed
+     */
     bool handle_ssl_handshake(RemoteTarget::SharedPtr remote);
 
     void handle_connection(RemoteTarget::SharedPtr remote) override;
 
     RemoteTarget::SharedPtr create_remote(int remote_fd) override;
 
-    void add_remote_event(int fd) override;
+    void add_remote_event(int fd, EventLoop* event_loop) override;
+
+    /**
+     * @brief TcpServer::flush_output through SSL_write, the pending output is plaintext
+     */
+    bool flush_output(RemoteTarget::SharedPtr remote, EventLoop* event_loop) override;
 
     std::shared_ptr<SSLContext> m_ctx;
 };
@@ -26,9 +26,25 @@ public:
 
     std::optional<NetError> close() override;
 
-    std::optional<NetError> read(std::vector<uint8_t>& data, std::size_t time_out = 0) override;
+    std::optional<NetError>
+    read(std::vector<uint8_t>& data, std::size_t time_out = 0, std::size_t max_size = 0) override;
 
     std::optional<NetError> write(const std::vector<uint8_t>& data, std::size_t time_out = 0) override;
+
+    /**
+     * @brief connect to every address the name resolved to at once instead of one after another, the first
+     *        connection to complete is kept. Helps with hosts having addresses that are unreachable or slow.
+     */
+    void set_parallel_connect(bool enable);
+
+protected:
+    /**
+     * @brief connect to the resolved addresses by deadline, the connected socket takes over m_fd
+     *        In turn an address failing hands over to the next, in parallel they are all tried at once.
+     */
+    std::optional<NetError> connect_until(const Deadline& deadline);
+
+    bool m_parallel_connect = false;
 };
 
 class TcpServer: public SocketServer {
@@ -55,14 +71,67 @@ public:
 
     std::optional<NetError> read(std::vector<uint8_t>& data, RemoteTarget::SharedPtr remote) override;
 
+    std::optional<NetError>
+    read(PooledBuffer& buffer, RemoteTarget::SharedPtr remote, std::size_t max_size = 0) override;
+
     std::optional<NetError> write(const std::vector<uint8_t>& data, RemoteTarget::SharedPtr remote) override;
 
+    std::optional<NetError>
+    writev(const struct iovec* iov, std::size_t iov_count, RemoteTarget::SharedPtr remote) override;
+
+    /**
+     * @brief sendfile straight from the page cache, nothing is buffered
+     *        When the socket is full, or output queued earlier has to go first, the connection is marked above
+     *        its high watermark so that on_low_watermark fires once it is writable again.
+     */
+    std::optional<NetError>
+    send_file(int file_fd, off_t& offset, std::size_t count, RemoteTarget::SharedPtr remote) override;
+
 protected:
     void handle_connection(RemoteTarget::SharedPtr remote) override;
 
     RemoteTarget::SharedPtr create_remote(int remote_fd) override;
 
-    void add_remote_event(int fd) override;
+    void add_remote_event(int fd, EventLoop* event_loop) override;
+
+    /**
+     * @brief bind and listen on listen_fd, reuse_port is only set for the per-reactor listen sockets so that a
+     *        single accept loop server still owns its port exclusively
+     */
+    std::optional<NetError> bind_and_listen(int listen_fd, bool reuse_port);
+
+    std::optional<NetError> set_reuse_port(int listen_fd);
+
+    /**
+     * @brief set m_stop and wake every loop so that they return, safe to call from a loop thread
+     */
+    void stop_event_loops();
+
+    void run_event_loop(EventLoop::SharedPtr event_loop, int listen_fd);
+
+    /**
+     * @brief whether the event loop of the connection receives and sends for it, see EventLoop::completion_based
+     */
+    bool loop_io(int fd);
+
+    /**
+     * @brief read what the event loop received for the connection, the loop_io counterpart of read
+     */
+    std::optional<NetError> read_received(PooledBuffer& buffer, RemoteTarget::SharedPtr remote, std::size_t max_size);
+
+    /**
+     * @brief send as much of the pending output as the socket takes, called when the socket becomes writable
+     * @return true if the output buffer is drained and the connection stays open
+     */
+    virtual bool flush_output(RemoteTarget::SharedPtr remote, EventLoop* event_loop);
+
+    /**
+     * @brief stop watching a drained connection for writing, report the low watermark and close the connection if
+     *        it waited for the output to drain
+     * @note called with the output buffer mutex held by lock, which is released
+     * @return true if the output buffer is drained and the connection stays open
+     */
+    bool finish_flush(RemoteTarget::SharedPtr remote, EventLoop* event_loop, std::unique_lock<std::mutex>& lock);
 };
 
 } // namespace net
\ No newline at end of file
@@ -4,13 +4,18 @@
 #include "event_loop.hpp"
 #include "logger.hpp"
 #include "remote_target.hpp"
+#include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
 #include <cstddef>
 #include <fcntl.h>
 #include <format>
+#include <future>
 #include <iostream>
 #include <memory>
 #include <optional>
+#include <poll.h>
 #include <string>
 #include <sys/select.h>
 #include <sys/socket.h>
@@ -52,6 +57,35 @@ SocketStatus SocketClient::status() const {
     return m_status;
 }
 
+SocketClient::Deadline SocketClient::make_deadline(std::size_t time_out) {
+    if (time_out == 0) {
+        return std::nullopt;
+    }
+    return std::chrono::steady_clock::now() + std::chrono::milliseconds(time_out);
+}
+
+std::optional<NetError> SocketClient::wait_ready(short events, const Deadline& deadline) {
+    while (true) {
+        int time_out = -1;
+        if (deadline.has_value()) {
+            auto remain = std::chrono::ceil<std::chrono::milliseconds>(deadline.value() - std::chrono::steady_clock::now());
+            if (remain.count() <= 0) {
+                return NetError { NET_TIMEOUT_CODE, "Timeout to wait for socket" };
+            }
+            time_out = static_cast<int>(remain.count());
+        }
+        struct pollfd poll_fd { m_fd, events, 0 };
+        int ret = ::poll(&poll_fd, 1, time_out);
+        if (ret > 0) {
+            // errors and hang ups are reported by the following socket call
+            return std::nullopt;
+        }
+        if (ret == -1 && errno != EINTR) {
+            return GET_ERROR_MSG();
+        }
+    }
+}
+
 std::optional<NetError> SocketClient::set_non_blocking_socket(int fd) {
     int flag = ::fcntl(fd, F_GETFL, 0);
     if (flag == -1) {
@@ -82,16 +116,41 @@ void SocketServer::set_logger(const utils::LoggerManager::Logger& logger) {
     m_logger_set = true;
 }
 
-void SocketServer::enable_thread_pool(std::size_t worker_num) {
+void SocketServer::enable_thread_pool(std::size_t worker_num, utils::ThreadPoolMode mode) {
     assert(worker_num > 0 && "Worker number should be greater than 0");
     assert(m_thread_pool == nullptr && "Thread pool is already enabled");
     assert(
         m_status == SocketStatus::DISCONNECTED || m_status == SocketStatus::LISTENING && "Server is already connected"
     );
-    m_thread_pool = std::make_shared<utils::ThreadPool>(worker_num);
+    m_thread_pool = std::make_shared<utils::ThreadPool>(worker_num, mode);
 }
 
-std::optional<NetError> SocketServer::enable_event_loop(EventLoopType type, int time_out) {
+static EventLoop::SharedPtr
+create_event_loop(EventLoopType type, int time_out, std::size_t max_events, bool adaptive) {
+    if (type == EventLoopType::SELECT) {
+        return std::make_shared<SelectEventLoop>(time_out);
+    } else if (type == EventLoopType::EPOLL) {
+        return std::make_shared<EpollEventLoop>(time_out, max_events, adaptive);
+    } else if (type == EventLoopType::POLL) {
+        return std::make_shared<PollEventLoop>(time_out);
+    } else if (type == EventLoopType::IO_URING) {
+        try {
+            return std::make_shared<IoUringEventLoop>(time_out);
+        } catch (const std::exception& e) {
+            std::cerr << std::format("io_uring is unavailable, falling back to epoll: {}\n", e.what());
+            return std::make_shared<EpollEventLoop>(time_out, max_events, adaptive);
+        }
+    }
+    return nullptr;
+}
+
+std::optional<NetError> SocketServer::enable_event_loop(
+    EventLoopType type,
+    int time_out,
+    std::size_t reactor_num,
+    std::size_t max_events,
+    bool adaptive
+) {
     assert(
         m_status == SocketStatus::DISCONNECTED || m_status == SocketStatus::LISTENING && "Server is already connected"
     );
@@ -99,17 +158,176 @@ std::optional<NetError> SocketServer::enable_event_loop(EventLoopType type, int
         std::cerr
             << "Select way is not stable for it can't handle more than 1024 connections even if the value of socket_fd\
              is more than 1024\n";
-        m_event_loop = std::make_shared<SelectEventLoop>(time_out);
-    } else if (type == EventLoopType::EPOLL) {
-        m_event_loop = std::make_shared<EpollEventLoop>(time_out);
-    } else if (type == EventLoopType::POLL) {
-        m_event_loop = std::make_shared<PollEventLoop>(time_out);
+    }
+    m_event_loop.reset();
+    m_reactors.clear();
+    if (reactor_num == 0) {
+        m_event_loop = create_event_loop(type, time_out, max_events, adaptive);
+        if (m_event_loop == nullptr) {
+            return NetError { NET_INVALID_EVENT_LOOP_CODE, "Invalid event loop type" };
+        }
+        return std::nullopt;
+    }
+    for (std::size_t i = 0; i < reactor_num; ++i) {
+        auto event_loop = create_event_loop(type, time_out, max_events, adaptive);
+        if (event_loop == nullptr) {
+            m_reactors.clear();
+            return NetError { NET_INVALID_EVENT_LOOP_CODE, "Invalid event loop type" };
+        }
+        m_reactors.push_back(std::move(event_loop));
+    }
+    return std::nullopt;
+}
+
+bool SocketServer::event_loop_enabled() const {
+    return m_event_loop != nullptr || !m_reactors.empty();
+}
+
+std::vector<EventLoopStats> SocketServer::event_loop_stats() const {
+    std::vector<EventLoopStats> stats;
+    if (m_event_loop) {
+        stats.push_back(m_event_loop->stats());
+    }
+    for (auto& reactor: m_reactors) {
+        stats.push_back(reactor->stats());
+    }
+    return stats;
+}
+
+EventLoop::SharedPtr SocketServer::get_event_loop(int fd) {
+    if (m_event_loop) {
+        return m_event_loop;
+    }
+    for (auto& reactor: m_reactors) {
+        if (reactor->get_event(fd) != nullptr) {
+            return reactor;
+        }
+    }
+    return nullptr;
+}
+
+void SocketServer::remove_remote(RemoteTarget::SharedPtr remote) {
+    auto event_loop = get_event_loop(remote->fd());
+    if (event_loop == nullptr) {
+        m_remotes.remove_remote(remote);
+        return;
+    }
+    // removal is conditional on the loop still holding this event, not on the fd number
+    auto event = std::dynamic_pointer_cast<Event>(remote);
+    if (event != nullptr && event_loop->remove_event(event) && event->idle_timer() != 0) {
+        event_loop->timer_service()->cancel(event->idle_timer());
+    }
+}
+
+void SocketServer::dispatch(std::function<void()> task) {
+    if (!m_reactors.empty()) {
+        // reactor mode, connection is owned by the calling loop thread
+        task();
+    } else if (m_thread_pool) {
+        m_thread_pool->post(std::move(task));
     } else {
-        return NetError { NET_INVALID_EVENT_LOOP_CODE, "Invalid event loop type" };
+        auto unused = std::async(std::launch::async, std::move(task));
+    }
+}
+
+bool SocketServer::buffer_output(RemoteTarget::SharedPtr remote, const uint8_t* data, std::size_t size) {
+    auto& output = remote->output_buffer();
+    bool was_empty = output.empty();
+    output.append(data, size);
+    if (was_empty) {
+        auto event_loop = get_event_loop(remote->fd());
+        if (event_loop) {
+            try {
+                event_loop->watch_writable(remote->fd(), true);
+            } catch (const std::runtime_error& e) {
+                if (m_logger_set) {
+                    NET_LOG_ERROR(m_logger, "Failed to watch socket {} for writing: {}", remote->fd(), e.what());
+                }
+                std::cerr << std::format("Failed to watch socket {} for writing: {}\n", remote->fd(), e.what());
+            }
+        }
+    }
+    if (!output.m_above_high_watermark && output.size() >= m_high_watermark) {
+        output.m_above_high_watermark = true;
+        return true;
+    }
+    return false;
+}
+
+std::optional<NetError>
+SocketServer::send_file(int file_fd, off_t& offset, std::size_t count, RemoteTarget::SharedPtr remote) {
+    auto above_high_watermark = [&remote]() {
+        auto& output = remote->output_buffer();
+        std::lock_guard<std::mutex> lock(output.mutex());
+        return output.m_above_high_watermark;
+    };
+    std::vector<uint8_t> data;
+    while (count > 0 && !above_high_watermark()) {
+        data.resize(std::min(count, BufferPool::SIZE_CLASSES.back()));
+        auto num_bytes = ::pread(file_fd, data.data(), data.size(), offset);
+        if (num_bytes == -1 && errno == EINTR) {
+            continue;
+        }
+        if (num_bytes == -1) {
+            return GET_ERROR_MSG();
+        }
+        if (num_bytes == 0) {
+            return NetError { NET_FILE_TRUNCATED_CODE, "File ended before the requested range" };
+        }
+        data.resize(static_cast<std::size_t>(num_bytes));
+        if (auto err = write(data, remote)) {
+            return err;
+        }
+        offset += num_bytes;
+        count -= static_cast<std::size_t>(num_bytes);
     }
     return std::nullopt;
 }
 
+void SocketServer::close_remote(RemoteTarget::SharedPtr remote) {
+    {
+        auto& output = remote->output_buffer();
+        std::lock_guard<std::mutex> lock(output.mutex());
+        if (!output.empty()) {
+            // the write handler closes it once the rest is out
+            output.m_close_when_drained = true;
+            return;
+        }
+    }
+    remove_remote(remote);
+}
+
+std::shared_ptr<TimerService> SocketServer::timer_service(int fd) {
+    auto event_loop = get_event_loop(fd);
+    if (event_loop == nullptr) {
+        return nullptr;
+    }
+    return event_loop->timer_service();
+}
+
+void SocketServer::refresh_idle_timer(RemoteTarget::SharedPtr remote, EventLoop* event_loop) {
+    if (m_idle_timeout.count() <= 0) {
+        return;
+    }
+    auto timer_service = event_loop->timer_service();
+    if (remote->idle_timer() != 0) {
+        timer_service->cancel(remote->idle_timer());
+    }
+    // weak, a closed connection must not be kept alive by its timer
+    RemoteTarget::WeakPtr weak_remote = remote;
+    remote->set_idle_timer(timer_service->schedule(m_idle_timeout, [this, weak_remote]() {
+        auto remote = weak_remote.lock();
+        if (remote == nullptr || !remote->is_active()) {
+            return;
+        }
+        if (m_logger_set) {
+            NET_LOG_INFO(m_logger, "Close idle connection {}", remote->fd());
+        }
+        remote->set_idle_timer(0);
+        remove_remote(remote);
+    }));
+}
+
 void SocketServer::on_start(std::function<void(RemoteTarget::SharedPtr)> handler) {
     m_accept_handler = handler;
 }
@@ -130,6 +348,24 @@ void SocketServer::on_accept(CallBack handler) {
     m_on_accept = handler;
 }
 
+void SocketServer::set_write_watermark(std::size_t high, std::size_t low) {
+    assert(low <= high && "Low watermark is higher than high watermark");
+    m_high_watermark = high;
+    m_low_watermark = low;
+}
+
+void SocketServer::set_idle_timeout(std::chrono::milliseconds idle_timeout) {
+    m_idle_timeout = idle_timeout;
+}
+
+void SocketServer::on_high_watermark(CallBack handler) {
+    m_on_high_watermark = handler;
+}
+
+void SocketServer::on_low_watermark(CallBack handler) {
+    m_on_low_watermark = handler;
+}
+
 std::string SocketServer::get_ip() const {
     return m_ip;
 }
@@ -1,21 +1,25 @@
 #include "ssl.hpp"
+#include "buffer_pool.hpp"
 #include "defines.hpp"
 #include "remote_target.hpp"
 #include "socket_base.hpp"
 #include "ssl_utils.hpp"
 #include "tcp.hpp"
-#include "timer.hpp"
 #include <algorithm>
 #include <asm-generic/errno-base.h>
 #include <asm-generic/errno.h>
+#include <climits>
 #include <cstddef>
 #include <cstdint>
 #include <memory>
+#include <mutex>
 #include <openssl/err.h>
 #include <openssl/ssl.h>
 #include <openssl/types.h>
 #include <optional>
+#include <poll.h>
 #include <stdexcept>
+#include <sys/socket.h>
 #include <type_traits>
 #include <utility>
 #include <vector>
@@ -32,30 +36,8 @@ SSLClient::SSLClient(std::shared_ptr<SSLContext> ctx, const std::string& ip, con
     SSL_set_fd(m_ssl.get(), m_fd);
 }
 
-std::optional<NetError> SSLClient::ssl_connect(std::size_t time_out) {
-    if (time_out == 0) {
-        while (true) {
-            int err = SSL_connect(m_ssl.get());
-            if (err == 1) {
-                return std::nullopt;
-            }
-            if (err == 0) {
-                return NetError { NET_CONNECTION_RESET_CODE, "Connection reset by peer while ssl connecting" };
-            }
-            int ssl_error = SSL_get_error(m_ssl.get(), err);
-            if (ssl_error == SSL_ERROR_WANT_READ || ssl_error == SSL_ERROR_WANT_WRITE) {
-                continue;
-            }
-            return NetError { ssl_error, ERR_error_string(ssl_error, nullptr) };
-        }
-    }
-    Timer timer;
-    timer.set_timeout(std::chrono::milliseconds(time_out));
-    timer.async_start_timing();
+std::optional<NetError> SSLClient::ssl_connect(const Deadline& deadline) {
     while (true) {
-        if (timer.timeout()) {
-            return NetError { NET_TIMEOUT_CODE, "Timeout to connect to server" };
-        }
         int err = SSL_connect(m_ssl.get());
         if (err == 1) {
             return std::nullopt;
@@ -64,18 +46,30 @@ std::optional<NetError> SSLClient::ssl_connect(std::size_t time_out) {
             return NetError { NET_CONNECTION_RESET_CODE, "Connection reset by peer while ssl connecting" };
         }
         int ssl_error = SSL_get_error(m_ssl.get(), err);
-        if (ssl_error == SSL_ERROR_WANT_READ || ssl_error == SSL_ERROR_WANT_WRITE) {
-            continue;
+        if (ssl_error != SSL_ERROR_WANT_READ && ssl_error != SSL_ERROR_WANT_WRITE) {
+            return NetError { ssl_error, ERR_error_string(ssl_error, nullptr) };
+        }
+        auto wait_err = wait_ready(ssl_error == SSL_ERROR_WANT_READ ? POLLIN : POLLOUT, deadline);
+        if (wait_err.has_value()) {
+            if (wait_err.value().error_code == NET_TIMEOUT_CODE) {
+                return NetError { NET_TIMEOUT_CODE, "Timeout to connect to server" };
+            }
+            return wait_err;
         }
     }
 }
 
 std::optional<NetError> SSLClient::connect(std::size_t time_out) {
-    auto opt = TcpClient::connect(time_out);
+    // one deadline for the TCP and the TLS handshake together
+    auto deadline = make_deadline(time_out);
+    auto opt = TcpClient::connect_until(deadline);
     if (opt.has_value()) {
         return opt.value();
     }
-    return ssl_connect(time_out);
+    if (SSL_get_fd(m_ssl.get()) != m_fd) {
+        SSL_set_fd(m_ssl.get(), m_fd);
+    }
+    return ssl_connect(deadline);
 }
 
 std::optional<NetError> SSLClient::connect_with_retry(std::size_t time_out, std::size_t retry_time_limit) {
@@ -88,7 +82,7 @@ std::optional<NetError> SSLClient::connect_with_retry(std::size_t time_out, std:
         if (tried_time++ >= retry_time_limit) {
             return NetError { NET_TIMEOUT_CODE, "Failed to connect to server" };
         }
-        auto ret = ssl_connect(time_out);
+        auto ret = ssl_connect(make_deadline(time_out));
         if (!ret.has_value()) {
             return std::nullopt;
         }
@@ -99,71 +93,64 @@ std::optional<NetError> SSLClient::connect_with_retry(std::size_t time_out, std:
 std::optional<NetError> SSLClient::write(const std::vector<uint8_t>& data, std::size_t time_out) {
     assert(m_status == SocketStatus::CONNECTED && "Client is not connected");
     assert(data.size() > 0 && "Data buffer is empty");
-    Timer timer;
     std::size_t bytes_has_send = 0;
-    timer.reset();
-    if (time_out != 0) {
-        timer.set_timeout(std::chrono::milliseconds(time_out));
-        timer.async_start_timing();
-    }
-    while (true) {
-        if (timer.timeout()) {
-            return NetError { NET_TIMEOUT_CODE, "Timeout to write data" };
-        }
-        auto err = SSL_write(m_ssl.get(), data.data(), data.size());
+    auto deadline = make_deadline(time_out);
+    while (bytes_has_send < data.size()) {
+        auto err = SSL_write(m_ssl.get(), data.data() + bytes_has_send, static_cast<int>(data.size() - bytes_has_send));
         if (err > 0) {
             bytes_has_send += err;
-            if (bytes_has_send == data.size()) {
-                return std::nullopt;
-            }
         } else if (err == 0) {
             return NetError { NET_CONNECTION_RESET_CODE, "Connection reset by peer while writing" };
         } else {
             int ssl_error = SSL_get_error(m_ssl.get(), err);
-            if ((ssl_error == SSL_ERROR_WANT_READ || ssl_error == SSL_ERROR_WANT_WRITE)) {
-                if (bytes_has_send <= 0) {
-                    continue;
+            if (ssl_error != SSL_ERROR_WANT_READ && ssl_error != SSL_ERROR_WANT_WRITE) {
+                return NetError { ssl_error, ERR_error_string(ssl_error, nullptr) };
+            }
+            auto wait_err = wait_ready(ssl_error == SSL_ERROR_WANT_READ ? POLLIN : POLLOUT, deadline);
+            if (wait_err.has_value()) {
+                if (wait_err.value().error_code == NET_TIMEOUT_CODE) {
+                    return NetError { NET_TIMEOUT_CODE, "Timeout to write data" };
                 }
-                break;
+                return wait_err;
             }
-            return NetError { ssl_error, ERR_error_string(ssl_error, nullptr) };
         }
-        return std::nullopt;
     }
     return std::nullopt;
 }
 
-std::optional<NetError> SSLClient::read(std::vector<uint8_t>& data, std::size_t time_out) {
+std::optional<NetError>
+SSLClient::read(std::vector<uint8_t>& data, std::size_t time_out, std::size_t max_size) {
     assert(m_status == SocketStatus::CONNECTED && "Client is not connected");
     data.clear();
     int num_bytes;
-    Timer timer;
-    timer.reset();
-    if (time_out != 0) {
-        timer.set_timeout(std::chrono::milliseconds(time_out));
-        timer.async_start_timing();
-    }
+    PooledBuffer buffer(BufferPool::SIZE_CLASSES.back());
+    auto deadline = make_deadline(time_out);
     while (true) {
-        if (timer.timeout()) {
-            return NetError { NET_TIMEOUT_CODE, "Timeout to read data" };
-        }
-        std::vector<uint8_t> buffer(1024);
-        num_bytes = SSL_read(m_ssl.get(), buffer.data(), buffer.size());
+        num_bytes = SSL_read(m_ssl.get(), buffer.data(), static_cast<int>(buffer.capacity()));
         if (num_bytes <= 0) {
             auto ssl_err = SSL_get_error(m_ssl.get(), num_bytes);
             if (ssl_err == SSL_ERROR_WANT_READ || ssl_err == SSL_ERROR_WANT_WRITE) {
-                if (data.size() <= 0) {
-                    continue;
+                if (!data.empty()) {
+                    break;
                 }
-                break;
+                auto wait_err = wait_ready(ssl_err == SSL_ERROR_WANT_READ ? POLLIN : POLLOUT, deadline);
+                if (wait_err.has_value()) {
+                    if (wait_err.value().error_code == NET_TIMEOUT_CODE) {
+                        return NetError { NET_TIMEOUT_CODE, "Timeout to read data" };
+                    }
+                    return wait_err;
+                }
+                continue;
             } else if (ssl_err == SSL_ERROR_SYSCALL) {
                 return NetError { NET_CONNECTION_RESET_CODE, "Connection reset by peer while reading" };
             } else {
                 return NetError { ssl_err, ERR_error_string(ssl_err, nullptr) };
             }
         }
-        buffer.resize(num_bytes);
-        std::copy(buffer.begin(), buffer.end(), std::back_inserter(data));
+        data.insert(data.end(), buffer.data(), buffer.data() + num_bytes);
+        if (max_size != 0 && data.size() >= max_size) {
+            break;
+        }
     }
 
     return std::nullopt;
@@ -185,21 +172,31 @@ std::optional<NetError> SSLServer::listen() {
 }
 
 std::optional<NetError> SSLServer::read(std::vector<uint8_t>& data, RemoteTarget::SharedPtr remote) {
+    PooledBuffer buffer;
+    auto err = read(buffer, remote);
+    data.assign(buffer.data(), buffer.data() + buffer.size());
+    return err;
+}
+
+std::optional<NetError>
+SSLServer::read(PooledBuffer& buffer, RemoteTarget::SharedPtr remote, std::size_t max_size) {
     auto ssl_remote = std::dynamic_pointer_cast<SSLRemoteTarget>(remote);
     int num_bytes;
-    data.clear();
+    buffer.clear();
+    if (max_size != 0 && buffer.capacity() < max_size) {
+        buffer.reserve(max_size);
+    }
     do {
-        std::vector<uint8_t> read_buffer(1024);
-        num_bytes = SSL_read(ssl_remote->get_ssl().get(), read_buffer.data(), read_buffer.size());
+        if (buffer.writable() == 0) {
+            buffer.reserve(buffer.capacity() + BufferPool::SIZE_CLASSES.front());
+        }
+        auto size = max_size == 0 ? buffer.writable() : std::min(buffer.writable(), max_size - buffer.size());
+        num_bytes = SSL_read(ssl_remote->get_ssl().get(), buffer.tail(), static_cast<int>(size));
         if (num_bytes == -1) {
             int ssl_error = SSL_get_error(ssl_remote->get_ssl().get(), num_bytes);
             if (ssl_error == SSL_ERROR_WANT_READ || ssl_error == SSL_ERROR_WANT_WRITE) {
-                if (data.size() <= 0) {
-                    if (m_event_loop) {
-                        m_event_loop->remove_event(remote->fd());
-                    } else {
-                        m_remotes.remove_remote(remote->fd());
-                    }
+                if (buffer.empty() && max_size == 0) {
+                    remove_remote(remote);
                     return GET_ERROR_MSG();
                 }
                 break;
@@ -212,11 +209,7 @@ std::optional<NetError> SSLServer::read(std::vector<uint8_t>& data, RemoteTarget
                         ERR_error_string(ssl_error, nullptr)
                     );
                 }
-                if (m_event_loop) {
-                    m_event_loop->remove_event(remote->fd());
-                } else {
-                    m_remotes.remove_remote(remote->fd());
-                }
+                remove_remote(remote);
                 return NetError { NET_CONNECTION_RESET_CODE, "Connection reset by peer while writting" };
             } else {
                 if (m_logger_set) {
@@ -227,11 +220,7 @@ std::optional<NetError> SSLServer::read(std::vector<uint8_t>& data, RemoteTarget
                         ERR_error_string(ssl_error, nullptr)
                     );
                 }
-                if (m_event_loop) {
-                    m_event_loop->remove_event(remote->fd());
-                } else {
-                    m_remotes.remove_remote(remote->fd());
-                }
+                remove_remote(remote);
                 return NetError { ssl_error, ERR_error_string(ssl_error, nullptr) };
             }
         }
@@ -239,18 +228,13 @@ std::optional<NetError> SSLServer::read(std::vector<uint8_t>& data, RemoteTarget
             if (m_logger_set) {
                 NET_LOG_ERROR(m_logger, "Connection reset by peer while reading");
             }
-            if (m_event_loop) {
-                m_event_loop->remove_event(remote->fd());
-            } else {
-                m_remotes.remove_remote(remote->fd());
-            }
+            remove_remote(remote);
             return NetError { NET_CONNECTION_RESET_CODE, "Connection reset by peer while writting" };
         }
         if (num_bytes > 0) {
-            read_buffer.resize(num_bytes);
-            std::copy(read_buffer.begin(), read_buffer.end(), std::back_inserter(data));
+            buffer.commit(static_cast<std::size_t>(num_bytes));
         }
-    } while (num_bytes > 0 && m_event_loop);
+    } while (num_bytes > 0 && event_loop_enabled() && (max_size == 0 || buffer.size() < max_size));
     return std::nullopt;
 }
 
@@ -258,52 +242,88 @@ std::optional<NetError> SSLServer::write(const std::vector<uint8_t>& data, Remot
     assert(m_status == SocketStatus::LISTENING && "Server is not listening");
     assert(data.size() > 0 && "Data buffer is empty");
     auto ssl_remote = std::dynamic_pointer_cast<SSLRemoteTarget>(remote);
-    int num_bytes;
-    std::size_t bytes_has_send = 0;
-    do {
-        num_bytes = SSL_write(ssl_remote->get_ssl().get(), data.data(), data.size());
-        if (num_bytes == -1) {
-            auto err = SSL_get_error(ssl_remote->get_ssl().get(), num_bytes);
-            if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
-                break;
-            } else if (err == SSL_ERROR_SYSCALL) {
-                if (m_event_loop) {
-                    m_event_loop->remove_event(remote->fd());
+    auto& output = remote->output_buffer();
+    std::unique_lock<std::mutex> lock(output.mutex());
+    bool high_watermark = false;
+    if (event_loop_enabled() && !output.empty()) {
+        // keep the byte order, queued output goes first once the socket is writable
+        high_watermark = buffer_output(remote, data.data(), data.size());
+    } else {
+        int num_bytes;
+        std::size_t bytes_has_send = 0;
+        do {
+            num_bytes = SSL_write(
+                ssl_remote->get_ssl().get(),
+                data.data() + bytes_has_send,
+                static_cast<int>(data.size() - bytes_has_send)
+            );
+            if (num_bytes == -1) {
+                auto err = SSL_get_error(ssl_remote->get_ssl().get(), num_bytes);
+                if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+                    // the record is retried from the output buffer, which starts with the same bytes
+                    if (event_loop_enabled()) {
+                        high_watermark =
+                            buffer_output(remote, data.data() + bytes_has_send, data.size() - bytes_has_send);
+                    }
+                    break;
+                } else if (err == SSL_ERROR_SYSCALL) {
+                    lock.unlock();
+                    remove_remote(remote);
+                    if (m_logger_set) {
+                        NET_LOG_ERROR(m_logger, "Connection reset by peer while writting");
+                    }
+                    return NetError { NET_CONNECTION_RESET_CODE, "Connection reset by peer while writting" };
                 } else {
-                    m_remotes.remove_remote(remote->fd());
+                    lock.unlock();
+                    remove_remote(remote);
+                    if (m_logger_set) {
+                        NET_LOG_ERROR(m_logger, "Failed to write to socket: {}", ERR_error_string(err, nullptr));
+                    }
+                    return NetError { err, ERR_error_string(err, nullptr) };
                 }
+            }
+            if (num_bytes == 0) {
                 if (m_logger_set) {
-                    NET_LOG_ERROR(m_logger, "Connection reset by peer while writting");
+                    NET_LOG_WARN(m_logger, "Connection reset by peer while writting");
                 }
+                lock.unlock();
+                remove_remote(remote);
                 return NetError { NET_CONNECTION_RESET_CODE, "Connection reset by peer while writting" };
-            } else {
-                if (m_event_loop) {
-                    m_event_loop->remove_event(remote->fd());
-                } else {
-                    m_remotes.remove_remote(remote->fd());
-                }
-                if (m_logger_set) {
-                    NET_LOG_ERROR(m_logger, "Failed to write to socket: {}", ERR_error_string(err, nullptr));
-                }
-                return NetError { err, ERR_error_string(err, nullptr) };
-            }
-        }
-        if (num_bytes == 0) {
-            if (m_logger_set) {
-                NET_LOG_WARN(m_logger, "Connection reset by peer while writting");
             }
-            if (m_event_loop) {
-                m_event_loop->remove_event(remote->fd());
-            } else {
-                m_remotes.remove_remote(remote->fd());
-            }
-            return NetError { NET_CONNECTION_RESET_CODE, "Connection reset by peer while writting" };
-        }
-        bytes_has_send += num_bytes;
-    } while (num_bytes > 0 && m_event_loop && bytes_has_send < data.size());
+            bytes_has_send += num_bytes;
+        } while (num_bytes > 0 && event_loop_enabled() && bytes_has_send < data.size());
+    }
+    lock.unlock();
+    if (high_watermark && m_on_high_watermark) {
+        m_on_high_watermark(remote);
+    }
     return std::nullopt;
 }
 
+std::optional<NetError>
+SSLServer::writev(const struct iovec* iov, std::size_t iov_count, RemoteTarget::SharedPtr remote) {
+    // records are encrypted from one contiguous buffer anyway, so the pieces are gathered here
+    std::vector<uint8_t> data;
+    std::size_t size = 0;
+    for (std::size_t i = 0; i < iov_count; i++) {
+        size += iov[i].iov_len;
+    }
+    if (size == 0) {
+        return std::nullopt;
+    }
+    data.reserve(size);
+    for (std::size_t i = 0; i < iov_count; i++) {
+        auto base = static_cast<const uint8_t*>(iov[i].iov_base);
+        data.insert(data.end(), base, base + iov[i].iov_len);
+    }
+    return write(data, remote);
+}
+
+std::optional<NetError>
+SSLServer::send_file(int file_fd, off_t& offset, std::size_t count, RemoteTarget::SharedPtr remote) {
+    return SocketServer::send_file(file_fd, offset, count, remote);
+}
+
 std::optional<NetError> SSLServer::close() {
     m_remotes.iterate([](auto remote) {
         auto ssl_remote = std::dynamic_pointer_cast<SSLRemoteTarget>(remote);
@@ -348,67 +368,91 @@ bool SSLServer::handle_ssl_handshake(RemoteTarget::SharedPtr remote) {
         return false;
     } else {
         ssl_remote->set_ssl_handshaked(true);
-        return false;
+        // data sent right behind the handshake raises no further edge, it is read now if it is there
+        char byte;
+        return SSL_pending(ssl_remote->get_ssl().get()) > 0
+            || ::recv(ssl_remote->fd(), &byte, 1, MSG_PEEK | MSG_DONTWAIT) > 0;
     }
 }
 
-void SSLServer::add_remote_event(int client_fd) {
+bool SSLServer::flush_output(RemoteTarget::SharedPtr remote, EventLoop* event_loop) {
+    auto ssl_remote = std::dynamic_pointer_cast<SSLRemoteTarget>(remote);
+    auto& output = remote->output_buffer();
+    std::unique_lock<std::mutex> lock(output.mutex());
+    while (!output.empty()) {
+        int num_bytes =
+            SSL_write(ssl_remote->get_ssl().get(), output.data(), static_cast<int>(std::min<std::size_t>(output.size(), INT_MAX)));
+        if (num_bytes <= 0) {
+            auto err = SSL_get_error(ssl_remote->get_ssl().get(), num_bytes);
+            if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+                break;
+            }
+            if (m_logger_set) {
+                NET_LOG_ERROR(m_logger, "Failed to flush output of socket {} : {}", remote->fd(), ERR_error_string(err, nullptr));
+            }
+            lock.unlock();
+            remove_remote(remote);
+            return false;
+        }
+        output.consume(static_cast<std::size_t>(num_bytes));
+    }
+    return finish_flush(remote, event_loop, lock);
+}
+
+void SSLServer::add_remote_event(int client_fd, EventLoop* event_loop) {
     auto client_event_handler = std::make_shared<EventHandler>();
-    client_event_handler->m_on_read = [this](int client_fd) {
+    client_event_handler->m_on_read = [this, event_loop](int client_fd) {
+        if (m_idle_timeout.count() > 0) {
+            if (auto event = event_loop->get_event(client_fd)) {
+                refresh_idle_timer(event, event_loop);
+            }
+        }
         if (!this->m_on_read) {
             return;
         }
 
-        auto event = m_event_loop->get_event(client_fd);
+        auto event = event_loop->get_event(client_fd);
         if (event == nullptr) {
             return;
         }
         if (!handle_ssl_handshake(event)) {
             return;
         }
-        if (this->m_thread_pool) {
-            this->m_thread_pool->submit([this, event]() { this->m_on_read(event); });
-        } else {
-            auto unused = std::async(std::launch::async, [this, event]() { this->m_on_read(event); });
-        }
+        dispatch([this, event]() { this->m_on_read(event); });
     };
-    client_event_handler->m_on_write = [this](int client_fd) {
-        if (!this->m_on_write) {
-            return;
-        }
-        auto event = m_event_loop->get_event(client_fd);
+    client_event_handler->m_on_write = [this, event_loop](int client_fd) {
+        auto event = event_loop->get_event(client_fd);
         if (event == nullptr) {
             return;
         }
         if (!handle_ssl_handshake(event)) {
             return;
         }
-        if (this->m_thread_pool) {
-            this->m_thread_pool->submit([this, event]() { this->m_on_write(event); });
-        } else {
-            auto unused = std::async(std::launch::async, [this, event]() { this->m_on_write(event); });
+        // write interest is only armed while output is pending, m_on_write reports that it has drained
+        if (!flush_output(event, event_loop) || !this->m_on_write) {
+            return;
         }
+        dispatch([this, event]() { this->m_on_write(event); });
     };
-    client_event_handler->m_on_error = [this](int client_fd) {
+    client_event_handler->m_on_error = [this, event_loop](int client_fd) {
         if (!this->m_on_error) {
             return;
         };
-        auto event = m_event_loop->get_event(client_fd);
+        auto event = event_loop->get_event(client_fd);
         if (event == nullptr) {
             return;
         }
-        if (this->m_thread_pool) {
-            this->m_thread_pool->submit([this, event]() { this->m_on_error(event); });
-        } else {
-            auto unused = std::async(std::launch::async, [this, event]() { this->m_on_error(event); });
-        }
+        dispatch([this, event]() { this->m_on_error(event); });
     };
     auto ssl = std::shared_ptr<SSL>(SSL_new(m_ctx->get().get()), [](SSL* ssl) { SSL_free(ssl); });
+    // output the socket didn't take is retried from the output buffer, which moves as it is consumed
+    SSL_set_mode(ssl.get(), SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
     auto client_event = std::make_shared<SSLEvent>(client_fd, client_event_handler, ssl);
-    m_event_loop->add_event(client_event);
+    event_loop->add_event(client_event);
+    refresh_idle_timer(client_event, event_loop);
     if (m_on_accept) {
         try {
-            m_on_accept(m_event_loop->get_event(client_fd));
+            m_on_accept(event_loop->get_event(client_fd));
         } catch (const std::exception& e) {
             if (m_logger_set) {
                 NET_LOG_ERROR(m_logger, "Failed to execute on accept: {}", e.what());
@@ -1,11 +1,13 @@
 #include "tcp.hpp"
+#include "buffer_pool.hpp"
 #include "defines.hpp"
 #include "event_loop.hpp"
 #include "logger.hpp"
 #include "remote_target.hpp"
 #include "socket_base.hpp"
-#include "timer.hpp"
+#include "timing_wheel.hpp"
 #include <algorithm>
+#include <array>
 #include <cassert>
 #include <cerrno>
 #include <chrono>
@@ -13,15 +15,22 @@
 #include <cstddef>
 #include <cstdint>
 #include <exception>
+#include <fcntl.h>
+#include <format>
 #include <memory>
 #include <mutex>
 #include <netdb.h>
 #include <optional>
+#include <poll.h>
 #include <ratio>
 #include <shared_mutex>
 #include <stdexcept>
+#include <string>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <system_error>
 #include <thread>
 #include <utility>
 #include <vector>
@@ -46,42 +55,131 @@ TcpClient::TcpClient(const std::string& ip, const std::string& service) {
     set_non_blocking_socket(m_fd);
 }
 
-std::optional<NetError> TcpClient::connect(std::size_t time_out) {
-    if (time_out == 0) {
-        while (::connect(m_fd, m_addr_info.get_address().m_addr, m_addr_info.get_address().m_len) == -1) {
-            if (errno == EALREADY || errno == EINPROGRESS) {
-                continue;
-            } else {
-                return GET_ERROR_MSG();
+namespace {
+
+    /**
+     * @brief close every attempt but the one at keep, which may be npos
+     */
+    void close_attempts(std::vector<struct pollfd>& attempts, std::size_t keep = std::string::npos) {
+        for (std::size_t i = 0; i < attempts.size(); i++) {
+            if (i != keep) {
+                ::close(attempts[i].fd);
             }
         }
-        m_status = SocketStatus::CONNECTED;
-        return std::nullopt;
+        attempts.clear();
     }
-    Timer timer;
-    timer.set_timeout(std::chrono::milliseconds(time_out));
-    timer.async_start_timing();
-    while (::connect(m_fd, m_addr_info.get_address().m_addr, m_addr_info.get_address().m_len) == -1) {
-        if (errno != EALREADY && errno != EINPROGRESS) {
-            auto error = GET_ERROR_MSG();
-            if (m_logger_set) {
-                NET_LOG_ERROR(m_logger, "Failed to connect to socket: {}", error.msg);
+
+    /**
+     * @brief connect to all of addresses at once, the first to complete wins
+     * @return connected socket, or -1 with error set
+     */
+    int race_connect(
+        const std::vector<const struct ::addrinfo*>& addresses,
+        const std::optional<std::chrono::steady_clock::time_point>& deadline,
+        NetError& error
+    ) {
+        std::vector<struct pollfd> attempts;
+        for (auto address: addresses) {
+            int fd = ::socket(address->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, address->ai_protocol);
+            if (fd == -1) {
+                error = GET_ERROR_MSG();
+                continue;
             }
-            return error;
+            if (::connect(fd, address->ai_addr, address->ai_addrlen) == 0) {
+                close_attempts(attempts);
+                return fd;
+            }
+            if (errno != EINPROGRESS) {
+                error = GET_ERROR_MSG();
+                ::close(fd);
+                continue;
+            }
+            attempts.push_back({ fd, POLLOUT, 0 });
         }
-        if (timer.timeout()) {
-            auto error = GET_ERROR_MSG();
-            if (m_logger_set) {
-                NET_LOG_ERROR(m_logger, "Timeout to connect to socket, last error: {}", error.msg);
+        while (!attempts.empty()) {
+            int time_out = -1;
+            if (deadline.has_value()) {
+                auto remain =
+                    std::chrono::ceil<std::chrono::milliseconds>(deadline.value() - std::chrono::steady_clock::now());
+                time_out = static_cast<int>(std::max<int64_t>(remain.count(), 0));
+            }
+            int ret = ::poll(attempts.data(), attempts.size(), time_out);
+            if (ret == -1 && errno == EINTR) {
+                continue;
             }
-            return NetError { NET_TIMEOUT_CODE,
-                              std::format("Timeout to connect to socket, last error: {}", error.msg) };
+            if (ret <= 0) {
+                error = ret == 0 ? NetError { NET_TIMEOUT_CODE, "Timeout to connect to socket" } : GET_ERROR_MSG();
+                close_attempts(attempts);
+                return -1;
+            }
+            for (std::size_t i = 0; i < attempts.size();) {
+                if (attempts[i].revents == 0) {
+                    i++;
+                    continue;
+                }
+                int so_error = 0;
+                socklen_t len = sizeof(so_error);
+                ::getsockopt(attempts[i].fd, SOL_SOCKET, SO_ERROR, &so_error, &len);
+                if (so_error == 0) {
+                    int fd = attempts[i].fd;
+                    close_attempts(attempts, i);
+                    return fd;
+                }
+                error = NetError { so_error, std::system_category().message(so_error) };
+                ::close(attempts[i].fd);
+                attempts.erase(attempts.begin() + static_cast<std::ptrdiff_t>(i));
+            }
+        }
+        return -1;
+    }
+
+} // namespace
+
+std::optional<NetError> TcpClient::connect(std::size_t time_out) {
+    return connect_until(make_deadline(time_out));
+}
+
+std::optional<NetError> TcpClient::connect_until(const Deadline& deadline) {
+    // without hints every address comes once per socket type
+    std::vector<const struct ::addrinfo*> addresses;
+    for (auto entry = m_addr_info.m_curr; entry != nullptr; entry = entry->ai_next) {
+        if (entry->ai_socktype == SOCK_STREAM || entry->ai_socktype == 0) {
+            addresses.push_back(entry);
         }
     }
+    NetError error { NET_CONNECTION_RESET_CODE, "No address to connect to" };
+    int fd = -1;
+    if (m_parallel_connect) {
+        fd = race_connect(addresses, deadline, error);
+    } else {
+        for (auto address: addresses) {
+            fd = race_connect({ address }, deadline, error);
+            if (fd != -1 || error.error_code == NET_TIMEOUT_CODE) {
+                break;
+            }
+        }
+    }
+    if (fd == -1) {
+        if (m_logger_set) {
+            NET_LOG_ERROR(m_logger, "Failed to connect to socket: {}", error.msg);
+        }
+        return error;
+    }
+    // the descriptor number stays the same, whatever was bound to m_fd keeps working
+    if (m_fd == -1) {
+        m_fd = fd;
+    } else {
+        ::dup3(fd, m_fd, O_CLOEXEC);
+        ::close(fd);
+    }
     m_status = SocketStatus::CONNECTED;
     return std::nullopt;
 }
 
+void TcpClient::set_parallel_connect(bool enable) {
+    m_parallel_connect = enable;
+}
+
 std::optional<NetError> TcpClient::connect_with_retry(std::size_t time_out, std::size_t retry_time_limit) {
     std::size_t tried_time = 0;
     while (true) {
@@ -108,35 +206,38 @@ std::optional<NetError> TcpClient::close() {
         }
         return error;
     }
+    // the number may be handed out again right away, a later connect must not take it over
+    m_fd = -1;
     m_status = SocketStatus::DISCONNECTED;
     return std::nullopt;
 }
 
-std::optional<NetError> TcpClient::read(std::vector<uint8_t>& data, std::size_t time_out) {
+std::optional<NetError>
+TcpClient::read(std::vector<uint8_t>& data, std::size_t time_out, std::size_t max_size) {
     assert(m_status == SocketStatus::CONNECTED && "Client is not connected");
     data.clear();
     ssize_t num_bytes;
-    Timer timer;
-    timer.reset();
-    if (time_out != 0) {
-        timer.set_timeout(std::chrono::milliseconds(time_out));
-        timer.async_start_timing();
-    }
+    // scratch block from the thread local pool, one allocation-free landing zone for the whole read
+    PooledBuffer buffer(BufferPool::SIZE_CLASSES.back());
+    auto deadline = make_deadline(time_out);
     while (true) {
-        if (timer.timeout()) {
-            if (m_logger_set) {
-                NET_LOG_ERROR(m_logger, "Timeout to read from socket");
-            }
-            return NetError { NET_TIMEOUT_CODE, "Timeout to read from socket" };
-        }
-        std::vector<uint8_t> buffer(1024);
-        num_bytes = ::recv(m_fd, buffer.data(), buffer.size(), MSG_NOSIGNAL);
+        num_bytes = ::recv(m_fd, buffer.data(), buffer.capacity(), MSG_NOSIGNAL);
         if (num_bytes == -1) {
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                if (data.size() <= 0) {
-                    continue;
+                if (!data.empty()) {
+                    break;
                 }
-                break;
+                auto err = wait_ready(POLLIN, deadline);
+                if (err.has_value()) {
+                    if (err.value().error_code == NET_TIMEOUT_CODE) {
+                        if (m_logger_set) {
+                            NET_LOG_ERROR(m_logger, "Timeout to read from socket");
+                        }
+                        return NetError { NET_TIMEOUT_CODE, "Timeout to read from socket" };
+                    }
+                    return err;
+                }
+                continue;
             }
             auto error = GET_ERROR_MSG();
             if (m_logger_set) {
@@ -150,8 +251,10 @@ std::optional<NetError> TcpClient::read(std::vector<uint8_t>& data, std::size_t
             }
             return NetError { NET_CONNECTION_RESET_CODE, "Connection reset by peer while reading" };
         }
-        buffer.resize(num_bytes);
-        std::copy(buffer.begin(), buffer.end(), std::back_inserter(data));
+        data.insert(data.end(), buffer.data(), buffer.data() + num_bytes);
+        if (max_size != 0 && data.size() >= max_size) {
+            break;
+        }
     };
     return std::nullopt;
 }
@@ -160,50 +263,44 @@ std::optional<NetError> TcpClient::write(const std::vector<uint8_t>& data, std::
     assert(m_status == SocketStatus::CONNECTED && "Client is not connected");
     assert(data.size() > 0 && "Data buffer is empty");
     size_t bytes_has_send = 0;
-    Timer timer;
-    timer.reset();
-    if (time_out != 0) {
-        timer.set_timeout(std::chrono::milliseconds(time_out));
-        timer.async_start_timing();
-    }
-    while (true) {
-        if (timer.timeout() && bytes_has_send <= 0) {
-            if (m_logger_set) {
-                NET_LOG_ERROR(m_logger, "Timeout to write to socket");
-            }
-            return NetError { NET_TIMEOUT_CODE, "Timeout to write to socket" };
-        }
+    auto deadline = make_deadline(time_out);
+    while (bytes_has_send < data.size()) {
         ssize_t num_bytes = ::send(m_fd, data.data() + bytes_has_send, data.size() - bytes_has_send, MSG_NOSIGNAL);
         if (num_bytes == -1) {
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                if (bytes_has_send <= 0) {
+                auto err = wait_ready(POLLOUT, deadline);
+                if (!err.has_value()) {
                     continue;
                 }
-                if (bytes_has_send != data.size()) {
+                if (err.value().error_code != NET_TIMEOUT_CODE) {
+                    return err;
+                }
+                if (bytes_has_send > 0) {
                     if (m_logger_set) {
                         NET_LOG_WARN(m_logger, "early end of socket");
                     }
                     return NetError { NET_EARLY_END_OF_SOCKET, "early end of socket" };
                 }
-                auto error = GET_ERROR_MSG();
                 if (m_logger_set) {
-                    NET_LOG_ERROR(m_logger, "Failed to write to socket: {}", error.msg);
+                    NET_LOG_ERROR(m_logger, "Timeout to write to socket");
                 }
-                return error;
+                return NetError { NET_TIMEOUT_CODE, "Timeout to write to socket" };
             }
-            if (num_bytes == 0) {
-                if (m_logger_set) {
-                    NET_LOG_WARN(m_logger, "Connection reset by peer while reading");
-                }
-                return NetError { NET_CONNECTION_RESET_CODE, "Connection reset by peer while writing" };
+            auto error = GET_ERROR_MSG();
+            if (m_logger_set) {
+                NET_LOG_ERROR(m_logger, "Failed to write to socket: {}", error.msg);
             }
-            bytes_has_send += num_bytes;
-            if (bytes_has_send >= data.size()) {
-                return std::nullopt;
+            return error;
+        }
+        if (num_bytes == 0) {
+            if (m_logger_set) {
+                NET_LOG_WARN(m_logger, "Connection reset by peer while writing");
             }
-        };
-        return std::nullopt;
+            return NetError { NET_CONNECTION_RESET_CODE, "Connection reset by peer while writing" };
+        }
+        bytes_has_send += num_bytes;
     }
+    return std::nullopt;
 }
 
 TcpClient::~TcpClient() {
@@ -236,8 +333,17 @@ TcpServer::~TcpServer() {
 }
 
 std::optional<NetError> TcpServer::listen() {
+    auto err = bind_and_listen(m_listen_fd, !m_reactors.empty());
+    if (err.has_value()) {
+        return err;
+    }
+    m_status = SocketStatus::LISTENING;
+    return std::nullopt;
+}
+
+std::optional<NetError> TcpServer::bind_and_listen(int listen_fd, bool reuse_port) {
     int opt = 1;
-    auto ret = ::setsockopt(m_listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    auto ret = ::setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
     if (ret == -1) {
         auto error = GET_ERROR_MSG();
         if (m_logger_set) {
@@ -245,28 +351,69 @@ std::optional<NetError> TcpServer::listen() {
         }
         return error;
     }
-    if (::bind(m_listen_fd, m_addr_info.get_address().m_addr, m_addr_info.get_address().m_len) == -1) {
+    if (reuse_port) {
+        auto error = set_reuse_port(listen_fd);
+        if (error.has_value()) {
+            return error;
+        }
+    }
+    if (::bind(listen_fd, m_addr_info.get_address().m_addr, m_addr_info.get_address().m_len) == -1) {
         auto error = GET_ERROR_MSG();
         if (m_logger_set) {
             NET_LOG_ERROR(m_logger, "Failed to bind socket: {}", error.msg);
         }
         return error;
     }
-    if (::listen(m_listen_fd, 10) == -1) {
+    if (::listen(listen_fd, 10) == -1) {
         auto error = GET_ERROR_MSG();
         if (m_logger_set) {
             NET_LOG_ERROR(m_logger, "Failed to listen on socket: {}", error.msg);
         }
         return error;
     }
+    return std::nullopt;
+}
 
-    m_status = SocketStatus::LISTENING;
+std::optional<NetError> TcpServer::set_reuse_port(int listen_fd) {
+    // every reactor binds its own listen socket to the same address, kernel balances connections between them
+    int opt = 1;
+    if (::setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1) {
+        auto error = GET_ERROR_MSG();
+        if (m_logger_set) {
+            NET_LOG_ERROR(m_logger, "Failed to set socket options: {}", error.msg);
+        }
+        return error;
+    }
     return std::nullopt;
 }
 
-std::optional<NetError> TcpServer::close() {
+void TcpServer::stop_event_loops() {
     m_stop = true;
-    m_accept_thread.join();
+    // the loops may be blocked in a wait without timeout, a timer due right away gets them to look at m_stop
+    if (m_event_loop) {
+        m_event_loop->timer_service()->schedule(std::chrono::milliseconds(0), []() {});
+    }
+    for (auto& reactor: m_reactors) {
+        reactor->timer_service()->schedule(std::chrono::milliseconds(0), []() {});
+    }
+}
+
+std::optional<NetError> TcpServer::close() {
+    stop_event_loops();
+    if (m_accept_thread.joinable()) {
+        m_accept_thread.join();
+    }
+    for (auto& reactor_thread: m_reactor_threads) {
+        if (reactor_thread.joinable()) {
+            reactor_thread.join();
+        }
+    }
+    m_reactor_threads.clear();
+    for (auto listen_fd: m_reactor_listen_fds) {
+        ::close(listen_fd);
+    }
+    m_reactor_listen_fds.clear();
+    m_reactors.clear();
     m_event_loop.reset();
     if (m_thread_pool) {
         m_thread_pool->stop();
@@ -287,68 +434,32 @@ std::optional<NetError> TcpServer::start() {
     assert(m_status == SocketStatus::LISTENING && "Server is not listening");
     assert(m_accept_handler != nullptr && "No handler set");
     m_stop = false;
-    if (m_event_loop) {
-        m_accept_thread = std::thread([this]() {
-            auto err = set_non_blocking_socket(m_listen_fd);
+    if (!m_reactors.empty()) {
+        // the first reactor takes over the listen socket created by listen(), the others bind their own, listen() may
+        // have run before the reactors were enabled so the shared socket joins the port group here
+        auto err = set_reuse_port(m_listen_fd);
+        if (err.has_value()) {
+            return err;
+        }
+        for (std::size_t i = 1; i < m_reactors.size(); ++i) {
+            int listen_fd = m_addr_info.create_socket();
+            err = bind_and_listen(listen_fd, true);
             if (err.has_value()) {
-                if (m_logger_set) {
-                    NET_LOG_ERROR(
-                        m_logger,
-                        "Failed to set non-blocking socket to listen fd, server will not start: {}",
-                        err.value().msg
-                    );
+                ::close(listen_fd);
+                for (auto fd: m_reactor_listen_fds) {
+                    ::close(fd);
                 }
-                std::cerr << std::format(
-                    "Failed to set non-blocking socket to listen fd, server will not start: {}\n",
-                    err.value().msg
-                );
-                return;
+                m_reactor_listen_fds.clear();
+                return err;
             }
-            EventHandler::SharedPtr server_event_handler = std::make_shared<EventHandler>();
-            server_event_handler->m_on_read = [this](int server_fd) {
-                while (true) {
-                    addressResolver::address client_addr;
-                    int client_fd = ::accept(server_fd, &client_addr.m_addr, &client_addr.m_addr_len);
-                    if (client_fd == -1) {
-                        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                            break;
-                        }
-                        auto error = GET_ERROR_MSG();
-                        if (m_logger_set) {
-                            NET_LOG_ERROR(m_logger, "Failed to accept RemoteTarget: {}", error.msg);
-                        }
-                        std::cerr << std::format("Failed to accept RemoteTarget: {}\n", error.msg);
-                        continue;
-                    }
-                    auto err = set_non_blocking_socket(client_fd);
-                    if (err.has_value()) {
-                        if (m_logger_set) {
-                            NET_LOG_ERROR(m_logger, "Failed to set non-blocking socket: {}", err.value().msg);
-                        }
-                        std::cerr << std::format("Failed to set non-blocking socket: {}\n", err.value().msg);
-                        return;
-                    }
-                    add_remote_event(client_fd);
-                }
-            };
-            server_event_handler->m_on_error = [this](int server_fd) {
-                auto error = GET_ERROR_MSG();
-                if (m_logger_set) {
-                    NET_LOG_ERROR(m_logger, "Error on server socket: {}", error.msg);
-                }
-                std::cerr << std::format("Error on server socket: {}\n", error.msg);
-                this->close();
-            };
-            auto server_event = std::make_shared<Event>(m_listen_fd, server_event_handler);
-            m_event_loop->add_event(server_event);
-            while (!m_stop) {
-                try {
-                    m_event_loop->wait_for_events();
-                } catch (std::runtime_error& e) {
-                    std::cerr << std::format("Failed to waiting for events: {}\n", e.what()) << std::endl;
-                }
-            }
-        });
+            m_reactor_listen_fds.push_back(listen_fd);
+        }
+        for (std::size_t i = 0; i < m_reactors.size(); ++i) {
+            int listen_fd = i == 0 ? m_listen_fd : m_reactor_listen_fds[i - 1];
+            m_reactor_threads.emplace_back([this, i, listen_fd]() { run_event_loop(m_reactors[i], listen_fd); });
+        }
+    } else if (m_event_loop) {
+        m_accept_thread = std::thread([this]() { run_event_loop(m_event_loop, m_listen_fd); });
     } else {
         m_accept_thread = std::thread([this]() {
             while (!m_stop) {
@@ -364,7 +475,7 @@ std::optional<NetError> TcpServer::start() {
                 }
                 m_remotes.add_remote(create_remote(client_fd));
                 if (m_thread_pool) {
-                    m_thread_pool->submit([this, client_fd]() { handle_connection(m_remotes.get_remote(client_fd)); });
+                    m_thread_pool->post([this, client_fd]() { handle_connection(m_remotes.get_remote(client_fd)); });
                 } else {
                     auto unused = std::async(std::launch::async, [this, client_fd]() {
                         handle_connection(m_remotes.get_remote(client_fd));
@@ -376,24 +487,104 @@ std::optional<NetError> TcpServer::start() {
     return std::nullopt;
 }
 
+void TcpServer::run_event_loop(EventLoop::SharedPtr event_loop, int listen_fd) {
+    auto err = set_non_blocking_socket(listen_fd);
+    if (err.has_value()) {
+        if (m_logger_set) {
+            NET_LOG_ERROR(
+                m_logger,
+                "Failed to set non-blocking socket to listen fd, server will not start: {}",
+                err.value().msg
+            );
+        }
+        std::cerr << std::format(
+            "Failed to set non-blocking socket to listen fd, server will not start: {}\n",
+            err.value().msg
+        );
+        return;
+    }
+    EventHandler::SharedPtr server_event_handler = std::make_shared<EventHandler>();
+    server_event_handler->m_on_read = [this, event_loop = event_loop.get()](int server_fd) {
+        while (true) {
+            addressResolver::address client_addr;
+            int client_fd = ::accept(server_fd, &client_addr.m_addr, &client_addr.m_addr_len);
+            if (client_fd == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break;
+                }
+                auto error = GET_ERROR_MSG();
+                if (m_logger_set) {
+                    NET_LOG_ERROR(m_logger, "Failed to accept RemoteTarget: {}", error.msg);
+                }
+                std::cerr << std::format("Failed to accept RemoteTarget: {}\n", error.msg);
+                continue;
+            }
+            auto err = set_non_blocking_socket(client_fd);
+            if (err.has_value()) {
+                if (m_logger_set) {
+                    NET_LOG_ERROR(m_logger, "Failed to set non-blocking socket: {}", err.value().msg);
+                }
+                std::cerr << std::format("Failed to set non-blocking socket: {}\n", err.value().msg);
+                return;
+            }
+            add_remote_event(client_fd, event_loop);
+        }
+    };
+    // completion based loops accept on their own, the fd comes non-blocking already
+    server_event_handler->m_on_accept = [this, event_loop = event_loop.get()](int, int client_fd) {
+        add_remote_event(client_fd, event_loop);
+    };
+    server_event_handler->m_on_error = [this](int server_fd) {
+        auto error = GET_ERROR_MSG();
+        if (m_logger_set) {
+            NET_LOG_ERROR(m_logger, "Error on server socket: {}", error.msg);
+        }
+        std::cerr << std::format("Error on server socket: {}\n", error.msg);
+        // runs on a loop thread, which close() would join, the owner's close() does the joining
+        stop_event_loops();
+    };
+    auto server_event = std::make_shared<Event>(listen_fd, server_event_handler);
+    event_loop->add_event(server_event);
+    while (!m_stop) {
+        try {
+            event_loop->wait_for_events();
+        } catch (std::runtime_error& e) {
+            std::cerr << std::format("Failed to waiting for events: {}\n", e.what()) << std::endl;
+        }
+    }
+}
+
 std::optional<NetError> TcpServer::read(std::vector<uint8_t>& data, RemoteTarget::SharedPtr remote) {
+    PooledBuffer buffer;
+    auto err = read(buffer, remote);
+    data.assign(buffer.data(), buffer.data() + buffer.size());
+    return err;
+}
+
+std::optional<NetError>
+TcpServer::read(PooledBuffer& buffer, RemoteTarget::SharedPtr remote, std::size_t max_size) {
+    if (loop_io(remote->fd())) {
+        return read_received(buffer, remote, max_size);
+    }
     ssize_t num_bytes;
-    data.clear();
+    buffer.clear();
+    if (max_size != 0 && buffer.capacity() < max_size) {
+        buffer.reserve(max_size);
+    }
     do {
-        std::vector<uint8_t> read_buffer(1024);
-        num_bytes = ::recv(remote->fd(), read_buffer.data(), read_buffer.size(), MSG_NOSIGNAL);
+        if (buffer.writable() == 0) {
+            buffer.reserve(buffer.capacity() + BufferPool::SIZE_CLASSES.front());
+        }
+        auto size = max_size == 0 ? buffer.writable() : std::min(buffer.writable(), max_size - buffer.size());
+        num_bytes = ::recv(remote->fd(), buffer.tail(), size, MSG_NOSIGNAL);
         if (num_bytes == -1) {
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                if (data.size() <= 0) {
+                if (buffer.empty() && max_size == 0) {
                     auto error = GET_ERROR_MSG();
                     if (m_logger_set) {
                         NET_LOG_ERROR(m_logger, "Failed to read from socket {} (Epoll) : {}", remote->fd(), error.msg);
                     }
-                    if (m_event_loop) {
-                        m_event_loop->remove_event(remote->fd());
-                    } else {
-                        m_remotes.remove_remote(remote->fd());
-                    }
+                    remove_remote(remote);
                     return error;
                 }
                 break;
@@ -402,11 +593,7 @@ std::optional<NetError> TcpServer::read(std::vector<uint8_t>& data, RemoteTarget
                 if (m_logger_set) {
                     NET_LOG_ERROR(m_logger, "Failed to read from socket {} : {}", remote->fd(), error.msg);
                 }
-                if (m_event_loop) {
-                    m_event_loop->remove_event(remote->fd());
-                } else {
-                    m_remotes.remove_remote(remote->fd());
-                }
+                remove_remote(remote);
                 return error;
             }
         }
@@ -414,56 +601,286 @@ std::optional<NetError> TcpServer::read(std::vector<uint8_t>& data, RemoteTarget
             if (m_logger_set) {
                 NET_LOG_WARN(m_logger, "Connection reset by peer while reading");
             }
-            if (m_event_loop) {
-                m_event_loop->remove_event(remote->fd());
-            } else {
-                m_remotes.remove_remote(remote->fd());
-            }
+            remove_remote(remote);
             return NetError { NET_CONNECTION_RESET_CODE, "Connection reset by peer while reading" };
         }
         if (num_bytes > 0) {
-            read_buffer.resize(num_bytes);
-            std::copy(read_buffer.begin(), read_buffer.end(), std::back_inserter(data));
+            buffer.commit(static_cast<std::size_t>(num_bytes));
         }
-    } while (num_bytes > 0 && m_event_loop);
+    } while (num_bytes > 0 && event_loop_enabled() && (max_size == 0 || buffer.size() < max_size));
     return std::nullopt;
 }
 
+std::optional<NetError>
+TcpServer::read_received(PooledBuffer& buffer, RemoteTarget::SharedPtr remote, std::size_t max_size) {
+    auto& input = remote->input_buffer();
+    std::unique_lock<std::mutex> lock(input.mutex());
+    input.take(buffer, max_size);
+    // bytes received before the connection ended are handed out first
+    if (!buffer.empty() || !input.m_closed) {
+        return std::nullopt;
+    }
+    auto error = input.m_error;
+    lock.unlock();
+    remove_remote(remote);
+    if (error != 0) {
+        auto msg = std::system_category().message(error);
+        if (m_logger_set) {
+            NET_LOG_ERROR(m_logger, "Failed to read from socket {} : {}", remote->fd(), msg);
+        }
+        return NetError { error, msg };
+    }
+    if (m_logger_set) {
+        NET_LOG_WARN(m_logger, "Connection reset by peer while reading");
+    }
+    return NetError { NET_CONNECTION_RESET_CODE, "Connection reset by peer while reading" };
+}
+
 std::optional<NetError> TcpServer::write(const std::vector<uint8_t>& data, RemoteTarget::SharedPtr remote) {
     assert(m_status == SocketStatus::LISTENING && "Server is not listening");
     assert(data.size() > 0 && "Data buffer is empty");
-    ssize_t num_bytes;
-    std::size_t bytes_has_send = 0;
-    do {
-        num_bytes = ::send(remote->fd(), data.data() + bytes_has_send, data.size() - bytes_has_send, MSG_NOSIGNAL);
+    bool queue = loop_io(remote->fd());
+    auto& output = remote->output_buffer();
+    std::unique_lock<std::mutex> lock(output.mutex());
+    bool high_watermark = false;
+    if (event_loop_enabled() && (!output.empty() || queue)) {
+        // keep the byte order, queued output goes first once the socket is writable. A loop doing the I/O sends
+        // everything from the queue.
+        high_watermark = buffer_output(remote, data.data(), data.size());
+    } else {
+        ssize_t num_bytes;
+        std::size_t bytes_has_send = 0;
+        do {
+            num_bytes =
+                ::send(remote->fd(), data.data() + bytes_has_send, data.size() - bytes_has_send, MSG_NOSIGNAL);
+            if (num_bytes == -1) {
+                if (event_loop_enabled() && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    high_watermark =
+                        buffer_output(remote, data.data() + bytes_has_send, data.size() - bytes_has_send);
+                    break;
+                }
+                auto error = GET_ERROR_MSG();
+                if (m_logger_set) {
+                    NET_LOG_ERROR(m_logger, "Failed to write to socket {} : {}", remote->fd(), error.msg);
+                }
+                lock.unlock();
+                remove_remote(remote);
+                return error;
+            }
+            if (num_bytes == 0) {
+                if (m_logger_set) {
+                    NET_LOG_WARN(m_logger, "Connection reset by peer while writting");
+                }
+                lock.unlock();
+                remove_remote(remote);
+                return NetError { NET_CONNECTION_RESET_CODE, "Connection reset by peer while writting" };
+            }
+            bytes_has_send += num_bytes;
+        } while (num_bytes > 0 && event_loop_enabled() && bytes_has_send < data.size());
+    }
+    lock.unlock();
+    if (high_watermark && m_on_high_watermark) {
+        m_on_high_watermark(remote);
+    }
+    return std::nullopt;
+}
+
+std::optional<NetError>
+TcpServer::writev(const struct iovec* iov, std::size_t iov_count, RemoteTarget::SharedPtr remote) {
+    assert(m_status == SocketStatus::LISTENING && "Server is not listening");
+    bool queue = loop_io(remote->fd());
+    auto& output = remote->output_buffer();
+    std::unique_lock<std::mutex> lock(output.mutex());
+    bool high_watermark = false;
+    // position of the first byte not sent yet
+    std::size_t index = 0;
+    std::size_t offset = 0;
+    auto skip_empty = [&]() {
+        while (index < iov_count && iov[index].iov_len == offset) {
+            ++index;
+            offset = 0;
+        }
+    };
+    auto buffer_rest = [&]() {
+        for (; index < iov_count; ++index, offset = 0) {
+            if (iov[index].iov_len > offset) {
+                high_watermark |= buffer_output(
+                    remote,
+                    static_cast<const uint8_t*>(iov[index].iov_base) + offset,
+                    iov[index].iov_len - offset
+                );
+            }
+        }
+    };
+    skip_empty();
+    if (event_loop_enabled() && (!output.empty() || queue)) {
+        // keep the byte order, queued output goes first once the socket is writable. A loop doing the I/O sends
+        // everything from the queue.
+        buffer_rest();
+    }
+    while (index < iov_count) {
+        // the first piece may be sent partly already, so the pieces are sent from a copy
+        std::array<struct iovec, 64> batch;
+        std::size_t count = 0;
+        for (auto i = index; i < iov_count && count < batch.size(); ++i) {
+            if (iov[i].iov_len == 0) {
+                continue;
+            }
+            batch[count] = iov[i];
+            if (i == index) {
+                batch[count].iov_base = static_cast<uint8_t*>(iov[i].iov_base) + offset;
+                batch[count].iov_len -= offset;
+            }
+            ++count;
+        }
+        struct msghdr msg {};
+        msg.msg_iov = batch.data();
+        msg.msg_iovlen = count;
+        ssize_t num_bytes = ::sendmsg(remote->fd(), &msg, MSG_NOSIGNAL);
         if (num_bytes == -1) {
+            if (event_loop_enabled() && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                buffer_rest();
+                break;
+            }
             auto error = GET_ERROR_MSG();
             if (m_logger_set) {
                 NET_LOG_ERROR(m_logger, "Failed to write to socket {} : {}", remote->fd(), error.msg);
             }
-            if (m_event_loop) {
-                m_event_loop->remove_event(remote->fd());
-            } else {
-                m_remotes.remove_remote(remote->fd());
-            }
+            lock.unlock();
+            remove_remote(remote);
             return error;
         }
         if (num_bytes == 0) {
             if (m_logger_set) {
                 NET_LOG_WARN(m_logger, "Connection reset by peer while writting");
             }
-            if (m_event_loop) {
-                m_event_loop->remove_event(remote->fd());
-            } else {
-                m_remotes.remove_remote(remote->fd());
-            }
+            lock.unlock();
+            remove_remote(remote);
             return NetError { NET_CONNECTION_RESET_CODE, "Connection reset by peer while writting" };
         }
-        bytes_has_send += num_bytes;
-    } while (num_bytes > 0 && m_event_loop && bytes_has_send < data.size());
+        auto sent = static_cast<std::size_t>(num_bytes);
+        while (sent > 0) {
+            auto left = iov[index].iov_len - offset;
+            if (sent < left) {
+                offset += sent;
+                break;
+            }
+            sent -= left;
+            ++index;
+            offset = 0;
+            skip_empty();
+        }
+    }
+    lock.unlock();
+    if (high_watermark && m_on_high_watermark) {
+        m_on_high_watermark(remote);
+    }
     return std::nullopt;
 }
 
+std::optional<NetError>
+TcpServer::send_file(int file_fd, off_t& offset, std::size_t count, RemoteTarget::SharedPtr remote) {
+    assert(m_status == SocketStatus::LISTENING && "Server is not listening");
+    auto& output = remote->output_buffer();
+    std::unique_lock<std::mutex> lock(output.mutex());
+    auto wait_writable = [&]() {
+        // flush_output reports the drain through on_low_watermark, even with nothing queued
+        output.m_above_high_watermark = true;
+        if (output.empty()) {
+            if (auto event_loop = get_event_loop(remote->fd())) {
+                try {
+                    event_loop->watch_writable(remote->fd(), true);
+                } catch (const std::runtime_error& e) {
+                    std::cerr << std::format("Failed to watch socket {} for writing: {}\n", remote->fd(), e.what());
+                }
+            }
+        }
+    };
+    if (event_loop_enabled() && !output.empty()) {
+        // keep the byte order, queued output goes first
+        wait_writable();
+        return std::nullopt;
+    }
+    while (count > 0) {
+        auto num_bytes = ::sendfile(remote->fd(), file_fd, &offset, count);
+        if (num_bytes == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (event_loop_enabled() && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                wait_writable();
+                break;
+            }
+            auto error = GET_ERROR_MSG();
+            if (m_logger_set) {
+                NET_LOG_ERROR(m_logger, "Failed to send file to socket {} : {}", remote->fd(), error.msg);
+            }
+            lock.unlock();
+            remove_remote(remote);
+            return error;
+        }
+        if (num_bytes == 0) {
+            return NetError { NET_FILE_TRUNCATED_CODE, "File ended before the requested range" };
+        }
+        count -= static_cast<std::size_t>(num_bytes);
+    }
+    return std::nullopt;
+}
+
+bool TcpServer::flush_output(RemoteTarget::SharedPtr remote, EventLoop* event_loop) {
+    auto& output = remote->output_buffer();
+    std::unique_lock<std::mutex> lock(output.mutex());
+    while (!output.empty()) {
+        ssize_t num_bytes = ::send(remote->fd(), output.data(), output.size(), MSG_NOSIGNAL);
+        if (num_bytes == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            auto error = GET_ERROR_MSG();
+            if (m_logger_set) {
+                NET_LOG_ERROR(m_logger, "Failed to flush output of socket {} : {}", remote->fd(), error.msg);
+            }
+            lock.unlock();
+            remove_remote(remote);
+            return false;
+        }
+        output.consume(static_cast<std::size_t>(num_bytes));
+    }
+    return finish_flush(remote, event_loop, lock);
+}
+
+bool TcpServer::finish_flush(RemoteTarget::SharedPtr remote, EventLoop* event_loop, std::unique_lock<std::mutex>& lock) {
+    auto& output = remote->output_buffer();
+    bool drained = output.empty();
+    if (drained) {
+        try {
+            event_loop->watch_writable(remote->fd(), false);
+        } catch (const std::runtime_error& e) {
+            std::cerr << std::format("Failed to stop watching socket {} for writing: {}\n", remote->fd(), e.what());
+        }
+    }
+    bool low_watermark = false;
+    if (output.m_above_high_watermark && output.size() <= m_low_watermark) {
+        output.m_above_high_watermark = false;
+        low_watermark = true;
+    }
+    bool close_remote = drained && output.m_close_when_drained;
+    lock.unlock();
+    if (low_watermark && m_on_low_watermark) {
+        dispatch([this, remote]() { this->m_on_low_watermark(remote); });
+    }
+    if (close_remote) {
+        remove_remote(remote);
+        return false;
+    }
+    return drained;
+}
+
+bool TcpServer::loop_io(int fd) {
+    auto event_loop = get_event_loop(fd);
+    return event_loop != nullptr && event_loop->completion_based();
+}
+
 void TcpServer::handle_connection(RemoteTarget::SharedPtr remote) {
     while (m_status == SocketStatus::LISTENING && remote->is_active()) {
         m_accept_handler(remote);
@@ -474,61 +891,60 @@ RemoteTarget::SharedPtr TcpServer::create_remote(int remote_fd) {
     return std::make_shared<RemoteTarget>(remote_fd);
 }
 
-void TcpServer::add_remote_event(int client_fd) {
+void TcpServer::add_remote_event(int client_fd, EventLoop* event_loop) {
+    // the handler is owned by the event which is owned by the loop, so the raw loop pointer never dangles here
     auto client_event_handler = std::make_shared<EventHandler>();
-    client_event_handler->m_on_read = [this](int client_fd) {
+    client_event_handler->m_loop_io = event_loop->completion_based();
+    client_event_handler->m_on_read = [this, event_loop](int client_fd) {
+        if (m_idle_timeout.count() > 0) {
+            if (auto event = event_loop->get_event(client_fd)) {
+                refresh_idle_timer(event, event_loop);
+            }
+        }
         if (!this->m_on_read) {
             return;
         }
-        {
-            auto event = m_event_loop->get_event(client_fd);
-            if (event == nullptr) {
-                return;
-            }
-            if (this->m_thread_pool) {
-                this->m_thread_pool->submit([this, event]() { this->m_on_read(std::move(event)); });
-            } else {
-                auto unused = std::async(std::launch::async, [this, event]() { this->m_on_read(std::move(event)); });
-            }
+        auto event = event_loop->get_event(client_fd);
+        if (event == nullptr) {
+            return;
         }
+        dispatch([this, event]() { this->m_on_read(event); });
     };
-    client_event_handler->m_on_write = [this](int client_fd) {
-        if (!this->m_on_write) {
+    client_event_handler->m_on_write = [this, event_loop](int client_fd) {
+        auto event = event_loop->get_event(client_fd);
+        if (event == nullptr) {
             return;
         }
-        {
-            auto event = m_event_loop->get_event(client_fd);
-            if (event == nullptr) {
-                return;
-            }
-            if (this->m_thread_pool) {
-                this->m_thread_pool->submit([this, event]() { this->m_on_write(std::move(event)); });
-            } else {
-                auto unused = std::async(std::launch::async, [this, event]() { this->m_on_write(std::move(event)); });
-            }
+        // write interest is only armed while output is pending, m_on_write reports that it has drained
+        bool drained;
+        if (event_loop->completion_based()) {
+            // a send of the loop completed, only what follows a flush is left
+            std::unique_lock<std::mutex> lock(event->output_buffer().mutex());
+            drained = finish_flush(event, event_loop, lock);
+        } else {
+            drained = flush_output(event, event_loop);
+        }
+        if (!drained || !this->m_on_write) {
+            return;
         }
+        dispatch([this, event]() { this->m_on_write(event); });
     };
-    client_event_handler->m_on_error = [this](int client_fd) {
+    client_event_handler->m_on_error = [this, event_loop](int client_fd) {
         if (!this->m_on_error) {
             return;
         };
-        {
-            auto event = m_event_loop->get_event(client_fd);
-            if (event == nullptr) {
-                return;
-            }
-            if (this->m_thread_pool) {
-                this->m_thread_pool->submit([this, event]() { this->m_on_error(std::move(event)); });
-            } else {
-                auto unused = std::async(std::launch::async, [this, event]() { this->m_on_error(std::move(event)); });
-            }
+        auto event = event_loop->get_event(client_fd);
+        if (event == nullptr) {
+            return;
         }
+        dispatch([this, event]() { this->m_on_error(event); });
     };
     auto client_event = std::make_shared<Event>(client_fd, client_event_handler);
-    m_event_loop->add_event(client_event);
+    event_loop->add_event(client_event);
+    refresh_idle_timer(client_event, event_loop);
     if (m_on_accept) {
         try {
-            m_on_accept(m_event_loop->get_event(client_fd));
+            m_on_accept(event_loop->get_event(client_fd));
         } catch (const std::exception& e) {
             if (m_logger_set) {
                 NET_LOG_ERROR(m_logger, "Failed to execute on accept: {}", e.what());
@@ -3,6 +3,7 @@
 #include "websocket_utils.hpp"
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
 #include <gtest/gtest.h>
 #include <ios>
 #include <optional>
@@ -15,6 +16,19 @@ protected:
 
     void TearDown() override {}
 
+    /**
+     * @brief response as written, with the Date header the writer adds taken out
+     */
+    static std::string without_date(const std::vector<uint8_t>& buffer) {
+        std::string response(buffer.begin(), buffer.end());
+        auto date = response.find("\r\nDate: ");
+        EXPECT_NE(date, std::string::npos);
+        if (date != std::string::npos) {
+            response.erase(date + 2, response.find("\r\n", date + 2) - date);
+        }
+        return response;
+    }
+
 public:
     net::HttpParser http_parser;
     net::WebSocketParser websocket_parser;
@@ -49,7 +63,7 @@ TEST_F(ParserTest, HttpResponseWriteTest) {
 
     std::string wanted_buffer = "HTTP/1.1 200 OK\r\nContent-Length: 19\r\n\r\nthis is a post test";
 
-    ASSERT_EQ(std::string(res_buffer.begin(), res_buffer.end()), wanted_buffer);
+    ASSERT_EQ(without_date(res_buffer), wanted_buffer);
 }
 
 TEST_F(ParserTest, HttpRequestReadTest) {
@@ -138,6 +152,230 @@ TEST_F(ParserTest, HttpResponseLongReadTest) {
     ASSERT_EQ(res.body(), body);
 }
 
+TEST_F(ParserTest, HttpRequestViewReadTest) {
+    std::string buffer = "POST /test HTTP/1.1\r\nContent-Length: 19\r\nX-Trace:  abc \r\n\r\nthis is a post test"
+                         "GET /next HTTP/1.1\r\nHost: local";
+    net::PooledBuffer data(buffer.size());
+    std::memcpy(data.tail(), buffer.data(), buffer.size());
+    data.commit(buffer.size());
+    http_parser.add_req_view_buffer(std::move(data));
+
+    auto req = http_parser.read_req_view();
+    ASSERT_TRUE(req.has_value());
+    ASSERT_EQ(req->method(), net::HttpMethod::POST);
+    ASSERT_EQ(req->url(), "/test");
+    ASSERT_EQ(req->version(), HTTP_VERSION_1_1);
+    ASSERT_EQ(req->header("content-length"), "19");
+    ASSERT_EQ(req->header("X-TRACE"), "abc");
+    ASSERT_FALSE(req->has_header("Host"));
+    ASSERT_EQ(req->body(), "this is a post test");
+    ASSERT_FALSE(http_parser.read_req_view().has_value());
+    ASSERT_EQ(http_parser.req_phase(), net::HttpReadPhase::HEADER);
+
+    // the rest of the second request arrives after the first one was handed out, its views must stay put
+    std::string rest = "\r\n\r\n";
+    net::PooledBuffer more(rest.size());
+    std::memcpy(more.tail(), rest.data(), rest.size());
+    more.commit(rest.size());
+    http_parser.add_req_view_buffer(std::move(more));
+    auto next = http_parser.read_req_view();
+    ASSERT_TRUE(next.has_value());
+    ASSERT_EQ(next->method(), net::HttpMethod::GET);
+    ASSERT_EQ(next->url(), "/next");
+    ASSERT_EQ(next->header("host"), "local");
+    ASSERT_EQ(req->body(), "this is a post test");
+    ASSERT_EQ(next->to_request().header("host"), "local");
+    ASSERT_EQ(http_parser.req_phase(), net::HttpReadPhase::IDLE);
+}
+
+TEST_F(ParserTest, HttpRequestPooledReadTest) {
+    // the header and the body are split across reads, a pipelined request follows in the same read
+    std::vector<std::string> reads = { "POST /a HTTP/1.1\r\nContent-Le",
+                                       "ngth: 5\r\n\r\nhel",
+                                       "loGET /b HTTP/1.1\r\nHost: x\r\n\r\n" };
+    std::vector<net::HttpRequest> requests;
+    for (auto& read: reads) {
+        net::PooledBuffer data(read.size());
+        std::memcpy(data.tail(), read.data(), read.size());
+        data.commit(read.size());
+        http_parser.add_req_read_buffer(data);
+        while (auto req = http_parser.read_req()) {
+            requests.push_back(std::move(req.value()));
+        }
+    }
+    ASSERT_EQ(requests.size(), 2);
+    ASSERT_EQ(requests[0].url(), "/a");
+    ASSERT_EQ(requests[0].body(), "hello");
+    ASSERT_EQ(requests[1].url(), "/b");
+    ASSERT_EQ(requests[1].header("host"), "x");
+    ASSERT_EQ(http_parser.req_phase(), net::HttpReadPhase::IDLE);
+}
+
+TEST_F(ParserTest, PooledBufferCopyTest) {
+    net::PooledBuffer buffer(16);
+    std::memcpy(buffer.tail(), "abc", 3);
+    buffer.commit(3);
+    auto copy = buffer;
+    std::memcpy(buffer.tail(), "def", 3);
+    buffer.commit(3);
+    ASSERT_EQ(copy.view(), "abc");
+    ASSERT_EQ(buffer.view(), "abcdef");
+    // a shared block is left to the copy
+    buffer.clear();
+    ASSERT_EQ(copy.view(), "abc");
+    ASSERT_TRUE(buffer.empty());
+}
+
+TEST_F(ParserTest, HttpRequestViewMalformedTest) {
+    std::string buffer = "GET / HTTP/1.1\r\nContent-Length: abc\r\n\r\n";
+    net::PooledBuffer data(buffer.size());
+    std::memcpy(data.tail(), buffer.data(), buffer.size());
+    data.commit(buffer.size());
+    http_parser.add_req_view_buffer(std::move(data));
+    ASSERT_FALSE(http_parser.read_req_view().has_value());
+    ASSERT_TRUE(http_parser.req_view_failed());
+}
+
+TEST_F(ParserTest, HttpResponseChunkedReadTest) {
+    std::string buffer = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+                         "5;ext=1\r\nthis \r\n13\r\nis a chunked body\r\n\r\n0\r\nX-Checksum: 42\r\n\r\n"
+                         "HTTP/1.1 204 No Content\r\n\r\n";
+    // fed byte by byte, every split point of the framing has to be handled
+    std::optional<net::HttpResponse> res_opt;
+    for (char c: buffer) {
+        http_parser.add_res_read_buffer(std::vector<uint8_t> { static_cast<uint8_t>(c) });
+        if (!res_opt.has_value()) {
+            res_opt = http_parser.read_res();
+        }
+    }
+    ASSERT_TRUE(res_opt.has_value());
+    ASSERT_FALSE(http_parser.res_failed());
+    ASSERT_EQ(res_opt->body(), "this is a chunked body\r\n");
+    ASSERT_EQ(res_opt->header("content-length"), "24");
+    ASSERT_EQ(res_opt->header("x-checksum"), "42");
+    ASSERT_FALSE(res_opt->headers().contains("transfer-encoding"));
+
+    auto next = http_parser.read_res();
+    ASSERT_TRUE(next.has_value());
+    ASSERT_EQ(next->status_code(), net::HttpResponseCode::NO_CONTENT);
+
+    http_parser.add_res_read_buffer(std::vector<uint8_t> {});
+    std::string malformed = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n";
+    http_parser.add_res_read_buffer(std::vector<uint8_t>(malformed.begin(), malformed.end()));
+    ASSERT_FALSE(http_parser.read_res().has_value());
+    ASSERT_TRUE(http_parser.res_failed());
+}
+
+TEST_F(ParserTest, HttpChunkedWriteTest) {
+    std::size_t produced = 0;
+    net::HttpResponse res;
+    res.set_status_code(net::HttpResponseCode::OK).set_body_producer([&produced](std::string& chunk) {
+        chunk = "part";
+        return ++produced < 2;
+    });
+    auto head = http_parser.write_res(res);
+    ASSERT_EQ(without_date(head), "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n");
+
+    std::string body;
+    std::string chunk;
+    bool more = true;
+    while (more) {
+        chunk.clear();
+        more = res.body_producer()(chunk);
+        auto data = http_parser.write_res_chunk(chunk);
+        body.append(data.begin(), data.end());
+    }
+    auto last = http_parser.write_res_last_chunk({ { "X-Parts", "2" } });
+    body.append(last.begin(), last.end());
+    ASSERT_EQ(body, "4\r\npart\r\n4\r\npart\r\n0\r\nX-Parts: 2\r\n\r\n");
+}
+
+TEST_F(ParserTest, HttpResponseSerializeTest) {
+    ASSERT_EQ(net::status_line(net::HttpResponseCode::NOT_FOUND), "HTTP/1.1 404 Not Found\r\n");
+    ASSERT_EQ(net::reason_phrase(net::HttpResponseCode::OK), "OK");
+    ASSERT_TRUE(net::status_line(static_cast<net::HttpResponseCode>(299)).empty());
+    auto date = net::date_header();
+    ASSERT_TRUE(date.starts_with("Date: ") && date.ends_with(" GMT\r\n"));
+    ASSERT_EQ(date.size(), 37);
+
+    net::HttpResponse res;
+    std::string body = "not here";
+    res.set_status_code(net::HttpResponseCode::NOT_FOUND)
+        .set_reason(std::string(utils::dump_enum(net::HttpResponseCode::NOT_FOUND)))
+        .set_header("Date", "Sun, 06 Nov 1994 08:49:37 GMT")
+        .set_body(body);
+    net::HttpResponseSerializer serializer;
+    struct iovec iov[net::HttpResponseSerializer::MAX_IOV];
+    ASSERT_EQ(serializer.serialize(res, iov), 3);
+    ASSERT_EQ(iov[0].iov_base, net::status_line(net::HttpResponseCode::NOT_FOUND).data());
+    ASSERT_EQ(
+        std::string(static_cast<char*>(iov[1].iov_base), iov[1].iov_len),
+        "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\nContent-Length: 8\r\n\r\n"
+    );
+    // the body is referred to, not copied
+    ASSERT_EQ(iov[2].iov_base, res.body().data());
+
+    res.set_reason("Gone Fishing");
+    ASSERT_EQ(serializer.serialize(res, iov), 2);
+    ASSERT_TRUE(std::string_view(static_cast<char*>(iov[0].iov_base), iov[0].iov_len)
+                    .starts_with("HTTP/1.1 404 Gone Fishing\r\nDate: "));
+}
+
+TEST_F(ParserTest, HttpRequestViewChunkedTest) {
+    std::string buffer = "POST /upload HTTP/1.1\r\nTransfer-Encoding: gzip, chunked\r\n\r\n"
+                         "3\r\nabc\r\n";
+    net::PooledBuffer data(buffer.size());
+    std::memcpy(data.tail(), buffer.data(), buffer.size());
+    data.commit(buffer.size());
+    http_parser.add_req_view_buffer(std::move(data));
+    ASSERT_FALSE(http_parser.read_req_view().has_value());
+    ASSERT_EQ(http_parser.req_phase(), net::HttpReadPhase::BODY);
+
+    std::string rest = "A\r\ndefghijklm\r\n0\r\nX-Ignored: 1\r\n\r\nGET / HTTP/1.1\r\n\r\n";
+    net::PooledBuffer more(rest.size());
+    std::memcpy(more.tail(), rest.data(), rest.size());
+    more.commit(rest.size());
+    http_parser.add_req_view_buffer(std::move(more));
+    auto req = http_parser.read_req_view();
+    ASSERT_TRUE(req.has_value());
+    ASSERT_EQ(req->url(), "/upload");
+    ASSERT_EQ(req->body(), "abcdefghijklm");
+    auto next = http_parser.read_req_view();
+    ASSERT_TRUE(next.has_value());
+    ASSERT_EQ(next->url(), "/");
+    ASSERT_EQ(req->body(), "abcdefghijklm");
+}
+
+TEST_F(ParserTest, HttpRequestViewStreamBodyTest) {
+    std::string buffer = "POST /upload HTTP/1.1\r\nContent-Length: 10\r\n\r\nabcd";
+    net::PooledBuffer data(buffer.size());
+    std::memcpy(data.tail(), buffer.data(), buffer.size());
+    data.commit(buffer.size());
+    http_parser.add_req_view_buffer(std::move(data));
+    auto head = http_parser.read_req_view_head();
+    ASSERT_TRUE(head.has_value());
+    ASSERT_EQ(head->url(), "/upload");
+    ASSERT_TRUE(head->body().empty());
+    ASSERT_FALSE(http_parser.read_req_view_head().has_value());
+    http_parser.stream_req_view_body();
+
+    std::string body;
+    auto on_data = [&body](std::string_view piece) { body.append(piece); };
+    ASSERT_FALSE(http_parser.read_req_view_body(on_data));
+    ASSERT_EQ(body, "abcd");
+
+    std::string rest = "efghijGET / HTTP/1.1\r\n\r\n";
+    net::PooledBuffer more(rest.size());
+    std::memcpy(more.tail(), rest.data(), rest.size());
+    more.commit(rest.size());
+    http_parser.add_req_view_buffer(std::move(more));
+    ASSERT_TRUE(http_parser.read_req_view_body(on_data));
+    ASSERT_EQ(body, "abcdefghij");
+    auto next = http_parser.read_req_view();
+    ASSERT_TRUE(next.has_value());
+    ASSERT_EQ(next->url(), "/");
+}
+
 TEST_F(ParserTest, WebSocketFrameWriteTest) {
     net::WebSocketFrame frame;
     frame.set_fin(1)
@@ -252,6 +490,28 @@ TEST_F(ParserTest, WebSocketFrameLongReadTest) {
     ASSERT_EQ(res_frame.mask(), 1);
 }
 
+TEST_F(ParserTest, WebSocketFrameSplitReadTest) {
+    net::WebSocketFrame first;
+    first.set_fin(1).set_opcode(net::WebSocketOpcode::TEXT).set_mask(0x12345678).set_payload("first");
+    net::WebSocketFrame second;
+    second.set_fin(1).set_opcode(net::WebSocketOpcode::BINARY).set_payload(std::string(300, 'x'));
+    auto bytes = websocket_parser.write_frame(first);
+    auto second_bytes = websocket_parser.write_frame(second);
+    bytes.insert(bytes.end(), second_bytes.begin(), second_bytes.end());
+
+    // a frame is handed out only once all of its payload arrived
+    std::vector<uint8_t> head(bytes.begin(), bytes.begin() + 4);
+    ASSERT_FALSE(websocket_parser.read_frame(head).has_value());
+    std::vector<uint8_t> rest(bytes.begin() + 4, bytes.end());
+    auto frame = websocket_parser.read_frame(rest);
+    ASSERT_TRUE(frame.has_value());
+    ASSERT_EQ(frame->payload(), "first");
+    frame = websocket_parser.read_frame(std::vector<uint8_t> {});
+    ASSERT_TRUE(frame.has_value());
+    ASSERT_EQ(frame->opcode(), net::WebSocketOpcode::BINARY);
+    ASSERT_EQ(frame->payload(), std::string(300, 'x'));
+}
+
 int main() {
     testing::InitGoogleTest();
     return RUN_ALL_TESTS();
@@ -0,0 +1,114 @@
+#include "http_async_client.hpp"
+#include "http_server.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <gtest/gtest.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr const char* IP = "127.0.0.1";
+constexpr const char* PORT = "18331";
+
+class AsyncClientTest: public testing::Test {
+protected:
+    static void SetUpTestSuite() {
+        server = std::make_unique<net::HttpServer>(IP, PORT);
+        server->get("/hello", [](const net::HttpRequest& req) {
+            net::HttpResponse res;
+            res.set_version(HTTP_VERSION_1_1).set_status_code(net::HttpResponseCode::OK).set_body("hello " + req.url());
+            return res;
+        });
+        server->get("/slow", [](const net::HttpRequest&) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(300));
+            net::HttpResponse res;
+            res.set_version(HTTP_VERSION_1_1).set_status_code(net::HttpResponseCode::OK).set_body("late");
+            return res;
+        });
+        ASSERT_FALSE(server->listen().has_value());
+        server->enable_event_loop(net::EventLoopType::EPOLL);
+        ASSERT_FALSE(server->start().has_value());
+    }
+
+    static void TearDownTestSuite() {
+        server->close();
+        server.reset();
+    }
+
+    static net::HttpRequest request(const std::string& path) {
+        net::HttpRequest req;
+        req.set_method(net::HttpMethod::GET).set_url(path).set_version(HTTP_VERSION_1_1).set_header("Host", IP);
+        return req;
+    }
+
+    static std::unique_ptr<net::HttpServer> server;
+};
+
+std::unique_ptr<net::HttpServer> AsyncClientTest::server;
+
+} // namespace
+
+TEST_F(AsyncClientTest, Future) {
+    net::HttpAsyncClient client;
+    auto result = client.request(IP, PORT, request("/hello")).get();
+    ASSERT_FALSE(result.m_error.has_value());
+    EXPECT_EQ(result.m_response.status_code(), net::HttpResponseCode::OK);
+    EXPECT_EQ(result.m_response.body(), "hello /hello");
+    EXPECT_EQ(client.in_flight(), 0);
+}
+
+TEST_F(AsyncClientTest, FanOut) {
+    net::HttpAsyncClientOptions options;
+    options.m_event_loops = 2;
+    options.m_max_connections_per_host = 8;
+    net::HttpAsyncClient client(options);
+    constexpr int COUNT = 1000;
+    std::mutex mutex;
+    std::condition_variable done;
+    int finished = 0;
+    int failed = 0;
+    for (int i = 0; i < COUNT; i++) {
+        auto path = "/hello?" + std::to_string(i);
+        client.request(IP, PORT, request(path), [&, path](std::optional<net::NetError> error, net::HttpResponse res) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (error.has_value() || res.body() != "hello " + path) {
+                failed++;
+            }
+            if (++finished == COUNT) {
+                done.notify_one();
+            }
+        });
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    ASSERT_TRUE(done.wait_for(lock, std::chrono::seconds(30), [&]() { return finished == COUNT; }));
+    EXPECT_EQ(failed, 0);
+}
+
+TEST_F(AsyncClientTest, Timeout) {
+    net::HttpAsyncClient client;
+    auto slow = client.request(IP, PORT, request("/slow"), std::chrono::milliseconds(50));
+    auto result = slow.get();
+    ASSERT_TRUE(result.m_error.has_value());
+    EXPECT_EQ(result.m_error->error_code, NET_TIMEOUT_CODE);
+    // the connection cut off is replaced for the next request
+    result = client.request(IP, PORT, request("/hello")).get();
+    ASSERT_FALSE(result.m_error.has_value());
+    EXPECT_EQ(result.m_response.body(), "hello /hello");
+}
+
+TEST_F(AsyncClientTest, ConnectionRefused) {
+    net::HttpAsyncClient client;
+    auto result = client.request(IP, "1", request("/")).get();
+    ASSERT_TRUE(result.m_error.has_value());
+    EXPECT_EQ(result.m_error->error_code, ECONNREFUSED);
+}
+
+int main() {
+    testing::InitGoogleTest();
+    return RUN_ALL_TESTS();
+}
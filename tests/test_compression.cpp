@@ -0,0 +1,111 @@
+#include "http_compression.hpp"
+#include "http_parser.hpp"
+#include <array>
+#include <gtest/gtest.h>
+#include <string>
+#include <zlib.h>
+
+namespace {
+
+std::string inflate_body(std::string_view data, bool gzip) {
+    z_stream stream {};
+    EXPECT_EQ(inflateInit2(&stream, gzip ? 15 + 16 : 15), Z_OK);
+    std::string out(1 << 20, '\0');
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = static_cast<uInt>(data.size());
+    stream.next_out = reinterpret_cast<Bytef*>(out.data());
+    stream.avail_out = static_cast<uInt>(out.size());
+    inflate(&stream, Z_SYNC_FLUSH);
+    out.resize(out.size() - stream.avail_out);
+    inflateEnd(&stream);
+    return out;
+}
+
+net::HttpResponse text_response(const std::string& body) {
+    net::HttpResponse response;
+    response.set_version(HTTP_VERSION_1_1)
+        .set_status_code(net::HttpResponseCode::OK)
+        .set_header("Content-Type", "text/html; charset=utf-8")
+        .set_header("ETag", "\"v1\"")
+        .set_body(body);
+    return response;
+}
+
+} // namespace
+
+TEST(CompressionTest, Negotiate) {
+    std::array codings { net::ContentCoding::BROTLI, net::ContentCoding::GZIP, net::ContentCoding::DEFLATE };
+    EXPECT_EQ(net::negotiate_coding("gzip, deflate, br", codings), net::ContentCoding::BROTLI);
+    EXPECT_EQ(net::negotiate_coding("gzip;q=1.0, br;q=0.5", codings), net::ContentCoding::GZIP);
+    EXPECT_EQ(net::negotiate_coding("br;q=0, *;q=0.1", codings), net::ContentCoding::GZIP);
+    EXPECT_EQ(net::negotiate_coding("x-gzip", codings), net::ContentCoding::GZIP);
+    EXPECT_EQ(net::negotiate_coding("identity", codings), net::ContentCoding::IDENTITY);
+    EXPECT_EQ(net::negotiate_coding("", codings), net::ContentCoding::IDENTITY);
+    EXPECT_EQ(net::negotiate_coding("gzip;q=2", codings), net::ContentCoding::IDENTITY);
+}
+
+TEST(CompressionTest, CompressAndCache) {
+    net::ResponseCompressor compressor;
+    std::string body;
+    for (int i = 0; i < 200; i++) {
+        body += "<p>line " + std::to_string(i) + "</p>\n";
+    }
+    auto response = text_response(body);
+    compressor.apply("gzip", response);
+    EXPECT_EQ(response.header("Content-Encoding"), "gzip");
+    EXPECT_EQ(response.header("Vary"), "Accept-Encoding");
+    EXPECT_EQ(response.header("ETag"), "\"v1-gzip\"");
+    EXPECT_EQ(response.header("Content-Length"), std::to_string(response.body_view().size()));
+    EXPECT_LT(response.body_view().size(), body.size());
+    EXPECT_EQ(inflate_body(response.body_view(), true), body);
+    EXPECT_EQ(compressor.cached_entries(), 0);
+
+    // seen twice, the second one is compressed into the cache and the third one served from there
+    auto second = text_response(body);
+    compressor.apply("deflate, gzip", second);
+    EXPECT_EQ(compressor.cached_entries(), 1);
+    auto third = text_response(body);
+    compressor.apply("gzip", third);
+    EXPECT_EQ(third.body_view().data(), second.body_view().data());
+    EXPECT_EQ(inflate_body(third.body_view(), true), body);
+
+    auto small = text_response("tiny");
+    compressor.apply("gzip", small);
+    EXPECT_FALSE(small.has_header("Content-Encoding"));
+    auto image = text_response(body);
+    image.set_header("Content-Type", "image/png");
+    compressor.apply("gzip", image);
+    EXPECT_FALSE(image.has_header("Content-Encoding"));
+    EXPECT_FALSE(image.has_header("Vary"));
+}
+
+TEST(CompressionTest, StreamedBody) {
+    net::ResponseCompressor compressor;
+    int pieces = 0;
+    auto response = text_response("");
+    response.set_body_producer([&pieces](std::string& chunk) {
+        chunk = "piece " + std::to_string(pieces) + " ";
+        return ++pieces < 50;
+    });
+    response.set_header("Content-Length", "1000");
+    compressor.apply("deflate", response);
+    EXPECT_EQ(response.header("Content-Encoding"), "deflate");
+    EXPECT_FALSE(response.has_header("Content-Length"));
+    std::string compressed;
+    std::string expected;
+    std::string chunk;
+    bool more = true;
+    for (int i = 0; more; i++) {
+        chunk.clear();
+        more = response.body_producer()(chunk);
+        compressed += chunk;
+        expected += "piece " + std::to_string(i) + " ";
+        // every piece is flushed, what came so far decodes without the rest
+        EXPECT_EQ(inflate_body(compressed, false), expected);
+    }
+}
+
+int main() {
+    testing::InitGoogleTest();
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,187 @@
+#include "http_client.hpp"
+#include "http_server.hpp"
+#include <cerrno>
+#include <chrono>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <thread>
+
+namespace {
+
+constexpr const char* IP = "127.0.0.1";
+constexpr const char* PORT = "18330";
+
+class ConnectionPoolTest: public testing::Test {
+protected:
+    static void SetUpTestSuite() {
+        server = std::make_unique<net::HttpServer>(IP, PORT);
+        server->get("/hello", [](const net::HttpRequest& req) {
+            net::HttpResponse res;
+            res.set_version(HTTP_VERSION_1_1).set_status_code(net::HttpResponseCode::OK).set_body("hello " + req.url());
+            return res;
+        });
+        server->get("/bye", [](const net::HttpRequest&) {
+            net::HttpResponse res;
+            res.set_version(HTTP_VERSION_1_1)
+                .set_status_code(net::HttpResponseCode::OK)
+                .set_header("Connection", "close")
+                .set_body("bye");
+            return res;
+        });
+        server->set_keep_alive_timeout(std::chrono::milliseconds(100));
+        ASSERT_FALSE(server->listen().has_value());
+        server->enable_event_loop(net::EventLoopType::EPOLL);
+        ASSERT_FALSE(server->start().has_value());
+    }
+
+    static void TearDownTestSuite() {
+        server->close();
+        server.reset();
+    }
+
+    static net::HttpRequest request(const std::string& path) {
+        net::HttpRequest req;
+        req.set_method(net::HttpMethod::GET).set_url(path).set_version(HTTP_VERSION_1_1).set_header("Host", IP);
+        return req;
+    }
+
+    static std::unique_ptr<net::HttpServer> server;
+};
+
+std::unique_ptr<net::HttpServer> ConnectionPoolTest::server;
+
+} // namespace
+
+TEST_F(ConnectionPoolTest, Reuse) {
+    net::HttpConnectionPool pool;
+    for (int i = 0; i < 3; i++) {
+        net::HttpResponse res;
+        ASSERT_FALSE(pool.request(res, IP, PORT, request("/hello")).has_value());
+        EXPECT_EQ(res.body(), "hello /hello");
+    }
+    EXPECT_EQ(pool.open_connections(IP, PORT), 1);
+    EXPECT_EQ(pool.idle_connections(IP, PORT), 1);
+
+    // the server asks to close, the connection is not kept
+    net::HttpResponse res;
+    ASSERT_FALSE(pool.request(res, IP, PORT, request("/bye")).has_value());
+    EXPECT_EQ(res.body(), "bye");
+    EXPECT_EQ(pool.open_connections(IP, PORT), 0);
+}
+
+TEST_F(ConnectionPoolTest, LimitPerHost) {
+    net::HttpConnectionPoolOptions options;
+    options.m_max_connections_per_host = 1;
+    options.m_acquire_timeout = std::chrono::milliseconds(50);
+    net::HttpConnectionPool pool(options);
+    net::HttpConnectionPool::Lease first;
+    ASSERT_FALSE(pool.acquire(first, IP, PORT).has_value());
+    EXPECT_FALSE(first.reused());
+    net::HttpConnectionPool::Lease second;
+    auto err = pool.acquire(second, IP, PORT);
+    ASSERT_TRUE(err.has_value());
+    EXPECT_EQ(err.value().error_code, NET_TIMEOUT_CODE);
+
+    std::thread releaser([&first]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        first.release();
+    });
+    EXPECT_FALSE(pool.acquire(second, IP, PORT).has_value());
+    releaser.join();
+    EXPECT_TRUE(second.reused());
+    EXPECT_EQ(pool.open_connections(IP, PORT), 1);
+}
+
+TEST_F(ConnectionPoolTest, ReconnectAfterServerClose) {
+    net::HttpConnectionPool pool;
+    net::HttpResponse res;
+    ASSERT_FALSE(pool.request(res, IP, PORT, request("/hello")).has_value());
+    // outlive the keep-alive timeout of the server
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    ASSERT_FALSE(pool.request(res, IP, PORT, request("/hello?again")).has_value());
+    EXPECT_EQ(res.body(), "hello /hello?again");
+    EXPECT_EQ(pool.open_connections(IP, PORT), 1);
+}
+
+TEST_F(ConnectionPoolTest, IdleEviction) {
+    net::HttpConnectionPoolOptions options;
+    options.m_idle_timeout = std::chrono::milliseconds(20);
+    net::HttpConnectionPool pool(options);
+    net::HttpResponse res;
+    ASSERT_FALSE(pool.request(res, IP, PORT, request("/hello")).has_value());
+    EXPECT_EQ(pool.idle_connections(IP, PORT), 1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(40));
+    pool.evict_idle();
+    EXPECT_EQ(pool.idle_connections(IP, PORT), 0);
+    EXPECT_EQ(pool.open_connections(IP, PORT), 0);
+}
+
+TEST_F(ConnectionPoolTest, ParallelConnect) {
+    net::HttpConnectionPoolOptions options;
+    options.m_parallel_connect = true;
+    options.m_connect_timeout = std::chrono::milliseconds(1000);
+    net::HttpConnectionPool pool(options);
+    net::HttpResponse res;
+    ASSERT_FALSE(pool.request(res, "localhost", PORT, request("/hello")).has_value());
+    EXPECT_EQ(res.body(), "hello /hello");
+    // nothing listens there, every attempt is refused
+    auto err = pool.request(res, "localhost", "1", request("/hello"));
+    ASSERT_TRUE(err.has_value());
+    EXPECT_EQ(err.value().error_code, ECONNREFUSED);
+    EXPECT_EQ(pool.open_connections("localhost", "1"), 0);
+}
+
+TEST_F(ConnectionPoolTest, PortIsExclusiveWithoutReactors) {
+    net::HttpServer other(IP, PORT);
+    auto err = other.listen();
+    ASSERT_TRUE(err.has_value());
+    EXPECT_EQ(err.value().error_code, EADDRINUSE);
+}
+
+TEST(IoUringServerTest, ReceiveAndSendThroughTheRing) {
+    constexpr const char* URING_PORT = "18332";
+    net::HttpServer server(IP, URING_PORT);
+    std::string big(4 << 20, 'x');
+    server.get("/big", [&big](const net::HttpRequest&) {
+        net::HttpResponse res;
+        res.set_version(HTTP_VERSION_1_1).set_status_code(net::HttpResponseCode::OK).set_body(big);
+        return res;
+    });
+    server.post("/echo", [](const net::HttpRequest& req) {
+        net::HttpResponse res;
+        res.set_version(HTTP_VERSION_1_1).set_status_code(net::HttpResponseCode::OK).set_body(std::string(req.body()));
+        return res;
+    });
+    ASSERT_FALSE(server.listen().has_value());
+    // falls back to epoll where the kernel lacks io_uring, the requests work all the same
+    server.enable_event_loop(net::EventLoopType::IO_URING, 2);
+    ASSERT_FALSE(server.start().has_value());
+
+    net::HttpConnectionPool pool;
+    for (int i = 0; i < 3; i++) {
+        net::HttpRequest get;
+        get.set_method(net::HttpMethod::GET).set_url("/big").set_version(HTTP_VERSION_1_1).set_header("Host", IP);
+        net::HttpResponse res;
+        ASSERT_FALSE(pool.request(res, IP, URING_PORT, get).has_value());
+        EXPECT_EQ(res.body().size(), big.size());
+        // more than one provided buffer holds
+        std::string body(100000 + i, 'a' + i);
+        net::HttpRequest req;
+        req.set_method(net::HttpMethod::POST)
+            .set_url("/echo")
+            .set_version(HTTP_VERSION_1_1)
+            .set_header("Host", IP)
+            .set_header("Content-Length", std::to_string(body.size()))
+            .set_body(body);
+        ASSERT_FALSE(pool.request(res, IP, URING_PORT, req).has_value());
+        EXPECT_EQ(res.body(), body);
+    }
+    EXPECT_EQ(pool.open_connections(IP, URING_PORT), 1);
+    server.close();
+}
+
+int main() {
+    testing::InitGoogleTest();
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,316 @@
+#include "address_resolver.hpp"
+#include "dns_resolver.hpp"
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <future>
+#include <gtest/gtest.h>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+constexpr const char* NAMESERVER = "127.0.0.1:18353";
+constexpr uint16_t NAMESERVER_PORT = 18353;
+
+/**
+ * @brief answers A queries for a few names, AAAA queries with no record and everything else with NXDOMAIN
+ */
+class StubDnsServer {
+public:
+    struct Record {
+        std::string m_ip;
+        uint32_t m_ttl;
+        std::chrono::milliseconds m_delay { 0 };
+        bool m_drop = false;
+    };
+
+    StubDnsServer() {
+        m_records["www.test"] = { "10.0.0.1", 1 };
+        m_records["slow.test"] = { "10.0.0.2", 60, std::chrono::milliseconds(100) };
+        m_records["drop.test"] = { "10.0.0.3", 60, std::chrono::milliseconds(0), true };
+        m_fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+        ::sockaddr_in addr {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(NAMESERVER_PORT);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (::bind(m_fd, reinterpret_cast<::sockaddr*>(&addr), sizeof(addr)) == -1) {
+            throw std::runtime_error("Failed to bind the stub name server");
+        }
+        m_thread = std::thread([this]() { serve(); });
+    }
+
+    ~StubDnsServer() {
+        m_stop = true;
+        m_thread.join();
+        ::close(m_fd);
+    }
+
+    std::size_t queries(const std::string& name) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_queries[name];
+    }
+
+private:
+    void serve() {
+        uint8_t buffer[512];
+        while (!m_stop) {
+            ::pollfd pfd { m_fd, POLLIN, 0 };
+            if (::poll(&pfd, 1, 20) <= 0) {
+                continue;
+            }
+            ::sockaddr_storage peer;
+            ::socklen_t peer_len = sizeof(peer);
+            auto n = ::recvfrom(m_fd, buffer, sizeof(buffer), 0, reinterpret_cast<::sockaddr*>(&peer), &peer_len);
+            if (n < 17) {
+                continue;
+            }
+            std::string name;
+            std::size_t pos = 12;
+            while (pos < static_cast<std::size_t>(n) && buffer[pos] != 0) {
+                if (!name.empty()) {
+                    name += '.';
+                }
+                name.append(reinterpret_cast<char*>(buffer + pos + 1), buffer[pos]);
+                pos += 1 + buffer[pos];
+            }
+            auto question_end = pos + 5;
+            uint16_t type = static_cast<uint16_t>((buffer[pos + 1] << 8) | buffer[pos + 2]);
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_queries[name]++;
+            }
+            std::vector<uint8_t> reply(buffer, buffer + question_end);
+            // response, recursion desired and available
+            reply[2] = 0x81;
+            reply[3] = 0x80;
+            reply[6] = reply[7] = reply[8] = reply[9] = reply[10] = reply[11] = 0;
+            auto it = m_records.find(name);
+            if (it == m_records.end()) {
+                reply[3] |= 3;
+            } else if (it->second.m_drop) {
+                continue;
+            } else if (type == 1) {
+                std::this_thread::sleep_for(it->second.m_delay);
+                reply[7] = 1;
+                auto ttl = it->second.m_ttl;
+                // pointer to the question name, type A, class IN, TTL and the length of the address
+                std::vector<uint8_t> answer = { 0xC0, 0x0C, 0, 1, 0, 1 };
+                for (int shift = 24; shift >= 0; shift -= 8) {
+                    answer.push_back(static_cast<uint8_t>(ttl >> shift));
+                }
+                answer.push_back(0);
+                answer.push_back(4);
+                reply.insert(reply.end(), answer.begin(), answer.end());
+                ::in_addr ip;
+                ::inet_pton(AF_INET, it->second.m_ip.c_str(), &ip);
+                auto* bytes = reinterpret_cast<uint8_t*>(&ip);
+                reply.insert(reply.end(), bytes, bytes + 4);
+            }
+            ::sendto(m_fd, reply.data(), reply.size(), 0, reinterpret_cast<::sockaddr*>(&peer), peer_len);
+        }
+    }
+
+    int m_fd;
+    std::atomic<bool> m_stop = false;
+    std::thread m_thread;
+    std::map<std::string, Record> m_records;
+    std::mutex m_mutex;
+    std::map<std::string, std::size_t> m_queries;
+};
+
+std::string to_string(const ::sockaddr_storage& address) {
+    char buffer[INET6_ADDRSTRLEN];
+    uint16_t port;
+    if (address.ss_family == AF_INET) {
+        auto* v4 = reinterpret_cast<const ::sockaddr_in*>(&address);
+        ::inet_ntop(AF_INET, &v4->sin_addr, buffer, sizeof(buffer));
+        port = ntohs(v4->sin_port);
+    } else {
+        auto* v6 = reinterpret_cast<const ::sockaddr_in6*>(&address);
+        ::inet_ntop(AF_INET6, &v6->sin6_addr, buffer, sizeof(buffer));
+        port = ntohs(v6->sin6_port);
+    }
+    return std::string(buffer) + ":" + std::to_string(port);
+}
+
+class DnsResolverTest: public testing::Test {
+protected:
+    static void SetUpTestSuite() {
+        stub = std::make_unique<StubDnsServer>();
+    }
+
+    static void TearDownTestSuite() {
+        stub.reset();
+    }
+
+    static net::DnsResolverOptions options() {
+        net::DnsResolverOptions options;
+        options.m_nameservers = { NAMESERVER };
+        options.m_hosts_file = "";
+        options.m_query_timeout = std::chrono::milliseconds(200);
+        options.m_attempts = 1;
+        return options;
+    }
+
+    static std::unique_ptr<StubDnsServer> stub;
+};
+
+std::unique_ptr<StubDnsServer> DnsResolverTest::stub;
+
+} // namespace
+
+TEST_F(DnsResolverTest, HostsFile) {
+    const std::string path = "/tmp/easynet_test_hosts";
+    {
+        std::ofstream file(path);
+        file << "# comment\n10.1.2.3 Alpha.test alias.test\n::1 alpha.test\n";
+    }
+    auto opts = options();
+    opts.m_hosts_file = path;
+    net::DnsResolver resolver(opts);
+    net::DnsAnswer answer;
+    ASSERT_FALSE(resolver.resolve("ALPHA.test.", "80", answer).has_value());
+    ASSERT_EQ(answer.m_addresses.size(), 2);
+    EXPECT_EQ(to_string(answer.m_addresses[0]), "10.1.2.3:80");
+    EXPECT_EQ(to_string(answer.m_addresses[1]), "::1:80");
+    ASSERT_FALSE(resolver.resolve("alias.test", "http", answer).has_value());
+    EXPECT_EQ(to_string(answer.m_addresses[0]), "10.1.2.3:80");
+
+    // read again once changed, cached names stay until they expire
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    {
+        std::ofstream file(path);
+        file << "10.9.9.9 alpha.test\n";
+    }
+    ASSERT_FALSE(resolver.resolve("alpha.test", "80", answer).has_value());
+    EXPECT_EQ(to_string(answer.m_addresses[0]), "10.1.2.3:80");
+    resolver.clear();
+    ASSERT_FALSE(resolver.resolve("alpha.test", "80", answer).has_value());
+    ASSERT_EQ(answer.m_addresses.size(), 1);
+    EXPECT_EQ(to_string(answer.m_addresses[0]), "10.9.9.9:80");
+    std::remove(path.c_str());
+}
+
+TEST_F(DnsResolverTest, NameServerTtl) {
+    net::DnsResolver resolver(options());
+    net::DnsAnswer answer;
+    ASSERT_FALSE(resolver.resolve("www.test", "8080", answer).has_value());
+    ASSERT_EQ(answer.m_addresses.size(), 1);
+    EXPECT_EQ(to_string(answer.m_addresses[0]), "10.0.0.1:8080");
+    auto asked = stub->queries("www.test");
+    // A and AAAA
+    EXPECT_EQ(asked, 2);
+    ASSERT_FALSE(resolver.resolve("www.test", "9090", answer).has_value());
+    EXPECT_EQ(to_string(answer.m_addresses[0]), "10.0.0.1:9090");
+    EXPECT_EQ(stub->queries("www.test"), asked);
+
+    // the record lives for a second
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    ASSERT_FALSE(resolver.resolve("www.test", "8080", answer).has_value());
+    EXPECT_EQ(stub->queries("www.test"), asked + 2);
+}
+
+TEST_F(DnsResolverTest, NegativeCaching) {
+    net::DnsResolver resolver(options());
+    net::DnsAnswer answer;
+    auto err = resolver.resolve("missing.test", "80", answer);
+    ASSERT_TRUE(err.has_value());
+    EXPECT_EQ(err.value().error_code, NET_HOST_NOT_FOUND_CODE);
+    auto asked = stub->queries("missing.test");
+    err = resolver.resolve("missing.test", "80", answer);
+    ASSERT_TRUE(err.has_value());
+    EXPECT_EQ(err.value().error_code, NET_HOST_NOT_FOUND_CODE);
+    EXPECT_EQ(stub->queries("missing.test"), asked);
+}
+
+TEST_F(DnsResolverTest, TimeoutNotCached) {
+    net::DnsResolver resolver(options());
+    net::DnsAnswer answer;
+    auto err = resolver.resolve("drop.test", "80", answer);
+    ASSERT_TRUE(err.has_value());
+    EXPECT_EQ(err.value().error_code, NET_TIMEOUT_CODE);
+    EXPECT_EQ(resolver.size(), 0);
+    auto asked = stub->queries("drop.test");
+    EXPECT_TRUE(resolver.resolve("drop.test", "80", answer).has_value());
+    EXPECT_EQ(stub->queries("drop.test"), asked + 2);
+}
+
+TEST_F(DnsResolverTest, Coalescing) {
+    net::DnsResolver resolver(options());
+    std::vector<std::thread> threads;
+    std::atomic<int> resolved = 0;
+    for (int i = 0; i < 8; i++) {
+        threads.emplace_back([&resolver, &resolved]() {
+            net::DnsAnswer answer;
+            if (!resolver.resolve("slow.test", "80", answer).has_value()
+                && to_string(answer.m_addresses[0]) == "10.0.0.2:80")
+            {
+                resolved++;
+            }
+        });
+    }
+    std::promise<std::string> async_result;
+    resolver.async_resolve("slow.test", "443", [&async_result](std::optional<net::NetError> err, net::DnsAnswer answer) {
+        async_result.set_value(err.has_value() ? err->msg : to_string(answer.m_addresses[0]));
+    });
+    for (auto& thread: threads) {
+        thread.join();
+    }
+    EXPECT_EQ(resolved, 8);
+    EXPECT_EQ(async_result.get_future().get(), "10.0.0.2:443");
+    EXPECT_EQ(stub->queries("slow.test"), 2);
+}
+
+TEST_F(DnsResolverTest, Async) {
+    net::DnsResolver resolver(options());
+    std::promise<std::optional<net::NetError>> missing;
+    resolver.async_resolve("nowhere.test", "80", [&missing](std::optional<net::NetError> err, net::DnsAnswer) {
+        missing.set_value(err);
+    });
+    auto err = missing.get_future().get();
+    ASSERT_TRUE(err.has_value());
+    EXPECT_EQ(err->error_code, NET_HOST_NOT_FOUND_CODE);
+
+    // numeric addresses and cached names are answered on the calling thread
+    bool called = false;
+    resolver.async_resolve("::1", "80", [&called](std::optional<net::NetError> err, net::DnsAnswer answer) {
+        called = !err.has_value() && to_string(answer.m_addresses[0]) == "::1:80";
+    });
+    EXPECT_TRUE(called);
+    called = false;
+    resolver.async_resolve("nowhere.test", "80", [&called](std::optional<net::NetError> err, net::DnsAnswer) {
+        called = err.has_value();
+    });
+    EXPECT_TRUE(called);
+}
+
+TEST_F(DnsResolverTest, AddressResolver) {
+    net::addressResolver resolver;
+    auto info = resolver.resolve("localhost", "80");
+    auto address = info.get_address();
+    ASSERT_EQ(address.m_addr->sa_family, AF_INET);
+    auto* v4 = reinterpret_cast<::sockaddr_in*>(address.m_addr);
+    EXPECT_EQ(ntohs(v4->sin_port), 80);
+    EXPECT_EQ(ntohl(v4->sin_addr.s_addr), INADDR_LOOPBACK);
+    EXPECT_EQ(info.m_curr->ai_socktype, SOCK_STREAM);
+    EXPECT_THROW(resolver.resolve("localhost", "no-such-service"), std::system_error);
+}
+
+int main() {
+    testing::InitGoogleTest();
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,225 @@
+#include "hpack.hpp"
+#include "http2.hpp"
+#include "http_parser.hpp"
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+std::string from_hex(std::string_view hex) {
+    std::string out;
+    for (std::size_t i = 0; i + 1 < hex.size(); i += 2) {
+        out.push_back(static_cast<char>(std::stoi(std::string(hex.substr(i, 2)), nullptr, 16)));
+    }
+    return out;
+}
+
+std::string frame(net::Http2FrameType type, uint8_t flags, uint32_t stream_id, std::string_view payload) {
+    std::string out;
+    net::Http2FrameHeader { static_cast<uint32_t>(payload.size()), type, flags, stream_id }.write(out);
+    out.append(payload);
+    return out;
+}
+
+struct Frame {
+    net::Http2FrameHeader m_header;
+    std::string m_payload;
+};
+
+std::vector<Frame> take_output(net::Http2Connection& connection) {
+    std::vector<struct iovec> iov;
+    connection.output(iov);
+    std::string data;
+    for (auto& entry: iov) {
+        data.append(static_cast<const char*>(entry.iov_base), entry.iov_len);
+    }
+    connection.consume_output();
+    std::vector<Frame> frames;
+    for (std::size_t pos = 0; pos + net::Http2FrameHeader::SIZE <= data.size();) {
+        auto header = net::Http2FrameHeader::parse(reinterpret_cast<const uint8_t*>(data.data() + pos));
+        frames.push_back({ header, data.substr(pos + net::Http2FrameHeader::SIZE, header.m_length) });
+        pos += net::Http2FrameHeader::SIZE + header.m_length;
+    }
+    return frames;
+}
+
+std::vector<std::pair<std::string, std::string>> decode(net::HpackDecoder& decoder, std::string_view block) {
+    std::vector<std::pair<std::string, std::string>> fields;
+    EXPECT_TRUE(decoder.decode(block, [&fields](std::string_view name, std::string_view value) {
+        fields.emplace_back(name, value);
+    }));
+    return fields;
+}
+
+} // namespace
+
+TEST(HpackTest, Huffman) {
+    // RFC 7541 appendix C.4
+    std::string out;
+    net::hpack::huffman_encode("www.example.com", out);
+    EXPECT_EQ(out, from_hex("f1e3c2e5f23a6ba0ab90f4ff"));
+    EXPECT_EQ(net::hpack::huffman_size("www.example.com"), out.size());
+    out.clear();
+    net::hpack::huffman_encode("custom-value", out);
+    EXPECT_EQ(out, from_hex("25a849e95bb8e8b4bf"));
+    std::string decoded;
+    EXPECT_TRUE(net::hpack::huffman_decode(from_hex("a8eb10649cbf"), decoded));
+    EXPECT_EQ(decoded, "no-cache");
+    // padding longer than 7 bits
+    EXPECT_FALSE(net::hpack::huffman_decode(from_hex("a8eb10649cbfff"), decoded));
+}
+
+TEST(HpackTest, RequestExamples) {
+    // RFC 7541 appendix C.4, three requests sharing the dynamic table
+    net::HpackDecoder decoder;
+    auto first = decode(decoder, from_hex("828684418cf1e3c2e5f23a6ba0ab90f4ff"));
+    ASSERT_EQ(first.size(), 4);
+    EXPECT_EQ(first[3], std::make_pair(std::string(":authority"), std::string("www.example.com")));
+    EXPECT_EQ(decoder.table().size(), 57);
+    auto second = decode(decoder, from_hex("828684be5886a8eb10649cbf"));
+    ASSERT_EQ(second.size(), 5);
+    EXPECT_EQ(second[3].second, "www.example.com");
+    EXPECT_EQ(second[4], std::make_pair(std::string("cache-control"), std::string("no-cache")));
+    EXPECT_EQ(decoder.table().size(), 110);
+    auto third = decode(decoder, from_hex("828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf"));
+    ASSERT_EQ(third.size(), 5);
+    EXPECT_EQ(third[4], std::make_pair(std::string("custom-key"), std::string("custom-value")));
+    EXPECT_EQ(decoder.table().size(), 164);
+    EXPECT_EQ(decoder.table().entries(), 3);
+    // index beyond the table
+    EXPECT_FALSE(decoder.decode(from_hex("ff00"), [](std::string_view, std::string_view) {}));
+}
+
+TEST(HpackTest, EncoderRoundTrip) {
+    net::HpackEncoder encoder;
+    net::HpackDecoder decoder;
+    std::vector<std::pair<std::string, std::string>> fields {
+        { ":status", "200" },
+        { "content-type", "text/html; charset=utf-8" },
+        { "x-request-id", "42" },
+    };
+    std::string first;
+    encoder.begin_block(first);
+    for (auto& [name, value]: fields) {
+        encoder.encode(name, value, first);
+    }
+    EXPECT_EQ(decode(decoder, first), fields);
+    // the second time everything is indexed
+    std::string second;
+    encoder.begin_block(second);
+    for (auto& [name, value]: fields) {
+        encoder.encode(name, value, second);
+    }
+    EXPECT_EQ(second.size(), fields.size());
+    EXPECT_EQ(decode(decoder, second), fields);
+}
+
+TEST(Http2Test, Exchange) {
+    net::Http2Connection connection;
+    net::HpackEncoder encoder;
+    std::string block;
+    encoder.begin_block(block);
+    encoder.encode(":method", "GET", block);
+    encoder.encode(":scheme", "http", block);
+    encoder.encode(":path", "/a?b=1", block);
+    encoder.encode(":authority", "example.com", block);
+    encoder.encode("cookie", "a=1", block);
+    encoder.encode("cookie", "b=2", block);
+    std::string input = std::string(net::http2::PREFACE) + frame(net::Http2FrameType::SETTINGS, 0, 0, "")
+        + frame(net::Http2FrameType::HEADERS,
+                net::http2::FLAG_END_HEADERS | net::http2::FLAG_END_STREAM,
+                1,
+                block);
+    // split in the middle of the preface and of the frame
+    connection.feed(std::string_view(input).substr(0, 10));
+    EXPECT_FALSE(connection.next_request().has_value());
+    connection.feed(std::string_view(input).substr(10, 30));
+    connection.feed(std::string_view(input).substr(40));
+    auto request = connection.next_request();
+    ASSERT_TRUE(request.has_value());
+    EXPECT_EQ(request->m_stream_id, 1);
+    EXPECT_EQ(request->m_request.method(), net::HttpMethod::GET);
+    EXPECT_EQ(request->m_request.path(), "/a");
+    EXPECT_EQ(request->m_request.version(), HTTP_VERSION_2_0);
+    EXPECT_EQ(request->m_request.header("Host"), "example.com");
+    EXPECT_EQ(request->m_request.header("Cookie"), "a=1; b=2");
+
+    net::HttpResponse response;
+    response.set_status_code(net::HttpResponseCode::OK).set_header("Connection", "keep-alive").set_body("hello");
+    connection.submit_response(1, std::move(response));
+    connection.produce(1024);
+    auto frames = take_output(connection);
+    ASSERT_EQ(frames.size(), 5);
+    EXPECT_EQ(frames[0].m_header.m_type, net::Http2FrameType::SETTINGS);
+    EXPECT_EQ(frames[1].m_header.m_type, net::Http2FrameType::WINDOW_UPDATE);
+    EXPECT_EQ(frames[2].m_header.m_type, net::Http2FrameType::SETTINGS);
+    EXPECT_EQ(frames[2].m_header.m_flags, net::http2::FLAG_ACK);
+    EXPECT_EQ(frames[3].m_header.m_type, net::Http2FrameType::HEADERS);
+    net::HpackDecoder decoder;
+    auto fields = decode(decoder, frames[3].m_payload);
+    ASSERT_FALSE(fields.empty());
+    EXPECT_EQ(fields[0], std::make_pair(std::string(":status"), std::string("200")));
+    for (auto& [name, value]: fields) {
+        // connection specific fields are not forwarded
+        EXPECT_NE(name, "connection");
+    }
+    EXPECT_EQ(frames[4].m_header.m_type, net::Http2FrameType::DATA);
+    EXPECT_EQ(frames[4].m_header.m_flags, net::http2::FLAG_END_STREAM);
+    EXPECT_EQ(frames[4].m_payload, "hello");
+    EXPECT_EQ(connection.open_streams(), 0);
+}
+
+TEST(Http2Test, FlowControlAndErrors) {
+    net::Http2Connection connection;
+    // SETTINGS_INITIAL_WINDOW_SIZE = 3
+    std::string settings = from_hex("000400000003");
+    net::HpackEncoder encoder;
+    std::string block;
+    encoder.begin_block(block);
+    encoder.encode(":method", "GET", block);
+    encoder.encode(":scheme", "http", block);
+    encoder.encode(":path", "/", block);
+    connection.feed(
+        std::string(net::http2::PREFACE) + frame(net::Http2FrameType::SETTINGS, 0, 0, settings)
+        + frame(net::Http2FrameType::HEADERS,
+                net::http2::FLAG_END_HEADERS | net::http2::FLAG_END_STREAM,
+                1,
+                block)
+    );
+    ASSERT_TRUE(connection.next_request().has_value());
+    take_output(connection);
+    net::HttpResponse response;
+    response.set_status_code(net::HttpResponseCode::OK).set_body("hello");
+    connection.submit_response(1, std::move(response));
+    connection.produce(1024);
+    auto frames = take_output(connection);
+    ASSERT_EQ(frames.size(), 2);
+    EXPECT_EQ(frames[1].m_payload, "hel");
+    EXPECT_EQ(frames[1].m_header.m_flags, 0);
+    EXPECT_TRUE(connection.has_pending_bodies());
+
+    connection.feed(frame(net::Http2FrameType::WINDOW_UPDATE, 0, 1, from_hex("0000000a")));
+    connection.produce(1024);
+    frames = take_output(connection);
+    ASSERT_EQ(frames.size(), 1);
+    EXPECT_EQ(frames[0].m_payload, "lo");
+    EXPECT_EQ(frames[0].m_header.m_flags, net::http2::FLAG_END_STREAM);
+
+    // a request on an even stream id is a connection error
+    connection.feed(
+        frame(net::Http2FrameType::HEADERS, net::http2::FLAG_END_HEADERS | net::http2::FLAG_END_STREAM, 2, block)
+    );
+    frames = take_output(connection);
+    ASSERT_EQ(frames.size(), 1);
+    EXPECT_EQ(frames[0].m_header.m_type, net::Http2FrameType::GOAWAY);
+    EXPECT_EQ(frames[0].m_payload, from_hex("0000000100000001"));
+    EXPECT_TRUE(connection.closed());
+}
+
+int main() {
+    testing::InitGoogleTest();
+    return RUN_ALL_TESTS();
+}
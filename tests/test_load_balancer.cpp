@@ -0,0 +1,297 @@
+#include "http_client.hpp"
+#include "http_server.hpp"
+#include "http_server_proxy.hpp"
+#include "load_balancer.hpp"
+#include <chrono>
+#include <gtest/gtest.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr const char* IP = "127.0.0.1";
+constexpr const char* PROXY_PORT = "18340";
+constexpr const char* UPSTREAM_PORTS[] = { "18341", "18342" };
+// nothing listens there
+constexpr const char* DEAD_PORT = "18343";
+constexpr const char* FORWARD_PROXY_PORT = "18344";
+
+std::vector<net::Upstream> upstreams(std::size_t count) {
+    std::vector<net::Upstream> result;
+    for (std::size_t i = 0; i < count; i++) {
+        result.push_back({ IP, std::to_string(20000 + i) });
+    }
+    return result;
+}
+
+net::LoadBalancerOptions options(net::LoadBalancePolicy policy) {
+    net::LoadBalancerOptions result;
+    result.m_policy = policy;
+    return result;
+}
+
+class ReverseProxyTest: public testing::Test {
+protected:
+    static void SetUpTestSuite() {
+        for (auto port: UPSTREAM_PORTS) {
+            auto server = std::make_unique<net::HttpServer>(IP, port);
+            std::string name = port;
+            server->get("/who", [name](const net::HttpRequest& req) {
+                net::HttpResponse res;
+                res.set_version(HTTP_VERSION_1_1)
+                    .set_status_code(net::HttpResponseCode::OK)
+                    .set_header("X-Seen-For", req.header("x-forwarded-for"))
+                    .set_body(name);
+                return res;
+            });
+            // answers with the size of the body and how it was framed
+            server->route_stream(net::HttpMethod::POST, "/upload", [](const net::HttpRequestView& head) {
+                auto reader = std::make_shared<net::HttpBodyReader>();
+                auto size = std::make_shared<std::size_t>(0);
+                std::string framing = head.has_header("Transfer-Encoding") ? "chunked" : "length";
+                reader->m_on_data = [size](std::string_view piece) { *size += piece.size(); };
+                reader->m_on_end = [size, framing]() {
+                    net::HttpResponse res;
+                    res.set_version(HTTP_VERSION_1_1)
+                        .set_status_code(net::HttpResponseCode::OK)
+                        .set_body(std::to_string(*size) + " " + framing);
+                    return res;
+                };
+                return reader;
+            });
+            ASSERT_FALSE(server->listen().has_value());
+            server->enable_event_loop(net::EventLoopType::EPOLL);
+            ASSERT_FALSE(server->start().has_value());
+            servers.push_back(std::move(server));
+        }
+    }
+
+    static void TearDownTestSuite() {
+        for (auto& server: servers) {
+            server->close();
+        }
+        servers.clear();
+    }
+
+    static std::unique_ptr<net::HttpServerProxyReverse>
+    start_proxy(std::vector<net::Upstream> targets, net::HttpReverseProxyOptions options) {
+        auto proxy = std::make_unique<net::HttpServerProxyReverse>(IP, PROXY_PORT, std::move(targets), options);
+        EXPECT_FALSE(proxy->listen().has_value());
+        proxy->enable_event_loop(net::EventLoopType::EPOLL);
+        EXPECT_FALSE(proxy->start().has_value());
+        return proxy;
+    }
+
+    static net::HttpRequest request(const std::string& path) {
+        net::HttpRequest req;
+        req.set_method(net::HttpMethod::GET).set_url(path).set_version(HTTP_VERSION_1_1).set_header("Host", IP);
+        return req;
+    }
+
+    /**
+     * @brief upload count copies of body to url through port, once with a content-length and once as chunks
+     */
+    static void upload(const char* port, const std::string& url, const std::string& body, int count) {
+        std::string upstream = std::string(IP) + ":" + UPSTREAM_PORTS[0];
+        net::HttpConnectionPool pool;
+        net::HttpRequest req = request(url);
+        req.set_method(net::HttpMethod::POST).set_header("Host", upstream);
+        auto chunked = req;
+        req.set_header("Content-Length", std::to_string(body.size() * count));
+        net::HttpConnectionPool::Lease lease;
+        ASSERT_FALSE(pool.send_head(lease, IP, port, req).has_value());
+        for (int i = 0; i < count; i++) {
+            ASSERT_FALSE(lease->write_http_body(body).has_value());
+        }
+        ASSERT_FALSE(lease->end_http_body().has_value());
+        net::HttpResponse res;
+        ASSERT_FALSE(pool.receive(lease, res).has_value());
+        EXPECT_EQ(read_body(lease), std::to_string(body.size() * count) + " length");
+
+        // without a length the body goes on as chunks
+        ASSERT_FALSE(pool.send_head(lease, IP, port, chunked).has_value());
+        for (int i = 0; i < count; i++) {
+            ASSERT_FALSE(lease->write_http_body(body).has_value());
+        }
+        ASSERT_FALSE(lease->end_http_body().has_value());
+        ASSERT_FALSE(pool.receive(lease, res).has_value());
+        EXPECT_EQ(read_body(lease), std::to_string(body.size() * count) + " chunked");
+        lease.release();
+    }
+
+    static std::string read_body(net::HttpConnectionPool::Lease& lease) {
+        std::string body;
+        bool finished = false;
+        while (!finished) {
+            std::string piece;
+            if (lease->read_http_body(piece, finished).has_value()) {
+                break;
+            }
+            body += piece;
+        }
+        return body;
+    }
+
+    static std::vector<std::unique_ptr<net::HttpServer>> servers;
+};
+
+std::vector<std::unique_ptr<net::HttpServer>> ReverseProxyTest::servers;
+
+using ForwardProxyTest = ReverseProxyTest;
+
+} // namespace
+
+TEST(LoadBalancerTest, WeightedRoundRobin) {
+    auto targets = upstreams(2);
+    targets[0].m_weight = 3;
+    net::LoadBalancer balancer(targets, options(net::LoadBalancePolicy::ROUND_ROBIN));
+    std::vector<std::size_t> picks;
+    for (int i = 0; i < 8; i++) {
+        picks.push_back(balancer.pick());
+    }
+    // smooth, the lighter one is not left waiting until the heavier one had all its turns
+    EXPECT_EQ(picks, (std::vector<std::size_t> { 0, 0, 1, 0, 0, 0, 1, 0 }));
+}
+
+TEST(LoadBalancerTest, LeastConnections) {
+    net::LoadBalancer balancer(upstreams(3), options(net::LoadBalancePolicy::LEAST_CONNECTIONS));
+    balancer.on_start(0);
+    balancer.on_start(1);
+    EXPECT_EQ(balancer.pick(), 2);
+    balancer.on_start(2);
+    balancer.on_start(2);
+    balancer.on_finish(1, std::chrono::nanoseconds(0), true);
+    EXPECT_EQ(balancer.pick(), 1);
+}
+
+TEST(LoadBalancerTest, EwmaLatency) {
+    net::LoadBalancer balancer(upstreams(2), options(net::LoadBalancePolicy::EWMA_LATENCY));
+    balancer.on_start(0);
+    balancer.on_finish(0, std::chrono::milliseconds(50), true);
+    balancer.on_start(1);
+    balancer.on_finish(1, std::chrono::milliseconds(5), true);
+    for (int i = 0; i < 4; i++) {
+        EXPECT_EQ(balancer.pick(), 1);
+    }
+    // enough requests in flight outweigh the lower latency
+    for (int i = 0; i < 10; i++) {
+        balancer.on_start(1);
+    }
+    EXPECT_EQ(balancer.pick(), 0);
+}
+
+TEST(LoadBalancerTest, ConsistentHash) {
+    auto targets = upstreams(4);
+    net::LoadBalancer balancer(targets, options(net::LoadBalancePolicy::CONSISTENT_HASH));
+    std::map<std::string, std::size_t> owners;
+    for (int i = 0; i < 200; i++) {
+        auto key = "/user/" + std::to_string(i);
+        owners[key] = balancer.pick(key);
+        EXPECT_EQ(balancer.pick(key), owners[key]);
+    }
+    // only the keys of the upstream going away move
+    balancer.set_healthy(2, false);
+    for (auto& [key, owner]: owners) {
+        auto now = balancer.pick(key);
+        EXPECT_NE(now, 2);
+        if (owner != 2) {
+            EXPECT_EQ(now, owner);
+        }
+    }
+}
+
+TEST(LoadBalancerTest, PassiveFailures) {
+    auto balancer_options = options(net::LoadBalancePolicy::ROUND_ROBIN);
+    balancer_options.m_max_fails = 2;
+    balancer_options.m_fail_timeout = std::chrono::milliseconds(30);
+    net::LoadBalancer balancer(upstreams(2), balancer_options);
+    for (int i = 0; i < 2; i++) {
+        balancer.on_start(0);
+        balancer.on_finish(0, std::chrono::nanoseconds(0), false);
+    }
+    EXPECT_FALSE(balancer.available(0));
+    EXPECT_EQ(balancer.pick(), 1);
+    EXPECT_EQ(balancer.pick("", { 1 }), net::LoadBalancer::npos);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_TRUE(balancer.available(0));
+}
+
+TEST_F(ReverseProxyTest, RoundRobin) {
+    std::vector<net::Upstream> targets;
+    for (auto port: UPSTREAM_PORTS) {
+        targets.push_back({ IP, port });
+    }
+    auto proxy = start_proxy(targets, {});
+    net::HttpConnectionPool pool;
+    std::map<std::string, int> seen;
+    for (int i = 0; i < 4; i++) {
+        net::HttpResponse res;
+        ASSERT_FALSE(pool.request(res, IP, PROXY_PORT, request("/who")).has_value());
+        ASSERT_EQ(res.status_code(), net::HttpResponseCode::OK);
+        EXPECT_EQ(res.header("X-Seen-For"), IP);
+        seen[res.body()]++;
+    }
+    EXPECT_EQ(seen[UPSTREAM_PORTS[0]], 2);
+    EXPECT_EQ(seen[UPSTREAM_PORTS[1]], 2);
+    proxy->close();
+}
+
+TEST_F(ReverseProxyTest, RetryOnRefusedUpstream) {
+    net::HttpReverseProxyOptions proxy_options;
+    proxy_options.m_balancer.m_fail_timeout = std::chrono::milliseconds(60000);
+    auto proxy = start_proxy({ { IP, DEAD_PORT }, { IP, UPSTREAM_PORTS[0] } }, proxy_options);
+    net::HttpConnectionPool pool;
+    for (int i = 0; i < 3; i++) {
+        net::HttpResponse res;
+        ASSERT_FALSE(pool.request(res, IP, PROXY_PORT, request("/who")).has_value());
+        ASSERT_EQ(res.status_code(), net::HttpResponseCode::OK);
+        EXPECT_EQ(res.body(), UPSTREAM_PORTS[0]);
+    }
+    EXPECT_FALSE(proxy->balancer().available(0));
+    proxy->close();
+}
+
+TEST_F(ReverseProxyTest, NoUpstreamLeft) {
+    net::HttpReverseProxyOptions proxy_options;
+    proxy_options.m_health_check_path = "/who";
+    proxy_options.m_health_check_interval = std::chrono::milliseconds(10);
+    proxy_options.m_unhealthy_threshold = 1;
+    auto proxy = start_proxy({ { IP, DEAD_PORT } }, proxy_options);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_FALSE(proxy->balancer().available(0));
+    net::HttpConnectionPool pool;
+    net::HttpResponse res;
+    ASSERT_FALSE(pool.request(res, IP, PROXY_PORT, request("/who")).has_value());
+    EXPECT_EQ(res.status_code(), net::HttpResponseCode::SERVICE_UNAVAILABLE);
+    proxy->close();
+}
+
+TEST_F(ReverseProxyTest, StreamsUploads) {
+    auto proxy = start_proxy({ { IP, UPSTREAM_PORTS[0] } }, {});
+    upload(PROXY_PORT, "/upload", std::string(256 * 1024, 'u'), 8);
+    proxy->close();
+}
+
+TEST_F(ForwardProxyTest, StreamsUploads) {
+    net::HttpServerProxyForward proxy(IP, FORWARD_PROXY_PORT);
+    ASSERT_FALSE(proxy.listen().has_value());
+    proxy.enable_event_loop(net::EventLoopType::EPOLL);
+    ASSERT_FALSE(proxy.start().has_value());
+    upload(FORWARD_PROXY_PORT, std::string("http://") + IP + ":" + UPSTREAM_PORTS[0] + "/upload", "forward", 3);
+
+    net::HttpConnectionPool pool;
+    net::HttpRequest req = request(std::string("http://") + IP + ":" + UPSTREAM_PORTS[0] + "/who");
+    req.set_header("Host", std::string(IP) + ":" + UPSTREAM_PORTS[0]);
+    net::HttpResponse res;
+    ASSERT_FALSE(pool.request(res, IP, FORWARD_PROXY_PORT, req).has_value());
+    EXPECT_EQ(res.body(), UPSTREAM_PORTS[0]);
+    proxy.close();
+}
+
+int main() {
+    testing::InitGoogleTest();
+    return RUN_ALL_TESTS();
+}
@@ -1,9 +1,12 @@
 #include "logger.hpp"
 
 #include <chrono>
+#include <filesystem>
+#include <fstream>
 #include <gtest/gtest.h>
 #include <iostream>
 #include <thread>
+#include <vector>
 
 class LoggerTest: public ::testing::Test {
 protected:
@@ -138,6 +141,45 @@ TEST_F(LoggerTest, TestLoggerWithSourceLocation) {
     }
 }
 
+TEST(AsyncLoggerTest, RotateBySize) {
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "net_async_logger_test";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    auto logger = utils::LoggerManager::get_instance().get_logger("rotate_logger", (dir / "rotate.log").string());
+
+    utils::LoggerManager::get_instance().enable_async_logging({
+        .overflow_policy = utils::LogOverflowPolicy::BLOCK,
+        .max_file_size = 16 * 1024,
+    });
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&logger, t] {
+            for (int i = 0; i < 500; ++i) {
+                NET_LOG_WARN(logger, "thread {} message {}", t, i);
+            }
+        });
+    }
+    for (auto& thread: threads) {
+        thread.join();
+    }
+    utils::LoggerManager::get_instance().disable_async_logging();
+
+    std::size_t files = 0, lines = 0;
+    for (auto& entry: std::filesystem::directory_iterator(dir)) {
+        files++;
+        ASSERT_LE(entry.file_size(), 16 * 1024);
+        std::ifstream file(entry.path());
+        std::string line;
+        while (std::getline(file, line)) {
+            lines++;
+        }
+    }
+    ASSERT_GT(files, 1);
+    ASSERT_EQ(lines, 2000);
+    ASSERT_EQ(utils::LoggerManager::get_instance().dropped_records(), 0);
+    std::filesystem::remove_all(dir);
+}
+
 int main() {
     ::testing::InitGoogleTest();
     return RUN_ALL_TESTS();
@@ -0,0 +1,87 @@
+#include "http_router.hpp"
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+class RouterTest: public ::testing::Test {
+protected:
+    int match(std::string_view path) {
+        auto handler = router.match(path, params);
+        return handler == nullptr ? 0 : *handler;
+    }
+
+    net::HttpRouter<int> router;
+    net::RouteParams params;
+};
+
+TEST_F(RouterTest, StaticRoutes) {
+    router.insert("/", 1);
+    router.insert("/users", 2);
+    router.insert("/user", 3);
+    router.insert("/users/list", 4);
+    EXPECT_EQ(router.size(), 4);
+    EXPECT_EQ(match("/"), 1);
+    EXPECT_EQ(match("/users"), 2);
+    EXPECT_EQ(match("/user"), 3);
+    EXPECT_EQ(match("/users/list"), 4);
+    EXPECT_EQ(match("/us"), 0);
+    EXPECT_EQ(match("/users/"), 0);
+    router.insert("/users", 5);
+    EXPECT_EQ(router.size(), 4);
+    EXPECT_EQ(match("/users"), 5);
+}
+
+TEST_F(RouterTest, Parameters) {
+    std::string_view path = "/users/42/posts/hello";
+    router.insert("/users/:id", 1);
+    router.insert("/users/:id/posts/:post", 2);
+    EXPECT_EQ(match(path), 2);
+    ASSERT_EQ(params.size(), 2);
+    EXPECT_EQ(params.get(path, "id"), "42");
+    EXPECT_EQ(params.get(path, "post"), "hello");
+    EXPECT_EQ(params.get(path, "missing"), "");
+    EXPECT_EQ(match("/users/7"), 1);
+    EXPECT_EQ(match("/users/"), 0);
+    EXPECT_EQ(match("/users/7/posts/"), 0);
+    EXPECT_THROW(router.insert("/users/:name", 3), std::invalid_argument);
+}
+
+TEST_F(RouterTest, PriorityAndBacktracking) {
+    router.insert("/files/new", 1);
+    router.insert("/files/:name", 2);
+    router.insert("/files/:name/raw", 3);
+    router.insert("/files/*path", 4);
+    EXPECT_EQ(match("/files/new"), 1);
+    EXPECT_TRUE(params.empty());
+    EXPECT_EQ(match("/files/news"), 2);
+    EXPECT_EQ(match("/files/new/raw"), 3);
+    EXPECT_EQ(params.get("/files/new/raw", "name"), "new");
+    // the parameter branch fails further down and the wildcard takes over
+    std::string_view path = "/files/a/b/c";
+    EXPECT_EQ(match(path), 4);
+    ASSERT_EQ(params.size(), 1);
+    EXPECT_EQ(params.get(path, "path"), "a/b/c");
+    EXPECT_EQ(match("/files/"), 4);
+    EXPECT_EQ(params.get("/files/", "path"), "");
+}
+
+TEST_F(RouterTest, RequestParams) {
+    net::HttpRouter<int> routes;
+    routes.insert("/items/:id", 1);
+    net::HttpRequest request;
+    request.set_url("/items/99?verbose=1&sort=asc");
+    EXPECT_EQ(request.path(), "/items/99");
+    EXPECT_EQ(request.query(), "verbose=1&sort=asc");
+    ASSERT_NE(routes.match(request.path(), params), nullptr);
+    request.set_params(params);
+    // values are offsets into the url, a copy reads them from its own url
+    auto copy = request;
+    request.set_url("/other");
+    EXPECT_EQ(copy.param("id"), "99");
+}
+
+int main() {
+    testing::InitGoogleTest();
+    return RUN_ALL_TESTS();
+}
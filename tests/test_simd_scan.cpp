@@ -0,0 +1,58 @@
+#include "simd_scan.hpp"
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class SimdScanTest: public ::testing::TestWithParam<net::simd::Isa> {
+protected:
+    void SetUp() override {
+        net::simd::set_isa(GetParam());
+    }
+
+    void TearDown() override {
+        net::simd::set_isa(net::simd::Isa::AVX2);
+    }
+};
+
+TEST_P(SimdScanTest, MatchesScalarOnRandomInput) {
+    // a small alphabet makes matches straddling the block boundaries frequent
+    const std::string alphabet = "\r\n:ab \x80";
+    std::mt19937 rng(42);
+    for (int round = 0; round < 2000; ++round) {
+        std::string data(rng() % 200, ' ');
+        for (auto& c: data) {
+            c = alphabet[rng() % alphabet.size()];
+        }
+        std::string_view view = data;
+        for (std::size_t from: { std::size_t(0), std::size_t(1), std::size_t(17), data.size() / 2 }) {
+            ASSERT_EQ(net::simd::find_crlf(view, from), view.find("\r\n", from));
+            ASSERT_EQ(net::simd::find_header_end(view, from), view.find("\r\n\r\n", from));
+            ASSERT_EQ(net::simd::find_char(view, ':', from), view.find(':', from));
+        }
+    }
+}
+
+TEST_P(SimdScanTest, FindsInvalidTokenChar) {
+    std::string token = "X-Forwarded-For!#$%&'*+-.^_`|~0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    ASSERT_EQ(net::simd::find_invalid_token_char(token), std::string_view::npos);
+    for (char bad: std::string("\t \"(),/:;<=>?@[\\]{}\x7f\x80\xff")) {
+        for (std::size_t pos: { std::size_t(0), std::size_t(15), std::size_t(16), std::size_t(40), token.size() - 1 }) {
+            auto copy = token;
+            copy[pos] = bad;
+            ASSERT_EQ(net::simd::find_invalid_token_char(copy), pos);
+        }
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    AllIsa,
+    SimdScanTest,
+    ::testing::Values(net::simd::Isa::SCALAR, net::simd::Isa::SSE42, net::simd::Isa::AVX2)
+);
+
+int main() {
+    testing::InitGoogleTest();
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,139 @@
+#include "http_parser.hpp"
+#include "static_files.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+
+class StaticFilesTest: public ::testing::Test {
+protected:
+    void SetUp() override {
+        char dir[] = "/tmp/static_files_XXXXXX";
+        ASSERT_NE(::mkdtemp(dir), nullptr);
+        root = dir;
+        std::filesystem::create_directory(root / "docs");
+        write("index.html", "<h1>home</h1>");
+        write("docs/index.html", "<h1>docs</h1>");
+        write("data.txt", "0123456789");
+    }
+
+    void TearDown() override {
+        files.reset();
+        std::filesystem::remove_all(root);
+    }
+
+    void write(const std::string& name, const std::string& content) {
+        std::ofstream(root / name, std::ios::binary | std::ios::trunc) << content;
+    }
+
+    net::HttpResponse get(const std::string& path, const std::string& headers = "") {
+        if (files == nullptr) {
+            files = std::make_unique<net::StaticFiles>(root.string());
+        }
+        net::HttpParser parser;
+        std::string request = "GET /" + path + " HTTP/1.1\r\n" + headers + "\r\n";
+        net::PooledBuffer data(request.size());
+        std::memcpy(data.tail(), request.data(), request.size());
+        data.commit(request.size());
+        parser.add_req_view_buffer(std::move(data));
+        auto view = parser.read_req_view();
+        return files->serve(view.value(), path);
+    }
+
+    std::filesystem::path root;
+    std::unique_ptr<net::StaticFiles> files;
+};
+
+TEST_F(StaticFilesTest, ServeCached) {
+    auto res = get("data.txt");
+    EXPECT_EQ(res.status_code(), net::HttpResponseCode::OK);
+    EXPECT_EQ(res.body_view(), "0123456789");
+    EXPECT_EQ(res.header("Content-Length"), "10");
+    EXPECT_EQ(res.header("Content-Type"), "text/plain; charset=utf-8");
+    EXPECT_FALSE(res.header("ETag").empty());
+    EXPECT_EQ(files->cached_files(), 1);
+    // the mapping is shared, not copied into the response
+    EXPECT_EQ(get("data.txt").body_view().data(), res.body_view().data());
+    EXPECT_EQ(get("").body_view(), "<h1>home</h1>");
+    EXPECT_EQ(get("docs/").body_view(), "<h1>docs</h1>");
+    EXPECT_EQ(get("docs/%2E/index.html").body_view(), "<h1>docs</h1>");
+    EXPECT_THROW(get("missing.txt"), net::HttpResponseCode);
+    EXPECT_THROW(get("docs/../../etc/passwd"), net::HttpResponseCode);
+    EXPECT_THROW(get("docs/%2e%2e/data.txt"), net::HttpResponseCode);
+}
+
+TEST_F(StaticFilesTest, ConditionalAndRange) {
+    auto res = get("data.txt");
+    auto etag = res.header("ETag");
+    EXPECT_EQ(get("data.txt", "If-None-Match: \"x\", " + etag + "\r\n").status_code(),
+              net::HttpResponseCode::NOT_MODIFIED);
+    EXPECT_EQ(get("data.txt", "If-None-Match: \"x\"\r\n").status_code(), net::HttpResponseCode::OK);
+    EXPECT_EQ(get("data.txt", "If-Modified-Since: " + res.header("Last-Modified") + "\r\n").status_code(),
+              net::HttpResponseCode::NOT_MODIFIED);
+    EXPECT_EQ(get("data.txt", "If-Modified-Since: Thu, 01 Jan 1970 00:00:00 GMT\r\n").status_code(),
+              net::HttpResponseCode::OK);
+
+    auto partial = get("data.txt", "Range: bytes=2-4\r\n");
+    EXPECT_EQ(partial.status_code(), net::HttpResponseCode::PARTIAL_CONTENT);
+    EXPECT_EQ(partial.body_view(), "234");
+    EXPECT_EQ(partial.header("Content-Range"), "bytes 2-4/10");
+    EXPECT_EQ(get("data.txt", "Range: bytes=-3\r\n").body_view(), "789");
+    EXPECT_EQ(get("data.txt", "Range: bytes=7-\r\n").body_view(), "789");
+    EXPECT_EQ(get("data.txt", "Range: bytes=8-100\r\n").body_view(), "89");
+    auto unsatisfiable = get("data.txt", "Range: bytes=10-\r\n");
+    EXPECT_EQ(unsatisfiable.status_code(), net::HttpResponseCode::RANGE_NOT_SATISFIABLE);
+    EXPECT_EQ(unsatisfiable.header("Content-Range"), "bytes */10");
+    // several ranges and a stale If-Range get the whole file
+    EXPECT_EQ(get("data.txt", "Range: bytes=0-1,4-5\r\n").status_code(), net::HttpResponseCode::OK);
+    EXPECT_EQ(get("data.txt", "Range: bytes=2-4\r\nIf-Range: \"old\"\r\n").status_code(), net::HttpResponseCode::OK);
+    EXPECT_EQ(get("data.txt", "Range: bytes=2-4\r\nIf-Range: " + etag + "\r\n").body_view(), "234");
+}
+
+TEST_F(StaticFilesTest, Precompressed) {
+    write("app.js", "console.log(1)");
+    write("app.js.gz", "gzipped");
+    auto res = get("app.js", "Accept-Encoding: gzip, br\r\n");
+    EXPECT_EQ(res.header("Content-Encoding"), "gzip");
+    EXPECT_EQ(res.header("Vary"), "Accept-Encoding");
+    EXPECT_EQ(res.header("Content-Type"), "text/javascript; charset=utf-8");
+    EXPECT_EQ(res.body_view(), "gzipped");
+    auto identity = get("app.js");
+    EXPECT_FALSE(identity.has_header("Content-Encoding"));
+    EXPECT_EQ(identity.header("Vary"), "Accept-Encoding");
+    EXPECT_EQ(identity.body_view(), "console.log(1)");
+    EXPECT_NE(identity.header("ETag"), res.header("ETag"));
+    EXPECT_FALSE(get("data.txt", "Accept-Encoding: gzip\r\n").has_header("Vary"));
+}
+
+TEST_F(StaticFilesTest, LargeFileAndInvalidation) {
+    net::StaticFileOptions options;
+    options.m_max_cached_file_size = 4;
+    files = std::make_unique<net::StaticFiles>(root.string(), options);
+    auto res = get("data.txt", "Range: bytes=3-5\r\n");
+    ASSERT_NE(res.body_file(), nullptr);
+    EXPECT_TRUE(res.body_view().empty());
+    EXPECT_EQ(res.body_file_offset(), 3);
+    EXPECT_EQ(res.body_file_size(), 3);
+    EXPECT_EQ(files->cached_files(), 0);
+
+    files = std::make_unique<net::StaticFiles>(root.string());
+    EXPECT_EQ(get("data.txt").body_view(), "0123456789");
+    // replaced the way deployments do it, a new file renamed over the old one
+    write("data.txt.new", "changed");
+    std::filesystem::rename(root / "data.txt.new", root / "data.txt");
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (files->cached_files() != 0 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(get("data.txt").body_view(), "changed");
+}
+
+int main() {
+    testing::InitGoogleTest();
+    return RUN_ALL_TESTS();
+}
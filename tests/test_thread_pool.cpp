@@ -1,4 +1,5 @@
 #include "thread_pool.hpp"
+#include <atomic>
 #include <chrono>
 #include <format>
 #include <future>
@@ -55,6 +56,30 @@ TEST_F(ThreadPoolTest, DeleteWorkerTest) {
     ASSERT_EQ(pool->worker_num(), 3);
 }
 
+TEST(WorkStealingThreadPoolTest, PostAndSubmit) {
+    utils::ThreadPool pool(4, utils::ThreadPoolMode::WORK_STEALING);
+    std::atomic<int> counter = 0;
+    for (int i = 0; i < 10000; ++i) {
+        // half of the tasks post another one from the worker thread
+        ASSERT_TRUE(pool.post([&pool, &counter, i] {
+            counter.fetch_add(1);
+            if (i % 2 == 0) {
+                pool.post([&counter] { counter.fetch_add(1); });
+            }
+        }));
+    }
+    auto result = pool.submit([](int a, int b) { return a * b; }, 6, 7);
+    ASSERT_TRUE(result.has_value());
+    ASSERT_EQ(result.value().get(), 42);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (counter.load() != 15000 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_EQ(counter.load(), 15000);
+    pool.stop();
+    ASSERT_FALSE(pool.post([] {}));
+}
+
 int main() {
     testing::InitGoogleTest();
 
@@ -0,0 +1,62 @@
+#include "timing_wheel.hpp"
+#include <chrono>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <vector>
+
+class TimingWheelTest: public ::testing::Test {
+protected:
+    void advance(uint64_t ticks) {
+        std::vector<net::TimingWheel::Callback> expired;
+        wheel.advance(ticks, expired);
+        for (auto& callback: expired) {
+            callback();
+        }
+    }
+
+    net::TimingWheel wheel { std::chrono::milliseconds(1) };
+    std::vector<int> fired;
+};
+
+TEST_F(TimingWheelTest, FireInOrder) {
+    wheel.schedule(std::chrono::milliseconds(3), [this]() { fired.push_back(3); });
+    wheel.schedule(std::chrono::milliseconds(1), [this]() { fired.push_back(1); });
+    wheel.schedule(std::chrono::milliseconds(2), [this]() { fired.push_back(2); });
+    advance(2);
+    EXPECT_EQ(fired, (std::vector<int> { 1, 2 }));
+    advance(1);
+    EXPECT_EQ(fired, (std::vector<int> { 1, 2, 3 }));
+    EXPECT_TRUE(wheel.empty());
+}
+
+TEST_F(TimingWheelTest, Cancel) {
+    auto id = wheel.schedule(std::chrono::milliseconds(5), [this]() { fired.push_back(5); });
+    EXPECT_TRUE(wheel.cancel(id));
+    EXPECT_FALSE(wheel.cancel(id));
+    advance(10);
+    EXPECT_TRUE(fired.empty());
+}
+
+TEST_F(TimingWheelTest, CascadeFromHigherLevels) {
+    // one timer per level, each has to be cascaded down before it fires
+    for (int delay: { 255, 256, 300, 65535, 65536, 70000, 16777216 + 5 }) {
+        wheel.schedule(std::chrono::milliseconds(delay), [this, delay]() { fired.push_back(delay); });
+    }
+    advance(1);
+    int ticks = 1;
+    for (int delay: { 255, 256, 300, 65535, 65536, 70000, 16777216 + 5 }) {
+        advance(delay - 1 - ticks);
+        ticks = delay - 1;
+        EXPECT_TRUE(fired.empty() || fired.back() != delay) << "fired early: " << delay;
+        advance(1);
+        ticks = delay;
+        ASSERT_FALSE(fired.empty());
+        EXPECT_EQ(fired.back(), delay);
+    }
+    EXPECT_EQ(fired.size(), 7);
+}
+
+int main() {
+    testing::InitGoogleTest();
+    return RUN_ALL_TESTS();
+}
@@ -1,24 +1,31 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
 #include <cassert>
 #include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstddef>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <fcntl.h>
 #include <format>
-#include <fstream>
 #include <iostream>
 #include <memory>
 #include <mutex>
-#include <queue>
 #include <source_location>
 #include <string>
-#include <sys/file.h>
+#include <string_view>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <thread>
 #include <unistd.h>
 #include <unordered_map>
+#include <vector>
 
 #define LOG_FOREACH_LOG_LEVEL(f) f(DEBUG) f(INFO) f(WARN) f(ERROR) f(FATAL)
 
@@ -54,6 +61,136 @@ public:
     }
 };
 
+enum class LogOverflowPolicy : uint8_t { DROP = 0, BLOCK };
+
+struct AsyncLoggingOptions {
+    // bytes of the ring each logging thread formats into, fixed when the thread logs for the first time
+    std::size_t ring_size = 1 << 20;
+    // what a thread does when its ring is full, DROP counts the record in dropped_records()
+    LogOverflowPolicy overflow_policy = LogOverflowPolicy::DROP;
+    // rotate a log file once it would grow past this many bytes, 0 disables it
+    std::size_t max_file_size = 0;
+    // rotate a log file once it has been open this long, 0 disables it
+    std::chrono::seconds rotate_interval { 0 };
+    // longest time a record waits in a ring before the writer picks it up
+    std::chrono::milliseconds flush_interval { 10 };
+};
+
+/**
+ * @brief Single producer single consumer ring of formatted log records
+ *        Records are kept contiguous, one that doesn't fit before the end of the buffer is preceded by a padding
+ *        record and starts over at the beginning. The writer hands the records to writev right where they are.
+ */
+class LogRing {
+public:
+    static constexpr uint32_t PADDING = UINT32_MAX;
+
+    explicit LogRing(std::size_t capacity):
+        m_capacity(std::bit_ceil(std::max<std::size_t>(capacity, 4096))),
+        m_buffer(std::make_unique<char[]>(m_capacity)) {}
+
+    /**
+     * @brief largest record the ring takes, longer ones have to be written synchronously
+     */
+    std::size_t max_record_size() const {
+        return m_capacity / 4;
+    }
+
+    /**
+     * @brief called by the owning thread only
+     * @return false if the ring is full
+     */
+    bool write(uint32_t sink, std::string_view record) {
+        auto total = record_size(record.size());
+        auto tail = m_tail.load(std::memory_order_relaxed);
+        auto head = m_head.load(std::memory_order_acquire);
+        auto offset = tail & (m_capacity - 1);
+        auto contiguous = m_capacity - offset;
+        auto needed = contiguous < total ? total + contiguous : total;
+        if (m_capacity - (tail - head) < needed) {
+            return false;
+        }
+        if (contiguous < total) {
+            put_header(offset, PADDING, static_cast<uint32_t>(contiguous - sizeof(Header)));
+            tail += contiguous;
+            offset = 0;
+        }
+        put_header(offset, sink, static_cast<uint32_t>(record.size()));
+        std::memcpy(m_buffer.get() + offset + sizeof(Header), record.data(), record.size());
+        m_tail.store(tail + total, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief called by the writer only, visit every record ready to be read without consuming it
+     * @return position to pass to release() once the visited records are no longer needed
+     */
+    template<typename F>
+    std::size_t peek(F&& on_record) const {
+        auto head = m_head.load(std::memory_order_relaxed);
+        auto tail = m_tail.load(std::memory_order_acquire);
+        while (head != tail) {
+            Header header;
+            auto offset = head & (m_capacity - 1);
+            std::memcpy(&header, m_buffer.get() + offset, sizeof(Header));
+            if (header.sink != PADDING) {
+                on_record(header.sink, std::string_view(m_buffer.get() + offset + sizeof(Header), header.size));
+            }
+            head += record_size(header.size);
+        }
+        return tail;
+    }
+
+    void release(std::size_t position) {
+        m_head.store(position, std::memory_order_release);
+    }
+
+    bool empty() const {
+        return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+    }
+
+    std::size_t size() const {
+        return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+    }
+
+    std::size_t capacity() const {
+        return m_capacity;
+    }
+
+    // set when the owning thread exits, the writer forgets the ring once it is drained
+    std::atomic<bool> m_closed = false;
+
+private:
+    struct Header {
+        uint32_t sink;
+        uint32_t size;
+    };
+
+    static std::size_t record_size(std::size_t size) {
+        return (sizeof(Header) + size + alignof(Header) - 1) & ~(alignof(Header) - 1);
+    }
+
+    void put_header(std::size_t offset, uint32_t sink, uint32_t size) {
+        Header header { sink, size };
+        std::memcpy(m_buffer.get() + offset, &header, sizeof(Header));
+    }
+
+    const std::size_t m_capacity;
+    std::unique_ptr<char[]> m_buffer;
+    alignas(64) std::atomic<std::size_t> m_head = 0;
+    alignas(64) std::atomic<std::size_t> m_tail = 0;
+};
+
+/**
+ * @brief Log file kept open between records, path is empty for the console
+ */
+struct LogSink {
+    std::string path;
+    int fd = -1;
+    std::size_t size = 0;
+    std::chrono::steady_clock::time_point opened_at {};
+};
+
 class LoggerManager {
 public:
     struct Logger {
@@ -64,35 +201,55 @@ public:
     private:
         std::string logger_name;
         std::string path;
+        // index of the file in the sink table, 0 is the console
+        uint32_t sink = 0;
     };
 
-    void enable_async_logging() {
+    /**
+     * @brief hand records to a background writer
+     *        Every logging thread formats into its own ring without locking, the writer drains all rings in
+     *        batches with writev into log files it keeps open and rotates as configured.
+     */
+    void enable_async_logging(AsyncLoggingOptions options = {}) {
         assert(instance != nullptr && "LoggerManager instance is not initialized");
         // if thread is already running, return
         if (m_log_thread.joinable()) {
             return;
         }
+        m_options = options;
+        m_writer_stop = false;
+        m_log_thread = std::thread([] { write_loop(); });
         m_async_logging_enabled = true;
-        m_log_thread = std::thread([&] {
-            while (instance != nullptr && m_async_logging_enabled) {
-                if (!m_log_queue.empty()) {
-                    const auto& [log_level, logger, message, loc] = m_log_queue.front();
-                    generate_log(logger, log_level, message, loc);
-                    m_log_queue.pop();
-                }
-            }
-        });
     }
 
+    /**
+     * @brief switch back to synchronous logging, records still in the rings are written before this returns
+     */
     void disable_async_logging() {
+        if (!m_log_thread.joinable()) {
+            return;
+        }
         m_async_logging_enabled = false;
+        // a thread which saw async logging enabled may still be writing its record
+        while (m_async_producers.load() != 0) {
+            std::this_thread::yield();
+        }
+        m_writer_stop = true;
+        wake_writer();
         m_log_thread.join();
     }
 
+    /**
+     * @brief number of records thrown away because the ring of their thread was full
+     */
+    std::size_t dropped_records() const {
+        return m_dropped_records.load(std::memory_order_relaxed);
+    }
+
     Logger& get_logger(std::string logger_name, std::string path = "") {
         if (m_loggers.find(logger_name) == m_loggers.end()) [[unlikely]] {
             m_loggers[logger_name].logger_name = logger_name;
-            m_loggers[logger_name].path = path;
+            set_log_path(m_loggers[logger_name], path);
         } else {
             if (path != m_loggers[logger_name].path) {
                 set_log_path(m_loggers[logger_name], path);
@@ -112,101 +269,353 @@ public:
     void
     log(const Logger& logger, LogLevel log_level, with_source_location<std::format_string<Args...>> fmt, Args&&... args
     ) {
+        if (log_level < min_level) {
+            return;
+        }
         const auto& loc = fmt.location();
         auto msg = std::vformat(fmt.format().get(), std::make_format_args(args...));
+        if (m_async_logging_enabled) {
+            async_log_record(logger, log_level, msg, loc);
+            return;
+        }
         generate_log(logger, log_level, msg, loc);
     }
 
     template<typename... Args>
     void async_log(
-        LogLevel log_level,
         const Logger& logger,
+        LogLevel log_level,
         with_source_location<std::format_string<Args...>> fmt,
         Args&&... args
     ) {
+        if (log_level < min_level) {
+            return;
+        }
         auto message = std::vformat(fmt.format().get(), std::make_format_args(args...));
-        m_log_queue.push(std::make_tuple(log_level, logger, message, fmt.location()));
+        if (!m_async_logging_enabled) {
+            generate_log(logger, log_level, message, fmt.location());
+            return;
+        }
+        async_log_record(logger, log_level, message, fmt.location());
     }
 
     void set_log_path(Logger& logger, const std::string& path) {
         logger.path = path;
+        logger.sink = sink_id(path);
     }
 
     ~LoggerManager() {
-        for (auto& [logger_name, file]: m_files) {
-            file.close();
+        disable_async_logging();
+        std::lock_guard<std::mutex> lock(m_file_mutex);
+        for (auto& sink: m_sinks) {
+            if (sink.fd > STDERR_FILENO) {
+                ::close(sink.fd);
+            }
         }
-        delete instance;
-
-        m_log_thread.join();
     }
 
 private:
     LoggerManager() {};
 
-    void generate_log(const Logger& logger, LogLevel log_level, std::string message, const std::source_location& loc) {
-        if (log_level < min_level) {
-            return;
+    struct LocalRing {
+        std::shared_ptr<LogRing> ring;
+
+        ~LocalRing() {
+            if (ring) {
+                ring->m_closed = true;
+            }
         }
+    };
 
+    static uint32_t sink_id(const std::string& path) {
+        if (path.empty()) {
+            return 0;
+        }
         std::lock_guard<std::mutex> lock(m_file_mutex);
-        std::chrono::zoned_time now { std::chrono::current_zone(), std::chrono::system_clock::now() };
+        for (std::size_t i = 1; i < m_sinks.size(); i++) {
+            if (m_sinks[i].path == path) {
+                return static_cast<uint32_t>(i);
+            }
+        }
+        m_sinks.push_back(LogSink { .path = path });
+        return static_cast<uint32_t>(m_sinks.size() - 1);
+    }
 
-        auto msg = std::format(
-            "{} {}:{} [{}][{}]:{}",
+    static std::string format_record(
+        const Logger& logger,
+        LogLevel log_level,
+        std::string_view message,
+        const std::source_location& loc
+    ) {
+        std::chrono::zoned_time now { std::chrono::current_zone(), std::chrono::system_clock::now() };
+        return std::format(
+            "{}{} {}:{} [{}][{}]:{}{}\n",
+            _IF_HAS_ANSI_COLORS(k_level_ansi_colors[(std::uint8_t)log_level]),
             now,
             loc.file_name(),
             loc.line(),
             get_log_level_name(log_level),
             logger.logger_name,
-            message
+            message,
+            _IF_HAS_ANSI_COLORS(k_reset_ansi_color)
         );
-        if (logger.path.empty()) {
-            // log to console
-            std::cout << _IF_HAS_ANSI_COLORS(k_level_ansi_colors[(std::uint8_t)log_level] +)
-                    msg _IF_HAS_ANSI_COLORS(+k_reset_ansi_color)
-                      << std::endl;
+    }
+
+    static LogRing* local_ring() {
+        thread_local LocalRing local;
+        if (local.ring == nullptr) {
+            local.ring = std::make_shared<LogRing>(m_options.ring_size);
+            std::lock_guard<std::mutex> lock(m_rings_mutex);
+            m_rings.push_back(local.ring);
+            m_rings_version++;
+        }
+        return local.ring.get();
+    }
+
+    void async_log_record(
+        const Logger& logger,
+        LogLevel log_level,
+        std::string_view message,
+        const std::source_location& loc
+    ) {
+        m_async_producers.fetch_add(1);
+        if (!m_async_logging_enabled) {
+            m_async_producers.fetch_sub(1);
+            generate_log(logger, log_level, message, loc);
+            return;
+        }
+        auto record = format_record(logger, log_level, message, loc);
+        auto ring = local_ring();
+        if (record.size() > ring->max_record_size()) {
+            m_async_producers.fetch_sub(1);
+            write_record(logger.sink, record);
             return;
         }
-        if (m_files.find(logger.logger_name) == m_files.end()) {
-            m_files[logger.logger_name].open(logger.path, std::ios::out | std::ios::app);
+        while (!ring->write(logger.sink, record)) {
+            wake_writer();
+            if (m_options.overflow_policy == LogOverflowPolicy::DROP) {
+                m_dropped_records.fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+            std::this_thread::yield();
+        }
+        m_async_producers.fetch_sub(1);
+        // only wake the writer early when the ring fills up, otherwise it comes by every flush_interval
+        if (ring->size() > ring->capacity() / 2) {
+            wake_writer();
+        }
+    }
+
+    static void wake_writer() {
+        {
+            std::lock_guard<std::mutex> lock(m_writer_mutex);
+            m_writer_notified = true;
         }
+        m_writer_condition.notify_one();
+    }
 
-        int fd = ::open(logger.path.c_str(), O_WRONLY | O_APPEND, 0777);
-        if (fd == -1) {
-            std::cerr << "Failed to open file: " << logger.path << " " << ::strerror(errno) << std::endl;
+    static void write_loop() {
+        std::vector<std::shared_ptr<LogRing>> rings;
+        std::size_t rings_version = SIZE_MAX;
+        std::vector<std::vector<struct iovec>> batches;
+        std::vector<std::size_t> positions;
+        while (true) {
+            bool stopping = m_writer_stop.load();
+            if (rings_version != m_rings_version.load()) {
+                std::lock_guard<std::mutex> lock(m_rings_mutex);
+                rings = m_rings;
+                rings_version = m_rings_version.load();
+            }
+            bool collected = false;
+            positions.clear();
+            for (auto& ring: rings) {
+                positions.push_back(ring->peek([&](uint32_t sink, std::string_view record) {
+                    if (batches.size() <= sink) {
+                        batches.resize(sink + 1);
+                    }
+                    auto base = const_cast<char*>(record.data());
+                    batches[sink].push_back({ base, record.size() });
+                    if (sink != 0) {
+                        // file records are echoed to the console like synchronous ones
+                        batches[0].push_back({ base, record.size() });
+                    }
+                    collected = true;
+                }));
+            }
+            if (collected) {
+                std::lock_guard<std::mutex> lock(m_file_mutex);
+                for (std::size_t sink = 0; sink < batches.size(); sink++) {
+                    if (!batches[sink].empty()) {
+                        write_batch(m_sinks[sink], batches[sink]);
+                        batches[sink].clear();
+                    }
+                }
+            }
+            bool closed_ring = false;
+            for (std::size_t i = 0; i < rings.size(); i++) {
+                rings[i]->release(positions[i]);
+                closed_ring |= rings[i]->m_closed && rings[i]->empty();
+            }
+            if (closed_ring) {
+                // the threads owning these rings are gone, nobody writes to them anymore
+                std::lock_guard<std::mutex> lock(m_rings_mutex);
+                std::erase_if(m_rings, [](auto& ring) { return ring->m_closed && ring->empty(); });
+                m_rings_version++;
+            }
+            if (collected) {
+                continue;
+            }
+            if (stopping) {
+                return;
+            }
+            std::unique_lock<std::mutex> lock(m_writer_mutex);
+            m_writer_condition.wait_for(lock, m_options.flush_interval, [] {
+                return m_writer_notified || m_writer_stop;
+            });
+            m_writer_notified = false;
+        }
+    }
+
+    /**
+     * @note must be called with m_file_mutex held
+     */
+    static bool open_sink(LogSink& sink) {
+        if (sink.fd != -1) {
+            return true;
+        }
+        if (sink.path.empty()) {
+            sink.fd = STDOUT_FILENO;
+            return true;
+        }
+        sink.fd = ::open(sink.path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        if (sink.fd == -1) {
+            std::cerr << "Failed to open file: " << sink.path << " " << ::strerror(errno) << std::endl;
+            return false;
+        }
+        struct stat st;
+        sink.size = ::fstat(sink.fd, &st) == 0 ? static_cast<std::size_t>(st.st_size) : 0;
+        sink.opened_at = std::chrono::steady_clock::now();
+        return true;
+    }
+
+    /**
+     * @brief move a log file aside once it is too large or too old and start a new one
+     * @note must be called with m_file_mutex held
+     */
+    static void rotate_sink(LogSink& sink, std::size_t incoming) {
+        if (sink.path.empty() || sink.fd == -1) {
             return;
         }
+        bool too_large = m_options.max_file_size != 0 && sink.size != 0
+            && sink.size + incoming > m_options.max_file_size;
+        bool too_old = m_options.rotate_interval.count() != 0
+            && std::chrono::steady_clock::now() - sink.opened_at >= m_options.rotate_interval;
+        if (!too_large && !too_old) {
+            return;
+        }
+        ::close(sink.fd);
+        sink.fd = -1;
+        auto rotated = std::format(
+            "{}.{:%Y%m%d-%H%M%S}",
+            sink.path,
+            std::chrono::floor<std::chrono::seconds>(std::chrono::system_clock::now())
+        );
+        auto target = rotated;
+        for (int i = 1; ::access(target.c_str(), F_OK) == 0; i++) {
+            target = std::format("{}.{}", rotated, i);
+        }
+        if (::rename(sink.path.c_str(), target.c_str()) == -1) {
+            std::cerr << "Failed to rotate file: " << sink.path << " " << ::strerror(errno) << std::endl;
+        }
+        open_sink(sink);
+    }
 
-        if (::flock(fd, LOCK_EX) == -1) {
-            std::cerr << "Failed to lock file: " << logger.path << " " << ::strerror(errno) << std::endl;
+    /**
+     * @note must be called with m_file_mutex held
+     */
+    static void write_batch(LogSink& sink, std::vector<struct iovec>& iovs) {
+        if (!open_sink(sink)) {
             return;
         }
+        std::size_t index = 0;
+        while (index < iovs.size()) {
+            rotate_sink(sink, iovs[index].iov_len);
+            if (sink.fd == -1) {
+                return;
+            }
+            // records going into the current file, a rotation can only happen between two writev
+            std::size_t end = index + 1;
+            std::size_t size = iovs[index].iov_len;
+            while (end < iovs.size() && end - index < IOV_MAX) {
+                size += iovs[end].iov_len;
+                if (m_options.max_file_size != 0 && sink.size + size > m_options.max_file_size) {
+                    break;
+                }
+                end++;
+            }
+            if (!write_all(sink, iovs.data() + index, end - index)) {
+                return;
+            }
+            index = end;
+        }
+    }
 
-        m_files[logger.logger_name] << _IF_HAS_ANSI_COLORS(k_level_ansi_colors[(std::uint8_t)log_level] +)
-                msg _IF_HAS_ANSI_COLORS(+k_reset_ansi_color)
-                                    << std::endl;
-        ::flock(fd, LOCK_UN);
-        ::close(fd);
-        std::cout << _IF_HAS_ANSI_COLORS(k_level_ansi_colors[(std::uint8_t)log_level] +)
-                msg _IF_HAS_ANSI_COLORS(+k_reset_ansi_color)
-                  << std::endl;
+    static bool write_all(LogSink& sink, struct iovec* iovs, std::size_t count) {
+        while (count != 0) {
+            auto written = ::writev(sink.fd, iovs, static_cast<int>(count));
+            if (written == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                std::cerr << "Failed to write file: " << sink.path << " " << ::strerror(errno) << std::endl;
+                return false;
+            }
+            sink.size += static_cast<std::size_t>(written);
+            // skip what went out, a partially written record is resumed at its first unwritten byte
+            auto remaining = static_cast<std::size_t>(written);
+            while (count != 0 && remaining >= iovs->iov_len) {
+                remaining -= iovs->iov_len;
+                iovs++;
+                count--;
+            }
+            if (remaining != 0) {
+                iovs->iov_base = static_cast<char*>(iovs->iov_base) + remaining;
+                iovs->iov_len -= remaining;
+            }
+        }
+        return true;
+    }
+
+    static void write_record(uint32_t sink, std::string_view record) {
+        std::vector<struct iovec> iov { { const_cast<char*>(record.data()), record.size() } };
+        std::lock_guard<std::mutex> lock(m_file_mutex);
+        write_batch(m_sinks[sink], iov);
+        if (sink != 0) {
+            iov = { { const_cast<char*>(record.data()), record.size() } };
+            write_batch(m_sinks[0], iov);
+        }
+    }
+
+    void generate_log(const Logger& logger, LogLevel log_level, std::string_view message, const std::source_location& loc) {
+        if (log_level < min_level) {
+            return;
+        }
+        write_record(logger.sink, format_record(logger, log_level, message, loc));
     }
 
-    std::string get_log_level_name(LogLevel log_level) {
-        const static std::unordered_map<LogLevel, std::string> log_level_map = {
-#define _FUNCTION(name) { LogLevel::name, #name },
+    static std::string_view get_log_level_name(LogLevel log_level) {
+        constexpr std::string_view log_level_names[] = {
+#define _FUNCTION(name) #name,
             LOG_FOREACH_LOG_LEVEL(_FUNCTION)
 #undef _FUNCTION
         };
-        return log_level_map.at(log_level);
+        return log_level_names[static_cast<int>(log_level)];
     }
 
-    inline static std::queue<std::tuple<LogLevel, Logger, std::string, std::source_location>> m_log_queue = {};
-
     inline static std::unordered_map<std::string, Logger> m_loggers = {};
 
-    inline static std::unordered_map<std::string, std::fstream> m_files = {};
+    // every file ever logged to, index 0 is the console, entries are never removed so sink ids stay valid
+    inline static std::vector<LogSink> m_sinks = { LogSink {} };
 
     inline static std::mutex m_file_mutex = {};
 
@@ -214,7 +623,22 @@ private:
 
     inline static std::thread m_log_thread = {};
 
-    inline static bool m_async_logging_enabled = false;
+    inline static std::atomic<bool> m_async_logging_enabled = false;
+
+    inline static AsyncLoggingOptions m_options = {};
+
+    // rings of every thread that logged asynchronously, the writer takes a copy whenever the version changes
+    inline static std::vector<std::shared_ptr<LogRing>> m_rings = {};
+    inline static std::mutex m_rings_mutex = {};
+    inline static std::atomic<std::size_t> m_rings_version = 0;
+
+    inline static std::atomic<std::size_t> m_async_producers = 0;
+    inline static std::atomic<std::size_t> m_dropped_records = 0;
+
+    inline static std::mutex m_writer_mutex = {};
+    inline static std::condition_variable m_writer_condition = {};
+    inline static bool m_writer_notified = false;
+    inline static std::atomic<bool> m_writer_stop = false;
 
     inline static LogLevel min_level =
         std::getenv("LOG_LEVEL") ? static_cast<LogLevel>(std::stoi(std::getenv("LOG_LEVEL"))) : LogLevel::INFO;
@@ -268,12 +692,12 @@ LOG_FOREACH_LOG_LEVEL(_FUNCTION)
 #define NET_DISABLE_ASYNC_LOGGING() utils::LoggerManager::get_instance().disable_async_logging()
 
 #define NET_LOG_DEBUG_ASYNC(logger, format, ...) \
-    net_async_net_log_DEBUG(logger, { format, std::source_location::current() } __VA_OPT__(, ) __VA_ARGS__)
+    net_async_log_DEBUG(logger, { format, std::source_location::current() } __VA_OPT__(, ) __VA_ARGS__)
 #define NET_LOG_INFO_ASYNC(logger, format, ...) \
-    net_async_net_log_INFO(logger, { format, std::source_location::current() } __VA_OPT__(, ) __VA_ARGS__)
+    net_async_log_INFO(logger, { format, std::source_location::current() } __VA_OPT__(, ) __VA_ARGS__)
 #define NET_LOG_WARN_ASYNC(logger, format, ...) \
-    net_async_net_log_WARN(logger, { format, std::source_location::current() } __VA_OPT__(, ) __VA_ARGS__)
+    net_async_log_WARN(logger, { format, std::source_location::current() } __VA_OPT__(, ) __VA_ARGS__)
 #define NET_LOG_ERROR_ASYNC(logger, format, ...) \
-    net_async_net_log_ERROR(logger, { format, std::source_location::current() } __VA_OPT__(, ) __VA_ARGS__)
+    net_async_log_ERROR(logger, { format, std::source_location::current() } __VA_OPT__(, ) __VA_ARGS__)
 #define NET_LOG_FATAL_ASYNC(logger, format, ...) \
-    net_async_net_log_FATAL(logger, { format, std::source_location::current() } __VA_OPT__(, ) __VA_ARGS__)
+    net_async_log_FATAL(logger, { format, std::source_location::current() } __VA_OPT__(, ) __VA_ARGS__)
@@ -1,13 +1,18 @@
 #pragma once
 
 #include "enum_parser.hpp"
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <chrono>
+#include <condition_variable>
 #include <cstddef>
 #include <cstdint>
+#include <deque>
 #include <functional>
 #include <future>
 #include <iostream>
+#include <memory>
 #include <mutex>
 #include <optional>
 #include <ostream>
@@ -26,6 +31,96 @@ enum class TaskStatus : uint8_t { WAITING = 0, RUNNING, FINISHED };
 
 enum class WorkerStatus : uint8_t { IDLE = 0, RUNNING };
 
+/**
+ * @brief SHARED_QUEUE keeps every task in one deque behind one mutex, WORK_STEALING gives each worker its own lock
+ *        free queue, lets idle workers steal from the others and parks each of them on its own condition variable
+ */
+enum class ThreadPoolMode : uint8_t { SHARED_QUEUE = 0, WORK_STEALING };
+
+/**
+ * @brief Bounded lock free multi producer multi consumer queue of tasks (Vyukov)
+ *        Every cell carries a sequence number telling whether it is ready to be written or read, so producers and
+ *        consumers only contend on the head or tail index they advance.
+ */
+template<typename T>
+class TaskRing {
+public:
+    explicit TaskRing(std::size_t capacity): m_cells(capacity), m_mask(capacity - 1) {
+        assert((capacity & m_mask) == 0 && "Capacity should be a power of 2");
+        for (std::size_t i = 0; i < capacity; i++) {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @return false if the ring is full, item is left untouched then
+     */
+    bool push(T& item) {
+        auto pos = m_tail.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &m_cells[pos & m_mask];
+            auto sequence = cell->sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(pos);
+            if (diff == 0) {
+                if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+        cell->item = std::move(item);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item) {
+        auto pos = m_head.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &m_cells[pos & m_mask];
+            auto sequence = cell->sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_head.load(std::memory_order_relaxed);
+            }
+        }
+        item = std::move(cell->item);
+        cell->item = T {};
+        cell->sequence.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief approximate, exact only while nobody pushes or pops
+     */
+    std::size_t size() const {
+        auto tail = m_tail.load(std::memory_order_acquire);
+        auto head = m_head.load(std::memory_order_acquire);
+        return tail > head ? tail - head : 0;
+    }
+
+private:
+    struct Cell {
+        std::atomic<std::size_t> sequence;
+        T item;
+    };
+
+    std::vector<Cell> m_cells;
+    const std::size_t m_mask;
+    alignas(64) std::atomic<std::size_t> m_head = 0;
+    alignas(64) std::atomic<std::size_t> m_tail = 0;
+};
+
 class ThreadPool {
 private:
     struct Worker {
@@ -38,7 +133,22 @@ private:
     };
 
 public:
-    explicit ThreadPool(std::size_t nums_threads) {
+    // capacity of the queue of each worker in WORK_STEALING mode, tasks beyond it go to a shared overflow deque
+    static constexpr std::size_t WORKER_QUEUE_CAPACITY = 1024;
+
+    explicit ThreadPool(std::size_t nums_threads, ThreadPoolMode mode = ThreadPoolMode::SHARED_QUEUE): m_mode(mode) {
+        if (m_mode == ThreadPoolMode::WORK_STEALING) {
+            for (std::size_t i = 0; i < nums_threads; i++) {
+                m_stealers.emplace_back(std::make_unique<Stealer>());
+            }
+            for (std::size_t i = 0; i < nums_threads; i++) {
+                m_workers.emplace_back(Worker {
+                    .worker_thread = std::thread([this, i] { steal_loop(i); }),
+                    .status = WorkerStatus::IDLE,
+                });
+            }
+            return;
+        }
         auto worker_func = [this] {
             while (true) {
                 Task task;
@@ -71,25 +181,28 @@ public:
         );
         std::future<ReturnType> result = task->get_future();
 
-        {
-            Task t([task] { (*task)(); });
-            std::lock_guard<std::mutex> lock(m_queue_mutex);
-            if (m_stop) {
-                return std::nullopt;
-            }
-            m_tasks.push_back(std::move(t));
+        if (!enqueue(Task([task] { (*task)(); }))) {
+            return std::nullopt;
         }
-
-        m_condition.notify_one();
         return result;
     }
 
+    /**
+     * @brief run f on a worker without a way to get its result, saves the future and shared state of submit
+     * @return false if the pool is stopped
+     */
+    template<typename F>
+    bool post(F&& f) {
+        return enqueue(Task(std::forward<F>(f)));
+    }
+
     void stop() {
         {
             std::lock_guard<std::mutex> lock(m_queue_mutex);
             m_stop = true;
         }
         m_condition.notify_all();
+        wake_all();
 
         for (auto& worker: m_workers) {
             worker.join();
@@ -99,6 +212,7 @@ public:
     void stop_now() {
         m_stop = true;
         m_condition.notify_all();
+        wake_all();
 
         for (auto& worker: m_workers) {
             worker.join();
@@ -115,7 +229,14 @@ public:
         }
     }
 
+    /**
+     * @note not supported in WORK_STEALING mode, the number of worker queues is fixed on construction
+     */
     void add_worker(std::size_t nums_threads) {
+        assert(m_mode == ThreadPoolMode::SHARED_QUEUE && "Workers can't be added to a work stealing pool");
+        if (m_mode != ThreadPoolMode::SHARED_QUEUE) {
+            return;
+        }
         auto worker_func = [this] {
             while (true) {
                 Task task;
@@ -141,7 +262,8 @@ public:
     }
 
     void delete_worker(std::size_t nums_threads) {
-        if (m_workers.empty()) {
+        assert(m_mode == ThreadPoolMode::SHARED_QUEUE && "Workers can't be deleted from a work stealing pool");
+        if (m_workers.empty() || m_mode != ThreadPoolMode::SHARED_QUEUE) {
             return;
         }
         std::lock_guard<std::mutex> lock(m_queue_mutex);
@@ -169,22 +291,197 @@ public:
      * @brief get the number of tasks in the idle queue
      */
     std::size_t task_num() const {
+        if (m_mode == ThreadPoolMode::WORK_STEALING) {
+            std::size_t num = m_overflow_num.load(std::memory_order_relaxed);
+            for (auto& stealer: m_stealers) {
+                num += stealer->m_queue.size();
+            }
+            return num;
+        }
         return m_tasks.size();
     }
 
+    ThreadPoolMode mode() const {
+        return m_mode;
+    }
+
     using SharedPtr = std::shared_ptr<ThreadPool>;
     using UniquePtr = std::unique_ptr<ThreadPool>;
 
 private:
     using Task = std::function<void(void)>;
 
+    struct Stealer {
+        TaskRing<Task> m_queue { WORKER_QUEUE_CAPACITY };
+        // set by whoever hands the parked worker new work
+        bool m_woken = false;
+        std::mutex m_wakeup_mutex;
+        std::condition_variable m_wakeup;
+
+        void wait() {
+            std::unique_lock<std::mutex> lock(m_wakeup_mutex);
+            m_wakeup.wait(lock, [this] { return m_woken; });
+            m_woken = false;
+        }
+
+        void wake() {
+            {
+                std::lock_guard<std::mutex> lock(m_wakeup_mutex);
+                m_woken = true;
+            }
+            m_wakeup.notify_one();
+        }
+    };
+
+    bool enqueue(Task&& task) {
+        if (m_mode == ThreadPoolMode::SHARED_QUEUE) {
+            {
+                std::lock_guard<std::mutex> lock(m_queue_mutex);
+                if (m_stop) {
+                    return false;
+                }
+                m_tasks.push_back(std::move(task));
+            }
+            m_condition.notify_one();
+            return true;
+        }
+        if (m_stop) {
+            return false;
+        }
+        auto num = m_stealers.size();
+        // workers keep what they post to themselves, other threads spread tasks round robin
+        auto start = t_pool == this ? t_worker_index
+                                    : m_next_queue.fetch_add(1, std::memory_order_relaxed) % num;
+        bool pushed = false;
+        for (std::size_t i = 0; i < num && !pushed; i++) {
+            pushed = m_stealers[(start + i) % num]->m_queue.push(task);
+        }
+        if (!pushed) {
+            std::lock_guard<std::mutex> lock(m_overflow_mutex);
+            m_overflow.push_back(std::move(task));
+            m_overflow_num.fetch_add(1);
+        }
+        // pairs with the fence in park, either the parked worker sees the task or this sees the parked worker
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        wake_one();
+        return true;
+    }
+
+    bool take(std::size_t index, Task& task) {
+        if (m_stealers[index]->m_queue.pop(task)) {
+            return true;
+        }
+        auto num = m_stealers.size();
+        for (std::size_t i = 1; i < num; i++) {
+            if (m_stealers[(index + i) % num]->m_queue.pop(task)) {
+                return true;
+            }
+        }
+        if (m_overflow_num.load() == 0) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(m_overflow_mutex);
+        if (m_overflow.empty()) {
+            return false;
+        }
+        task = std::move(m_overflow.front());
+        m_overflow.pop_front();
+        m_overflow_num.fetch_sub(1);
+        return true;
+    }
+
+    bool has_task() const {
+        if (m_overflow_num.load() != 0) {
+            return true;
+        }
+        return std::any_of(m_stealers.begin(), m_stealers.end(), [](auto& stealer) {
+            return stealer->m_queue.size() != 0;
+        });
+    }
+
+    void steal_loop(std::size_t index) {
+        t_pool = this;
+        t_worker_index = index;
+        Task task;
+        while (!m_stop) {
+            if (take(index, task)) {
+                task();
+                task = nullptr;
+                continue;
+            }
+            park(index);
+        }
+    }
+
+    void park(std::size_t index) {
+        {
+            std::lock_guard<std::mutex> lock(m_park_mutex);
+            m_parked.push_back(index);
+            m_parked_num.fetch_add(1);
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (has_task() || m_stop) {
+            std::lock_guard<std::mutex> lock(m_park_mutex);
+            auto it = std::find(m_parked.begin(), m_parked.end(), index);
+            if (it != m_parked.end()) {
+                m_parked.erase(it);
+                m_parked_num.fetch_sub(1);
+                return;
+            }
+            // somebody took this worker off the list already, its wakeup has to be consumed below
+        }
+        m_stealers[index]->wait();
+    }
+
+    void wake_one() {
+        if (m_parked_num.load() == 0) {
+            return;
+        }
+        std::size_t index;
+        {
+            std::lock_guard<std::mutex> lock(m_park_mutex);
+            if (m_parked.empty()) {
+                return;
+            }
+            // the most recently parked worker has the warmest cache
+            index = m_parked.back();
+            m_parked.pop_back();
+            m_parked_num.fetch_sub(1);
+        }
+        m_stealers[index]->wake();
+    }
+
+    void wake_all() {
+        std::lock_guard<std::mutex> lock(m_park_mutex);
+        for (auto index: m_parked) {
+            m_stealers[index]->wake();
+        }
+        m_parked.clear();
+        m_parked_num.store(0);
+    }
+
+    const ThreadPoolMode m_mode;
+
     std::vector<Worker> m_workers;
     std::deque<Task> m_tasks;
 
     std::mutex m_queue_mutex;
     std::condition_variable m_condition;
 
-    bool m_stop = false;
+    std::atomic<bool> m_stop = false;
+
+    // WORK_STEALING mode only
+    std::vector<std::unique_ptr<Stealer>> m_stealers;
+    std::deque<Task> m_overflow;
+    std::mutex m_overflow_mutex;
+    std::atomic<std::size_t> m_overflow_num = 0;
+    std::vector<std::size_t> m_parked;
+    std::mutex m_park_mutex;
+    std::atomic<std::size_t> m_parked_num = 0;
+    std::atomic<std::size_t> m_next_queue = 0;
+
+    inline static thread_local ThreadPool* t_pool = nullptr;
+    inline static thread_local std::size_t t_worker_index = 0;
 };
 
 } // namespace utils
\ No newline at end of file